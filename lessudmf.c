@@ -7,30 +7,36 @@
 //     - Updated the non-visible Wall Texture removal
 //     - Optimizations in the linedef->sidedef->sector lookups
 
-// TODO:
-// - Remove the texture parameter values if the texture itself is not applied
-// - Better slope detection: See how exactly lines create line-based slopes
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // for copy_file_range()
+#endif
 
 #include <ctype.h> //for isspace()
+#include <math.h>
+#include <setjmp.h> // for the errors of the library
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <zlib.h> // for the PK3 files
+
+#ifndef _WIN32
+#include <fcntl.h> // for open()
+#include <pthread.h>
+#include <sys/mman.h> // for mmap()
+#include <unistd.h> // for sysconf()
+#define LESSUDMF_THREADS
+#define LESSUDMF_MMAP
+#ifdef __linux__
+#include <sys/sendfile.h>
+#define LESSUDMF_COPYRANGE // lumps are copied between the files by the kernel
+#endif
+#endif
 
 #include "json.h"
-
-// Internal program flags
-enum flags {
-    FLAG_CONFIGLOADED = 1, // Game configuration file is loaded
-    FLAGS_CUSTOMCONFIG = 2, // Custom game configuration file is used
-    FLAG_PRESERVESECTORS = 4, // Preserve indentical sectors in map
-    FLAG_PRESERVETEXTURES = 8, // Preserve textures on control linedefs which do not use them
-    FLAG_PRESERVEANGLES = 16, // Preserge facing angles on things that do not require angle information
-    FLAG_PRESERVEDEFAULT = 32, // Preserve the UDMF fields which are set to default value
-    FLAG_PRESERVEFLATS = 64, // Preserve floor/ceiling flat textures on sectors that are invisible or not reachable
-    FLAG_BIT8 = 128 // Unused
-};
+#include "lessudmf.h"
 
 enum configFlags {
     CFGFLAG_POLYGONSLOPE = 1, // Game supports slopes made with vertexes in triangular sectors
@@ -55,7 +61,7 @@ enum {
 };
 
 // Config files
-const char* configFiles[] = {
+static const char* const defaultConfigFiles[] = {
     0, // ENGINE_UNKNOWN, custom config filepath goes there
     "DOOM.JSON", // ENGINE_DOOM
     "HERETIC.JSON", // ENGINE_HERETIC
@@ -81,6 +87,44 @@ typedef struct {
     uint32_t size;
 } lump_t;
 
+// Lumps generated for the current map
+enum {
+    MAPLUMP_ZNODES,
+    MAPLUMP_REJECT,
+    MAPLUMP_COUNT
+};
+
+// Binary map formats the optimized map can be written in
+enum {
+    BINARYFORMAT_NONE, // the map is written as TEXTMAP
+    BINARYFORMAT_DOOM,
+    BINARYFORMAT_HEXEN
+};
+
+// Lumps of a binary map, in the order they follow the map marker
+enum {
+    BINLUMP_THINGS,
+    BINLUMP_LINEDEFS,
+    BINLUMP_SIDEDEFS,
+    BINLUMP_VERTEXES,
+    BINLUMP_SEGS,
+    BINLUMP_SSECTORS, // holds the extended GL nodes (ZNODES of the UDMF map)
+    BINLUMP_NODES,
+    BINLUMP_SECTORS,
+    BINLUMP_REJECT,
+    BINLUMP_BLOCKMAP,
+    BINLUMP_BEHAVIOR, // Hexen format only
+    BINLUMP_SCRIPTS,
+    BINLUMP_COUNT
+};
+
+// Lump generated for the current map, written in place of the map lump with the same name or before ENDMAP
+typedef struct {
+    const char* name;
+    char* data; // 0 if nothing is waiting to be written
+    uint32_t size;
+} maplump_t;
+
 // Key/Value pair inside data block
 typedef struct {
     char* key;
@@ -99,7 +143,7 @@ typedef struct {
     int sectorID; // index of the sector in ORIGINAL ordering
     int masterID; // new index of the sector
     char isMaster; // 1=kept, 0=removed as duplicate, -1=unvisited
-    char isSlope; // 1=sloped sector, 0=not sloped
+    int8_t isSlope; // SLOPE_FLOOR/SLOPE_CEILING bits of the sloped planes, -1=not checked yet
 } sector_t;
 
 typedef struct {
@@ -109,92 +153,526 @@ typedef struct {
 
 typedef struct {
     block_t* block;
-    block_t* v1;
-    block_t* v2;
+    double x; // decoded "x" field
+    double y; // decoded "y" field
+} vertex_t;
+
+typedef struct {
+    block_t* block;
+    vertex_t* v1;
+    vertex_t* v2;
     sidedef_t* sidefront;
     sidedef_t* sideback;
 } linedef_t;
 
+// Sector planes made sloped, for linedef specials the back sector planes are shifted by 2
+enum {
+    SLOPE_FLOOR = 1,
+    SLOPE_CEILING = 2,
+    SLOPE_BACKFLOOR = 4,
+    SLOPE_BACKCEILING = 8
+};
+
+// When a slope rule applies
+enum {
+    SLOPERULE_ALWAYS, // linedef special alone
+    SLOPERULE_EQUAL, // argument equals the value
+    SLOPERULE_NONZERO, // argument is not 0
+    SLOPERULE_MASK // argument has any of the value bits
+};
+
+// Planes a slope linedef special makes sloped depending on one of its arguments
+typedef struct {
+    uint8_t type; // SLOPERULE_*
+    uint8_t arg;
+    int32_t value;
+    uint8_t planes; // SLOPE_* bits
+    uint8_t ifArg; // the rule also needs this argument to have any of the ifMask bits (if ifMask is not 0)
+    int32_t ifMask;
+} sloperule_t;
+
+typedef struct {
+    uint16_t special;
+    uint16_t rulesCount;
+    sloperule_t* rules;
+} slopemodel_t;
+
+// Grid a numeric field is snapped to by the quantization
+typedef struct {
+    char* key;
+    double step;
+} quantizerule_t;
+
+// Operands of the texture rule conditions
+enum {
+    RULEOPERAND_NUMBER,
+    RULEOPERAND_STRING,
+    RULEOPERAND_LINEDEF, // field of the linedef
+    RULEOPERAND_SIDE, // field of the sidedef the rule is checked for
+    RULEOPERAND_SECTOR, // field of the sector on the side (or the sector itself for the sector rules)
+    RULEOPERAND_OTHERSECTOR, // field of the sector on the other side of the linedef
+    RULEOPERAND_SLOPED, // 1 if any of the SLOPE_* planes in the number is sloped in the sectors of the linedef
+    RULEOPERAND_TWOSIDED // 1 if the linedef has sectors on both sides
+};
+
+// Comparisons of the texture rule conditions
+enum {
+    RULEOP_EQUAL,
+    RULEOP_NOTEQUAL,
+    RULEOP_LESS,
+    RULEOP_LESSEQUAL,
+    RULEOP_GREATER,
+    RULEOP_GREATEREQUAL
+};
+
+typedef struct {
+    uint8_t type; // RULEOPERAND_*
+    double number;
+    char* string; // string constant or the key of the field
+} ruleoperand_t;
+
+typedef struct {
+    ruleoperand_t a;
+    ruleoperand_t b;
+    uint8_t op; // RULEOP_*
+} rulecondition_t;
+
+// Fields removed when all the conditions of the rule are true
+typedef struct {
+    char** remove; // zero-terminated list of fields, "*" removes all the fields except the index fields
+    rulecondition_t* conditions;
+    uint16_t conditionsCount;
+} texturerule_t;
+
+// Bits of the argument schemas: arg0..arg9 and stringarg0..stringarg1
+#define ARGSCHEMA_ARGS 10
+#define ARGSCHEMA_STRINGARGS 2
+
+// String keyed hash table with open addressing
+typedef struct {
+    char** keys; // 0 for the empty slots
+    int64_t* values;
+    uint32_t size; // amount of slots, always a power of two
+    uint32_t count; // amount of used slots
+} hashtable_t;
+
 typedef struct {
     uint32_t filesize;
     uint16_t* linedefSpecialsNoTexture;
     uint16_t* linedefSpecialsSlope;
     uint16_t* thingTypesNoAngle;
+    uint16_t* thingTypesStackable; // thing types which are meant to be placed on top of each other, their duplicates are kept
+    uint16_t* thingTypesReachableFrom; // thing types the player can start from, be teleported to or view the level from
     char* buffer;
     char** sectorFieldsSlope;
+    uint8_t* sectorFieldsSlopePlanes; // SLOPE_* planes of every sectorFieldsSlope field
+    slopemodel_t* linedefSlopeModels; // terminated by special 0
     uint8_t flags;
     json_value* json;
     field_t* defaultValues[5];
+    char** textureKeys[5]; // zero-terminated list of the texture fields of the level element
+    hashtable_t textureParameters[5]; // parameter field -> bitmask of the textureKeys the parameter modifies
+    hashtable_t argSchemas[5]; // linedef special/thing type -> ARGSCHEMA_* bitmask of the arguments the game reads
+    hashtable_t tagArgs; // linedef special -> bitmask of the arguments which are tags, bit (LEVEL_* * ARGSCHEMA_ARGS + arg)
+    hashtable_t linedefPortals; // portal linedef special -> argument with the tag of the linked linedefs, -1 for its own tag
+    hashtable_t fieldTypes[5]; // field -> NUMBER_* type, taken from the form of the default value
+    quantizerule_t* quantizeRules[5]; // terminated by key 0
+    texturerule_t* textureRules[5]; // texture visibility rules of the linedef sides and sectors, terminated by remove 0
+    char** sectorToleranceKeys; // zero-terminated list of the sector fields which can differ in merged sectors
+    double* sectorTolerances; // the largest difference of every sectorToleranceKeys field
 } config_t;
 
-block_t* blocks;
-uint32_t blockCount = 0;
-sector_t* sectors;
-uint32_t sectorCount = 0;
-sidedef_t* sidedefs;
-uint32_t sidedefCount = 0;
-linedef_t* linedefs;
-uint32_t linedefCount = 0;
-char* namespaceValue;
-uint8_t gameEngine;
-uint8_t gameEngine_last = UINT8_MAX;
-
-static FILE* inputWAD;
-static FILE* outputWAD;
-static char outputFilePath[UINT8_MAX] = "./output.wad";
-static FILE* configFile;
-config_t config;
-struct stat filestatus;
-
-static uint32_t bufferA = 0; // multipurpose
-static uint32_t bufferB = 0; // multipurpose
-static uint32_t OUTPUT_SIZE = 0;
-static char buffer_str[0x400];
-static char* OUTPUT_BUFFER;
-static char* LUMP_BUFFER;
-
-static uint32_t WAD_LumpsAmount;
-static uint32_t WAD_DirectoryAddress;
-static lump_t* lumps; // array of lumps loaded from the Input Wad
-
-static uint8_t FLAGS = 0;
+// Optimized lumps of a map, reused for the later maps with an identical TEXTMAP
+typedef struct {
+    uint8_t saved; // the lumps below are filled
+    uint8_t format; // binary map format
+    maplump_t textmap;
+    maplump_t generated[MAPLUMP_COUNT];
+    maplump_t binary[BINLUMP_COUNT];
+    char* log; // progress of the map optimized on the thread pool
+} mapcache_t;
+
+// Header of the memory allocated for a context. The allocations are linked in a list so the ones of a failed call
+// can be freed, the two pointers keep the alignment of malloc for the data after the header
+typedef struct allocation_s {
+    struct allocation_s* prev;
+    struct allocation_s* next;
+} allocation_t;
+
+// Memory allocated for a context and the contexts of the maps of its thread pool
+typedef struct {
+    allocation_t list; // circular list of the allocations, the head is not allocated
+    uint8_t shared; // other threads allocate from the list too, it is locked from then on
+#ifdef LESSUDMF_THREADS
+    pthread_mutex_t lock;
+#endif
+} memory_t;
+
+// All the state of the program: the options, the game configuration, the map being optimized and the Input and
+// Output WADs. The functions get the context they work on as their first argument
+struct lessudmf_s {
+    uint32_t FLAGS;
+    uint32_t mapFlags; // LESSUDMF_FLAG_BUILDNODES/LESSUDMF_FLAG_BUILDREJECT the changes made to the loaded map need, besides the options
+    const char* configFiles[ENGINE_SRB2 + 1];
+    FILE* configFile;
+    config_t config;
+    texturerule_t* builtinRules[5]; // texture rules used for the games with no config file
+    struct stat filestatus;
+
+    block_t* blocks;
+    uint32_t blockCount;
+    sector_t* sectors;
+    uint32_t sectorCount;
+    sidedef_t* sidedefs;
+    uint32_t sidedefCount;
+    linedef_t* linedefs;
+    uint32_t linedefCount;
+    vertex_t* vertices;
+    uint32_t vertexCount;
+    char* namespaceValue;
+    uint8_t gameEngine;
+    uint8_t gameEngine_last;
+    hashtable_t tagIndex[5]; // tags of the level elements in the current map: tag -> amount of elements with the tag
+    hashtable_t tagReferences; // tags referred to by the arguments of linedef specials and things: tag -> amount of references
+
+    const char* INPUT_DATA; // contents of the Input WAD, mapped into memory
+    uint32_t INPUT_SIZE;
+#ifdef LESSUDMF_MMAP
+    int INPUT_FD;
+    int OUTPUT_FD;
+#else
+    FILE* outputWAD;
+#endif
+    char outputFilePath[UINT8_MAX];
+    char outputTempPath[UINT8_MAX + 4]; // the Output WAD is written there and renamed when it is complete
+    char* OUTPUT_MEMORY; // the Output WAD is built there instead of a file (see OUTPUT_OpenMemory)
+    uint32_t OUTPUT_ALLOCATED;
+    uint32_t OUTPUT_SIZE;
+
+    uint32_t bufferA; // multipurpose
+    uint32_t bufferB; // multipurpose
+    char buffer_str[0x400];
+    char* LUMP_BUFFER;
+
+    uint32_t WAD_LumpsAmount;
+    uint8_t WAD_HasScripts; // the Input WAD has script lumps which can refer to the tags
+    uint8_t OUTSIDE_HasScripts; // scripts outside of the Input WAD (files of the PK3, or not known) can refer to the tags
+    uint32_t WAD_DirectoryAddress;
+    lump_t* lumps; // array of lumps loaded from the Input Wad
+    lump_t* outputLumps; // Directory Table of the Output WAD
+    uint32_t outputLumpsAmount;
+    maplump_t mapLumps[MAPLUMP_COUNT];
+    uint8_t binaryFormat; // format of the map being written, its lumps are collected until ENDMAP
+    maplump_t binaryLumps[BINLUMP_COUNT];
+    uint32_t* identicalMaps; // by lump index: index of the first identical TEXTMAP lump (itself for the first one)
+    mapcache_t** mapCache; // by lump index: the optimized lumps of the maps which have identical copies later
+    hashtable_t outputLumpData; // "hash size" of the lump data -> Directory Table index of the first lump with the data
+    uint32_t outputSharedLumps;
+    uint32_t outputSharedBytes;
+
+    // Texture name -> size in map units, packed as (width << 32 | height). Size 0 means the size is not known
+    // (the texture is scaled), such textures are indexed so they replace the earlier definitions.
+    hashtable_t textureSizes;
+
+    uint32_t mapThreads; // amount of threads the maps of a WAD are optimized on, 0 for all processor cores
+    lessudmf_t* parent; // context of the WAD for the contexts of the maps optimized on the thread pool
+    config_t sharedConfigs[ENGINE_SRB2 + 1]; // configurations shared by the maps of the thread pool, by game engine
+    uint8_t sharedConfigsState[ENGINE_SRB2 + 1]; // 0: not loaded yet, 1: loaded, 2: failed to load
+    char* log; // progress printed by the map, kept until its lumps are written (0 to print it right away)
+    uint32_t logSize;
+    uint32_t logAllocated;
+
+    jmp_buf* failJump; // where the call of the library or the program goes back to when an error happens
+    memory_t allocations;
+    memory_t* memory; // list the memory goes to: its own allocations, or the ones of the WAD context for a map
+};
+
+// Lock the memory list if other threads use it
+static void MEMORY_Lock(memory_t* memory)
+{
+#ifdef LESSUDMF_THREADS
+    if (memory->shared)
+        pthread_mutex_lock(&memory->lock);
+#else
+    (void)memory;
+#endif
+}
+
+static void MEMORY_Unlock(memory_t* memory)
+{
+#ifdef LESSUDMF_THREADS
+    if (memory->shared)
+        pthread_mutex_unlock(&memory->lock);
+#else
+    (void)memory;
+#endif
+}
+
+// Let other threads allocate from the list, called before the threads are started. It is set only by the first
+// thread, the other threads only read it
+static void MEMORY_Share(lessudmf_t* context)
+{
+    if (!context->memory->shared)
+        context->memory->shared = 1;
+}
+
+// Add the allocation to the memory list of the context. Returns the data after the header
+static void* MEMORY_Link(lessudmf_t* context, allocation_t* header)
+{
+    if (!header)
+        return 0;
+    memory_t* memory = context->memory;
+    MEMORY_Lock(memory);
+    header->prev = &memory->list;
+    header->next = memory->list.next;
+    header->next->prev = header;
+    memory->list.next = header;
+    MEMORY_Unlock(memory);
+    return header + 1;
+}
+
+// Take the allocation out of the memory list of the context. Returns its header
+static allocation_t* MEMORY_Unlink(lessudmf_t* context, void* data)
+{
+    allocation_t* header = (allocation_t*)data - 1;
+    memory_t* memory = context->memory;
+    MEMORY_Lock(memory);
+    header->prev->next = header->next;
+    header->next->prev = header->prev;
+    MEMORY_Unlock(memory);
+    return header;
+}
+
+// Allocate memory for the context, it is freed with MEMORY_Free or when a call of the library fails
+static void* MEMORY_Alloc(lessudmf_t* context, size_t size)
+{
+    if (size > SIZE_MAX - sizeof(allocation_t))
+        return 0;
+    return MEMORY_Link(context, (allocation_t*)malloc(sizeof(allocation_t) + size));
+}
+
+static void* MEMORY_Calloc(lessudmf_t* context, size_t count, size_t size)
+{
+    if (size && count > (SIZE_MAX - sizeof(allocation_t)) / size)
+        return 0;
+    return MEMORY_Link(context, (allocation_t*)calloc(1, sizeof(allocation_t) + count * size));
+}
+
+// Resize the memory of the context, it stays allocated if it can not be resized
+static void* MEMORY_Realloc(lessudmf_t* context, void* data, size_t size)
+{
+    if (!data)
+        return MEMORY_Alloc(context, size);
+    if (size > SIZE_MAX - sizeof(allocation_t))
+        return 0;
+    allocation_t* header = MEMORY_Unlink(context, data);
+    allocation_t* resized = (allocation_t*)realloc(header, sizeof(allocation_t) + size);
+    MEMORY_Link(context, resized ? resized : header);
+    return resized ? resized + 1 : 0;
+}
+
+static char* MEMORY_StrDup(lessudmf_t* context, const char* str)
+{
+    size_t length = strlen(str) + 1;
+    char* copy = (char*)MEMORY_Alloc(context, length);
+    if (copy)
+        memcpy(copy, str, length);
+    return copy;
+}
+
+static void MEMORY_Free(lessudmf_t* context, void* data)
+{
+    if (data)
+        free(MEMORY_Unlink(context, data));
+}
+
+// Take the memory out of the context so it is not freed with it, it is freed with LESSUDMF_Free
+static void MEMORY_Release(lessudmf_t* context, void* data)
+{
+    if (data) {
+        allocation_t* header = MEMORY_Unlink(context, data);
+        header->prev = header->next = header;
+    }
+}
+
+// Free all the memory of the context, after a failed call or with the context
+static void MEMORY_FreeAll(lessudmf_t* context)
+{
+    allocation_t* list = &context->memory->list;
+    while (list->next != list) {
+        allocation_t* header = list->next;
+        list->next = header->next;
+        free(header);
+    }
+    list->prev = list;
+    context->memory->shared = 0;
+}
+
+// Set up a new context with the flags: no map, no WADs, the default config files or the custom one if the path
+// is given. Returns 0 on failure
+static uint8_t CONTEXT_Init(lessudmf_t* context, uint32_t flags, const char* configPath)
+{
+    static const maplump_t generatedLumps[MAPLUMP_COUNT] = {
+        { "ZNODES", 0, 0 }, // MAPLUMP_ZNODES
+        { "REJECT", 0, 0 } // MAPLUMP_REJECT
+    };
+    static const maplump_t binaryMapLumps[BINLUMP_COUNT] = {
+        { "THINGS", 0, 0 }, { "LINEDEFS", 0, 0 }, { "SIDEDEFS", 0, 0 }, { "VERTEXES", 0, 0 },
+        { "SEGS", 0, 0 }, { "SSECTORS", 0, 0 }, { "NODES", 0, 0 }, { "SECTORS", 0, 0 },
+        { "REJECT", 0, 0 }, { "BLOCKMAP", 0, 0 }, { "BEHAVIOR", 0, 0 }, { "SCRIPTS", 0, 0 }
+    };
+
+    memset(context, 0, sizeof(lessudmf_t));
+    memcpy(context->configFiles, defaultConfigFiles, sizeof(context->configFiles));
+    memcpy(context->mapLumps, generatedLumps, sizeof(generatedLumps));
+    memcpy(context->binaryLumps, binaryMapLumps, sizeof(binaryMapLumps));
+    context->gameEngine_last = UINT8_MAX;
+    context->binaryFormat = BINARYFORMAT_NONE;
+#ifdef LESSUDMF_MMAP
+    context->INPUT_FD = -1;
+    context->OUTPUT_FD = -1;
+#endif
+    strcpy(context->outputFilePath, "./output.wad");
+    context->mapThreads = 1;
+    context->allocations.list.prev = context->allocations.list.next = &context->allocations.list;
+#ifdef LESSUDMF_THREADS
+    pthread_mutex_init(&context->allocations.lock, 0);
+#endif
+    context->memory = &context->allocations;
+
+    context->FLAGS = flags;
+    if (configPath) {
+        context->configFiles[ENGINE_UNKNOWN] = strdup(configPath); // not in the memory of the context, kept after a failed call
+        if (!context->configFiles[ENGINE_UNKNOWN])
+            return 0;
+        context->FLAGS |= LESSUDMF_FLAG_CUSTOMCONFIG;
+    }
+    return 1;
+}
+
+// Give the context of a map the data of the WAD context it reads: the Input WAD, its texture sizes, the map cache
+// its optimized lumps go to and the config files. Its progress is kept in the log
+static uint8_t CONTEXT_Share(lessudmf_t* context, lessudmf_t* wad)
+{
+    if (!CONTEXT_Init(context, wad->FLAGS & ~LESSUDMF_FLAG_CONFIGLOADED, 0))
+        return 0;
+    memcpy(context->configFiles, wad->configFiles, sizeof(context->configFiles));
+    context->parent = wad;
+    context->memory = wad->memory;
+    context->INPUT_DATA = wad->INPUT_DATA;
+    context->INPUT_SIZE = wad->INPUT_SIZE;
+    context->lumps = wad->lumps;
+    context->WAD_LumpsAmount = wad->WAD_LumpsAmount;
+    context->WAD_HasScripts = wad->WAD_HasScripts;
+    context->OUTSIDE_HasScripts = wad->OUTSIDE_HasScripts;
+    context->identicalMaps = wad->identicalMaps;
+    context->mapCache = wad->mapCache;
+    context->textureSizes = wad->textureSizes;
+    context->logAllocated = 0x1000;
+    context->log = (char*)MEMORY_Calloc(context, context->logAllocated, 1);
+    return context->log != 0;
+}
+
+// Take back the shared data from the context of a map, so freeing it leaves the WAD context intact
+static void CONTEXT_Unshare(lessudmf_t* context)
+{
+    context->configFiles[ENGINE_UNKNOWN] = 0;
+    context->INPUT_DATA = 0;
+    context->lumps = 0;
+    context->identicalMaps = 0;
+    context->mapCache = 0;
+    memset(&context->textureSizes, 0, sizeof(hashtable_t));
+    memset(&context->config, 0, sizeof(config_t)); // shared read-only, owned by the WAD context
+    context->FLAGS &= ~LESSUDMF_FLAG_CONFIGLOADED;
+    MEMORY_Free(context, context->log);
+    context->log = 0;
+}
+
+// Stop the work after an error was printed. The function of the library that was called frees the memory of the
+// context and returns 0, the program removes the unfinished Output WAD and exits
+static _Noreturn void CONTEXT_Fail(lessudmf_t* context)
+{
+    longjmp(*context->failJump, 1);
+}
+
 
 // Constant strings that get reused multiple times
-const char DIRTABLE_STR[] = "\nID   ADRESS     SIZE     NAME";
-const char ERROR_STR[] = "ERROR:";
-const char WARNING_STR[] = "WARNING:";
-const char TEXTMAP_STR[] = "TEXTMAP";
-const char UDMF_STR[] = "UDMF";
-const char WAD_STR[] = "WAD";
-const char DONE_STR[] = "Done";
-const char INPUT_STR[] = "Input";
-const char OUTPUT_STR[] = "Output";
-const char NAMESPACE_STR[] = "namespace";
-const char VERTEX_STR[] = "vertex";
-const char LINEDEF_STR[] = "linedef";
-const char SIDEDEF_STR[] = "sidedef";
-const char SECTOR_STR[] = "sector";
-const char THING_STR[] = "thing";
-const char SIDEFRONT_STR[] = "sidefront";
-const char SIDEBACK_STR[] = "sideback";
-const char SPECIAL_STR[] = "special";
-const char ZFLOOR_STR[] = "zfloor";
-const char ZCEILING_STR[] = "zceiling";
-const char TWOSIDED_STR[] = "twosided";
-const char FLOORHEIGHT_STR[] = "heightfloor";
-const char CEILINGHEIGHT_STR[] = "heightceiling";
-const char TEXTURETOP_STR[] = "texturetop";
-const char TEXTUREBOTTOM_STR[] = "texturebottom";
-const char TEXTUREMIDDLE_STR[] = "texturemiddle";
-const char TEXTUREFLOOR_STR[] = "texturefloor";
-const char TEXTURECEILING_STR[] = "textureceiling";
-const char F_SKY1_STR[] = "\"F_SKY1\"";
-const char DEFAULTVALUES_STR[] = "defaultValues";
-const char FAILEDTO_STR[] = "Failed to";
-const char NOTFOUND_STR[] = "not found";
-const char ALLOCATEFOR_STR[] = "allocate memory for";
-const char CONFIGFILE_STR[] = "Config File";
-const char BYTES_STR[] = "bytes";
+static const char DIRTABLE_STR[] = "\nID   ADRESS     SIZE     NAME";
+static const char ERROR_STR[] = "ERROR:";
+static const char WARNING_STR[] = "WARNING:";
+static const char TEXTMAP_STR[] = "TEXTMAP";
+static const char ENDMAP_STR[] = "ENDMAP";
+static const char UDMF_STR[] = "UDMF";
+static const char WAD_STR[] = "WAD";
+#ifndef LESSUDMF_LIBRARY
+static const char PK3_STR[] = "PK3";
+#endif
+static const char DONE_STR[] = "Done";
+static const char INPUT_STR[] = "Input";
+static const char OUTPUT_STR[] = "Output";
+static const char NAMESPACE_STR[] = "namespace";
+static const char VERTEX_STR[] = "vertex";
+static const char LINEDEF_STR[] = "linedef";
+static const char SIDEDEF_STR[] = "sidedef";
+static const char SECTOR_STR[] = "sector";
+static const char THING_STR[] = "thing";
+static const char SIDEFRONT_STR[] = "sidefront";
+static const char SIDEBACK_STR[] = "sideback";
+static const char SPECIAL_STR[] = "special";
+static const char ZFLOOR_STR[] = "zfloor";
+static const char ZCEILING_STR[] = "zceiling";
+static const char FLOORHEIGHT_STR[] = "heightfloor";
+static const char CEILINGHEIGHT_STR[] = "heightceiling";
+static const char TEXTURETOP_STR[] = "texturetop";
+static const char TEXTUREBOTTOM_STR[] = "texturebottom";
+static const char TEXTUREMIDDLE_STR[] = "texturemiddle";
+static const char TEXTUREFLOOR_STR[] = "texturefloor";
+static const char TEXTURECEILING_STR[] = "textureceiling";
+static const char DEFAULTVALUES_STR[] = "defaultValues";
+static const char FAILEDTO_STR[] = "Failed to";
+static const char NOTFOUND_STR[] = "not found";
+static const char ALLOCATEFOR_STR[] = "allocate memory for";
+static const char CONFIGFILE_STR[] = "Config File";
+static const char BYTES_STR[] = "bytes";
+
+// Print the progress of the program. The maps optimized on the thread pool (see -j) keep it in the log of their
+// context, the log is printed when their lumps are written so the progress of the maps comes in their order.
+// The library does not print the progress, only the errors and warnings
+static int CONTEXT_Print(lessudmf_t* context, const char* format, ...)
+{
+#ifdef LESSUDMF_LIBRARY
+    (void)context;
+    (void)format;
+    return 0;
+#else
+    va_list args;
+    va_start(args, format);
+    if (!context->log) {
+        int result = vprintf(format, args);
+        va_end(args);
+        return result;
+    }
+
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(context->log + context->logSize, context->logAllocated - context->logSize, format, args);
+    if (length > 0 && context->logSize + length >= context->logAllocated) {
+        while (context->logSize + length >= context->logAllocated)
+            context->logAllocated *= 2;
+        context->log = (char*)MEMORY_Realloc(context, context->log, context->logAllocated);
+        if (!context->log) {
+            fprintf(stderr, "%s %s reallocate memory for the progress of the map\n", ERROR_STR, FAILEDTO_STR);
+            CONTEXT_Fail(context);
+        }
+        vsnprintf(context->log + context->logSize, context->logAllocated - context->logSize, format, copy);
+    }
+    if (length > 0)
+        context->logSize += length;
+    va_end(copy);
+    va_end(args);
+    return length;
+#endif
+}
 
 // Get the value for a key in a block
 static const char* getFieldValueFromBlock(const block_t* blk, const char* key)
@@ -237,51 +715,50 @@ static uint8_t BOOL_IsStrFloat(const char* s)
 }
 
 // Add a key/value field into block
-static void addField(block_t* blk, const char* key, const char* value)
+static void addField(lessudmf_t* context, block_t* blk, const char* key, const char* value)
 {
     if (!(blk && key))
         return;
 
-    field_t* tmp = (field_t*)realloc(blk->fields, (blk->fieldsCount + 1) * sizeof(field_t));
+    field_t* tmp = (field_t*)MEMORY_Realloc(context, blk->fields, (blk->fieldsCount + 1) * sizeof(field_t));
     if (!tmp) {
         fprintf(stderr, "%s %s re%s the new field in block\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
-        exit(1);
+        CONTEXT_Fail(context);
     }
     blk->fields = tmp;
 
-    blk->fields[blk->fieldsCount].key = strdup(key);
-    blk->fields[blk->fieldsCount].value = strdup(value ? value : "0");
+    blk->fields[blk->fieldsCount].key = MEMORY_StrDup(context, key);
+    blk->fields[blk->fieldsCount].value = MEMORY_StrDup(context, value ? value : "0");
     if (!blk->fields[blk->fieldsCount].key || !blk->fields[blk->fieldsCount].value) {
         fprintf(stderr, "%s addField: out of memory while copying strings\n", ERROR_STR);
-        exit(1);
+        CONTEXT_Fail(context);
     }
 
     blk->fieldsCount++;
 }
 
-static void removeField(block_t* blk, const char* key)
+static void removeField(lessudmf_t* context, block_t* blk, const char* key)
 {
     if (!(blk && key))
         return;
 
     for (uint8_t i = 0; i < blk->fieldsCount; i++) {
         if (!strcmp(blk->fields[i].key, key)) {
-            free(blk->fields[i].key);
+            MEMORY_Free(context, blk->fields[i].key);
             // blk->fields[i].key = 0;
-            free(blk->fields[i].value);
+            MEMORY_Free(context, blk->fields[i].value);
             // blk->fields[i].value = 0;
             memmove(&blk->fields[i], &blk->fields[i + 1], (blk->fieldsCount - i - 1) * sizeof(field_t));
             // for (uint8_t j = i; j < blk->fieldsCount - 1; j++) blk->fields[j] = blk->fields[j + 1];
             blk->fieldsCount--;
 
             if (blk->fieldsCount) {
-                blk->fields = (field_t*)realloc(blk->fields, blk->fieldsCount * sizeof(field_t));
-                if (!blk->fields) {
-                    fprintf(stderr, "%s %s re%s the reduced fields array in block\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
-                    exit(1);
-                }
+                // The bigger array is kept if it can not be reduced
+                field_t* tmp = (field_t*)MEMORY_Realloc(context, blk->fields, blk->fieldsCount * sizeof(field_t));
+                if (tmp)
+                    blk->fields = tmp;
             } else {
-                free(blk->fields);
+                MEMORY_Free(context, blk->fields);
                 blk->fields = 0;
             }
             return;
@@ -289,6 +766,57 @@ static void removeField(block_t* blk, const char* key)
     }
 }
 
+// Set the value for a key in a block, the field is added if the block does not have it yet
+static void setFieldValue(lessudmf_t* context, block_t* blk, const char* key, const char* value)
+{
+    if (!(blk && key))
+        return;
+
+    for (uint8_t i = 0; i < blk->fieldsCount; i++) {
+        if (!strcmp(blk->fields[i].key, key)) {
+            char* old = blk->fields[i].value;
+            blk->fields[i].value = MEMORY_StrDup(context, value ? value : "0");
+            if (!blk->fields[i].value) {
+                fprintf(stderr, "%s setFieldValue: out of memory while copying strings\n", ERROR_STR);
+                CONTEXT_Fail(context);
+            }
+            MEMORY_Free(context, old);
+            return;
+        }
+    }
+    addField(context, blk, key, value);
+}
+
+// Free all the fields of a block
+static void BLOCK_Free(lessudmf_t* context, block_t* blk)
+{
+    for (uint16_t j = 0; j < blk->fieldsCount; j++) {
+        MEMORY_Free(context, blk->fields[j].key);
+        blk->fields[j].key = 0;
+        MEMORY_Free(context, blk->fields[j].value);
+        blk->fields[j].value = 0;
+    }
+    MEMORY_Free(context, blk->fields);
+    blk->fields = 0;
+    blk->fieldsCount = 0;
+}
+
+// Get the level element type (LEVEL_*) of a block, UINT8_MAX if the block is not a known level element
+static uint8_t BLOCK_GetLevelElement(const block_t* blk)
+{
+    if (!strncmp(blk->header, VERTEX_STR, 6))
+        return LEVEL_VERTEX;
+    if (!strncmp(blk->header, LINEDEF_STR, 7))
+        return LEVEL_LINEDEF;
+    if (!strncmp(blk->header, SIDEDEF_STR, 7))
+        return LEVEL_SIDEDEF;
+    if (!strncmp(blk->header, SECTOR_STR, 6))
+        return LEVEL_SECTOR;
+    if (!strncmp(blk->header, THING_STR, 5))
+        return LEVEL_THING;
+    return UINT8_MAX;
+}
+
 // Remove trailing zeros from float values
 static const char* FLOAT_TrimValue(char* str)
 {
@@ -306,19 +834,111 @@ static const char* FLOAT_TrimValue(char* str)
     return str;
 }
 
-// Compare two block_t structs
-static char BOOL_AreBlocksEqual(const block_t* a, const block_t* b)
+// Write the shortest decimal form of the value which reads back as the same value
+static void FLOAT_ToShortestString(double value, char* str, size_t size)
+{
+    for (int precision = 0; precision <= 17; precision++) {
+        snprintf(str, size, "%.*f", precision, value);
+        if (strtod(str, 0) == value)
+            break;
+    }
+    if (!strcmp(str, "-0"))
+        strcpy(str, "0");
+}
+
+// Numeric types of the field values
+enum {
+    NUMBER_ANY, // unknown, written as the shortest decimal
+    NUMBER_INT,
+    NUMBER_FLOAT
+};
+
+// Write the canonical form of the numeric value to str: integer keys get integers, the others the shortest decimal
+// which reads back as the same double, with no '+' sign and no negative zero.
+// Returns 0 if the value is not a number or has no such form, str is undefined then.
+static uint8_t NUMBER_Canonicalize(const char* value, uint8_t type, char* str, size_t size)
+{
+    if (!value || !(isdigit((unsigned char)*value) || *value == '-' || *value == '+' || *value == '.'))
+        return 0; // strings, keywords, "inf" and "nan"
+
+    char* end;
+    double number = strtod(value, &end);
+    if (end == value || *end || !isfinite(number))
+        return 0;
+
+    if (type == NUMBER_INT) {
+        if (number != floor(number) || fabs(number) > 9007199254740992.0)
+            return 0;
+        snprintf(str, size, "%lld", (long long)number);
+        return 1;
+    }
+    FLOAT_ToShortestString(number, str, size);
+    return strtod(str, 0) == number;
+}
+
+// Numeric types of the base UDMF fields, the game config adds the types of the fields it has default values for
+static const struct {
+    uint8_t levelElement;
+    const char* key;
+    uint8_t type;
+} numberTypes[] = {
+    { LEVEL_VERTEX, "x", NUMBER_FLOAT },
+    { LEVEL_VERTEX, "y", NUMBER_FLOAT },
+    { LEVEL_VERTEX, "zfloor", NUMBER_FLOAT },
+    { LEVEL_VERTEX, "zceiling", NUMBER_FLOAT },
+    { LEVEL_LINEDEF, "v1", NUMBER_INT },
+    { LEVEL_LINEDEF, "v2", NUMBER_INT },
+    { LEVEL_LINEDEF, "sidefront", NUMBER_INT },
+    { LEVEL_LINEDEF, "sideback", NUMBER_INT },
+    { LEVEL_LINEDEF, "special", NUMBER_INT },
+    { LEVEL_LINEDEF, "id", NUMBER_INT },
+    { LEVEL_SIDEDEF, "sector", NUMBER_INT },
+    { LEVEL_SECTOR, "special", NUMBER_INT },
+    { LEVEL_SECTOR, "id", NUMBER_INT },
+    { LEVEL_THING, "type", NUMBER_INT },
+    { LEVEL_THING, "id", NUMBER_INT },
+    { LEVEL_THING, "x", NUMBER_FLOAT },
+    { LEVEL_THING, "y", NUMBER_FLOAT },
+    { LEVEL_THING, "height", NUMBER_FLOAT },
+    { LEVEL_THING, "angle", NUMBER_INT },
+    { 0, 0, 0 }
+};
+
+// Check if the key is in the zero-terminated list of keys
+static uint8_t BOOL_IsKeyInList(const char* key, const char** list)
+{
+    if (!list)
+        return 0;
+    for (uint16_t x = 0; list[x]; x++) {
+        if (!strcmp(key, list[x]))
+            return 1;
+    }
+    return 0;
+}
+
+// Compare two block_t structs, the fields with keys from the zero-terminated ignoredKeys list are not compared
+static char BOOL_AreBlocksEqualIgnoring(lessudmf_t* context, const block_t* a, const block_t* b, const char** ignoredKeys)
 {
     if (!(a && b))
         return 0;
 
-    if (a->fieldsCount != b->fieldsCount)
+    uint8_t countA = 0, countB = 0;
+    for (uint8_t i = 0; i < a->fieldsCount; i++)
+        countA += !BOOL_IsKeyInList(a->fields[i].key, ignoredKeys);
+    for (uint8_t i = 0; i < b->fieldsCount; i++)
+        countB += !BOOL_IsKeyInList(b->fields[i].key, ignoredKeys);
+    if (countA != countB)
         return 0;
-    char* matched = (char*)calloc(a->fieldsCount, 1);
+    if (!b->fieldsCount)
+        return 1;
+
+    char* matched = (char*)MEMORY_Calloc(context, b->fieldsCount, 1);
     if (!matched)
         return 0;
 
     for (uint8_t i = 0; i < a->fieldsCount; i++) {
+        if (BOOL_IsKeyInList(a->fields[i].key, ignoredKeys))
+            continue;
         int found = 0;
         for (uint8_t j = 0; j < b->fieldsCount; j++) {
             if (!matched[j] && !strcmp(a->fields[i].key, b->fields[j].key) && !strcmp(a->fields[i].value, b->fields[j].value)) {
@@ -328,112 +948,801 @@ static char BOOL_AreBlocksEqual(const block_t* a, const block_t* b)
             }
         }
         if (!found) {
-            free(matched);
+            MEMORY_Free(context, matched);
             return 0;
         }
     }
-    free(matched);
+    MEMORY_Free(context, matched);
     return 1;
 }
 
-// Parse the game config file
-static char CONFIG_Parse(config_t* config)
+// Compare two block_t structs
+static char BOOL_AreBlocksEqual(lessudmf_t* context, const block_t* a, const block_t* b)
 {
-    if (!config)
-        return 0;
-    if (!config->json)
-        return 0;
-
-    config->linedefSpecialsNoTexture = 0;
-    config->linedefSpecialsSlope = 0;
-    config->sectorFieldsSlope = 0;
-    config->thingTypesNoAngle = 0;
-    for (uint8_t x = 0; x < 5; x++)
-        config->defaultValues[x] = 0;
+    return BOOL_AreBlocksEqualIgnoring(context, a, b, 0);
+}
 
-    json_value* j = config->json;
+//
+// HASH TABLE
+//
 
-    for (uint16_t x = 0; x < j->u.object.length; x++) {
-        if (!strncmp(j->u.object.values[x].name, NAMESPACE_STR, 9) && gameEngine != ENGINE_UNKNOWN) {
-            // Cancel parsing if the config is made for another game
+// FNV-1a hash of the string
+static uint32_t HASH_String(const char* s)
+{
+    uint32_t hash = 2166136261u;
+    while (*s) {
+        hash ^= (uint8_t)*s++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
-            if (strcmp(j->u.object.values[x].value->u.string.ptr, namespaceValue)) {
-                fprintf(stderr, "%s %s is made for \"%s\", not for \"%s\" game engine\n", ERROR_STR, CONFIGFILE_STR, j->u.object.values[x].value->u.string.ptr, namespaceValue);
-                return 0;
+// 64-bit xxHash (XXH64) of the data
+static uint64_t HASH_Data(const void* data, size_t size)
+{
+    static const uint64_t P1 = 0x9E3779B185EBCA87ull, P2 = 0xC2B2AE3D27D4EB4Full, P3 = 0x165667B19E3779F9ull;
+    static const uint64_t P4 = 0x85EBCA77C2B2AE63ull, P5 = 0x27D4EB2F165667C5ull;
+#define HASH_ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+#define HASH_ROUND(acc, input) (HASH_ROTL((acc) + (input) * P2, 31) * P1)
+
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* end = p + size;
+    uint64_t hash, lane;
+    uint32_t half;
+
+    if (size >= 32) {
+        uint64_t v[4] = { P1 + P2, P2, 0, 0 - P1 };
+        for (; p + 32 <= end; p += 32) {
+            for (uint8_t x = 0; x < 4; x++) {
+                memcpy(&lane, p + x * 8, 8);
+                v[x] = HASH_ROUND(v[x], lane);
             }
         }
+        hash = HASH_ROTL(v[0], 1) + HASH_ROTL(v[1], 7) + HASH_ROTL(v[2], 12) + HASH_ROTL(v[3], 18);
+        for (uint8_t x = 0; x < 4; x++)
+            hash = (hash ^ HASH_ROUND(0, v[x])) * P1 + P4;
+    } else
+        hash = P5;
+    hash += size;
+
+    for (; p + 8 <= end; p += 8) {
+        memcpy(&lane, p, 8);
+        hash = HASH_ROTL(hash ^ HASH_ROUND(0, lane), 27) * P1 + P4;
+    }
+    if (p + 4 <= end) {
+        memcpy(&half, p, 4);
+        hash = HASH_ROTL(hash ^ (half * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        hash = HASH_ROTL(hash ^ (*p * P5), 11) * P1;
+
+    hash ^= hash >> 33;
+    hash *= P2;
+    hash ^= hash >> 29;
+    hash *= P3;
+    hash ^= hash >> 32;
+    return hash;
+#undef HASH_ROUND
+#undef HASH_ROTL
+}
 
-        //
-        // LINEDEF
-        //
-        else if (!strncmp(j->u.object.values[x].name, LINEDEF_STR, 7) && j->u.object.values[x].value->type == json_object) {
+// Find the slot with the key, or the empty slot where the key would be inserted
+static uint32_t HASHTABLE_Slot(const hashtable_t* table, const char* key)
+{
+    uint32_t slot = HASH_String(key) & (table->size - 1);
+    while (table->keys[slot] && strcmp(table->keys[slot], key))
+        slot = (slot + 1) & (table->size - 1);
+    return slot;
+}
 
-            for (uint16_t i = 0; i < j->u.object.values[x].value->u.object.length; i++) {
-                bufferB = j->u.object.values[x].value->u.object.values[i].value->type;
+// Set the value of the key, the key is copied into the table
+static void HASHTABLE_Set(lessudmf_t* context, hashtable_t* table, const char* key, int64_t value)
+{
+    if ((table->count + 1) * 2 > table->size) {
+        // Keep at least half of the slots empty so the lookups stay short
+        hashtable_t grown = { 0, 0, table->size ? table->size * 2 : 64, 0 };
+        grown.keys = (char**)MEMORY_Calloc(context, grown.size, sizeof(char*));
+        grown.values = (int64_t*)MEMORY_Alloc(context, grown.size * sizeof(int64_t));
+        if (!(grown.keys && grown.values)) {
+            fprintf(stderr, "%s %s %s the hash table (%u entries)\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, grown.size);
+            CONTEXT_Fail(context);
+        }
+        for (uint32_t x = 0; x < table->size; x++) {
+            if (!table->keys[x])
+                continue;
+            uint32_t slot = HASHTABLE_Slot(&grown, table->keys[x]);
+            grown.keys[slot] = table->keys[x];
+            grown.values[slot] = table->values[x];
+            grown.count++;
+        }
+        MEMORY_Free(context, table->keys);
+        MEMORY_Free(context, table->values);
+        *table = grown;
+    }
 
-                if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "specialsNoTexture") && bufferB == json_array) {
-                    // found array containing Linedef Special types that *do not* require sidefes textures
+    uint32_t slot = HASHTABLE_Slot(table, key);
+    if (!table->keys[slot]) {
+        table->keys[slot] = MEMORY_StrDup(context, key);
+        if (!table->keys[slot]) {
+            fprintf(stderr, "%s HASHTABLE_Set: out of memory while copying strings\n", ERROR_STR);
+            CONTEXT_Fail(context);
+        }
+        table->count++;
+    }
+    table->values[slot] = value;
+}
 
-                    bufferA = j->u.object.values[x].value->u.object.values[i].value->u.array.length;
-                    bufferA = (bufferA ? bufferA : 1);
+// Get the value of the key, returns 0 if the table does not have the key
+static uint8_t HASHTABLE_Get(const hashtable_t* table, const char* key, int64_t* value)
+{
+    if (!table->count)
+        return 0;
+    uint32_t slot = HASHTABLE_Slot(table, key);
+    if (!table->keys[slot])
+        return 0;
+    if (value)
+        *value = table->values[slot];
+    return 1;
+}
 
-                    // Allocate memory
-                    config->linedefSpecialsNoTexture = (uint16_t*)malloc((bufferA + 1) * sizeof(uint16_t));
-                    if (!config->linedefSpecialsNoTexture) {
-                        fprintf(stderr, "%s %s %s the non-textured Linedef Special types array", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
-                        return 0;
-                    }
+// Free all the keys of the table and the table itself
+static void HASHTABLE_Free(lessudmf_t* context, hashtable_t* table)
+{
+    for (uint32_t x = 0; x < table->size; x++)
+        MEMORY_Free(context, table->keys[x]);
+    MEMORY_Free(context, table->keys);
+    MEMORY_Free(context, table->values);
+    memset(table, 0, sizeof(hashtable_t));
+}
 
-                    // Copy data from JSON
-                    for (uint16_t a = 0; a < bufferA; a++) {
-                        config->linedefSpecialsNoTexture[a] = j->u.object.values[x].value->u.object.values[i].value->u.array.values[a]->u.integer;
-                    }
+// The JSON parser allocates the memory of its values from the context
+static void* CONFIG_JSONAlloc(size_t size, int zero, void* user_data)
+{
+    lessudmf_t* context = (lessudmf_t*)user_data;
+    return zero ? MEMORY_Calloc(context, 1, size) : MEMORY_Alloc(context, size);
+}
 
-                    config->linedefSpecialsNoTexture[bufferA] = 0;
-                }
+static void CONFIG_JSONFree(void* data, void* user_data)
+{
+    MEMORY_Free((lessudmf_t*)user_data, data);
+}
 
-                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "specialsSlope") && bufferB == json_array) {
-                    // found array containing Linedef Special types that create slopes
+// Settings of the JSON parser for the context
+static json_settings CONFIG_JSONSettings(lessudmf_t* context)
+{
+    json_settings settings = { 0 };
+    settings.mem_alloc = CONFIG_JSONAlloc;
+    settings.mem_free = CONFIG_JSONFree;
+    settings.user_data = context;
+    return settings;
+}
 
-                    bufferA = j->u.object.values[x].value->u.object.values[i].value->u.array.length;
-                    bufferA = (bufferA ? bufferA : 1);
+// Parse the texture parameters table of a level element: { "texture field" : [ "parameter field", ... ], ... }
+static char CONFIG_ParseTextureParameters(lessudmf_t* context, config_t* cfg, uint8_t levelElement, const json_value* table)
+{
+    uint32_t count = table->u.object.length;
+    if (count > 64)
+        count = 64; // one bit per texture field
+
+    // Allocate memory
+    cfg->textureKeys[levelElement] = (char**)MEMORY_Alloc(context, (count + 1) * sizeof(char*));
+    if (!cfg->textureKeys[levelElement]) {
+        fprintf(stderr, "%s %s %s the texture parameters table", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        return 0;
+    }
 
-                    // Allocate memory
-                    config->linedefSpecialsSlope = (uint16_t*)malloc((bufferA + 1) * sizeof(uint16_t));
-                    if (!config->linedefSpecialsSlope) {
-                        fprintf(stderr, "%s %s %s the slope Linedef Special types array", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
-                        return 0;
-                    }
+    // Copy data from JSON
+    for (uint32_t a = 0; a < count; a++) {
+        cfg->textureKeys[levelElement][a] = MEMORY_StrDup(context, table->u.object.values[a].name);
+        if (!cfg->textureKeys[levelElement][a]) {
+            fprintf(stderr, "%s %s %s string (index %u) in the texture parameters table", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, a);
+            cfg->textureKeys[levelElement][a] = 0;
+            return 0;
+        }
 
-                    // Copy data from JSON
-                    for (uint16_t a = 0; a < bufferA; a++) {
-                        config->linedefSpecialsSlope[a] = j->u.object.values[x].value->u.object.values[i].value->u.array.values[a]->u.integer;
-                    }
+        const json_value* parameters = table->u.object.values[a].value;
+        if (parameters->type != json_array)
+            continue;
+        for (uint32_t p = 0; p < parameters->u.array.length; p++) {
+            if (parameters->u.array.values[p]->type != json_string)
+                continue;
+            int64_t mask = 0;
+            HASHTABLE_Get(&cfg->textureParameters[levelElement], parameters->u.array.values[p]->u.string.ptr, &mask);
+            HASHTABLE_Set(context, &cfg->textureParameters[levelElement], parameters->u.array.values[p]->u.string.ptr, mask | (int64_t)((uint64_t)1 << a));
+        }
+    }
 
-                    config->linedefSpecialsSlope[bufferA] = 0;
-                }
+    cfg->textureKeys[levelElement][count] = 0;
+    return 1;
+}
 
-                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, DEFAULTVALUES_STR) && bufferB == json_object) {
-                    // found array containing default field values for Linedefs
+// Append the fields from the JSON array to the slope Sector fields, the fields make the planes sloped
+static char CONFIG_AddSlopeFields(lessudmf_t* context, config_t* cfg, const json_value* array, uint8_t planes)
+{
+    uint32_t count = 0;
+    while (cfg->sectorFieldsSlope && cfg->sectorFieldsSlope[count])
+        count++;
+
+    // Allocate memory for the arrays
+    char** fields = (char**)MEMORY_Realloc(context, cfg->sectorFieldsSlope, (count + array->u.array.length + 1) * sizeof(char*));
+    if (!fields) {
+        fprintf(stderr, "%s %s %s the slope Sector fields array", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        return 0;
+    }
+    cfg->sectorFieldsSlope = fields;
+    cfg->sectorFieldsSlope[count] = 0;
+    uint8_t* fieldPlanes = (uint8_t*)MEMORY_Realloc(context, cfg->sectorFieldsSlopePlanes, count + array->u.array.length + 1);
+    if (!fieldPlanes) {
+        fprintf(stderr, "%s %s %s the slope Sector fields array", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        return 0;
+    }
+    cfg->sectorFieldsSlopePlanes = fieldPlanes;
 
-                    bufferA = j->u.object.values[x].value->u.object.values[i].value->u.object.length;
-                    bufferA = (bufferA ? bufferA : 1);
+    // Copy data from JSON
+    for (uint32_t a = 0; a < array->u.array.length; a++) {
+        if (array->u.array.values[a]->type != json_string)
+            continue;
+        cfg->sectorFieldsSlope[count] = MEMORY_StrDup(context, array->u.array.values[a]->u.string.ptr);
+        if (!cfg->sectorFieldsSlope[count]) {
+            fprintf(stderr, "%s %s %s string (array index %u) in the slope Sector fields array", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, a);
+            return 0;
+        }
+        cfg->sectorFieldsSlopePlanes[count++] = planes;
+        cfg->sectorFieldsSlope[count] = 0;
+    }
+    return 1;
+}
 
-                    // Allocate memory
-                    config->defaultValues[LEVEL_LINEDEF] = (field_t*)malloc((bufferA + 1) * sizeof(field_t));
-                    if (!config->defaultValues[LEVEL_LINEDEF]) {
-                        fprintf(stderr, "%s %s %s the Linedef default values list", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
-                        return 0;
-                    }
+// Parse the slope linedef specials table: { "special" : [ { "arg" : n, "value"/"mask" : v, "ifArg" : n, "ifMask" : v, "planes" : [ "frontfloor", ... ] }, ... ], ... }
+static char CONFIG_ParseSlopeModels(lessudmf_t* context, config_t* cfg, const json_value* table)
+{
+    static const char* planeNames[4] = { "frontfloor", "frontceiling", "backfloor", "backceiling" };
+
+    // Allocate memory
+    cfg->linedefSlopeModels = (slopemodel_t*)MEMORY_Calloc(context, table->u.object.length + 1, sizeof(slopemodel_t));
+    if (!cfg->linedefSlopeModels) {
+        fprintf(stderr, "%s %s %s the slope Linedef Specials table", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        return 0;
+    }
+
+    uint32_t count = 0;
+    for (uint32_t a = 0; a < table->u.object.length; a++) {
+        const json_value* rules = table->u.object.values[a].value;
+        slopemodel_t* model = &cfg->linedefSlopeModels[count];
+        model->special = (uint16_t)strtol(table->u.object.values[a].name, 0, 10);
+        if (!model->special || rules->type != json_array) {
+            model->special = 0;
+            continue;
+        }
+
+        model->rules = (sloperule_t*)MEMORY_Calloc(context, rules->u.array.length ? rules->u.array.length : 1, sizeof(sloperule_t));
+        if (!model->rules) {
+            fprintf(stderr, "%s %s %s the slope rules of Linedef Special %u", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, model->special);
+            model->special = 0;
+            return 0;
+        }
+        count++;
+
+        // Copy data from JSON
+        for (uint32_t r = 0; r < rules->u.array.length; r++) {
+            const json_value* rule = rules->u.array.values[r];
+            if (rule->type != json_object)
+                continue;
+            sloperule_t* out = &model->rules[model->rulesCount++];
+            out->type = SLOPERULE_ALWAYS;
+
+            for (uint32_t f = 0; f < rule->u.object.length; f++) {
+                const char* name = rule->u.object.values[f].name;
+                const json_value* value = rule->u.object.values[f].value;
+
+                if (!strcmp(name, "arg") && value->type == json_integer) {
+                    out->arg = (uint8_t)value->u.integer;
+                    if (out->type == SLOPERULE_ALWAYS)
+                        out->type = SLOPERULE_NONZERO;
+                } else if (!strcmp(name, "value") && value->type == json_integer) {
+                    out->type = SLOPERULE_EQUAL;
+                    out->value = (int32_t)value->u.integer;
+                } else if (!strcmp(name, "mask") && value->type == json_integer) {
+                    out->type = SLOPERULE_MASK;
+                    out->value = (int32_t)value->u.integer;
+                } else if (!strcmp(name, "ifArg") && value->type == json_integer) {
+                    out->ifArg = (uint8_t)value->u.integer;
+                } else if (!strcmp(name, "ifMask") && value->type == json_integer) {
+                    out->ifMask = (int32_t)value->u.integer;
+                } else if (!strcmp(name, "planes") && value->type == json_array) {
+                    for (uint32_t p = 0; p < value->u.array.length; p++) {
+                        for (uint8_t n = 0; n < 4; n++) {
+                            if (value->u.array.values[p]->type == json_string && !strcmp(value->u.array.values[p]->u.string.ptr, planeNames[n]))
+                                out->planes |= 1 << n;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    cfg->linedefSlopeModels[count].special = 0;
+    return 1;
+}
+
+// Get the ARGSCHEMA_* bit of an argument field ("arg0".."arg9", "stringarg0".."stringarg1"), -1 if the field is not an argument
+static int8_t ARGSCHEMA_GetBit(const char* key)
+{
+    char* end;
+    long n;
+    if (!strncmp(key, "arg", 3)) {
+        n = strtol(key + 3, &end, 10);
+        return (end != key + 3 && !*end && n >= 0 && n < ARGSCHEMA_ARGS) ? (int8_t)n : -1;
+    }
+    if (!strncmp(key, "stringarg", 9)) {
+        n = strtol(key + 9, &end, 10);
+        return (end != key + 9 && !*end && n >= 0 && n < ARGSCHEMA_STRINGARGS) ? (int8_t)(ARGSCHEMA_ARGS + n) : -1;
+    }
+    return -1;
+}
+
+// Parse the argument schemas of a level element: { "special or type" : [ "arg0", "stringarg0", ... ], ... }
+static char CONFIG_ParseArgSchemas(lessudmf_t* context, config_t* cfg, uint8_t levelElement, const json_value* table)
+{
+    for (uint32_t a = 0; a < table->u.object.length; a++) {
+        const json_value* args = table->u.object.values[a].value;
+        if (args->type != json_array)
+            continue;
+
+        int64_t mask = 0;
+        for (uint32_t p = 0; p < args->u.array.length; p++) {
+            int8_t bit = (args->u.array.values[p]->type == json_string) ? ARGSCHEMA_GetBit(args->u.array.values[p]->u.string.ptr) : -1;
+            if (bit < 0) {
+                fprintf(stderr, "%s unknown argument in the schema of \"%s\" in the %s\n", WARNING_STR, table->u.object.values[a].name, CONFIGFILE_STR);
+                continue;
+            }
+            mask |= (int64_t)1 << bit;
+        }
+
+        // Same form as the values in map
+        snprintf(context->buffer_str, sizeof(context->buffer_str), "%ld", strtol(table->u.object.values[a].name, 0, 10));
+        HASHTABLE_Set(context, &cfg->argSchemas[levelElement], context->buffer_str, mask);
+    }
+    return 1;
+}
+
+// Parse the tag arguments table: { "sector"/"linedef"/"thing" : { "arg0" : [ special, ... ], ... }, ... }
+static char CONFIG_ParseTagArgs(lessudmf_t* context, config_t* cfg, const json_value* table)
+{
+    for (uint32_t t = 0; t < table->u.object.length; t++) {
+        const json_value* args = table->u.object.values[t].value;
+        int8_t levelElement = -1;
+        if (!strcmp(table->u.object.values[t].name, SECTOR_STR))
+            levelElement = LEVEL_SECTOR;
+        else if (!strcmp(table->u.object.values[t].name, LINEDEF_STR))
+            levelElement = LEVEL_LINEDEF;
+        else if (!strcmp(table->u.object.values[t].name, THING_STR))
+            levelElement = LEVEL_THING;
+        if (levelElement < 0 || args->type != json_object)
+            continue;
+
+        for (uint32_t a = 0; a < args->u.object.length; a++) {
+            int8_t arg = ARGSCHEMA_GetBit(args->u.object.values[a].name);
+            const json_value* specials = args->u.object.values[a].value;
+            if (arg < 0 || arg >= ARGSCHEMA_ARGS || specials->type != json_array) {
+                fprintf(stderr, "%s unknown tag argument \"%s\" in the %s\n", WARNING_STR, args->u.object.values[a].name, CONFIGFILE_STR);
+                continue;
+            }
+
+            for (uint32_t sp = 0; sp < specials->u.array.length; sp++) {
+                int64_t mask = 0;
+                snprintf(context->buffer_str, sizeof(context->buffer_str), "%ld", (long)specials->u.array.values[sp]->u.integer);
+                HASHTABLE_Get(&cfg->tagArgs, context->buffer_str, &mask);
+                HASHTABLE_Set(context, &cfg->tagArgs, context->buffer_str, mask | ((int64_t)1 << (levelElement * ARGSCHEMA_ARGS + arg)));
+            }
+        }
+    }
+    return 1;
+}
+
+// Parse the portal linedef specials table: { "special" : "id" or "arg0".."arg9", ... }, the linedefs with the
+// special are linked to the linedefs with the tag in their own "id" or in the argument
+static char CONFIG_ParsePortals(lessudmf_t* context, config_t* cfg, const json_value* table)
+{
+    for (uint32_t p = 0; p < table->u.object.length; p++) {
+        const json_value* value = table->u.object.values[p].value;
+        int8_t arg = -1;
+        if (value->type != json_string || (strcmp(value->u.string.ptr, "id") && ((arg = ARGSCHEMA_GetBit(value->u.string.ptr)) < 0 || arg >= ARGSCHEMA_ARGS))) {
+            fprintf(stderr, "%s unknown portal tag \"%s\" in the %s\n", WARNING_STR, table->u.object.values[p].name, CONFIGFILE_STR);
+            continue;
+        }
+        snprintf(context->buffer_str, sizeof(context->buffer_str), "%ld", strtol(table->u.object.values[p].name, 0, 10));
+        HASHTABLE_Set(context, &cfg->linedefPortals, context->buffer_str, arg);
+    }
+    return 1;
+}
+
+// Remember the numeric type of the default value ("1.0" is a float, "1" an integer)
+// and bring the value to the canonical form of the parsed values
+static void CONFIG_AddDefaultValue(lessudmf_t* context, config_t* cfg, uint8_t levelElement, field_t* field)
+{
+    uint8_t type = strpbrk(field->value, ".eE") ? NUMBER_FLOAT : NUMBER_INT;
+    char canonical[64];
+
+    if (!NUMBER_Canonicalize(field->value, type, canonical, sizeof(canonical)))
+        return;
+    HASHTABLE_Set(context, &cfg->fieldTypes[levelElement], field->key, type);
+    if (strcmp(canonical, field->value)) {
+        MEMORY_Free(context, field->value);
+        field->value = MEMORY_StrDup(context, canonical);
+    }
+}
+
+// Parse the quantization grids: { "vertex"/"linedef"/"sidedef"/"sector"/"thing" : { "field" : step, ... }, ... }
+static char CONFIG_ParseQuantizeRules(lessudmf_t* context, config_t* cfg, const json_value* table)
+{
+    const char* elements[5] = { VERTEX_STR, LINEDEF_STR, SIDEDEF_STR, SECTOR_STR, THING_STR };
+
+    for (uint32_t t = 0; t < table->u.object.length; t++) {
+        const json_value* rules = table->u.object.values[t].value;
+        uint8_t e = 0;
+        while (e < 5 && strcmp(table->u.object.values[t].name, elements[e]))
+            e++;
+        if (e == 5 || rules->type != json_object)
+            continue;
+
+        cfg->quantizeRules[e] = (quantizerule_t*)MEMORY_Calloc(context, rules->u.object.length + 1, sizeof(quantizerule_t));
+        if (!cfg->quantizeRules[e]) {
+            fprintf(stderr, "%s %s %s the quantization rules\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+            return 0;
+        }
+        uint16_t count = 0;
+        for (uint32_t r = 0; r < rules->u.object.length; r++) {
+            const json_value* step = rules->u.object.values[r].value;
+            double value = (step->type == json_integer) ? (double)step->u.integer : (step->type == json_double) ? step->u.dbl : 0;
+            if (!(value > 0)) {
+                fprintf(stderr, "%s bad quantization step of \"%s\" in the %s\n", WARNING_STR, rules->u.object.values[r].name, CONFIGFILE_STR);
+                continue;
+            }
+            cfg->quantizeRules[e][count].key = MEMORY_StrDup(context, rules->u.object.values[r].name);
+            cfg->quantizeRules[e][count].step = value;
+            count++;
+        }
+    }
+    return 1;
+}
+
+// Names of the rule operands which are not fields: name, type, field key or SLOPE_* planes
+static const struct {
+    const char* name;
+    uint8_t type;
+    const char* key;
+    uint8_t planes;
+} ruleOperandNames[] = {
+    { "floor", RULEOPERAND_SECTOR, "heightfloor", 0 },
+    { "ceiling", RULEOPERAND_SECTOR, "heightceiling", 0 },
+    { "floorflat", RULEOPERAND_SECTOR, "texturefloor", 0 },
+    { "ceilingflat", RULEOPERAND_SECTOR, "textureceiling", 0 },
+    { "otherfloor", RULEOPERAND_OTHERSECTOR, "heightfloor", 0 },
+    { "otherceiling", RULEOPERAND_OTHERSECTOR, "heightceiling", 0 },
+    { "otherfloorflat", RULEOPERAND_OTHERSECTOR, "texturefloor", 0 },
+    { "otherceilingflat", RULEOPERAND_OTHERSECTOR, "textureceiling", 0 },
+    { "sloped", RULEOPERAND_SLOPED, 0, SLOPE_FLOOR | SLOPE_CEILING },
+    { "slopedfloor", RULEOPERAND_SLOPED, 0, SLOPE_FLOOR },
+    { "slopedceiling", RULEOPERAND_SLOPED, 0, SLOPE_CEILING },
+    { "twosided", RULEOPERAND_TWOSIDED, 0, 0 },
+    { 0, 0, 0, 0 }
+};
+
+// Prefixes of the field operands ("sector.lightlevel")
+static const struct {
+    const char* prefix;
+    uint8_t type;
+} ruleOperandPrefixes[] = {
+    { "linedef.", RULEOPERAND_LINEDEF },
+    { "side.", RULEOPERAND_SIDE },
+    { "sector.", RULEOPERAND_SECTOR },
+    { "othersector.", RULEOPERAND_OTHERSECTOR },
+    { 0, 0 }
+};
+
+static void TEXTURERULES_Free(lessudmf_t* context, texturerule_t** rules)
+{
+    for (uint16_t r = 0; *rules && (*rules)[r].remove; r++) {
+        for (uint16_t x = 0; (*rules)[r].remove[x]; x++)
+            MEMORY_Free(context, (*rules)[r].remove[x]);
+        for (uint16_t c = 0; c < (*rules)[r].conditionsCount; c++) {
+            MEMORY_Free(context, (*rules)[r].conditions[c].a.string);
+            MEMORY_Free(context, (*rules)[r].conditions[c].b.string);
+        }
+        MEMORY_Free(context, (*rules)[r].remove);
+        MEMORY_Free(context, (*rules)[r].conditions);
+    }
+    MEMORY_Free(context, *rules);
+    *rules = 0;
+}
+
+// Compile the operand of a condition: a number, an operand name, a prefixed field or a string constant
+static char TEXTURERULE_ParseOperand(lessudmf_t* context, const json_value* value, ruleoperand_t* operand)
+{
+    memset(operand, 0, sizeof(ruleoperand_t));
+    if (value->type == json_integer || value->type == json_double) {
+        operand->type = RULEOPERAND_NUMBER;
+        operand->number = (value->type == json_integer) ? (double)value->u.integer : value->u.dbl;
+        return 1;
+    }
+    if (value->type != json_string)
+        return 0;
+
+    const char* name = value->u.string.ptr;
+    for (uint8_t x = 0; ruleOperandNames[x].name; x++) {
+        if (strcmp(ruleOperandNames[x].name, name))
+            continue;
+        operand->type = ruleOperandNames[x].type;
+        operand->number = ruleOperandNames[x].planes;
+        operand->string = ruleOperandNames[x].key ? MEMORY_StrDup(context, ruleOperandNames[x].key) : 0;
+        return 1;
+    }
+    for (uint8_t x = 0; ruleOperandPrefixes[x].prefix; x++) {
+        size_t length = strlen(ruleOperandPrefixes[x].prefix);
+        if (strncmp(ruleOperandPrefixes[x].prefix, name, length))
+            continue;
+        operand->type = ruleOperandPrefixes[x].type;
+        operand->string = MEMORY_StrDup(context, name + length);
+        return 1;
+    }
+    operand->type = RULEOPERAND_STRING;
+    operand->string = MEMORY_StrDup(context, name);
+    return 1;
+}
+
+// Compile the texture rules: [ { "remove" : [ field, ... ], "if" : [ [ operand, "op", operand ], ... ] }, ... ]
+static texturerule_t* CONFIG_ParseTextureRules(lessudmf_t* context, const json_value* array)
+{
+    const char* ops[] = { "==", "!=", "<", "<=", ">", ">=", 0 };
+
+    texturerule_t* rules = (texturerule_t*)MEMORY_Calloc(context, array->u.array.length + 1, sizeof(texturerule_t));
+    if (!rules) {
+        fprintf(stderr, "%s %s %s the texture rules\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        return 0;
+    }
+
+    uint16_t count = 0;
+    for (uint32_t r = 0; r < array->u.array.length; r++) {
+        const json_value* rule = array->u.array.values[r];
+        const json_value* remove = 0;
+        const json_value* conditions = 0;
+        for (uint32_t x = 0; rule->type == json_object && x < rule->u.object.length; x++) {
+            if (!strcmp(rule->u.object.values[x].name, "remove") && rule->u.object.values[x].value->type == json_array)
+                remove = rule->u.object.values[x].value;
+            else if (!strcmp(rule->u.object.values[x].name, "if") && rule->u.object.values[x].value->type == json_array)
+                conditions = rule->u.object.values[x].value;
+        }
+        if (!remove || !remove->u.array.length) {
+            fprintf(stderr, "%s texture rule %u in the %s does not remove anything\n", WARNING_STR, r, CONFIGFILE_STR);
+            continue;
+        }
+
+        texturerule_t* compiled = &rules[count];
+        compiled->remove = (char**)MEMORY_Calloc(context, remove->u.array.length + 1, sizeof(char*));
+        compiled->conditions = (rulecondition_t*)MEMORY_Calloc(context, conditions ? conditions->u.array.length + 1 : 1, sizeof(rulecondition_t));
+        if (!(compiled->remove && compiled->conditions)) {
+            fprintf(stderr, "%s %s %s the texture rules\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+            return rules;
+        }
+        for (uint32_t x = 0, f = 0; x < remove->u.array.length; x++) {
+            if (remove->u.array.values[x]->type == json_string)
+                compiled->remove[f++] = MEMORY_StrDup(context, remove->u.array.values[x]->u.string.ptr);
+        }
+
+        uint8_t valid = 1;
+        for (uint32_t c = 0; conditions && c < conditions->u.array.length && valid; c++) {
+            const json_value* condition = conditions->u.array.values[c];
+            rulecondition_t* out = &compiled->conditions[compiled->conditionsCount];
+            valid = condition->type == json_array && condition->u.array.length == 3 && condition->u.array.values[1]->type == json_string;
+            if (!valid)
+                break;
+            out->op = 0;
+            while (ops[out->op] && strcmp(ops[out->op], condition->u.array.values[1]->u.string.ptr))
+                out->op++;
+            compiled->conditionsCount++; // counted before the checks so the operand strings are freed
+            valid = ops[out->op] && TEXTURERULE_ParseOperand(context, condition->u.array.values[0], &out->a) && TEXTURERULE_ParseOperand(context, condition->u.array.values[2], &out->b);
+        }
+        if (!valid) {
+            fprintf(stderr, "%s bad condition in the texture rule %u in the %s, the rule is ignored\n", WARNING_STR, r, CONFIGFILE_STR);
+            texturerule_t* single = (texturerule_t*)MEMORY_Calloc(context, 2, sizeof(texturerule_t));
+            if (single) {
+                single[0] = *compiled;
+                TEXTURERULES_Free(context, &single);
+            }
+            memset(compiled, 0, sizeof(texturerule_t));
+            continue;
+        }
+        count++;
+    }
+    return rules;
+}
+
+// Parse the sector merge tolerances: { "field" : largest difference, ... }
+static char CONFIG_ParseSectorTolerances(lessudmf_t* context, config_t* cfg, const json_value* table)
+{
+    cfg->sectorToleranceKeys = (char**)MEMORY_Calloc(context, table->u.object.length + 1, sizeof(char*));
+    cfg->sectorTolerances = (double*)MEMORY_Calloc(context, table->u.object.length + 1, sizeof(double));
+    if (!(cfg->sectorToleranceKeys && cfg->sectorTolerances)) {
+        fprintf(stderr, "%s %s %s the sector merge tolerances\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        return 0;
+    }
+
+    uint16_t count = 0;
+    for (uint32_t t = 0; t < table->u.object.length; t++) {
+        const json_value* tolerance = table->u.object.values[t].value;
+        double value = (tolerance->type == json_integer) ? (double)tolerance->u.integer : (tolerance->type == json_double) ? tolerance->u.dbl : -1;
+        if (value < 0) {
+            fprintf(stderr, "%s bad merge tolerance of \"%s\" in the %s\n", WARNING_STR, table->u.object.values[t].name, CONFIGFILE_STR);
+            continue;
+        }
+        cfg->sectorToleranceKeys[count] = MEMORY_StrDup(context, table->u.object.values[t].name);
+        cfg->sectorTolerances[count] = value;
+        count++;
+    }
+    return 1;
+}
+
+// Parse the game config file
+static char CONFIG_Parse(lessudmf_t* context, config_t* cfg)
+{
+    if (!cfg)
+        return 0;
+    if (!cfg->json)
+        return 0;
+
+    cfg->linedefSpecialsNoTexture = 0;
+    cfg->linedefSpecialsSlope = 0;
+    cfg->sectorFieldsSlope = 0;
+    cfg->sectorFieldsSlopePlanes = 0;
+    cfg->linedefSlopeModels = 0;
+    cfg->thingTypesNoAngle = 0;
+    cfg->thingTypesStackable = 0;
+    cfg->thingTypesReachableFrom = 0;
+    for (uint8_t x = 0; x < 5; x++) {
+        cfg->defaultValues[x] = 0;
+        cfg->textureKeys[x] = 0;
+        memset(&cfg->textureParameters[x], 0, sizeof(hashtable_t));
+        memset(&cfg->argSchemas[x], 0, sizeof(hashtable_t));
+    }
+    memset(&cfg->tagArgs, 0, sizeof(hashtable_t));
+    memset(&cfg->linedefPortals, 0, sizeof(hashtable_t));
+    for (uint8_t x = 0; x < 5; x++) {
+        memset(&cfg->fieldTypes[x], 0, sizeof(hashtable_t));
+        cfg->quantizeRules[x] = 0;
+    }
+    cfg->sectorToleranceKeys = 0;
+    cfg->sectorTolerances = 0;
+    for (uint8_t x = 0; x < 5; x++)
+        cfg->textureRules[x] = 0;
+
+    json_value* j = cfg->json;
+
+    for (uint16_t x = 0; x < j->u.object.length; x++) {
+        if (!strncmp(j->u.object.values[x].name, NAMESPACE_STR, 9) && context->gameEngine != ENGINE_UNKNOWN) {
+            // Cancel parsing if the config is made for another game
+
+            if (strcmp(j->u.object.values[x].value->u.string.ptr, context->namespaceValue)) {
+                fprintf(stderr, "%s %s is made for \"%s\", not for \"%s\" game engine\n", ERROR_STR, CONFIGFILE_STR, j->u.object.values[x].value->u.string.ptr, context->namespaceValue);
+                return 0;
+            }
+        }
+
+        else if (!strcmp(j->u.object.values[x].name, "quantize") && j->u.object.values[x].value->type == json_object) {
+            // found the grids of the numeric fields for the "--quantize" CLI option
+
+            if (!CONFIG_ParseQuantizeRules(context, cfg, j->u.object.values[x].value))
+                return 0;
+        }
+
+        //
+        // LINEDEF
+        //
+        else if (!strncmp(j->u.object.values[x].name, LINEDEF_STR, 7) && j->u.object.values[x].value->type == json_object) {
+
+            for (uint16_t i = 0; i < j->u.object.values[x].value->u.object.length; i++) {
+                context->bufferB = j->u.object.values[x].value->u.object.values[i].value->type;
+
+                if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "specialsNoTexture") && context->bufferB == json_array) {
+                    // found array containing Linedef Special types that *do not* require sidefes textures
+
+                    context->bufferA = j->u.object.values[x].value->u.object.values[i].value->u.array.length;
+                    context->bufferA = (context->bufferA ? context->bufferA : 1);
+
+                    // Allocate memory
+                    cfg->linedefSpecialsNoTexture = (uint16_t*)MEMORY_Alloc(context, (context->bufferA + 1) * sizeof(uint16_t));
+                    if (!cfg->linedefSpecialsNoTexture) {
+                        fprintf(stderr, "%s %s %s the non-textured Linedef Special types array", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+                        return 0;
+                    }
+
+                    // Copy data from JSON
+                    for (uint16_t a = 0; a < context->bufferA; a++) {
+                        cfg->linedefSpecialsNoTexture[a] = j->u.object.values[x].value->u.object.values[i].value->u.array.values[a]->u.integer;
+                    }
+
+                    cfg->linedefSpecialsNoTexture[context->bufferA] = 0;
+                }
+
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "specialsSlope") && context->bufferB == json_array) {
+                    // found array containing Linedef Special types that create slopes
+
+                    context->bufferA = j->u.object.values[x].value->u.object.values[i].value->u.array.length;
+                    context->bufferA = (context->bufferA ? context->bufferA : 1);
+
+                    // Allocate memory
+                    cfg->linedefSpecialsSlope = (uint16_t*)MEMORY_Alloc(context, (context->bufferA + 1) * sizeof(uint16_t));
+                    if (!cfg->linedefSpecialsSlope) {
+                        fprintf(stderr, "%s %s %s the slope Linedef Special types array", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+                        return 0;
+                    }
+
+                    // Copy data from JSON
+                    for (uint16_t a = 0; a < context->bufferA; a++) {
+                        cfg->linedefSpecialsSlope[a] = j->u.object.values[x].value->u.object.values[i].value->u.array.values[a]->u.integer;
+                    }
+
+                    cfg->linedefSpecialsSlope[context->bufferA] = 0;
+                }
+
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "textureRules") && context->bufferB == json_array) {
+                    // found the rules of the wall textures which are not visible
+
+                    if (!(cfg->textureRules[LEVEL_LINEDEF] = CONFIG_ParseTextureRules(context, j->u.object.values[x].value->u.object.values[i].value)))
+                        return 0;
+                }
+
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "tagArgs") && context->bufferB == json_object) {
+                    // found table of the Linedef Special arguments which are tags of sectors, linedefs or things
+
+                    if (!CONFIG_ParseTagArgs(context, cfg, j->u.object.values[x].value->u.object.values[i].value))
+                        return 0;
+                }
+
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "portals") && context->bufferB == json_object) {
+                    // found table of the Linedef Specials which link the linedef to other linedefs by tag
+
+                    if (!CONFIG_ParsePortals(context, cfg, j->u.object.values[x].value->u.object.values[i].value))
+                        return 0;
+                }
+
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "argSchemas") && context->bufferB == json_object) {
+                    // found table of the arguments every Linedef Special uses
+
+                    if (!CONFIG_ParseArgSchemas(context, cfg, LEVEL_LINEDEF, j->u.object.values[x].value->u.object.values[i].value))
+                        return 0;
+                }
+
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "slopePlanes") && context->bufferB == json_object) {
+                    // found table describing which planes the slope Linedef Specials make sloped
+
+                    if (!CONFIG_ParseSlopeModels(context, cfg, j->u.object.values[x].value->u.object.values[i].value))
+                        return 0;
+                }
+
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, DEFAULTVALUES_STR) && context->bufferB == json_object) {
+                    // found array containing default field values for Linedefs
+
+                    context->bufferA = j->u.object.values[x].value->u.object.values[i].value->u.object.length;
+                    context->bufferA = (context->bufferA ? context->bufferA : 1);
+
+                    // Allocate memory
+                    cfg->defaultValues[LEVEL_LINEDEF] = (field_t*)MEMORY_Alloc(context, (context->bufferA + 1) * sizeof(field_t));
+                    if (!cfg->defaultValues[LEVEL_LINEDEF]) {
+                        fprintf(stderr, "%s %s %s the Linedef default values list", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+                        return 0;
+                    }
 
                     // Copy data from JSON
-                    for (uint16_t a = 0; a < bufferA; a++) {
-                        config->defaultValues[LEVEL_LINEDEF][a].key = strdup(j->u.object.values[x].value->u.object.values[i].value->u.object.values[a].name);
-                        config->defaultValues[LEVEL_LINEDEF][a].value = strdup(j->u.object.values[x].value->u.object.values[i].value->u.object.values[a].value->u.string.ptr);
+                    for (uint16_t a = 0; a < context->bufferA; a++) {
+                        cfg->defaultValues[LEVEL_LINEDEF][a].key = MEMORY_StrDup(context, j->u.object.values[x].value->u.object.values[i].value->u.object.values[a].name);
+                        cfg->defaultValues[LEVEL_LINEDEF][a].value = MEMORY_StrDup(context, j->u.object.values[x].value->u.object.values[i].value->u.object.values[a].value->u.string.ptr);
+                        CONFIG_AddDefaultValue(context, cfg, LEVEL_LINEDEF, &cfg->defaultValues[LEVEL_LINEDEF][a]); // same form as the parsed values
                     }
 
-                    config->defaultValues[LEVEL_LINEDEF][bufferA].key = 0;
-                    config->defaultValues[LEVEL_LINEDEF][bufferA].value = 0;
+                    cfg->defaultValues[LEVEL_LINEDEF][context->bufferA].key = 0;
+                    cfg->defaultValues[LEVEL_LINEDEF][context->bufferA].value = 0;
                 }
             }
         }
@@ -444,29 +1753,37 @@ static char CONFIG_Parse(config_t* config)
         else if (!strncmp(j->u.object.values[x].name, SIDEDEF_STR, 7) && j->u.object.values[x].value->type == json_object) {
 
             for (uint16_t i = 0; i < j->u.object.values[x].value->u.object.length; i++) {
-                bufferB = j->u.object.values[x].value->u.object.values[i].value->type;
+                context->bufferB = j->u.object.values[x].value->u.object.values[i].value->type;
 
-                if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, DEFAULTVALUES_STR) && bufferB == json_object) {
+                if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, DEFAULTVALUES_STR) && context->bufferB == json_object) {
                     // found array containing default field values for Sidedefs
 
-                    bufferA = j->u.object.values[x].value->u.object.values[i].value->u.object.length;
-                    bufferA = (bufferA ? bufferA : 1);
+                    context->bufferA = j->u.object.values[x].value->u.object.values[i].value->u.object.length;
+                    context->bufferA = (context->bufferA ? context->bufferA : 1);
 
                     // Allocate memory
-                    config->defaultValues[LEVEL_SIDEDEF] = (field_t*)malloc((bufferA + 1) * sizeof(field_t));
-                    if (!config->defaultValues[LEVEL_SIDEDEF]) {
+                    cfg->defaultValues[LEVEL_SIDEDEF] = (field_t*)MEMORY_Alloc(context, (context->bufferA + 1) * sizeof(field_t));
+                    if (!cfg->defaultValues[LEVEL_SIDEDEF]) {
                         fprintf(stderr, "%s %s %s the Sidedef default values list", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
                         return 0;
                     }
 
                     // Copy data from JSON
-                    for (uint16_t a = 0; a < bufferA; a++) {
-                        config->defaultValues[LEVEL_SIDEDEF][a].key = strdup(j->u.object.values[x].value->u.object.values[i].value->u.object.values[a].name);
-                        config->defaultValues[LEVEL_SIDEDEF][a].value = strdup(j->u.object.values[x].value->u.object.values[i].value->u.object.values[a].value->u.string.ptr);
+                    for (uint16_t a = 0; a < context->bufferA; a++) {
+                        cfg->defaultValues[LEVEL_SIDEDEF][a].key = MEMORY_StrDup(context, j->u.object.values[x].value->u.object.values[i].value->u.object.values[a].name);
+                        cfg->defaultValues[LEVEL_SIDEDEF][a].value = MEMORY_StrDup(context, j->u.object.values[x].value->u.object.values[i].value->u.object.values[a].value->u.string.ptr);
+                        CONFIG_AddDefaultValue(context, cfg, LEVEL_SIDEDEF, &cfg->defaultValues[LEVEL_SIDEDEF][a]); // same form as the parsed values
                     }
 
-                    config->defaultValues[LEVEL_SIDEDEF][bufferA].key = 0;
-                    config->defaultValues[LEVEL_SIDEDEF][bufferA].value = 0;
+                    cfg->defaultValues[LEVEL_SIDEDEF][context->bufferA].key = 0;
+                    cfg->defaultValues[LEVEL_SIDEDEF][context->bufferA].value = 0;
+                }
+
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "textureParameters") && context->bufferB == json_object) {
+                    // found table of the Sidedef fields that modify the wall textures
+
+                    if (!CONFIG_ParseTextureParameters(context, cfg, LEVEL_SIDEDEF, j->u.object.values[x].value->u.object.values[i].value))
+                        return 0;
                 }
             }
         }
@@ -477,64 +1794,81 @@ static char CONFIG_Parse(config_t* config)
         else if (!strncmp(j->u.object.values[x].name, SECTOR_STR, 6) && j->u.object.values[x].value->type == json_object) {
 
             for (uint16_t i = 0; i < j->u.object.values[x].value->u.object.length; i++) {
-                bufferB = j->u.object.values[x].value->u.object.values[i].value->type;
+                context->bufferB = j->u.object.values[x].value->u.object.values[i].value->type;
 
-                if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "polygonSlope") && bufferB == json_boolean) {
+                if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "polygonSlope") && context->bufferB == json_boolean) {
                     // Found information about polygonal slopes support
 
                     if (j->u.object.values[x].value->u.object.values[i].value->u.boolean)
-                        config->flags |= CFGFLAG_POLYGONSLOPE;
+                        cfg->flags |= CFGFLAG_POLYGONSLOPE;
                     else
-                        config->flags &= ~CFGFLAG_POLYGONSLOPE;
+                        cfg->flags &= ~CFGFLAG_POLYGONSLOPE;
                 }
 
-                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "fieldsSlope") && bufferB == json_array) {
-                    // found array containing sector UDMF fields that define slope
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "textureRules") && context->bufferB == json_array) {
+                    // found the rules of the flats which are not visible
+
+                    if (!(cfg->textureRules[LEVEL_SECTOR] = CONFIG_ParseTextureRules(context, j->u.object.values[x].value->u.object.values[i].value)))
+                        return 0;
+                }
 
-                    bufferA = j->u.object.values[x].value->u.object.values[i].value->u.array.length;
-                    bufferA = (bufferA ? bufferA : 1);
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "mergeTolerances") && context->bufferB == json_object) {
+                    // found the largest differences of the sector fields for the "-l" CLI option
 
-                    // Allocate memory for the array
-                    config->sectorFieldsSlope = (char**)malloc((bufferA + 1) * sizeof(char*));
-                    if (!config->sectorFieldsSlope) {
-                        fprintf(stderr, "%s %s %s the slope Sector fields array", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+                    if (!CONFIG_ParseSectorTolerances(context, cfg, j->u.object.values[x].value->u.object.values[i].value))
                         return 0;
-                    }
+                }
 
-                    // Copy data from JSON
-                    for (uint16_t a = 0; a < bufferA; a++) {
-                        // copy the string
-                        config->sectorFieldsSlope[a] = strdup(j->u.object.values[x].value->u.object.values[i].value->u.array.values[a]->u.string.ptr);
-                        if (!config->sectorFieldsSlope[a]) {
-                            fprintf(stderr, "%s %s %s string (array index %d) in the slope Sector fields array", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, a);
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "fieldsSlope") && context->bufferB == json_array) {
+                    // found array containing sector UDMF fields that define slope of both planes
+
+                    if (!CONFIG_AddSlopeFields(context, cfg, j->u.object.values[x].value->u.object.values[i].value, SLOPE_FLOOR | SLOPE_CEILING))
+                        return 0;
+                }
+
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "fieldsSlope") && context->bufferB == json_object) {
+                    // found arrays containing sector UDMF fields that define slope of the floor or ceiling
+
+                    const json_value* planes = j->u.object.values[x].value->u.object.values[i].value;
+                    for (uint16_t a = 0; a < planes->u.object.length; a++) {
+                        if (planes->u.object.values[a].value->type != json_array)
+                            continue;
+                        if (!strcmp(planes->u.object.values[a].name, "floor") && !CONFIG_AddSlopeFields(context, cfg, planes->u.object.values[a].value, SLOPE_FLOOR))
+                            return 0;
+                        if (!strcmp(planes->u.object.values[a].name, "ceiling") && !CONFIG_AddSlopeFields(context, cfg, planes->u.object.values[a].value, SLOPE_CEILING))
                             return 0;
-                        }
                     }
-
-                    config->sectorFieldsSlope[bufferA] = 0;
                 }
 
-                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, DEFAULTVALUES_STR) && bufferB == json_object) {
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, DEFAULTVALUES_STR) && context->bufferB == json_object) {
                     // found array containing default field values for Sectors
 
-                    bufferA = j->u.object.values[x].value->u.object.values[i].value->u.object.length;
-                    bufferA = (bufferA ? bufferA : 1);
+                    context->bufferA = j->u.object.values[x].value->u.object.values[i].value->u.object.length;
+                    context->bufferA = (context->bufferA ? context->bufferA : 1);
 
                     // Allocate memory
-                    config->defaultValues[LEVEL_SECTOR] = (field_t*)malloc((bufferA + 1) * sizeof(field_t));
-                    if (!config->defaultValues[LEVEL_SECTOR]) {
+                    cfg->defaultValues[LEVEL_SECTOR] = (field_t*)MEMORY_Alloc(context, (context->bufferA + 1) * sizeof(field_t));
+                    if (!cfg->defaultValues[LEVEL_SECTOR]) {
                         fprintf(stderr, "%s %s %s the Sector default values list", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
                         return 0;
                     }
 
                     // Copy data from JSON
-                    for (uint16_t a = 0; a < bufferA; a++) {
-                        config->defaultValues[LEVEL_SECTOR][a].key = strdup(j->u.object.values[x].value->u.object.values[i].value->u.object.values[a].name);
-                        config->defaultValues[LEVEL_SECTOR][a].value = strdup(j->u.object.values[x].value->u.object.values[i].value->u.object.values[a].value->u.string.ptr);
+                    for (uint16_t a = 0; a < context->bufferA; a++) {
+                        cfg->defaultValues[LEVEL_SECTOR][a].key = MEMORY_StrDup(context, j->u.object.values[x].value->u.object.values[i].value->u.object.values[a].name);
+                        cfg->defaultValues[LEVEL_SECTOR][a].value = MEMORY_StrDup(context, j->u.object.values[x].value->u.object.values[i].value->u.object.values[a].value->u.string.ptr);
+                        CONFIG_AddDefaultValue(context, cfg, LEVEL_SECTOR, &cfg->defaultValues[LEVEL_SECTOR][a]); // same form as the parsed values
                     }
 
-                    config->defaultValues[LEVEL_SECTOR][bufferA].key = 0;
-                    config->defaultValues[LEVEL_SECTOR][bufferA].value = 0;
+                    cfg->defaultValues[LEVEL_SECTOR][context->bufferA].key = 0;
+                    cfg->defaultValues[LEVEL_SECTOR][context->bufferA].value = 0;
+                }
+
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "textureParameters") && context->bufferB == json_object) {
+                    // found table of the Sector fields that modify the flat textures
+
+                    if (!CONFIG_ParseTextureParameters(context, cfg, LEVEL_SECTOR, j->u.object.values[x].value->u.object.values[i].value))
+                        return 0;
                 }
             }
         }
@@ -545,118 +1879,213 @@ static char CONFIG_Parse(config_t* config)
         else if (!strncmp(j->u.object.values[x].name, THING_STR, 5) && j->u.object.values[x].value->type == json_object) {
 
             for (uint16_t i = 0; i < j->u.object.values[x].value->u.object.length; i++) {
-                bufferB = j->u.object.values[x].value->u.object.values[i].value->type;
+                context->bufferB = j->u.object.values[x].value->u.object.values[i].value->type;
 
-                if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "noAngle") && bufferB == json_array) {
+                if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "noAngle") && context->bufferB == json_array) {
                     // found array containing sector thing types that do not use angle
 
-                    bufferA = j->u.object.values[x].value->u.object.values[i].value->u.array.length;
-                    bufferA = (bufferA ? bufferA : 1);
+                    context->bufferA = j->u.object.values[x].value->u.object.values[i].value->u.array.length;
+                    context->bufferA = (context->bufferA ? context->bufferA : 1);
 
                     // Allocate memory for the array
-                    config->thingTypesNoAngle = (uint16_t*)malloc((bufferA + 1) * sizeof(uint16_t));
-                    if (!config->thingTypesNoAngle) {
+                    cfg->thingTypesNoAngle = (uint16_t*)MEMORY_Alloc(context, (context->bufferA + 1) * sizeof(uint16_t));
+                    if (!cfg->thingTypesNoAngle) {
                         fprintf(stderr, "%s %s %s the no angle Things array", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
                         return 0;
                     }
 
                     // Copy data from JSON
-                    for (uint16_t a = 0; a < bufferA; a++) {
-                        config->thingTypesNoAngle[a] = j->u.object.values[x].value->u.object.values[i].value->u.array.values[a]->u.integer;
+                    for (uint16_t a = 0; a < context->bufferA; a++) {
+                        cfg->thingTypesNoAngle[a] = j->u.object.values[x].value->u.object.values[i].value->u.array.values[a]->u.integer;
                     }
 
-                    config->thingTypesNoAngle[bufferA] = 0;
+                    cfg->thingTypesNoAngle[context->bufferA] = 0;
                 }
 
-                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, DEFAULTVALUES_STR) && bufferB == json_object) {
-                    // found array containing default field values for Things
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "stackable") && context->bufferB == json_array) {
+                    // found array containing thing types which can be placed on top of each other on purpose
 
-                    bufferA = j->u.object.values[x].value->u.object.values[i].value->u.object.length;
-                    bufferA = (bufferA ? bufferA : 1);
+                    context->bufferA = j->u.object.values[x].value->u.object.values[i].value->u.array.length;
 
-                    // Allocate memory
-                    config->defaultValues[LEVEL_THING] = (field_t*)malloc((bufferA + 1) * sizeof(field_t));
-                    if (!config->defaultValues[LEVEL_THING]) {
-                        fprintf(stderr, "%s %s %s the Thing default values list", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+                    // Allocate memory for the array
+                    cfg->thingTypesStackable = (uint16_t*)MEMORY_Alloc(context, (context->bufferA + 1) * sizeof(uint16_t));
+                    if (!cfg->thingTypesStackable) {
+                        fprintf(stderr, "%s %s %s the stackable Things array", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
                         return 0;
                     }
 
                     // Copy data from JSON
-                    for (uint16_t a = 0; a < bufferA; a++) {
-                        config->defaultValues[LEVEL_THING][a].key = strdup(j->u.object.values[x].value->u.object.values[i].value->u.object.values[a].name);
-                        config->defaultValues[LEVEL_THING][a].value = strdup(j->u.object.values[x].value->u.object.values[i].value->u.object.values[a].value->u.string.ptr);
+                    for (uint16_t a = 0; a < context->bufferA; a++) {
+                        cfg->thingTypesStackable[a] = j->u.object.values[x].value->u.object.values[i].value->u.array.values[a]->u.integer;
                     }
 
-                    config->defaultValues[LEVEL_THING][bufferA].key = 0;
-                    config->defaultValues[LEVEL_THING][bufferA].value = 0;
+                    cfg->thingTypesStackable[context->bufferA] = 0;
                 }
-            }
-        }
-    }
 
-    return 1;
-}
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "reachableFrom") && context->bufferB == json_array) {
+                    // found array containing thing types the level can be reached or seen from
 
-// Unload game config file
-static void CONFIG_Free(config_t* config)
-{
-    if (!config)
-        return;
+                    context->bufferA = j->u.object.values[x].value->u.object.values[i].value->u.array.length;
 
-    if (config->json) {
-        json_value_free(config->json);
-        config->json = 0;
-    }
-    if (config->buffer) {
-        free(config->buffer);
-        config->buffer = 0;
-    }
-    if (config->linedefSpecialsNoTexture) {
-        free(config->linedefSpecialsNoTexture);
-        config->linedefSpecialsNoTexture = 0;
-    }
-    if (config->linedefSpecialsSlope) {
-        free(config->linedefSpecialsSlope);
-        config->linedefSpecialsSlope = 0;
-    }
-    if (config->thingTypesNoAngle) {
-        free(config->thingTypesNoAngle);
-        config->thingTypesNoAngle = 0;
-    }
+                    // Allocate memory for the array
+                    cfg->thingTypesReachableFrom = (uint16_t*)MEMORY_Alloc(context, (context->bufferA + 1) * sizeof(uint16_t));
+                    if (!cfg->thingTypesReachableFrom) {
+                        fprintf(stderr, "%s %s %s the reachable-from Things array", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+                        return 0;
+                    }
 
-    if (config->sectorFieldsSlope) {
-        for (uint16_t x = 0; config->sectorFieldsSlope[x]; x++) {
-            free(config->sectorFieldsSlope[x]);
-            config->sectorFieldsSlope[x] = 0;
-        }
-        free(config->sectorFieldsSlope);
-        config->sectorFieldsSlope = 0;
-    }
+                    // Copy data from JSON
+                    for (uint16_t a = 0; a < context->bufferA; a++) {
+                        cfg->thingTypesReachableFrom[a] = j->u.object.values[x].value->u.object.values[i].value->u.array.values[a]->u.integer;
+                    }
+
+                    cfg->thingTypesReachableFrom[context->bufferA] = 0;
+                }
+
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, "argSchemas") && context->bufferB == json_object) {
+                    // found table of the arguments every Thing type uses
+
+                    if (!CONFIG_ParseArgSchemas(context, cfg, LEVEL_THING, j->u.object.values[x].value->u.object.values[i].value))
+                        return 0;
+                }
+
+                else if (!strcmp(j->u.object.values[x].value->u.object.values[i].name, DEFAULTVALUES_STR) && context->bufferB == json_object) {
+                    // found array containing default field values for Things
+
+                    context->bufferA = j->u.object.values[x].value->u.object.values[i].value->u.object.length;
+                    context->bufferA = (context->bufferA ? context->bufferA : 1);
+
+                    // Allocate memory
+                    cfg->defaultValues[LEVEL_THING] = (field_t*)MEMORY_Alloc(context, (context->bufferA + 1) * sizeof(field_t));
+                    if (!cfg->defaultValues[LEVEL_THING]) {
+                        fprintf(stderr, "%s %s %s the Thing default values list", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+                        return 0;
+                    }
+
+                    // Copy data from JSON
+                    for (uint16_t a = 0; a < context->bufferA; a++) {
+                        cfg->defaultValues[LEVEL_THING][a].key = MEMORY_StrDup(context, j->u.object.values[x].value->u.object.values[i].value->u.object.values[a].name);
+                        cfg->defaultValues[LEVEL_THING][a].value = MEMORY_StrDup(context, j->u.object.values[x].value->u.object.values[i].value->u.object.values[a].value->u.string.ptr);
+                        CONFIG_AddDefaultValue(context, cfg, LEVEL_THING, &cfg->defaultValues[LEVEL_THING][a]); // same form as the parsed values
+                    }
+
+                    cfg->defaultValues[LEVEL_THING][context->bufferA].key = 0;
+                    cfg->defaultValues[LEVEL_THING][context->bufferA].value = 0;
+                }
+            }
+        }
+    }
+
+    return 1;
+}
+
+// Unload game config file
+static void CONFIG_Free(lessudmf_t* context, config_t* cfg)
+{
+    if (!cfg)
+        return;
+
+    if (cfg->json) {
+        json_settings settings = CONFIG_JSONSettings(context);
+        json_value_free_ex(&settings, cfg->json);
+        cfg->json = 0;
+    }
+    if (cfg->buffer) {
+        MEMORY_Free(context, cfg->buffer);
+        cfg->buffer = 0;
+    }
+    if (cfg->linedefSpecialsNoTexture) {
+        MEMORY_Free(context, cfg->linedefSpecialsNoTexture);
+        cfg->linedefSpecialsNoTexture = 0;
+    }
+    if (cfg->linedefSpecialsSlope) {
+        MEMORY_Free(context, cfg->linedefSpecialsSlope);
+        cfg->linedefSpecialsSlope = 0;
+    }
+    if (cfg->thingTypesNoAngle) {
+        MEMORY_Free(context, cfg->thingTypesNoAngle);
+        cfg->thingTypesNoAngle = 0;
+    }
+    if (cfg->thingTypesStackable) {
+        MEMORY_Free(context, cfg->thingTypesStackable);
+        cfg->thingTypesStackable = 0;
+    }
+    if (cfg->thingTypesReachableFrom) {
+        MEMORY_Free(context, cfg->thingTypesReachableFrom);
+        cfg->thingTypesReachableFrom = 0;
+    }
+
+    if (cfg->sectorFieldsSlope) {
+        for (uint16_t x = 0; cfg->sectorFieldsSlope[x]; x++) {
+            MEMORY_Free(context, cfg->sectorFieldsSlope[x]);
+            cfg->sectorFieldsSlope[x] = 0;
+        }
+        MEMORY_Free(context, cfg->sectorFieldsSlope);
+        cfg->sectorFieldsSlope = 0;
+    }
+    if (cfg->sectorFieldsSlopePlanes) {
+        MEMORY_Free(context, cfg->sectorFieldsSlopePlanes);
+        cfg->sectorFieldsSlopePlanes = 0;
+    }
+    if (cfg->linedefSlopeModels) {
+        for (uint16_t x = 0; cfg->linedefSlopeModels[x].special; x++)
+            MEMORY_Free(context, cfg->linedefSlopeModels[x].rules);
+        MEMORY_Free(context, cfg->linedefSlopeModels);
+        cfg->linedefSlopeModels = 0;
+    }
 
     for (uint16_t x = 0; x < 5; x++) {
-        if (!config->defaultValues[x])
+        if (!cfg->defaultValues[x])
             continue;
-        for (uint16_t y = 0; config->defaultValues[x][y].key; y++) {
-            if (config->defaultValues[x][y].key) {
-                free(config->defaultValues[x][y].key);
-                config->defaultValues[x][y].key = 0;
+        for (uint16_t y = 0; cfg->defaultValues[x][y].key; y++) {
+            if (cfg->defaultValues[x][y].key) {
+                MEMORY_Free(context, cfg->defaultValues[x][y].key);
+                cfg->defaultValues[x][y].key = 0;
             }
-            if (config->defaultValues[x][y].value) {
-                free(config->defaultValues[x][y].value);
-                config->defaultValues[x][y].value = 0;
+            if (cfg->defaultValues[x][y].value) {
+                MEMORY_Free(context, cfg->defaultValues[x][y].value);
+                cfg->defaultValues[x][y].value = 0;
             }
         }
-        free(config->defaultValues[x]);
-        config->defaultValues[x] = 0;
+        MEMORY_Free(context, cfg->defaultValues[x]);
+        cfg->defaultValues[x] = 0;
+    }
+
+    for (uint16_t x = 0; x < 5; x++) {
+        if (cfg->textureKeys[x]) {
+            for (uint16_t y = 0; cfg->textureKeys[x][y]; y++)
+                MEMORY_Free(context, cfg->textureKeys[x][y]);
+            MEMORY_Free(context, cfg->textureKeys[x]);
+            cfg->textureKeys[x] = 0;
+        }
+        HASHTABLE_Free(context, &cfg->textureParameters[x]);
+        HASHTABLE_Free(context, &cfg->argSchemas[x]);
     }
+    HASHTABLE_Free(context, &cfg->tagArgs);
+    HASHTABLE_Free(context, &cfg->linedefPortals);
+    for (uint8_t x = 0; x < 5; x++) {
+        HASHTABLE_Free(context, &cfg->fieldTypes[x]);
+        for (uint16_t r = 0; cfg->quantizeRules[x] && cfg->quantizeRules[x][r].key; r++)
+            MEMORY_Free(context, cfg->quantizeRules[x][r].key);
+        MEMORY_Free(context, cfg->quantizeRules[x]);
+        cfg->quantizeRules[x] = 0;
+    }
+    for (uint16_t x = 0; cfg->sectorToleranceKeys && cfg->sectorToleranceKeys[x]; x++)
+        MEMORY_Free(context, cfg->sectorToleranceKeys[x]);
+    MEMORY_Free(context, cfg->sectorToleranceKeys);
+    MEMORY_Free(context, cfg->sectorTolerances);
+    for (uint8_t x = 0; x < 5; x++)
+        TEXTURERULES_Free(context, &cfg->textureRules[x]);
+    cfg->sectorToleranceKeys = 0;
+    cfg->sectorTolerances = 0;
 
-    FLAGS &= ~FLAG_CONFIGLOADED;
+    context->FLAGS &= ~LESSUDMF_FLAG_CONFIGLOADED;
 }
 
 // Given a linedef block, return an array of pointers to the sidedef blocks it references (sidefront and sideback).
 // The returned array is always of size 2 (sidefront, sideback), with NULL for any missing side.
 // The caller does not own the returned array (static buffer).
-static block_t** LINEDEF_GetSidedefs(block_t* linedef, uint8_t* sidesCount)
+static block_t** LINEDEF_GetSidedefs(lessudmf_t* context, block_t* linedef, uint8_t* sidesCount)
 {
     const char* sidefront_str = getFieldValueFromBlock(linedef, SIDEFRONT_STR);
     const char* sideback_str = getFieldValueFromBlock(linedef, SIDEBACK_STR);
@@ -670,12 +2099,12 @@ static block_t** LINEDEF_GetSidedefs(block_t* linedef, uint8_t* sidesCount)
     block_t* ptr_front = NULL;
     block_t* ptr_back = NULL;
     int32_t idx = 0;
-    for (uint32_t i = 0; i < blockCount; i++) {
-        if (!strncmp(blocks[i].header, SIDEDEF_STR, 7)) {
+    for (uint32_t i = 0; i < context->blockCount; i++) {
+        if (!strncmp(context->blocks[i].header, SIDEDEF_STR, 7)) {
             if (idx == sidefront && sidefront >= 0)
-                ptr_front = &blocks[i];
+                ptr_front = &context->blocks[i];
             if (idx == sideback && sideback >= 0)
-                ptr_back = &blocks[i];
+                ptr_back = &context->blocks[i];
             idx++;
             if (ptr_front && ptr_back)
                 break;
@@ -683,238 +2112,441 @@ static block_t** LINEDEF_GetSidedefs(block_t* linedef, uint8_t* sidesCount)
     }
 
     // Build a compact array of valid pointers to return
-    block_t** sidedefs = NULL;
+    block_t** sides = NULL;
     uint8_t count = 0;
     if (ptr_front) {
-        sidedefs = (block_t**)malloc(sizeof(block_t*) * (count + 1));
-        sidedefs[count++] = ptr_front;
+        sides = (block_t**)MEMORY_Alloc(context, sizeof(block_t*) * (count + 1));
+        if (!sides) {
+            fprintf(stderr, "%s %s %s the %ss array for a linedef block\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, SIDEDEF_STR);
+            CONTEXT_Fail(context);
+        }
+        sides[count++] = ptr_front;
     }
     if (ptr_back && ptr_back != ptr_front) {
-        sidedefs = (block_t**)realloc(sidedefs, sizeof(block_t*) * (count + 1));
-        if (!sidedefs) {
-            free(sidedefs);
-            sidedefs = 0;
+        sides = (block_t**)MEMORY_Realloc(context, sides, sizeof(block_t*) * (count + 1));
+        if (!sides) {
+            MEMORY_Free(context, sides);
+            sides = 0;
             fprintf(stderr, "%s %s re%s the %ss array for a linedef block\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, SIDEDEF_STR);
-            exit(1);
+            CONTEXT_Fail(context);
         }
-        sidedefs[count++] = ptr_back;
+        sides[count++] = ptr_back;
     }
 
     *sidesCount = count;
-    return sidedefs;
-}
-
-// Collect unique vertex blocks that form the polygon boundary of the given sector.
-// Returns a dynamically allocated array of block_t* (unique, order of discovery) and sets outCount.
-// Caller must free the returned array (but not the block_t pointers themselves).
-static block_t** SECTOR_GetPolygonVertices(uint32_t sectorIndex, uint32_t* outCount)
-{
-    *outCount = 0;
-
-    // First pass: collect sidedef indices belonging to this sector
-    bufferA = 0; // side Idx
-    bufferB = 0; // sidedef count
-    int32_t* sidedefIndices = 0;
-    for (uint32_t i = 0; i < blockCount; i++) {
-        if (!strncmp(blocks[i].header, SIDEDEF_STR, 7)) {
-            const char* sec = getFieldValueFromBlock(&blocks[i], SECTOR_STR);
-            if (sec) {
-                uint32_t sval = strtol(sec, 0, 10);
-                if (sval == sectorIndex) {
-                    sidedefIndices = (int32_t*)realloc(sidedefIndices, (bufferB + 1) * sizeof(int32_t));
-                    if (!sidedefIndices) {
-                        free(sidedefIndices);
-                        fprintf(stderr, "%s %s re%s the %s indices array in SECTOR_GetPolygonVertices\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, SIDEDEF_STR);
-                        exit(1);
-                    }
-                    sidedefIndices[bufferB++] = bufferA;
-                }
-            }
-            bufferA++;
+    return sides;
+}
+
+static int SECTORVERTEX_Compare(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Find the sectors which are made of exactly 3 vertices (polygon slopes can be made in them).
+// Returns an array of 3 vertex indices per sector, -1 for sectors which are not triangles. The caller has to free it.
+static int32_t* SECTOR_GetTriangles(lessudmf_t* context)
+{
+    int32_t* triangles = (int32_t*)MEMORY_Alloc(context, (context->sectorCount ? context->sectorCount : 1) * 3 * sizeof(int32_t));
+    uint64_t* pairs = (uint64_t*)MEMORY_Alloc(context, (context->linedefCount ? context->linedefCount : 1) * 4 * sizeof(uint64_t));
+    if (!(triangles && pairs)) {
+        fprintf(stderr, "%s %s %s the %s triangles\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, SECTOR_STR);
+        CONTEXT_Fail(context);
+    }
+    memset(triangles, 0xFF, (context->sectorCount ? context->sectorCount : 1) * 3 * sizeof(int32_t));
+
+    // Every (sector, vertex) pair of the linedef sides, sorted so the vertices of a sector are next to each other
+    uint32_t pairsCount = 0;
+    for (uint32_t line = 0; line < context->linedefCount; line++) {
+        const linedef_t* linedef = &context->linedefs[line];
+        const sidedef_t* sides[2] = { linedef->sidefront, linedef->sideback };
+        if (!(linedef->v1 && linedef->v2))
+            continue;
+        for (uint8_t side = 0; side < 2; side++) {
+            if (!sides[side] || !sides[side]->sector)
+                continue;
+            uint64_t sector = (uint64_t)(sides[side]->sector - context->sectors) << 32;
+            pairs[pairsCount++] = sector | (uint32_t)(linedef->v1 - context->vertices);
+            pairs[pairsCount++] = sector | (uint32_t)(linedef->v2 - context->vertices);
         }
     }
-    if (!bufferB) { // found no sidedefs
-        free(sidedefIndices);
-        return 0;
+    qsort(pairs, pairsCount, sizeof(uint64_t), SECTORVERTEX_Compare);
+
+    for (uint32_t start = 0; start < pairsCount;) {
+        uint32_t sector = (uint32_t)(pairs[start] >> 32);
+        int32_t found[3];
+        uint32_t unique = 0;
+        uint32_t end = start;
+        for (; end < pairsCount && (uint32_t)(pairs[end] >> 32) == sector; end++) {
+            if (end != start && pairs[end] == pairs[end - 1])
+                continue;
+            if (unique < 3)
+                found[unique] = (int32_t)(pairs[end] & UINT32_MAX);
+            unique++;
+        }
+        if (unique == 3)
+            memcpy(&triangles[sector * 3], found, sizeof(found));
+        start = end;
     }
 
-    // Build vertex list (ordered by occurrence) to index into
-    bufferA = 0; // total vertices
-    for (uint32_t i = 0; i < blockCount; i++)
-        if (!strncmp(blocks[i].header, VERTEX_STR, 6))
-            bufferA++;
-    if (!bufferA) { //
-        free(sidedefIndices);
-        return 0;
+    MEMORY_Free(context, pairs);
+    return triangles;
+}
+
+// Get the integer value of the argument of the linedef, 0 if it is not set
+static int32_t LINEDEF_GetArg(const block_t* linedef, uint8_t arg)
+{
+    char key[8];
+    snprintf(key, sizeof(key), "arg%u", arg);
+    const char* value = getFieldValueFromBlock(linedef, key);
+    return (int32_t)strtol(value ? value : "0", 0, 10);
+}
+
+// Get the planes (SLOPE_* bits of both sides) the slope linedef special makes sloped
+static uint8_t LINEDEF_GetSlopedPlanes(lessudmf_t* context, const block_t* linedef, uint16_t special)
+{
+    const slopemodel_t* model = 0;
+    for (uint16_t m = 0; context->config.linedefSlopeModels && context->config.linedefSlopeModels[m].special; m++) {
+        if (context->config.linedefSlopeModels[m].special == special) {
+            model = &context->config.linedefSlopeModels[m];
+            break;
+        }
+    }
+    if (!model) // not described, any plane of both sectors may be sloped
+        return SLOPE_FLOOR | SLOPE_CEILING | SLOPE_BACKFLOOR | SLOPE_BACKCEILING;
+
+    uint8_t planes = 0;
+    for (uint16_t r = 0; r < model->rulesCount; r++) {
+        const sloperule_t* rule = &model->rules[r];
+        int32_t arg = LINEDEF_GetArg(linedef, rule->arg);
+        if (rule->ifMask && !(LINEDEF_GetArg(linedef, rule->ifArg) & rule->ifMask))
+            continue;
+
+        if (rule->type == SLOPERULE_ALWAYS || (rule->type == SLOPERULE_EQUAL && arg == rule->value) || (rule->type == SLOPERULE_NONZERO && arg) || (rule->type == SLOPERULE_MASK && (arg & rule->value)))
+            planes |= rule->planes;
     }
+    return planes;
+}
 
-    block_t** vertexList = (block_t**)malloc(bufferA * sizeof(block_t*));
-    uint32_t vi = 0;
-    for (uint32_t i = 0; i < blockCount; i++)
-        if (!strncmp(blocks[i].header, VERTEX_STR, 6))
-            vertexList[vi++] = &blocks[i];
+// Find the sloped planes of all the sectors by checking for slope-related fields in the sectors,
+// slope linedef specials (only the planes they actually slope) and vertex heights of triangular sectors.
+static void MAP_FindSlopes(lessudmf_t* context)
+{
+    for (uint32_t s = 0; s < context->sectorCount; s++) {
+        context->sectors[s].isSlope = 0;
+        for (uint16_t x = 0; context->config.sectorFieldsSlope && context->config.sectorFieldsSlope[x]; x++) {
+            if (BOOL_BlockHasField(context->sectors[s].block, context->config.sectorFieldsSlope[x]))
+                context->sectors[s].isSlope |= context->config.sectorFieldsSlopePlanes[x];
+        }
+    }
 
-    // Second pass: for every linedef, if it references any of the sidedefIndices, collect its v1/v2
-    block_t** found = 0;
-    uint32_t foundCount = 0;
-    for (uint32_t i = 0; i < blockCount; i++) {
-        if (!strncmp(blocks[i].header, LINEDEF_STR, 7)) {
-            // check fields for sidefront/sideback
-            char referencesSector = 0;
-            for (uint16_t p = 0; p < blocks[i].fieldsCount; ++p) {
-                if (!strncmp(blocks[i].fields[p].key, SIDEFRONT_STR, 9) || !strncmp(blocks[i].fields[p].key, SIDEBACK_STR, 8)) {
-                    int32_t iv = strtol(blocks[i].fields[p].value, 0, 10);
-                    if (iv >= 0) {
-                        for (uint32_t m = 0; m < bufferB; m++) {
-                            if (iv == sidedefIndices[m]) {
-                                referencesSector = 1;
-                                break;
-                            }
-                        }
-                    }
-                    if (referencesSector)
-                        break;
-                }
-            }
-            if (!referencesSector)
+    // Linedefs with slope specials
+    for (uint32_t line = 0; line < context->linedefCount && context->config.linedefSpecialsSlope; line++) {
+        const linedef_t* linedef = &context->linedefs[line];
+        const char* specs = getFieldValueFromBlock(linedef->block, SPECIAL_STR);
+        uint16_t special = (uint16_t)strtol(specs ? specs : "0", 0, 10);
+        if (!special)
+            continue;
+
+        for (uint16_t s = 0; context->config.linedefSpecialsSlope[s]; s++) {
+            if (special != context->config.linedefSpecialsSlope[s])
                 continue;
+            uint8_t planes = LINEDEF_GetSlopedPlanes(context, linedef->block, special);
+            if (linedef->sidefront && linedef->sidefront->sector)
+                linedef->sidefront->sector->isSlope |= planes & (SLOPE_FLOOR | SLOPE_CEILING);
+            if (linedef->sideback && linedef->sideback->sector)
+                linedef->sideback->sector->isSlope |= planes >> 2;
+            break;
+        }
+    }
 
-            // get v1 and v2 fields
-            const char* verts[2] = { getFieldValueFromBlock(&blocks[i], "v1"), getFieldValueFromBlock(&blocks[i], "v2") };
-            for (int viidx = 0; viidx < 2; viidx++) {
-                const char* vs = verts[viidx];
-                if (!vs || !*vs)
-                    continue;
-                uint32_t idx = strtol(vs, 0, 10);
-                if (idx < bufferA) {
-                    // avoid duplicates
-                    char already = 0;
-                    for (uint32_t f = 0; f < foundCount; f++)
-                        if (found[f] == vertexList[idx]) {
-                            already = 1;
-                            break;
-                        }
-                    if (!already) {
-                        found = (block_t**)realloc(found, (foundCount + 1) * sizeof(block_t*));
-                        if (!found) {
-                            free(found);
-                            fprintf(stderr, "%s %s re%s the found %s array in SECTOR_GetPolygonVertices\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, VERTEX_STR);
-                            exit(1);
-                        }
-                        found[foundCount++] = vertexList[idx];
-                    }
-                }
+    if (context->config.flags & CFGFLAG_POLYGONSLOPE) {
+        // Polygon slopes: the vertex heights are only used in sectors with exactly 3 vertices
+        int32_t* triangles = SECTOR_GetTriangles(context);
+        for (uint32_t s = 0; s < context->sectorCount; s++) {
+            for (uint8_t v = 0; v < 3 && triangles[s * 3] >= 0; v++) {
+                const block_t* vertex = context->vertices[triangles[s * 3 + v]].block;
+                if (BOOL_BlockHasField(vertex, ZFLOOR_STR))
+                    context->sectors[s].isSlope |= SLOPE_FLOOR;
+                if (BOOL_BlockHasField(vertex, ZCEILING_STR))
+                    context->sectors[s].isSlope |= SLOPE_CEILING;
             }
         }
+        MEMORY_Free(context, triangles);
+    }
+}
+
+// Remove the vertex heights (zfloor/zceiling) from the vertices which are not a part of any triangular sector,
+// the game only uses them to make polygon slopes in sectors with exactly 3 vertices
+static void MAP_RemoveUnusedVertexHeights(lessudmf_t* context)
+{
+    CONTEXT_Print(context, "Removing vertex heights outside of triangular sectors... ");
+
+    uint8_t* used = (uint8_t*)MEMORY_Calloc(context, context->vertexCount ? context->vertexCount : 1, 1);
+    if (!used) {
+        fprintf(stderr, "%s %s %s the used %s list\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, VERTEX_STR);
+        CONTEXT_Fail(context);
+    }
+    int32_t* triangles = SECTOR_GetTriangles(context);
+    for (uint32_t t = 0; t < context->sectorCount * 3; t++) {
+        if (triangles[t] >= 0)
+            used[triangles[t]] = 1;
     }
+    MEMORY_Free(context, triangles);
 
-    free(sidedefIndices);
-    free(vertexList);
-    *outCount = foundCount;
-    return found;
+    context->bufferA = 0;
+    for (uint32_t v = 0; v < context->vertexCount; v++) {
+        if (used[v])
+            continue;
+        if (BOOL_BlockHasField(context->vertices[v].block, ZFLOOR_STR) || BOOL_BlockHasField(context->vertices[v].block, ZCEILING_STR))
+            context->bufferA++;
+        removeField(context, context->vertices[v].block, ZFLOOR_STR);
+        removeField(context, context->vertices[v].block, ZCEILING_STR);
+    }
+
+    MEMORY_Free(context, used);
+    CONTEXT_Print(context, "%s (%u vertices)\n", DONE_STR, context->bufferA);
 }
 
-// Determine whether a sector is likely a sloped sector by checking for slope-related fields
-// in the sector itself, related linedefs and vertices.
-static char BOOL_IsSectorSloped(sector_t* sector)
+// Get the sloped planes (SLOPE_FLOOR/SLOPE_CEILING bits) of the sector, the slopes of all sectors are found on the first call
+static uint8_t SECTOR_GetSlopedPlanes(lessudmf_t* context, sector_t* sector)
 {
     if (!sector || !sector->block)
         return 0;
+    if (sector->isSlope < 0)
+        MAP_FindSlopes(context);
+    return (uint8_t)sector->isSlope;
+}
 
-    const block_t* sectorBlk = sector->block;
+// Check if any plane of the sector is sloped
+static char BOOL_IsSectorSloped(lessudmf_t* context, sector_t* sector)
+{
+    return SECTOR_GetSlopedPlanes(context, sector) != 0;
+}
 
-    if (config.sectorFieldsSlope) {
-        for (uint16_t x = 0; config.sectorFieldsSlope[x]; x++) {
-            if (BOOL_BlockHasField(sectorBlk, config.sectorFieldsSlope[x])) {
-                sector->isSlope = 1;
-                return 1;
-            }
+// Default values of the base UDMF fields, used when the game config does not have them
+static const struct {
+    uint8_t levelElement;
+    const char* key;
+    const char* value;
+} udmfDefaults[] = {
+    { LEVEL_SECTOR, "heightfloor", "0" },
+    { LEVEL_SECTOR, "heightceiling", "0" },
+    { LEVEL_SECTOR, "lightlevel", "160" },
+    { 0, 0, 0 }
+};
+
+// Value of the field in the block, or its default value from the game config if the block does not have it
+static const char* BLOCK_GetValueOrDefault(lessudmf_t* context, const block_t* blk, uint8_t levelElement, const char* key)
+{
+    const char* value = getFieldValueFromBlock(blk, key);
+    for (uint16_t x = 0; !value && (context->FLAGS & LESSUDMF_FLAG_CONFIGLOADED) && context->config.defaultValues[levelElement] && context->config.defaultValues[levelElement][x].key; x++) {
+        if (!strcmp(context->config.defaultValues[levelElement][x].key, key))
+            value = context->config.defaultValues[levelElement][x].value;
+    }
+    for (uint8_t x = 0; !value && udmfDefaults[x].key; x++) {
+        if (udmfDefaults[x].levelElement == levelElement && !strcmp(udmfDefaults[x].key, key))
+            value = udmfDefaults[x].value;
+    }
+    return value;
+}
+
+//
+// TEXTURE RULES
+//
+
+// Texture rules used when the game config does not have its own, same as the "textureRules" of the config files
+static const char builtinTextureRules[] = "{"
+    "\"linedef\":["
+        "{\"remove\":[\"texturetop\",\"texturebottom\"],\"if\":[[\"twosided\",\"==\",0]]},"
+        "{\"remove\":[\"*\"],\"if\":[[\"twosided\",\"==\",0],[\"floor\",\">=\",\"ceiling\"],[\"sloped\",\"==\",0]]},"
+        "{\"remove\":[\"texturetop\"],\"if\":[[\"ceiling\",\"<=\",\"otherceiling\"],[\"slopedceiling\",\"==\",0]]},"
+        "{\"remove\":[\"texturebottom\"],\"if\":[[\"floor\",\">=\",\"otherfloor\"],[\"slopedfloor\",\"==\",0]]},"
+        "{\"remove\":[\"texturemiddle\"],\"if\":[[\"twosided\",\"==\",1],[\"floor\",\">=\",\"ceiling\"],[\"sloped\",\"==\",0]]},"
+        "{\"remove\":[\"texturemiddle\"],\"if\":[[\"floor\",\">=\",\"otherceiling\"],[\"sloped\",\"==\",0]]}"
+    "],"
+    "\"sector\":["
+        "{\"remove\":[\"texturefloor\",\"textureceiling\"],\"if\":[[\"sloped\",\"==\",0],[\"floorflat\",\"!=\",\"F_SKY1\"],[\"ceilingflat\",\"!=\",\"F_SKY1\"],[\"floor\",\">=\",\"ceiling\"]]}"
+    "]"
+"}";
+
+// Get the texture rules of the level element: from the game config, or the built-in ones
+static const texturerule_t* TEXTURERULES_Get(lessudmf_t* context, uint8_t levelElement)
+{
+    if ((context->FLAGS & LESSUDMF_FLAG_CONFIGLOADED) && context->config.textureRules[levelElement])
+        return context->config.textureRules[levelElement];
+
+    if (!context->builtinRules[LEVEL_LINEDEF]) {
+        json_settings settings = CONFIG_JSONSettings(context);
+        json_value* j = json_parse_ex(&settings, builtinTextureRules, sizeof(builtinTextureRules) - 1, 0);
+        for (uint32_t x = 0; j && x < j->u.object.length; x++) {
+            if (!strcmp(j->u.object.values[x].name, LINEDEF_STR))
+                context->builtinRules[LEVEL_LINEDEF] = CONFIG_ParseTextureRules(context, j->u.object.values[x].value);
+            else if (!strcmp(j->u.object.values[x].name, SECTOR_STR))
+                context->builtinRules[LEVEL_SECTOR] = CONFIG_ParseTextureRules(context, j->u.object.values[x].value);
         }
+        json_value_free_ex(&settings, j);
+    }
+    return context->builtinRules[levelElement];
+}
+
+// Level elements a rule is checked for
+typedef struct {
+    const block_t* linedef;
+    const block_t* side;
+    const block_t* sector;
+    const block_t* othersector; // 0 for one-sided linedefs and sector rules
+    uint8_t slopes; // SLOPE_* planes sloped in the sectors
+} rulecontext_t;
+
+// Get the value of the operand as a string (without quotes) and, if it is numeric, as a number.
+// Returns 0 if the element the operand refers to does not exist.
+static uint8_t TEXTURERULE_GetOperand(lessudmf_t* context, const ruleoperand_t* operand, const rulecontext_t* ruleContext, char* str, size_t size, double* number, uint8_t* isNumber)
+{
+    const block_t* blk = 0;
+    uint8_t levelElement = LEVEL_SECTOR;
+    *isNumber = 0;
+    switch (operand->type) {
+    case RULEOPERAND_NUMBER:
+        *number = operand->number;
+        *isNumber = 1;
+        snprintf(str, size, "%g", operand->number);
+        return 1;
+    case RULEOPERAND_STRING:
+        snprintf(str, size, "%s", operand->string);
+        break;
+    case RULEOPERAND_SLOPED:
+        *number = (ruleContext->slopes & (uint8_t)operand->number) ? 1 : 0;
+        *isNumber = 1;
+        snprintf(str, size, "%g", *number);
+        return 1;
+    case RULEOPERAND_TWOSIDED:
+        *number = ruleContext->othersector ? 1 : 0;
+        *isNumber = 1;
+        snprintf(str, size, "%g", *number);
+        return 1;
+    case RULEOPERAND_LINEDEF:
+        blk = ruleContext->linedef;
+        levelElement = LEVEL_LINEDEF;
+        break;
+    case RULEOPERAND_SIDE:
+        blk = ruleContext->side;
+        levelElement = LEVEL_SIDEDEF;
+        break;
+    case RULEOPERAND_SECTOR:
+        blk = ruleContext->sector;
+        break;
+    case RULEOPERAND_OTHERSECTOR:
+        blk = ruleContext->othersector;
+        break;
     }
 
-    // Inspect linedefs that reference this sector through either front or back sidedefs.
-    for (uint32_t i = 0; i < linedefCount; i++) {
-        const linedef_t* linedef = &linedefs[i];
-        const sidedef_t* sides[2] = { linedef->sidefront, linedef->sideback };
+    if (operand->type != RULEOPERAND_STRING) {
+        if (!blk)
+            return 0;
+        // Missing fields with no default value are empty strings
+        const char* value = BLOCK_GetValueOrDefault(context, blk, levelElement, operand->string);
+        if (!value)
+            value = "";
+        size_t length = strlen(value);
+        if (length >= 2 && value[0] == '"' && value[length - 1] == '"')
+            snprintf(str, size, "%.*s", (int)(length - 2), value + 1);
+        else
+            snprintf(str, size, "%s", value);
+    }
 
-        for (uint8_t side = 0; side < 2; side++) {
-            const sidedef_t* currentSide = sides[side];
-            if (!currentSide || !currentSide->sector || currentSide->sector != sector)
-                continue;
+    char* end;
+    *number = strtod(str, &end);
+    *isNumber = (end != str && !*end);
+    return 1;
+}
 
-            if (config.linedefSpecialsSlope) {
-                const char* specs = getFieldValueFromBlock(linedef->block, SPECIAL_STR);
-                bufferB = strtol(specs ? specs : "0", 0, 10); // Linedef special number
-
-                for (uint16_t s = 0; config.linedefSpecialsSlope[s]; s++) {
-                    if (bufferB == config.linedefSpecialsSlope[s]) {
-                        // Preferably we also need to check what side is sloped and whether floor/ceiling or both are sloped
-                        // This would do a significant optimization for the maps
-                        // Not doing this here because each game, let alone each line, defines the slope differently
-                        // That's too much headache for me, perhaps some other time
-                        sector->isSlope = 1;
-                        return 1;
-                    }
-                }
-            }
+// Check the condition, numbers are compared by value and strings can only be equal or not equal
+static uint8_t TEXTURERULE_CheckCondition(lessudmf_t* context, const rulecondition_t* condition, const rulecontext_t* ruleContext)
+{
+    char strA[256], strB[256];
+    double numberA, numberB;
+    uint8_t isNumberA, isNumberB;
+
+    if (!TEXTURERULE_GetOperand(context, &condition->a, ruleContext, strA, sizeof(strA), &numberA, &isNumberA))
+        return 0;
+    if (!TEXTURERULE_GetOperand(context, &condition->b, ruleContext, strB, sizeof(strB), &numberB, &isNumberB))
+        return 0;
+
+    if (isNumberA && isNumberB) {
+        switch (condition->op) {
+        case RULEOP_EQUAL:
+            return numberA == numberB;
+        case RULEOP_NOTEQUAL:
+            return numberA != numberB;
+        case RULEOP_LESS:
+            return numberA < numberB;
+        case RULEOP_LESSEQUAL:
+            return numberA <= numberB;
+        case RULEOP_GREATER:
+            return numberA > numberB;
+        case RULEOP_GREATEREQUAL:
+            return numberA >= numberB;
         }
+        return 0;
     }
+    if (condition->op == RULEOP_EQUAL)
+        return !strcmp(strA, strB);
+    if (condition->op == RULEOP_NOTEQUAL)
+        return strcmp(strA, strB) != 0;
+    return 0;
+}
 
-    if (gameEngine == ENGINE_SRB2) {
-        // Polygon-only vertex check: collect unique polygon vertices for the sector and inspect them.
-        // Rule: mark as sloped if ANY vertex has a z-value (zfloor or zceiling).
-        bufferA = 0; // polyVertexCount
-        block_t** polyVertices = SECTOR_GetPolygonVertices((uint32_t)(sector - sectors), &bufferA);
-
-        if (polyVertices && (bufferA == 3)) { // Polysector needs to have exacly 3 vertices
-            char hasZvalue = 0;
+// Remove the fields of every rule whose conditions are all true from the block
+static void TEXTURERULES_Apply(lessudmf_t* context, const texturerule_t* rules, const rulecontext_t* ruleContext, block_t* blk)
+{
+    for (uint16_t r = 0; rules[r].remove; r++) {
+        uint16_t c = 0;
+        while (c < rules[r].conditionsCount && TEXTURERULE_CheckCondition(context, &rules[r].conditions[c], ruleContext))
+            c++;
+        if (c < rules[r].conditionsCount)
+            continue;
 
-            for (uint8_t pv = 0; pv < bufferA; pv++) {
-                const char* z_floor_str = getFieldValueFromBlock(polyVertices[pv], ZFLOOR_STR);
-                const char* z_ceil_str = getFieldValueFromBlock(polyVertices[pv], ZCEILING_STR);
-                if (z_floor_str || z_ceil_str) {
-                    hasZvalue = 1;
-                    break;
-                }
+        for (uint16_t x = 0; rules[r].remove[x]; x++) {
+            if (strcmp(rules[r].remove[x], "*")) {
+                removeField(context, blk, rules[r].remove[x]);
+                continue;
             }
-
-            if (hasZvalue) {
-                free(polyVertices);
-                sector->isSlope = 1;
-                return 1;
+            // Everything except the sector index of the sidedef
+            uint8_t y = 0;
+            while (y < blk->fieldsCount) {
+                if (!strcmp(blk->fields[y].key, SECTOR_STR) && BLOCK_GetLevelElement(blk) == LEVEL_SIDEDEF)
+                    y++;
+                else
+                    removeField(context, blk, blk->fields[y].key);
             }
         }
-
-        free(polyVertices);
     }
-
-    sector->isSlope = 0;
-    return 0;
 }
 
-static void MAP_RemoveControlLineTextures()
+static void MAP_RemoveControlLineTextures(lessudmf_t* context)
 {
-    printf("Removing textures on control linedefs that do not require them... ");
+    CONTEXT_Print(context, "Removing textures on control linedefs that do not require them... ");
 
     block_t* b;
 
-    for (uint32_t x = 0; x < blockCount; x++) {
-        b = &blocks[x];
+    for (uint32_t x = 0; x < context->blockCount; x++) {
+        b = &context->blocks[x];
 
         if (!strncmp(b->header, LINEDEF_STR, 7)) {
             for (uint8_t i = 0; i < b->fieldsCount; i++) {
                 if (!strncmp(b->fields[i].key, SPECIAL_STR, 7)) {
-                    for (uint16_t a = 0; config.linedefSpecialsNoTexture[a]; a++) {
-                        if (strtol(b->fields[i].value, 0, 10) == config.linedefSpecialsNoTexture[a]) {
+                    for (uint16_t a = 0; context->config.linedefSpecialsNoTexture[a]; a++) {
+                        if (strtol(b->fields[i].value, 0, 10) == context->config.linedefSpecialsNoTexture[a]) {
                             uint8_t numSides;
-                            block_t** sidedefs = LINEDEF_GetSidedefs(b, &numSides);
+                            block_t** lineSides = LINEDEF_GetSidedefs(context, b, &numSides);
                             for (uint8_t side = 0; side < numSides; side++) {
-                                removeField(sidedefs[side], TEXTURETOP_STR);
-                                removeField(sidedefs[side], TEXTUREMIDDLE_STR);
-                                removeField(sidedefs[side], TEXTUREBOTTOM_STR);
+                                removeField(context, lineSides[side], TEXTURETOP_STR);
+                                removeField(context, lineSides[side], TEXTUREMIDDLE_STR);
+                                removeField(context, lineSides[side], TEXTUREBOTTOM_STR);
                             }
-                            free(sidedefs);
-                            sidedefs = 0;
+                            MEMORY_Free(context, lineSides);
+                            lineSides = 0;
                             break;
                         }
                     }
@@ -922,141 +2554,104 @@ static void MAP_RemoveControlLineTextures()
             }
         }
     }
-    puts(DONE_STR);
+    CONTEXT_Print(context, "%s\n", DONE_STR);
 }
 
-static void MAP_RemoveUnseenWallTextures()
+// Remove the wall textures hidden by the sector heights, as described by the linedef texture rules
+static void MAP_RemoveUnseenWallTextures(lessudmf_t* context)
 {
-    printf("Removing hidden/not-visible textures from walls... ");
-
-    linedef_t* linedef;
-    sidedef_t* sidefront;
-    sidedef_t* sideback;
-    sector_t* frontsec;
-    sector_t* backsec;
-
-    for (uint32_t line = 0; line < linedefCount; line++) {
-        linedef = &linedefs[line];
+    CONTEXT_Print(context, "Removing hidden/not-visible textures from walls... ");
 
-        // Read frontside
-        sidefront = linedef->sidefront;
-        if (!sidefront || !sidefront->sector) {
+    const texturerule_t* rules = TEXTURERULES_Get(context, LEVEL_LINEDEF);
+    for (uint32_t line = 0; line < context->linedefCount && rules; line++) {
+        linedef_t* linedef = &context->linedefs[line];
+        if (!linedef->sidefront || !linedef->sidefront->sector)
             continue;
+        sector_t* frontsec = linedef->sidefront->sector;
+        sector_t* backsec = (linedef->sideback && linedef->sideback->sector) ? linedef->sideback->sector : 0;
+
+        // Heights of sloped planes can not be compared, the rules see the sloped planes of both sectors
+        rulecontext_t ruleContext = { linedef->block, 0, 0, 0, SECTOR_GetSlopedPlanes(context, frontsec) | (backsec ? SECTOR_GetSlopedPlanes(context, backsec) : 0) };
+
+        for (uint8_t side = 0; side < (backsec ? 2 : 1); side++) {
+            block_t* blk = side ? linedef->sideback->block : linedef->sidefront->block;
+            ruleContext.side = blk;
+            ruleContext.sector = side ? backsec->block : frontsec->block;
+            ruleContext.othersector = backsec ? (side ? frontsec->block : backsec->block) : 0;
+            TEXTURERULES_Apply(context, rules, &ruleContext, blk);
         }
-        frontsec = sidefront->sector;
-
-        // Read backside
-        sideback = linedef->sideback;
-        if (sideback && sideback->sector) {
-            backsec = sideback->sector;
-        } else {
-            backsec = 0;
-        }
-
-        if (BOOL_IsSectorSloped(frontsec) || (backsec && BOOL_IsSectorSloped(backsec)))
-            continue;
-
-        // read sector heights
-        const char* floor_front = getFieldValueFromBlock(frontsec->block, FLOORHEIGHT_STR);
-        const char* ceil_front = getFieldValueFromBlock(frontsec->block, CEILINGHEIGHT_STR);
-        const char* floor_back = backsec ? getFieldValueFromBlock(backsec->block, FLOORHEIGHT_STR) : 0;
-        const char* ceil_back = backsec ? getFieldValueFromBlock(backsec->block, CEILINGHEIGHT_STR) : 0;
-
-        if (!(floor_front && ceil_front))
-            continue;
-        int32_t ff = (int32_t)strtol(floor_front, 0, 10); // floor front
-        int32_t cf = (int32_t)strtol(ceil_front, 0, 10); // ceiling front
-
-        if (!backsec) {
-            // onesided: remove upper & lower textures
-            removeField(sidefront->block, TEXTURETOP_STR);
-            removeField(sidefront->block, TEXTUREBOTTOM_STR);
+    }
 
-            // if floor height >= ceiling height, remove all sidedef fields
-            if (ff >= cf) {
-                // In my perfect scenario, if all textures are getting removed, all texture parameters should be removed as well.
-                // Doing exactly that.
-                for (uint8_t key_index = 0; key_index < sidefront->block->fieldsCount; key_index++) {
-                    if (!strcmp(sidefront->block->fields[key_index].key, SECTOR_STR))
-                        continue; // do not remove the sector field
-                    removeField(sidefront->block, sidefront->block->fields[key_index].key);
-                }
-            }
-        } else {
-            // twosided: only proceed if we have both floor/ceil strings for the back sector
-            if (!(floor_back && ceil_back))
-                continue;
-            int32_t fb = (int32_t)strtol(floor_back, 0, 10); // floor back
-            int32_t cb = (int32_t)strtol(ceil_back, 0, 10); // ceiling back
+    CONTEXT_Print(context, "%s\n", DONE_STR);
+}
 
-            block_t* sides[2] = { sidefront->block, sideback->block };
 
-            // Remove upper textures when the sector on that side has a ceiling that is
-            // lower than or equal to the other sector's ceiling.
-            if (cf <= cb)
-                removeField(sides[0], TEXTURETOP_STR);
-            if (cb <= cf)
-                removeField(sides[1], TEXTURETOP_STR);
+static void TEXTMAP_BuildReferences(lessudmf_t* context);
 
-            // Remove lower textures when the sector on that side has a floor that is
-            // higher than or equal to the other sector's floor.
-            if (ff >= fb)
-                removeField(sides[0], TEXTUREBOTTOM_STR);
-            if (fb >= ff)
-                removeField(sides[1], TEXTUREBOTTOM_STR);
+// Compare two sectors, the fields with merge tolerances (config "mergeTolerances") can differ by the tolerance
+static char BOOL_AreSectorsSimilar(lessudmf_t* context, const block_t* a, const block_t* b)
+{
+    if (!BOOL_AreBlocksEqualIgnoring(context, a, b, (const char**)context->config.sectorToleranceKeys))
+        return 0;
 
-            // Remove middle textures if the sector floor is at or above either ceiling.
-            if ((ff >= cf) || (ff >= cb))
-                removeField(sides[0], TEXTUREMIDDLE_STR);
-            if ((fb >= cb) || (fb >= cf))
-                removeField(sides[1], TEXTUREMIDDLE_STR);
+    for (uint16_t x = 0; context->config.sectorToleranceKeys[x]; x++) {
+        const char* valueA = BLOCK_GetValueOrDefault(context, a, LEVEL_SECTOR, context->config.sectorToleranceKeys[x]);
+        const char* valueB = BLOCK_GetValueOrDefault(context, b, LEVEL_SECTOR, context->config.sectorToleranceKeys[x]);
+        if (!valueA || !valueB) {
+            if (valueA != valueB)
+                return 0;
+            continue;
         }
-    }
 
-    puts(DONE_STR);
+        char *endA, *endB;
+        double numberA = strtod(valueA, &endA), numberB = strtod(valueB, &endB);
+        if (endA == valueA || *endA || endB == valueB || *endB) {
+            if (strcmp(valueA, valueB))
+                return 0; // not numbers, have to be equal
+        } else if (fabs(numberA - numberB) > context->config.sectorTolerances[x])
+            return 0;
+    }
+    return 1;
 }
 
-
-static void TEXTMAP_BuildReferences(void);
-
-static void MAP_MergeSectors()
+static void MAP_MergeSectors(lessudmf_t* context)
 {
-    printf("Merging the identical sectors... ");
+    uint8_t similar = (context->FLAGS & LESSUDMF_FLAG_MERGESIMILAR) && context->config.sectorToleranceKeys;
+    CONTEXT_Print(context, "Merging the %s sectors... ", similar ? "similar" : "identical");
 
-    uint32_t sectorCount_old = sectorCount;
+    uint32_t sectorCount_old = context->sectorCount;
 
     // Mark all sectors as unvisited by the program
-    for (uint32_t i = 0; i < sectorCount; i++)
-        sectors[i].isMaster = -1;
+    for (uint32_t i = 0; i < context->sectorCount; i++)
+        context->sectors[i].isMaster = -1;
 
-    // Precompute slope flags for all sectors so we don't merge sloped sectors
-    for (uint32_t si = 0; si < sectorCount; si++)
-        sectors[si].isSlope = 0;
-    for (uint32_t si = 0; si < sectorCount; si++)
-        sectors[si].isSlope = BOOL_IsSectorSloped(&sectors[si]);
+    // Find the sloped sectors so we don't merge them
+    MAP_FindSlopes(context);
 
     // Find identical sectors and mark them
     uint32_t uniqueSectorID = 0;
-    for (uint32_t i = 0; i < sectorCount; i++) {
-        if (sectors[i].isMaster != -1)
+    for (uint32_t i = 0; i < context->sectorCount; i++) {
+        if (context->sectors[i].isMaster != -1)
             continue; // Skip sector because it is already processed
 
-        sectors[i].isMaster = 1;
-        sectors[i].masterID = uniqueSectorID;
-        sectors[i].sectorID = i;
+        context->sectors[i].isMaster = 1;
+        context->sectors[i].masterID = uniqueSectorID;
+        context->sectors[i].sectorID = i;
 
         // Compare with other sectors
-        for (uint32_t j = i + 1; j < sectorCount; j++) {
+        for (uint32_t j = i + 1; j < context->sectorCount; j++) {
             // Skip if already processed or either sector is a slope (do not merge slopes)
-            if (sectors[j].isMaster != -1 || sectors[j].isSlope || sectors[i].isSlope) {
+            if (context->sectors[j].isMaster != -1 || context->sectors[j].isSlope || context->sectors[i].isSlope) {
                 continue;
             }
 
-            if (BOOL_AreBlocksEqual(sectors[i].block, sectors[j].block)) {
+            // Every sector is compared with the first sector of its group, so all the sectors of the group stay
+            // within the tolerances of the one that is kept
+            if (similar ? BOOL_AreSectorsSimilar(context, context->sectors[i].block, context->sectors[j].block) : BOOL_AreBlocksEqual(context, context->sectors[i].block, context->sectors[j].block)) {
                 // Found a duplicate
-                sectors[j].masterID = uniqueSectorID;
-                sectors[j].sectorID = j;
-                sectors[j].isMaster = 0; // Mark as duplicate
+                context->sectors[j].masterID = uniqueSectorID;
+                context->sectors[j].sectorID = j;
+                context->sectors[j].isMaster = 0; // Mark as duplicate
             }
         }
 
@@ -1064,105 +2659,118 @@ static void MAP_MergeSectors()
     }
 
     // Count the amount of sidedefs in map
-    block_t* sidedefs;
+    block_t* sidedefBlocks;
     // Load Sidedefs
-    sidedefs = (block_t*)malloc(sizeof(block_t) * sidedefCount); // Allocate space for sidedefs
-    bufferA = 0; // Sidedef counter
-    for (uint32_t i = 0; i < blockCount; i++) {
-        if (!strncmp(blocks[i].header, SIDEDEF_STR, 7))
-            sidedefs[bufferA++] = blocks[i];
+    sidedefBlocks = (block_t*)MEMORY_Alloc(context, sizeof(block_t) * context->sidedefCount); // Allocate space for sidedefBlocks
+    if (context->sidedefCount && !sidedefBlocks) {
+        fprintf(stderr, "%s %s %s the %s blocks\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, SIDEDEF_STR);
+        CONTEXT_Fail(context);
+    }
+    context->bufferA = 0; // Sidedef counter
+    for (uint32_t i = 0; i < context->blockCount; i++) {
+        if (!strncmp(context->blocks[i].header, SIDEDEF_STR, 7))
+            sidedefBlocks[context->bufferA++] = context->blocks[i];
     }
 
     // Build masterID -> new compacted index
-    int* masterID_to_newIndex = (int*)malloc(uniqueSectorID * sizeof(int));
-    bufferA = 0; // new index counter
-    for (uint32_t i = 0; i < sectorCount; i++) {
-        if (sectors[i].isMaster == 1)
-            masterID_to_newIndex[sectors[i].masterID] = bufferA++;
-    }
-    int* oldToNew = (int*)malloc(sectorCount * sizeof(int));
-    for (uint32_t i = 0; i < sectorCount; i++)
-        oldToNew[i] = masterID_to_newIndex[sectors[i].masterID];
-    free(masterID_to_newIndex);
+    int* masterID_to_newIndex = (int*)MEMORY_Alloc(context, uniqueSectorID * sizeof(int));
+    int* oldToNew = (int*)MEMORY_Alloc(context, context->sectorCount * sizeof(int));
+    if ((uniqueSectorID && !masterID_to_newIndex) || (context->sectorCount && !oldToNew)) {
+        fprintf(stderr, "%s %s %s the %s index tables\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, SECTOR_STR);
+        CONTEXT_Fail(context);
+    }
+    context->bufferA = 0; // new index counter
+    for (uint32_t i = 0; i < context->sectorCount; i++) {
+        if (context->sectors[i].isMaster == 1)
+            masterID_to_newIndex[context->sectors[i].masterID] = context->bufferA++;
+    }
+    for (uint32_t i = 0; i < context->sectorCount; i++)
+        oldToNew[i] = masterID_to_newIndex[context->sectors[i].masterID];
+    MEMORY_Free(context, masterID_to_newIndex);
     masterID_to_newIndex = 0;
 
     // Remap sidedef sector indices
-    for (uint32_t i = 0; i < sidedefCount; i++) {
-        for (uint16_t j = 0; j < sidedefs[i].fieldsCount; j++) {
-            if (!strncmp(sidedefs[i].fields[j].key, SECTOR_STR, 6)) {
-                uint32_t sectorIndex = strtol(sidedefs[i].fields[j].value, 0, 10);
-
-                if (sectorIndex < sectorCount) {
-                    snprintf(buffer_str, sizeof(buffer_str), "%d", oldToNew[sectorIndex]);
-                    char* old = sidedefs[i].fields[j].value;
-                    sidedefs[i].fields[j].value = strdup(buffer_str);
-                    free(old);
+    for (uint32_t i = 0; i < context->sidedefCount; i++) {
+        for (uint16_t j = 0; j < sidedefBlocks[i].fieldsCount; j++) {
+            if (!strncmp(sidedefBlocks[i].fields[j].key, SECTOR_STR, 6)) {
+                uint32_t sectorIndex = strtol(sidedefBlocks[i].fields[j].value, 0, 10);
+
+                if (sectorIndex < context->sectorCount) {
+                    snprintf(context->buffer_str, sizeof(context->buffer_str), "%d", oldToNew[sectorIndex]);
+                    char* old = sidedefBlocks[i].fields[j].value;
+                    sidedefBlocks[i].fields[j].value = MEMORY_StrDup(context, context->buffer_str);
+                    if (!sidedefBlocks[i].fields[j].value) {
+                        sidedefBlocks[i].fields[j].value = old;
+                        fprintf(stderr, "%s %s %s the %s index\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, SECTOR_STR);
+                        CONTEXT_Fail(context);
+                    }
+                    MEMORY_Free(context, old);
                     old = 0;
                 } else {
-                    fprintf(stderr, "%s Invalid or out-of-bounds sector index '%s' for sidedef, setting to 0\n", WARNING_STR, sidedefs[i].fields[j].value);
-                    strcpy(sidedefs[i].fields[j].value, "0");
+                    fprintf(stderr, "%s Invalid or out-of-bounds sector index '%s' for sidedef, setting to 0\n", WARNING_STR, sidedefBlocks[i].fields[j].value);
+                    strcpy(sidedefBlocks[i].fields[j].value, "0");
                 }
             }
         }
     }
-    free(oldToNew);
+    MEMORY_Free(context, oldToNew);
 
     // Remove sector duplicates
     uint32_t writeIndex = 0;
-    bufferA = 0; // track which sector we're looking at in sector[]
+    context->bufferA = 0; // track which sector we're looking at in sector[]
 
-    for (uint32_t i = 0; i < blockCount; i++) {
-        if (strncmp(blocks[i].header, SECTOR_STR, 6)) {
+    for (uint32_t i = 0; i < context->blockCount; i++) {
+        if (strncmp(context->blocks[i].header, SECTOR_STR, 6)) {
             // Not a sector block, just keep the block
             if (writeIndex != i)
-                blocks[writeIndex] = blocks[i];
+                context->blocks[writeIndex] = context->blocks[i];
             writeIndex++;
         } else {
-            if (sectors[bufferA].isMaster) {
+            if (context->sectors[context->bufferA].isMaster) {
                 // Master sector, keep the block
                 if (writeIndex != i)
-                    blocks[writeIndex] = blocks[i];
+                    context->blocks[writeIndex] = context->blocks[i];
                 writeIndex++;
             } else {
                 // Duplicate sector, free its fields and the block itself
-                for (uint16_t j = 0; j < blocks[i].fieldsCount; j++) {
-                    free(blocks[i].fields[j].key);
-                    blocks[i].fields[j].key = 0;
-                    free(blocks[i].fields[j].value);
-                    blocks[i].fields[j].value = 0;
+                for (uint16_t j = 0; j < context->blocks[i].fieldsCount; j++) {
+                    MEMORY_Free(context, context->blocks[i].fields[j].key);
+                    context->blocks[i].fields[j].key = 0;
+                    MEMORY_Free(context, context->blocks[i].fields[j].value);
+                    context->blocks[i].fields[j].value = 0;
                 }
-                free(blocks[i].fields);
-                blocks[i].fields = 0;
+                MEMORY_Free(context, context->blocks[i].fields);
+                context->blocks[i].fields = 0;
             }
-            bufferA++;
+            context->bufferA++;
         }
     }
 
-    blockCount = writeIndex;
+    context->blockCount = writeIndex;
 
     // Rebuild the sector/sidedef/linedef references after the block list has been compacted.
-    TEXTMAP_BuildReferences();
+    TEXTMAP_BuildReferences(context);
 
-    printf("%s (before: %d, after: %d)\n", DONE_STR, sectorCount_old, sectorCount);
+    CONTEXT_Print(context, "%s (before: %d, after: %d)\n", DONE_STR, sectorCount_old, context->sectorCount);
 }
 
 // Make things that do not use angles face East (angle 0)
-static void MAP_NoAngleThings()
+static void MAP_NoAngleThings(lessudmf_t* context)
 {
-    printf("Adjusting no-angle Things to face East... ");
+    CONTEXT_Print(context, "Adjusting no-angle Things to face East... ");
     block_t* b;
-    bufferA = 0; // thing count
+    context->bufferA = 0; // thing count
 
-    for (uint32_t x = 0; x < blockCount; x++) {
-        b = &blocks[x];
+    for (uint32_t x = 0; x < context->blockCount; x++) {
+        b = &context->blocks[x];
 
         if (!strncmp(b->header, THING_STR, 5)) {
             for (uint8_t i = 0; i < b->fieldsCount; i++) {
                 if (!strncmp(b->fields[i].key, "type", 7)) {
-                    for (uint16_t a = 0; config.thingTypesNoAngle[a]; a++) {
-                        if (strtol(b->fields[i].value, 0, 10) == config.thingTypesNoAngle[a]) {
-                            removeField(b, "angle");
-                            bufferA++;
+                    for (uint16_t a = 0; context->config.thingTypesNoAngle[a]; a++) {
+                        if (strtol(b->fields[i].value, 0, 10) == context->config.thingTypesNoAngle[a]) {
+                            removeField(context, b, "angle");
+                            context->bufferA++;
                             break;
                         }
                     }
@@ -1171,743 +2779,5218 @@ static void MAP_NoAngleThings()
         }
     }
 
-    printf("%s (%u things)\n", DONE_STR, bufferA);
+    CONTEXT_Print(context, "%s (%u things)\n", DONE_STR, context->bufferA);
 }
 
-// Remove UDMF fields that match the default values
-static void MAP_RemoveDefaultValues()
-{
-    printf("Removing %s fields that match the default values... ", UDMF_STR);
-    uint8_t levelElement;
-    for (uint32_t b = 0; b < blockCount; b++) { // for each block
-        if (!strncmp(blocks[b].header, LINEDEF_STR, 7))
-            levelElement = LEVEL_LINEDEF;
-        else if (!strncmp(blocks[b].header, SIDEDEF_STR, 7))
-            levelElement = LEVEL_SIDEDEF;
-        else if (!strncmp(blocks[b].header, SECTOR_STR, 6))
-            levelElement = LEVEL_SECTOR;
-        else if (!strncmp(blocks[b].header, THING_STR, 5))
-            levelElement = LEVEL_THING;
-        else
-            continue;
+//
+// TEXTURE SIZES
+//
 
-        uint8_t y = 0;
-        while (y < blocks[b].fieldsCount) {
-            int match = 0;
-            for (uint16_t x = 0; config.defaultValues[levelElement][x].key; x++) {
-                if (!strcmp(config.defaultValues[levelElement][x].key, blocks[b].fields[y].key) && !strcmp(config.defaultValues[levelElement][x].value, blocks[b].fields[y].value)) {
-                    removeField(&blocks[b], blocks[b].fields[y].key);
-                    match = 1;
-                    break; // restart at same y, as fields have shifted
-                }
-            }
-            if (!match)
-                y++;
-        }
+// Uppercase the texture name and remove the quotes around it
+static void TEXTURE_GetKey(const char* name, char* key, size_t size)
+{
+    size_t x = 0;
+    for (; *name && x < size - 1; name++) {
+        if (*name != '"')
+            key[x++] = toupper((unsigned char)*name);
     }
-    puts(DONE_STR);
+    key[x] = 0;
+}
+
+// Get the size of a texture in map units, returns 0 if the size is not known
+static uint8_t TEXTURE_GetSize(lessudmf_t* context, const char* name, uint32_t* width, uint32_t* height)
+{
+    char key[64];
+    int64_t size;
+    TEXTURE_GetKey(name, key, sizeof(key));
+    if (!HASHTABLE_Get(&context->textureSizes, key, &size) || !size)
+        return 0;
+    *width = (uint32_t)(size >> 32);
+    *height = (uint32_t)(size & UINT32_MAX);
+    return 1;
 }
 
-static void MAP_RemoveUnseenFlatTextures() {
-    printf("Removing flat textures fron non-visible sector surfaces... ");
+static void TEXTURE_SetSize(lessudmf_t* context, const char* name, int32_t width, int32_t height)
+{
+    char key[64];
+    TEXTURE_GetKey(name, key, sizeof(key));
+    if (!*key)
+        return;
+    uint8_t valid = width > 0 && height > 0 && width <= UINT16_MAX && height <= UINT16_MAX;
+    HASHTABLE_Set(context, &context->textureSizes, key, valid ? ((int64_t)width << 32 | height) : 0);
+}
 
-    block_t *sector;
-    for (uint32_t s = 0; s < sectorCount; s++) {
-        sector = sectors[s].block;
+static uint16_t TEXTURE_ReadShort(const uint8_t* data)
+{
+    return data[0] | (data[1] << 8);
+}
 
-        // Ignore sloped sectors
-        if (BOOL_IsSectorSloped(&sectors[s]))
-            continue;
+static uint32_t TEXTURE_ReadLong(const uint8_t* data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
 
-        const char *fflat = getFieldValueFromBlock(sector, TEXTUREFLOOR_STR);
-        const char *cflat = getFieldValueFromBlock(sector, TEXTURECEILING_STR);
+// Read the size of a picture lump (Doom patch format or PNG), returns 0 if the lump is not a picture
+static uint8_t TEXTURE_GetPictureSize(const uint8_t* data, uint32_t size, int32_t* width, int32_t* height)
+{
+    if (size >= 24 && !memcmp(data, "\x89PNG\r\n\x1A\n", 8) && !memcmp(data + 12, "IHDR", 4)) {
+        *width = (int32_t)((uint32_t)data[16] << 24 | data[17] << 16 | data[18] << 8 | data[19]);
+        *height = (int32_t)((uint32_t)data[20] << 24 | data[21] << 16 | data[22] << 8 | data[23]);
+        return 1;
+    }
+    if (size < 8)
+        return 0;
+    *width = (int16_t)TEXTURE_ReadShort(data);
+    *height = (int16_t)TEXTURE_ReadShort(data + 2);
+    if (*width <= 0 || *height <= 0 || size < 8 + (uint32_t)*width * 4)
+        return 0;
+    // Every column has to start inside the lump
+    for (int32_t x = 0; x < *width; x++) {
+        if (TEXTURE_ReadLong(data + 8 + x * 4) >= size)
+            return 0;
+    }
+    return 1;
+}
 
-        // Ignore sectors that are a part of the sky
-        if (((fflat) && !strncmp(fflat, F_SKY1_STR, 6)) || ((cflat) && !strncmp(cflat, F_SKY1_STR, 6)))
+// Index the textures of a binary TEXTURE1/TEXTURE2 lump. The textures store their own size so PNAMES is not needed.
+static void TEXTURE_IndexTEXTUREx(lessudmf_t* context, const uint8_t* data, uint32_t size)
+{
+    if (size < 4)
+        return;
+    uint32_t count = TEXTURE_ReadLong(data);
+    if (count > (size - 4) / 4)
+        return;
+    for (uint32_t x = 0; x < count; x++) {
+        uint32_t offset = TEXTURE_ReadLong(data + 4 + x * 4);
+        if (offset > size || size - offset < 16)
             continue;
+        char name[9] = { 0 };
+        memcpy(name, data + offset, 8);
+        TEXTURE_SetSize(context, name, (int16_t)TEXTURE_ReadShort(data + offset + 12), (int16_t)TEXTURE_ReadShort(data + offset + 14));
+    }
+}
 
-        const char *fheight = getFieldValueFromBlock(sector, FLOORHEIGHT_STR);
-        const char *cheight = getFieldValueFromBlock(sector, CEILINGHEIGHT_STR);
-
-        int16_t fh = (int16_t)strtol(fheight ? fheight : "0", 0, 10);
-        int16_t ch = (int16_t)strtol(cheight ? cheight : "0", 0, 10);
+// Read the next token of a TEXTURES lump: a quoted string, a single ",{}" character or a word/number.
+// Returns 0 at the end of the lump.
+static uint8_t TEXTURE_NextToken(const char** ptr, const char* end, char* token, size_t size)
+{
+    const char* p = *ptr;
+    size_t x = 0;
+
+    for (;;) {
+        while (p < end && isspace((unsigned char)*p))
+            p++;
+        if (p + 1 < end && p[0] == '/' && p[1] == '/') {
+            while (p < end && *p != '\n')
+                p++;
+        } else if (p + 1 < end && p[0] == '/' && p[1] == '*') {
+            p += 2;
+            while (p + 1 < end && !(p[0] == '*' && p[1] == '/'))
+                p++;
+            p = (p + 2 < end) ? p + 2 : end;
+        } else
+            break;
+    }
+    if (p >= end)
+        return 0;
 
-        if (fh >= ch) {
-            removeField(sector, TEXTUREFLOOR_STR);
-            removeField(sector, TEXTURECEILING_STR);
+    if (*p == '"') {
+        for (p++; p < end && *p != '"'; p++) {
+            if (x < size - 1)
+                token[x++] = *p;
+        }
+        p += (p < end);
+    } else if (*p == ',' || *p == '{' || *p == '}')
+        token[x++] = *p++;
+    else {
+        while (p < end && !isspace((unsigned char)*p) && *p != ',' && *p != '{' && *p != '}' && *p != '"') {
+            if (x < size - 1)
+                token[x++] = *p;
+            p++;
         }
     }
+    token[x] = 0;
+    *ptr = p;
+    return 1;
+}
 
-    puts(DONE_STR);
+// Case-insensitive comparison of the token with the uppercase keyword
+static uint8_t TEXTURE_IsKeyword(const char* token, const char* keyword)
+{
+    while (*token && toupper((unsigned char)*token) == *keyword) {
+        token++;
+        keyword++;
+    }
+    return !*token && !*keyword;
 }
 
-// Tokenize TEXTMAP into block structures (block_t)
-static void TEXTMAP_Parse(char* textmapdata)
+// Index the wall textures of a TEXTURES lump. Textures with XScale/YScale are indexed with an unknown size.
+static void TEXTURE_IndexTEXTURES(lessudmf_t* context, const char* data, uint32_t size)
 {
-    char* ptr = textmapdata;
-    while (*ptr) {
-        // skip whitespace and comments at top-level
-        if (*ptr == '/' && ptr[1] == '/') {
-            ptr += 2;
-            while (*ptr && *ptr != '\n')
-                ptr++;
-            if (*ptr)
-                ptr++;
+    const char* ptr = data;
+    const char* end = data + size;
+    char token[64], name[64];
+    uint32_t depth = 0;
+
+    while (TEXTURE_NextToken(&ptr, end, token, sizeof(token))) {
+        if (*token == '{') {
+            depth++;
             continue;
         }
-        if (*ptr == '/' && ptr[1] == '*') {
-            ptr += 2;
-            while (*ptr && !(ptr[0] == '*' && ptr[1] == '/'))
-                ptr++;
-            if (*ptr)
-                ptr += 2;
+        if (*token == '}') {
+            depth -= (depth > 0);
             continue;
         }
-        if (isspace(*ptr)) {
-            ptr++;
+        if (depth || (!TEXTURE_IsKeyword(token, "TEXTURE") && !TEXTURE_IsKeyword(token, "WALLTEXTURE")))
             continue;
-        }
-
-        // namespace
-        if (!strncmp(ptr, NAMESPACE_STR, 9)) {
-            ptr += 9;
-            while (isspace(*ptr))
-                ptr++;
-            if (*ptr == '=')
-                ptr++;
-            while (isspace(*ptr))
-                ptr++;
-            if (*ptr == '"') {
-                ptr++;
-                char* start = ptr;
-                while (*ptr && *ptr != '"')
-                    ptr++;
-                size_t len = ptr - start;
-                namespaceValue = (char*)malloc(len + 1);
-                memcpy(namespaceValue, start, len);
-                namespaceValue[len] = '\0';
-                if (*ptr == '"')
-                    ptr++;
-            }
 
-            // determine engine
-            if (FLAGS & FLAGS_CUSTOMCONFIG) {
-                gameEngine = ENGINE_UNKNOWN;
-            } else {
-                if (namespaceValue) {
-                    if (!strncmp(namespaceValue, "doom", 4))
-                        gameEngine = ENGINE_DOOM;
-                    else if (!strncmp(namespaceValue, "heretic", 7))
-                        gameEngine = ENGINE_HERETIC;
-                    else if (!strncmp(namespaceValue, "hexen", 5))
-                        gameEngine = ENGINE_HEXEN;
-                    else if (!strncmp(namespaceValue, "strife", 6))
-                        gameEngine = ENGINE_STRIFE;
-                    else if (!strncmp(namespaceValue, "zdoom", 5))
-                        gameEngine = ENGINE_ZDOOM;
-                    else if (!strncmp(namespaceValue, "srb2", 4))
-                        gameEngine = ENGINE_SRB2;
-                    else
-                        gameEngine = ENGINE_UNKNOWN;
-                } else {
-                    gameEngine = ENGINE_UNKNOWN;
+        // Texture [optional] "NAME", width, height { ... }
+        if (!TEXTURE_NextToken(&ptr, end, name, sizeof(name)))
+            return;
+        if (TEXTURE_IsKeyword(name, "OPTIONAL") && !TEXTURE_NextToken(&ptr, end, name, sizeof(name)))
+            return;
+        int32_t width = 0, height = 0;
+        if (!(TEXTURE_NextToken(&ptr, end, token, sizeof(token)) && *token == ','))
+            continue;
+        if (!TEXTURE_NextToken(&ptr, end, token, sizeof(token)))
+            return;
+        width = (int32_t)strtol(token, 0, 10);
+        if (!(TEXTURE_NextToken(&ptr, end, token, sizeof(token)) && *token == ','))
+            continue;
+        if (!TEXTURE_NextToken(&ptr, end, token, sizeof(token)))
+            return;
+        height = (int32_t)strtol(token, 0, 10);
+
+        // Look for scaling inside the definition
+        const char* bodyStart = ptr;
+        if (TEXTURE_NextToken(&ptr, end, token, sizeof(token)) && *token == '{') {
+            depth = 1;
+            while (depth && TEXTURE_NextToken(&ptr, end, token, sizeof(token))) {
+                if (*token == '{')
+                    depth++;
+                else if (*token == '}')
+                    depth--;
+                else if (depth == 1 && (TEXTURE_IsKeyword(token, "XSCALE") || TEXTURE_IsKeyword(token, "YSCALE") || TEXTURE_IsKeyword(token, "SCALE"))) {
+                    if (!TEXTURE_NextToken(&ptr, end, token, sizeof(token)))
+                        break;
+                    if (strtod(token, 0) != 1.0)
+                        width = 0; // unknown size in map units
                 }
             }
+        } else
+            ptr = bodyStart;
 
-            // skip until semicolon
-            while (*ptr && *ptr != ';')
-                ptr++;
-            if (*ptr == ';')
-                ptr++;
+        TEXTURE_SetSize(context, name, width, height);
+    }
+}
+
+#ifndef LESSUDMF_LIBRARY
+// Map the Input WAD into memory, it is read into a buffer where mmap() is not available. Returns 0 on failure
+static uint8_t INPUT_Open(lessudmf_t* context, const char* path)
+{
+#ifdef LESSUDMF_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    if (fstat(fd, &st) || (uint64_t)st.st_size > UINT32_MAX) {
+        close(fd);
+        return 0;
+    }
+    context->INPUT_SIZE = (uint32_t)st.st_size;
+    if (context->INPUT_SIZE) {
+        void* data = mmap(0, context->INPUT_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return 0;
+        }
+        context->INPUT_DATA = (const char*)data;
+    }
+    context->INPUT_FD = fd; // kept open to copy the lumps from
+    return 1;
+#else
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return 0;
+    fseek(file, 0, SEEK_END);
+    context->INPUT_SIZE = (uint32_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = (char*)MEMORY_Alloc(context, context->INPUT_SIZE + 1);
+    if (!data || fread(data, 1, context->INPUT_SIZE, file) != context->INPUT_SIZE) {
+        MEMORY_Free(context, data);
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+    context->INPUT_DATA = data;
+    return 1;
+#endif
+}
+
+static void INPUT_Close(lessudmf_t* context)
+{
+#ifdef LESSUDMF_MMAP
+    if (context->INPUT_DATA)
+        munmap((void*)context->INPUT_DATA, context->INPUT_SIZE);
+    if (context->INPUT_FD >= 0)
+        close(context->INPUT_FD);
+    context->INPUT_FD = -1;
+#else
+    MEMORY_Free(context, (void*)context->INPUT_DATA);
+#endif
+    context->INPUT_DATA = 0;
+    context->INPUT_SIZE = 0;
+}
+#endif
+
+// Data of a lump of the Input WAD, read from the mapped file at the address of the lump
+static const uint8_t* WAD_GetLump(lessudmf_t* context, uint32_t index)
+{
+    return (const uint8_t*)context->INPUT_DATA + context->lumps[index].address;
+}
+
+// Index the sizes of the textures defined in the Input WAD: TEXTURE1/TEXTURE2, the pictures between
+// TX_START/TX_END and TEXTURES, later definitions replace the earlier ones like in the game
+static void TEXTURE_IndexWAD(lessudmf_t* context)
+{
+    CONTEXT_Print(context, "Indexing the texture sizes of the %s %s... ", INPUT_STR, WAD_STR);
+
+    for (uint32_t i = 0; i < context->WAD_LumpsAmount; i++) {
+        if (strncmp(context->lumps[i].name, "TEXTURE1", 8) && strncmp(context->lumps[i].name, "TEXTURE2", 8))
             continue;
+        TEXTURE_IndexTEXTUREx(context, WAD_GetLump(context, i), context->lumps[i].size);
+    }
+
+    uint8_t inTextures = 0;
+    for (uint32_t i = 0; i < context->WAD_LumpsAmount; i++) {
+        if (!strncmp(context->lumps[i].name, "TX_START", 8))
+            inTextures = 1;
+        else if (!strncmp(context->lumps[i].name, "TX_END", 8))
+            inTextures = 0;
+        else if (inTextures && context->lumps[i].size) {
+            int32_t width, height;
+            char name[9] = { 0 };
+            memcpy(name, context->lumps[i].name, 8);
+            if (TEXTURE_GetPictureSize(WAD_GetLump(context, i), context->lumps[i].size, &width, &height))
+                TEXTURE_SetSize(context, name, width, height);
         }
+    }
 
-        // Read block header (skip leading whitespace and avoid consuming comments)
-        char headerBuf[64];
-        int hi = 0;
+    for (uint32_t i = 0; i < context->WAD_LumpsAmount; i++) {
+        if (strncmp(context->lumps[i].name, "TEXTURES", 8))
+            continue;
+        TEXTURE_IndexTEXTURES(context, (const char*)WAD_GetLump(context, i), context->lumps[i].size);
+    }
 
-        // read header token until whitespace, '{' or comment start
-        while (*ptr && *ptr != '{') {
-            if ((*ptr == '/' && (ptr[1] == '/' || ptr[1] == '*')) || isspace(*ptr))
-                break; // don't include comment start or whitespace in header
-            if (hi < (int)sizeof(headerBuf) - 1)
-                headerBuf[hi++] = *ptr;
-            ptr++;
+    CONTEXT_Print(context, "%s (%u textures)\n", DONE_STR, context->textureSizes.count);
+}
+
+// Reduce the offset value of the field to the shortest value that is equal modulo period
+static uint8_t FIELD_ReduceOffset(lessudmf_t* context, block_t* blk, const char* key, uint64_t period)
+{
+    const char* value = getFieldValueFromBlock(blk, key);
+    if (!value || !period)
+        return 0;
+
+    char* end;
+    double offset = strtod(value, &end);
+    if (end == value || *end || !isfinite(offset))
+        return 0;
+
+    char reduced[2][64];
+    double positive = fmod(offset, (double)period);
+    if (positive < 0)
+        positive += (double)period;
+    FLOAT_ToShortestString(positive, reduced[0], sizeof(reduced[0]));
+    FLOAT_ToShortestString(positive - (double)period, reduced[1], sizeof(reduced[1]));
+
+    const char* best = (strlen(reduced[1]) < strlen(reduced[0])) ? reduced[1] : reduced[0];
+    if (strlen(best) >= strlen(value))
+        return 0;
+    setFieldValue(context, blk, key, best);
+    return 1;
+}
+
+static uint64_t MATH_GCD(uint64_t a, uint64_t b)
+{
+    while (b) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Check if the sector can be found by tag (has an "id" or "moreids")
+static uint8_t BOOL_IsSectorTagged(const sector_t* sector)
+{
+    const char* id = getFieldValueFromBlock(sector->block, "id");
+
+    if (id && strtol(id, 0, 10))
+        return 1;
+    return BOOL_BlockHasField(sector->block, "moreids");
+}
+
+enum {
+    WALLFLAG_MIDTILES = 1, // The middle texture tiles vertically (one-sided linedef or "wrapmidtex")
+    WALLFLAG_FOREIGN = 2 // Walls of other linedefs (3D floors) may be drawn on the side with its base offsets
+};
+
+// Get the WALLFLAG_* flags of every sidedef, the caller has to free the returned array
+static uint8_t* SIDEDEF_GetWallFlags(lessudmf_t* context)
+{
+    uint8_t* wallFlags = (uint8_t*)MEMORY_Calloc(context, context->sidedefCount ? context->sidedefCount : 1, 1);
+    if (!wallFlags) {
+        fprintf(stderr, "%s %s %s the sidedef wall flags\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        CONTEXT_Fail(context);
+    }
+    for (uint32_t line = 0; line < context->linedefCount; line++) {
+        const linedef_t* linedef = &context->linedefs[line];
+        const char* wrap = getFieldValueFromBlock(linedef->block, "wrapmidtex");
+        uint8_t flags = (!linedef->sideback || (wrap && !strcmp(wrap, "true"))) ? WALLFLAG_MIDTILES : 0;
+
+        // 3D floors are only made in tagged sectors
+        if (linedef->sidefront && linedef->sideback) {
+            if ((linedef->sidefront->sector && BOOL_IsSectorTagged(linedef->sidefront->sector)) || (linedef->sideback->sector && BOOL_IsSectorTagged(linedef->sideback->sector)))
+                flags |= WALLFLAG_FOREIGN;
         }
-        headerBuf[hi] = '\0';
 
-        // If we didn't read a header (e.g. encountered comment or stray chars), skip comments and continue
-        if (!hi) {
-            // skip comments or stray characters until next top-level token
-            if (*ptr == '/' && ptr[1] == '/') {
-                ptr += 2;
-                while (*ptr && *ptr != '\n')
-                    ptr++;
-                if (*ptr)
-                    ptr++;
+        if (linedef->sidefront)
+            wallFlags[linedef->sidefront - context->sidedefs] = flags;
+        if (linedef->sideback)
+            wallFlags[linedef->sideback - context->sidedefs] = flags;
+    }
+    return wallFlags;
+}
+
+// Reduce the sidedef texture offsets modulo the size of the textures, the texture looks the same on the wall.
+// The base offsets are reduced modulo the least common multiple of the sizes of all the textures the sidedef has,
+// unless 3D floor walls can be drawn on the side too.
+// The vertical offsets are not reduced if the middle texture does not tile vertically (two-sided linedef without "wrapmidtex").
+static void MAP_NormalizeTextureOffsets(lessudmf_t* context)
+{
+    CONTEXT_Print(context, "Reducing the texture offsets modulo the texture sizes... ");
+
+    static const char* textureKeys[3] = { TEXTURETOP_STR, TEXTUREMIDDLE_STR, TEXTUREBOTTOM_STR };
+    static const char* offsetXKeys[3] = { "offsetx_top", "offsetx_mid", "offsetx_bottom" };
+    static const char* offsetYKeys[3] = { "offsety_top", "offsety_mid", "offsety_bottom" };
+    static const char* scaleXKeys[3] = { "scalex_top", "scalex_mid", "scalex_bottom" };
+    static const char* scaleYKeys[3] = { "scaley_top", "scaley_mid", "scaley_bottom" };
+
+    uint8_t* wallFlags = SIDEDEF_GetWallFlags(context);
+
+    context->bufferA = 0;
+    for (uint32_t s = 0; s < context->sidedefCount; s++) {
+        block_t* blk = context->sidedefs[s].block;
+        uint64_t periodX = 1, periodY = 1;
+        uint8_t knownX = 0, knownY = 0, unknown = 0; // unknown: 1=horizontal, 2=vertical period is not known
+
+        for (uint8_t part = 0; part < 3; part++) {
+            const char* texture = getFieldValueFromBlock(blk, textureKeys[part]);
+            if (!texture || !strcmp(texture, "\"-\""))
                 continue;
-            }
-            if (*ptr == '/' && ptr[1] == '*') {
-                ptr += 2;
-                while (*ptr && !(ptr[0] == '*' && ptr[1] == '/'))
-                    ptr++;
-                if (*ptr)
-                    ptr += 2;
+
+            uint32_t width, height;
+            if (!TEXTURE_GetSize(context, texture, &width, &height)) {
+                unknown = 3;
                 continue;
             }
-            // if we hit '{' without a header, just skip it
-            if (*ptr == '{') {
-                ptr++;
-                continue;
+
+            // Scaled parts repeat at a different distance, leave their offsets alone
+            const char* scaleX = getFieldValueFromBlock(blk, scaleXKeys[part]);
+            const char* scaleY = getFieldValueFromBlock(blk, scaleYKeys[part]);
+            uint8_t scaledX = scaleX && strtod(scaleX, 0) != 1.0;
+            uint8_t scaledY = scaleY && strtod(scaleY, 0) != 1.0;
+            uint8_t tilesY = (part != 1) || (wallFlags[s] & WALLFLAG_MIDTILES);
+
+            if (scaledX)
+                unknown |= 1;
+            else {
+                context->bufferA += FIELD_ReduceOffset(context, blk, offsetXKeys[part], width);
+                periodX = periodX / MATH_GCD(periodX, width) * width;
+                knownX = 1;
+            }
+
+            if (scaledY || !tilesY)
+                unknown |= 2;
+            else {
+                context->bufferA += FIELD_ReduceOffset(context, blk, offsetYKeys[part], height);
+                periodY = periodY / MATH_GCD(periodY, height) * height;
+                knownY = 1;
             }
-            // otherwise continue to next iteration
-            continue;
         }
 
-        // Allocate space for the new block_t and add new block to the memory
-        blocks = (block_t*)realloc(blocks, (blockCount + 1) * sizeof(block_t));
-        if (!blocks) {
-            free(blocks);
-            fprintf(stderr, "%s %s re%s the blocks array for the new block\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
-            exit(1);
+        // The base offsets move all the textures at once
+        if (wallFlags[s] & WALLFLAG_FOREIGN)
+            continue;
+        if (knownX && !(unknown & 1))
+            context->bufferA += FIELD_ReduceOffset(context, blk, "offsetx", periodX);
+        if (knownY && !(unknown & 2))
+            context->bufferA += FIELD_ReduceOffset(context, blk, "offsety", periodY);
+    }
+
+    MEMORY_Free(context, wallFlags);
+    CONTEXT_Print(context, "%s (%u offsets)\n", DONE_STR, context->bufferA);
+}
+
+// Remove the fields that modify textures which are not applied to the block (config "textureParameters").
+// Parameters of several wall textures at once also move the 3D floor walls drawn on the side, such sides keep them.
+static void MAP_RemoveTextureParameters(lessudmf_t* context)
+{
+    CONTEXT_Print(context, "Removing the parameters of textures that are not applied... ");
+
+    uint8_t* wallFlags = SIDEDEF_GetWallFlags(context);
+    uint32_t side = 0;
+    context->bufferA = 0;
+
+    for (uint32_t b = 0; b < context->blockCount; b++) {
+        uint8_t levelElement = BLOCK_GetLevelElement(&context->blocks[b]);
+        if (levelElement == UINT8_MAX)
+            continue;
+        uint8_t keepShared = (levelElement == LEVEL_SIDEDEF) && (wallFlags[side++] & WALLFLAG_FOREIGN);
+        if (!context->config.textureParameters[levelElement].count)
+            continue;
+
+        // Find the textures applied to the block
+        uint64_t applied = 0;
+        for (uint8_t t = 0; context->config.textureKeys[levelElement][t]; t++) {
+            const char* texture = getFieldValueFromBlock(&context->blocks[b], context->config.textureKeys[levelElement][t]);
+            if (texture && strcmp(texture, "\"-\""))
+                applied |= (uint64_t)1 << t;
         }
-        block_t* blk = &blocks[blockCount];
-        memset(blk, 0, sizeof(block_t));
-        strncpy(blk->header, headerBuf, sizeof(blk->header) - 1);
 
-        // skip whitespace/comments between header and '{'
-        while (*ptr) {
-            if (isspace(*ptr)) {
-                ptr++;
-                continue;
-            }
-            if (*ptr == '/' && ptr[1] == '/') {
-                ptr += 2;
-                while (*ptr && *ptr != '\n')
-                    ptr++;
-                if (*ptr)
-                    ptr++;
-                continue;
-            }
-            if (*ptr == '/' && ptr[1] == '*') {
-                ptr += 2;
-                while (*ptr && !(ptr[0] == '*' && ptr[1] == '/'))
-                    ptr++;
-                if (*ptr)
-                    ptr += 2;
-                continue;
+        uint8_t y = 0;
+        while (y < context->blocks[b].fieldsCount) {
+            int64_t mask;
+            if (HASHTABLE_Get(&context->config.textureParameters[levelElement], context->blocks[b].fields[y].key, &mask) && !((uint64_t)mask & applied) && !(keepShared && (mask & (mask - 1)))) {
+                removeField(context, &context->blocks[b], context->blocks[b].fields[y].key);
+                context->bufferA++;
+                continue; // same y, the fields have shifted
             }
-            break;
+            y++;
+        }
+    }
+
+    MEMORY_Free(context, wallFlags);
+    CONTEXT_Print(context, "%s (%u fields)\n", DONE_STR, context->bufferA);
+}
+
+//
+// TAGS
+//
+
+// Add the tags of the block ("id" and "moreids") to the tag index of the level element
+static void TAGS_AddBlock(lessudmf_t* context, const block_t* blk, uint8_t levelElement)
+{
+    const char* id = getFieldValueFromBlock(blk, "id");
+    const char* moreids = getFieldValueFromBlock(blk, "moreids");
+    int64_t count;
+
+    if (id) {
+        snprintf(context->buffer_str, sizeof(context->buffer_str), "%ld", strtol(id, 0, 10));
+        count = 0;
+        HASHTABLE_Get(&context->tagIndex[levelElement], context->buffer_str, &count);
+        HASHTABLE_Set(context, &context->tagIndex[levelElement], context->buffer_str, count + 1);
+    }
+
+    // moreids is a string of space-separated tags
+    for (const char* ptr = moreids; ptr && *ptr;) {
+        if (!(isdigit((unsigned char)*ptr) || *ptr == '-')) {
+            ptr++;
+            continue;
         }
-        if (*ptr == '{')
+        char* end;
+        long tag = strtol(ptr, &end, 10);
+        if (end == ptr) {
             ptr++;
+            continue;
+        }
+        snprintf(context->buffer_str, sizeof(context->buffer_str), "%ld", tag);
+        count = 0;
+        HASHTABLE_Get(&context->tagIndex[levelElement], context->buffer_str, &count);
+        HASHTABLE_Set(context, &context->tagIndex[levelElement], context->buffer_str, count + 1);
+        ptr = end;
+    }
+}
 
-        // Parse fields inside block
-        while (*ptr) {
-            // skip whitespace and comments
-            if (*ptr == '/' && ptr[1] == '/') {
-                ptr += 2;
-                while (*ptr && *ptr != '\n')
-                    ptr++;
-                if (*ptr)
-                    ptr++;
+// Build the index of the sector, linedef and thing tags of the map
+static void MAP_BuildTagIndex(lessudmf_t* context)
+{
+    for (uint8_t x = 0; x < 5; x++)
+        HASHTABLE_Free(context, &context->tagIndex[x]);
+
+    for (uint32_t b = 0; b < context->blockCount; b++) {
+        uint8_t levelElement = BLOCK_GetLevelElement(&context->blocks[b]);
+        if (levelElement == LEVEL_SECTOR || levelElement == LEVEL_LINEDEF || levelElement == LEVEL_THING)
+            TAGS_AddBlock(context, &context->blocks[b], levelElement);
+    }
+}
+
+// Check if any element of the level element type has the tag
+static uint8_t BOOL_IsTagUsed(lessudmf_t* context, uint8_t levelElement, long tag)
+{
+    snprintf(context->buffer_str, sizeof(context->buffer_str), "%ld", tag);
+    return HASHTABLE_Get(&context->tagIndex[levelElement], context->buffer_str, 0);
+}
+
+static void TAGS_AddReference(lessudmf_t* context, const char* value)
+{
+    int64_t count = 0;
+    if (!value)
+        return;
+    snprintf(context->buffer_str, sizeof(context->buffer_str), "%ld", strtol(value, 0, 10));
+    HASHTABLE_Get(&context->tagReferences, context->buffer_str, &count);
+    HASHTABLE_Set(context, &context->tagReferences, context->buffer_str, count + 1);
+}
+
+// Build the index of the tags which the linedef specials and things of the map refer to.
+// Every argument is counted as a possible reference, as well as the tags of the linedefs with specials.
+static void MAP_BuildReferenceIndex(lessudmf_t* context)
+{
+    HASHTABLE_Free(context, &context->tagReferences);
+
+    for (uint32_t b = 0; b < context->blockCount; b++) {
+        uint8_t levelElement = BLOCK_GetLevelElement(&context->blocks[b]);
+        if (levelElement != LEVEL_LINEDEF && levelElement != LEVEL_THING)
+            continue;
+        if (levelElement == LEVEL_LINEDEF) {
+            const char* special = getFieldValueFromBlock(&context->blocks[b], SPECIAL_STR);
+            if (!special || !strtol(special, 0, 10))
                 continue;
+            TAGS_AddReference(context, getFieldValueFromBlock(&context->blocks[b], "id"));
+            const char* moreids = getFieldValueFromBlock(&context->blocks[b], "moreids");
+            for (const char* ptr = moreids; ptr && *ptr; ptr++) {
+                if ((isdigit((unsigned char)*ptr) || *ptr == '-') && (ptr == moreids || !isdigit((unsigned char)ptr[-1])))
+                    TAGS_AddReference(context, ptr);
             }
-            if (*ptr == '/' && ptr[1] == '*') {
-                ptr += 2;
-                while (*ptr && !(ptr[0] == '*' && ptr[1] == '/'))
-                    ptr++;
-                if (*ptr)
-                    ptr += 2;
-                continue;
+        }
+        for (uint8_t f = 0; f < context->blocks[b].fieldsCount; f++) {
+            if (!strncmp(context->blocks[b].fields[f].key, "arg", 3) && ARGSCHEMA_GetBit(context->blocks[b].fields[f].key) >= 0)
+                TAGS_AddReference(context, context->blocks[b].fields[f].value);
+        }
+    }
+}
+
+// Remove the sector tags ("id" and "moreids") which are not referred to, so more sectors can be merged
+static void MAP_RemoveUnreferencedSectorTags(lessudmf_t* context)
+{
+    CONTEXT_Print(context, "Removing sector tags which nothing refers to... ");
+    MAP_BuildReferenceIndex(context);
+
+    context->bufferA = 0;
+    for (uint32_t sec = 0; sec < context->sectorCount; sec++) {
+        block_t* blk = context->sectors[sec].block;
+        const char* id = getFieldValueFromBlock(blk, "id");
+        const char* moreids = getFieldValueFromBlock(blk, "moreids");
+
+        if (id && strtol(id, 0, 10)) {
+            snprintf(context->buffer_str, sizeof(context->buffer_str), "%ld", strtol(id, 0, 10));
+            if (!HASHTABLE_Get(&context->tagReferences, context->buffer_str, 0)) {
+                removeField(context, blk, "id");
+                context->bufferA++;
             }
-            if (isspace(*ptr)) {
+        }
+
+        if (!moreids)
+            continue;
+
+        // Rebuild the space-separated list with the referenced tags only
+        char kept[sizeof(context->buffer_str)] = "\"";
+        size_t length = 1;
+        uint8_t removed = 0;
+        for (const char* ptr = moreids; *ptr;) {
+            char* end;
+            long tag = strtol(ptr, &end, 10);
+            if (end == ptr) {
                 ptr++;
                 continue;
             }
-            if (*ptr == '}') {
-                ptr++;
+            ptr = end;
+            snprintf(context->buffer_str, sizeof(context->buffer_str), "%ld", tag);
+            if (!HASHTABLE_Get(&context->tagReferences, context->buffer_str, 0)) {
+                removed++;
+                continue;
+            }
+            length += snprintf(kept + length, sizeof(kept) - length, (length > 1) ? " %ld" : "%ld", tag);
+            if (length >= sizeof(kept) - 2) {
+                removed = 0; // too long to rebuild, keep the field as it is
                 break;
             }
+        }
+        if (!removed)
+            continue;
+        if (length > 1) {
+            strcpy(kept + length, "\"");
+            setFieldValue(context, blk, "moreids", kept);
+        } else
+            removeField(context, blk, "moreids");
+        context->bufferA += removed;
+    }
 
-            // read key
-            char key[128];
-            int ki = 0;
-            while (*ptr && *ptr != '=' && *ptr != '}' && !isspace(*ptr)) {
-                if (ki < (int)sizeof(key) - 1)
-                    key[ki++] = *ptr;
-                ptr++;
-            }
-            key[ki] = '\0';
-            while (isspace(*ptr))
-                ptr++;
-            if (*ptr == '=')
-                ptr++;
-            while (isspace(*ptr))
-                ptr++;
+    CONTEXT_Print(context, "%s (%u tags)\n", DONE_STR, context->bufferA);
+    HASHTABLE_Free(context, &context->tagReferences);
+}
 
-            // read value
-            char value[1024];
-            int vi = 0;
-            if (*ptr == '"') {
-                value[vi++] = '"';
-                ptr++;
-                while (*ptr && *ptr != '"') {
-                    if (vi < (int)sizeof(value) - 1)
-                        value[vi++] = *ptr;
-                    ptr++;
-                }
-                if (*ptr == '"') {
-                    if (vi < (int)sizeof(value) - 1)
-                        value[vi++] = '"';
-                    ptr++;
-                }
-            } else {
-                while (*ptr && *ptr != ';' && *ptr != '}') {
-                    if (vi < (int)sizeof(value) - 1)
-                        value[vi++] = *ptr;
-                    ptr++;
-                }
-            }
-            value[vi] = '\0';
+// Remove the specials (and their arguments) of linedefs whose tag arguments (config "tagArgs") match nothing in the map,
+// such specials can never do anything. Tag 0 is never treated as missing.
+static void MAP_RemoveDeadSpecials(lessudmf_t* context)
+{
+    CONTEXT_Print(context, "Removing linedef specials which target tags that do not exist... ");
+
+    context->bufferA = 0;
+    for (uint32_t line = 0; line < context->linedefCount; line++) {
+        block_t* blk = context->linedefs[line].block;
+        const char* special = getFieldValueFromBlock(blk, SPECIAL_STR);
+        int64_t mask;
+        if (!special)
+            continue;
+        snprintf(context->buffer_str, sizeof(context->buffer_str), "%ld", strtol(special, 0, 10));
+        if (!HASHTABLE_Get(&context->config.tagArgs, context->buffer_str, &mask))
+            continue;
 
-            if (BOOL_IsStrFloat(value))
-                FLOAT_TrimValue(value);
-            addField(blk, key, value);
+        // The special is dead when none of its tags can be found
+        uint8_t dead = 1;
+        for (uint8_t bit = 0; bit < 5 * ARGSCHEMA_ARGS && dead; bit++) {
+            if (!(mask & ((int64_t)1 << bit)))
+                continue;
+            char key[8];
+            snprintf(key, sizeof(key), "arg%u", bit % ARGSCHEMA_ARGS);
+            const char* value = getFieldValueFromBlock(blk, key);
+            long tag = strtol(value ? value : "0", 0, 10);
+            if (!tag || BOOL_IsTagUsed(context, bit / ARGSCHEMA_ARGS, tag))
+                dead = 0;
+        }
+        if (!dead)
+            continue;
+
+        removeField(context, blk, SPECIAL_STR);
+        uint8_t y = 0;
+        while (y < blk->fieldsCount) {
+            if (ARGSCHEMA_GetBit(blk->fields[y].key) >= 0)
+                removeField(context, blk, blk->fields[y].key);
+            else
+                y++;
+        }
+        context->bufferA++;
+    }
+
+    CONTEXT_Print(context, "%s (%u %ss)\n", DONE_STR, context->bufferA, LINEDEF_STR);
+}
+
+// Remove the arguments the game does not read for the linedef special or thing type (config "argSchemas").
+// Linedef specials and thing types without a schema keep all of their arguments.
+static void MAP_RemoveUnusedArgs(lessudmf_t* context)
+{
+    CONTEXT_Print(context, "Removing the arguments not used by linedef specials and thing types... ");
+
+    context->bufferA = 0;
+    for (uint32_t b = 0; b < context->blockCount; b++) {
+        uint8_t levelElement = BLOCK_GetLevelElement(&context->blocks[b]);
+        const char* schemaKey;
+        if (levelElement == LEVEL_LINEDEF)
+            schemaKey = getFieldValueFromBlock(&context->blocks[b], SPECIAL_STR);
+        else if (levelElement == LEVEL_THING)
+            schemaKey = getFieldValueFromBlock(&context->blocks[b], "type");
+        else
+            continue;
+        if (!context->config.argSchemas[levelElement].count)
+            continue;
+
+        // Linedefs without a special have special 0
+        int64_t mask;
+        snprintf(context->buffer_str, sizeof(context->buffer_str), "%ld", strtol(schemaKey ? schemaKey : "0", 0, 10));
+        if ((!schemaKey && levelElement == LEVEL_THING) || !HASHTABLE_Get(&context->config.argSchemas[levelElement], context->buffer_str, &mask))
+            continue;
+
+        uint8_t y = 0;
+        while (y < context->blocks[b].fieldsCount) {
+            int8_t bit = ARGSCHEMA_GetBit(context->blocks[b].fields[y].key);
+            if (bit >= 0 && !(mask & ((int64_t)1 << bit))) {
+                removeField(context, &context->blocks[b], context->blocks[b].fields[y].key);
+                context->bufferA++;
+                continue; // same y, the fields have shifted
+            }
+            y++;
+        }
+    }
+
+    CONTEXT_Print(context, "%s (%u fields)\n", DONE_STR, context->bufferA);
+}
+
+// Remove UDMF fields that match the default values
+static void MAP_RemoveDefaultValues(lessudmf_t* context)
+{
+    CONTEXT_Print(context, "Removing %s fields that match the default values... ", UDMF_STR);
+    uint8_t levelElement;
+    for (uint32_t b = 0; b < context->blockCount; b++) { // for each block
+        if (!strncmp(context->blocks[b].header, LINEDEF_STR, 7))
+            levelElement = LEVEL_LINEDEF;
+        else if (!strncmp(context->blocks[b].header, SIDEDEF_STR, 7))
+            levelElement = LEVEL_SIDEDEF;
+        else if (!strncmp(context->blocks[b].header, SECTOR_STR, 6))
+            levelElement = LEVEL_SECTOR;
+        else if (!strncmp(context->blocks[b].header, THING_STR, 5))
+            levelElement = LEVEL_THING;
+        else
+            continue;
+
+        uint8_t y = 0;
+        while (y < context->blocks[b].fieldsCount) {
+            int match = 0;
+            for (uint16_t x = 0; context->config.defaultValues[levelElement][x].key; x++) {
+                if (!strcmp(context->config.defaultValues[levelElement][x].key, context->blocks[b].fields[y].key) && !strcmp(context->config.defaultValues[levelElement][x].value, context->blocks[b].fields[y].value)) {
+                    removeField(context, &context->blocks[b], context->blocks[b].fields[y].key);
+                    match = 1;
+                    break; // restart at same y, as fields have shifted
+                }
+            }
+            if (!match)
+                y++;
+        }
+    }
+    CONTEXT_Print(context, "%s\n", DONE_STR);
+}
+
+// Remove the flats of the sector surfaces which can not be seen, as described by the sector texture rules
+static void MAP_RemoveUnseenFlatTextures(lessudmf_t* context)
+{
+    CONTEXT_Print(context, "Removing flat textures fron non-visible sector surfaces... ");
+
+    const texturerule_t* rules = TEXTURERULES_Get(context, LEVEL_SECTOR);
+    for (uint32_t s = 0; s < context->sectorCount && rules; s++) {
+        rulecontext_t ruleContext = { 0, 0, context->sectors[s].block, 0, SECTOR_GetSlopedPlanes(context, &context->sectors[s]) };
+        TEXTURERULES_Apply(context, rules, &ruleContext, context->sectors[s].block);
+    }
+
+    CONTEXT_Print(context, "%s\n", DONE_STR);
+}
+
+// Rewrite an index field (such as "v1" or "sector") of a block using the old->new index table.
+// Fields referencing a removed element (new index -1) are removed from the block.
+static void BLOCK_RemapIndexField(lessudmf_t* context, block_t* blk, const char* key, const int32_t* oldToNew, uint32_t count)
+{
+    const char* value = getFieldValueFromBlock(blk, key);
+    if (!value)
+        return;
+
+    int32_t index = (int32_t)strtol(value, 0, 10);
+    if (index < 0 || (uint32_t)index >= count)
+        return;
+
+    if (oldToNew[index] < 0) {
+        removeField(context, blk, key);
+    } else if (oldToNew[index] != index) {
+        snprintf(context->buffer_str, sizeof(context->buffer_str), "%d", oldToNew[index]);
+        setFieldValue(context, blk, key, context->buffer_str);
+    }
+}
+
+// Remove the level elements marked in the removed[LEVEL_*] arrays (one byte per element in map order,
+// NULL if nothing of that element type is removed) and remap the linedef v1/v2/sidefront/sideback and
+// sidedef sector references to the compacted ordering. The element references are rebuilt afterwards.
+static void MAP_RemoveElements(lessudmf_t* context, uint8_t* removed[5])
+{
+    int32_t* oldToNew[5] = { 0 };
+    const uint32_t counts[5] = { context->vertexCount, context->linedefCount, context->sidedefCount, context->sectorCount, 0 };
+
+    // Build the old->new index tables
+    for (uint8_t e = LEVEL_VERTEX; e <= LEVEL_SECTOR; e++) {
+        if (!removed[e] || !counts[e])
+            continue;
+
+        oldToNew[e] = (int32_t*)MEMORY_Alloc(context, counts[e] * sizeof(int32_t));
+        if (!oldToNew[e]) {
+            fprintf(stderr, "%s %s %s the index remapping table\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+            CONTEXT_Fail(context);
+        }
+        int32_t newIndex = 0;
+        for (uint32_t i = 0; i < counts[e]; i++)
+            oldToNew[e][i] = removed[e][i] ? -1 : newIndex++;
+    }
+
+    // Remap the references of the elements that are kept
+    for (uint32_t i = 0; i < context->linedefCount; i++) {
+        if (removed[LEVEL_LINEDEF] && removed[LEVEL_LINEDEF][i])
+            continue;
+        if (oldToNew[LEVEL_VERTEX]) {
+            BLOCK_RemapIndexField(context, context->linedefs[i].block, "v1", oldToNew[LEVEL_VERTEX], context->vertexCount);
+            BLOCK_RemapIndexField(context, context->linedefs[i].block, "v2", oldToNew[LEVEL_VERTEX], context->vertexCount);
+        }
+        if (oldToNew[LEVEL_SIDEDEF]) {
+            BLOCK_RemapIndexField(context, context->linedefs[i].block, SIDEFRONT_STR, oldToNew[LEVEL_SIDEDEF], context->sidedefCount);
+            BLOCK_RemapIndexField(context, context->linedefs[i].block, SIDEBACK_STR, oldToNew[LEVEL_SIDEDEF], context->sidedefCount);
+        }
+    }
+    if (oldToNew[LEVEL_SECTOR]) {
+        for (uint32_t i = 0; i < context->sidedefCount; i++) {
+            if (removed[LEVEL_SIDEDEF] && removed[LEVEL_SIDEDEF][i])
+                continue;
+            BLOCK_RemapIndexField(context, context->sidedefs[i].block, SECTOR_STR, oldToNew[LEVEL_SECTOR], context->sectorCount);
+        }
+    }
+
+    for (uint8_t e = 0; e < 5; e++)
+        MEMORY_Free(context, oldToNew[e]);
+
+    // Remove the blocks themselves
+    uint32_t elementIndex[5] = { 0 };
+    uint32_t writeIndex = 0;
+    for (uint32_t i = 0; i < context->blockCount; i++) {
+        uint8_t e = BLOCK_GetLevelElement(&context->blocks[i]);
+
+        if (e != UINT8_MAX && removed[e] && removed[e][elementIndex[e]++]) {
+            BLOCK_Free(context, &context->blocks[i]);
+            continue;
+        }
+        if (writeIndex != i)
+            context->blocks[writeIndex] = context->blocks[i];
+        writeIndex++;
+    }
+    context->blockCount = writeIndex;
+
+    TEXTMAP_BuildReferences(context);
+}
+
+// Renumber the vertices, sidedefs and sectors by the amount of references to them (linedef v1/v2/sidefront/sideback
+// and sidedef sector), the most referenced elements get the smallest indices and so the shortest numbers in TEXTMAP.
+// Elements with the same amount of references keep their order. The geometry does not change.
+static void MAP_RenumberElements(lessudmf_t* context)
+{
+    CONTEXT_Print(context, "Renumbering the level elements by the amount of references... ");
+
+    const uint32_t counts[5] = { context->vertexCount, 0, context->sidedefCount, context->sectorCount, 0 };
+    uint32_t* references[5] = { 0 };
+    int32_t* oldToNew[5] = { 0 };
+    for (uint8_t e = LEVEL_VERTEX; e <= LEVEL_SECTOR; e++) {
+        if (e == LEVEL_LINEDEF)
+            continue;
+        references[e] = (uint32_t*)MEMORY_Calloc(context, counts[e] + 1, sizeof(uint32_t));
+        oldToNew[e] = (int32_t*)MEMORY_Alloc(context, (counts[e] + 1) * sizeof(int32_t));
+        if (!(references[e] && oldToNew[e])) {
+            fprintf(stderr, "%s %s %s the index remapping table\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+            CONTEXT_Fail(context);
+        }
+    }
+
+    for (uint32_t i = 0; i < context->linedefCount; i++) {
+        if (context->linedefs[i].v1)
+            references[LEVEL_VERTEX][context->linedefs[i].v1 - context->vertices]++;
+        if (context->linedefs[i].v2)
+            references[LEVEL_VERTEX][context->linedefs[i].v2 - context->vertices]++;
+        if (context->linedefs[i].sidefront)
+            references[LEVEL_SIDEDEF][context->linedefs[i].sidefront - context->sidedefs]++;
+        if (context->linedefs[i].sideback)
+            references[LEVEL_SIDEDEF][context->linedefs[i].sideback - context->sidedefs]++;
+    }
+    for (uint32_t i = 0; i < context->sidedefCount; i++) {
+        if (context->sidedefs[i].sector)
+            references[LEVEL_SECTOR][context->sidedefs[i].sector - context->sectors]++;
+    }
+
+    // Sort by the amount of references (descending), then by the old index
+    uint32_t moved = 0;
+    for (uint8_t e = LEVEL_VERTEX; e <= LEVEL_SECTOR; e++) {
+        if (!references[e])
+            continue;
+        uint64_t* order = (uint64_t*)MEMORY_Alloc(context, (counts[e] + 1) * sizeof(uint64_t));
+        if (!order) {
+            fprintf(stderr, "%s %s %s the index remapping table\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+            CONTEXT_Fail(context);
+        }
+        for (uint32_t i = 0; i < counts[e]; i++)
+            order[i] = ((uint64_t)(UINT32_MAX - references[e][i]) << 32) | i;
+        qsort(order, counts[e], sizeof(uint64_t), SECTORVERTEX_Compare);
+        for (uint32_t i = 0; i < counts[e]; i++) {
+            oldToNew[e][(uint32_t)order[i]] = (int32_t)i;
+            moved += ((uint32_t)order[i] != i);
+        }
+        MEMORY_Free(context, order);
+        MEMORY_Free(context, references[e]);
+    }
+
+    if (moved) {
+        // Remap the references
+        for (uint32_t i = 0; i < context->linedefCount; i++) {
+            BLOCK_RemapIndexField(context, context->linedefs[i].block, "v1", oldToNew[LEVEL_VERTEX], context->vertexCount);
+            BLOCK_RemapIndexField(context, context->linedefs[i].block, "v2", oldToNew[LEVEL_VERTEX], context->vertexCount);
+            BLOCK_RemapIndexField(context, context->linedefs[i].block, SIDEFRONT_STR, oldToNew[LEVEL_SIDEDEF], context->sidedefCount);
+            BLOCK_RemapIndexField(context, context->linedefs[i].block, SIDEBACK_STR, oldToNew[LEVEL_SIDEDEF], context->sidedefCount);
+        }
+        for (uint32_t i = 0; i < context->sidedefCount; i++)
+            BLOCK_RemapIndexField(context, context->sidedefs[i].block, SECTOR_STR, oldToNew[LEVEL_SECTOR], context->sectorCount);
+
+        // Move the blocks, every element takes the place of the element with its new index in the block list
+        uint32_t* positions[5] = { 0 };
+        uint32_t elementIndex[5] = { 0 };
+        block_t* old = (block_t*)MEMORY_Alloc(context, context->blockCount * sizeof(block_t));
+        for (uint8_t e = LEVEL_VERTEX; e <= LEVEL_SECTOR; e++) {
+            if (oldToNew[e] && !(positions[e] = (uint32_t*)MEMORY_Alloc(context, (counts[e] + 1) * sizeof(uint32_t))))
+                old = 0;
+        }
+        if (!old) {
+            fprintf(stderr, "%s %s %s the block reordering table\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+            CONTEXT_Fail(context);
+        }
+        memcpy(old, context->blocks, context->blockCount * sizeof(block_t));
+        for (uint32_t i = 0; i < context->blockCount; i++) {
+            uint8_t e = BLOCK_GetLevelElement(&old[i]);
+            if (e != UINT8_MAX && oldToNew[e])
+                positions[e][elementIndex[e]++] = i;
+        }
+        memset(elementIndex, 0, sizeof(elementIndex));
+        for (uint32_t i = 0; i < context->blockCount; i++) {
+            uint8_t e = BLOCK_GetLevelElement(&old[i]);
+            if (e != UINT8_MAX && oldToNew[e]) {
+                context->blocks[positions[e][oldToNew[e][elementIndex[e]]]] = old[i];
+                elementIndex[e]++;
+            }
+        }
+        MEMORY_Free(context, old);
+        for (uint8_t e = 0; e < 5; e++)
+            MEMORY_Free(context, positions[e]);
+
+        TEXTMAP_BuildReferences(context);
+    }
+
+    for (uint8_t e = 0; e < 5; e++)
+        MEMORY_Free(context, oldToNew[e]);
+
+    CONTEXT_Print(context, "%s (%u moved)\n", DONE_STR, moved);
+
+    // The old nodes and reject refer to the old indices
+    if (moved && !((context->FLAGS & LESSUDMF_FLAG_BUILDNODES) && (context->FLAGS & LESSUDMF_FLAG_BUILDREJECT)))
+        CONTEXT_Print(context, "The map elements were renumbered, the nodes and reject of the map are rebuilt\n");
+    if (moved)
+        context->mapFlags |= LESSUDMF_FLAG_BUILDNODES | LESSUDMF_FLAG_BUILDREJECT;
+}
+
+// Check if the linedef does anything besides being a wall (has a special or can be found by tag)
+static uint8_t BOOL_IsLinedefFunctional(const block_t* linedef)
+{
+    const char* special = getFieldValueFromBlock(linedef, SPECIAL_STR);
+    const char* id = getFieldValueFromBlock(linedef, "id");
+
+    if (special && strtol(special, 0, 10))
+        return 1;
+    if (id && strtol(id, 0, 10))
+        return 1;
+    return BOOL_BlockHasField(linedef, "moreids");
+}
+
+// Compare the sidedefs of two linedefs, missing sidedefs are equal to each other
+static uint8_t BOOL_AreSidesEqual(lessudmf_t* context, const sidedef_t* a, const sidedef_t* b)
+{
+    if (!a || !b)
+        return a == b;
+    return a == b || BOOL_AreBlocksEqual(context, a->block, b->block);
+}
+
+typedef struct {
+    uint32_t v1;
+    uint32_t v2;
+    uint32_t linedef;
+} linedefkey_t;
+
+static int LINEDEFKEY_Compare(const void* a, const void* b)
+{
+    const linedefkey_t* ka = (const linedefkey_t*)a;
+    const linedefkey_t* kb = (const linedefkey_t*)b;
+
+    if (ka->v1 != kb->v1)
+        return ka->v1 < kb->v1 ? -1 : 1;
+    if (ka->v2 != kb->v2)
+        return ka->v2 < kb->v2 ? -1 : 1;
+    return ka->linedef < kb->linedef ? -1 : (ka->linedef > kb->linedef);
+}
+
+// Remove zero-length linedefs, exact duplicate linedefs and sectors with no area.
+// Linedefs with a special or a tag are never removed, neither are sectors with a special or a tag.
+static void MAP_RemoveDegenerateGeometry(lessudmf_t* context)
+{
+    CONTEXT_Print(context, "Removing degenerate and duplicate geometry... ");
+
+    uint8_t* removed[5] = { 0 };
+    removed[LEVEL_VERTEX] = (uint8_t*)MEMORY_Calloc(context, context->vertexCount + 1, 1);
+    removed[LEVEL_LINEDEF] = (uint8_t*)MEMORY_Calloc(context, context->linedefCount + 1, 1);
+    removed[LEVEL_SIDEDEF] = (uint8_t*)MEMORY_Calloc(context, context->sidedefCount + 1, 1);
+    removed[LEVEL_SECTOR] = (uint8_t*)MEMORY_Calloc(context, context->sectorCount + 1, 1);
+    if (!(removed[LEVEL_VERTEX] && removed[LEVEL_LINEDEF] && removed[LEVEL_SIDEDEF] && removed[LEVEL_SECTOR])) {
+        fprintf(stderr, "%s %s %s the geometry removal tables\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        CONTEXT_Fail(context);
+    }
+    uint32_t removedLinedefs = 0;
+    uint32_t removedSectors = 0;
+
+    // Zero-length linedefs: both ends are the same vertex or the vertices have the same coordinates
+    for (uint32_t i = 0; i < context->linedefCount; i++) {
+        const linedef_t* l = &context->linedefs[i];
+        if (!l->v1 || !l->v2 || BOOL_IsLinedefFunctional(l->block))
+            continue;
+        if (l->v1 == l->v2 || (l->v1->x == l->v2->x && l->v1->y == l->v2->y)) {
+            removed[LEVEL_LINEDEF][i] = 1;
+            removedLinedefs++;
+        }
+    }
+
+    // Duplicate linedefs: same vertex pair in the same direction, same fields and identical sidedefs
+    linedefkey_t* keys = (linedefkey_t*)MEMORY_Alloc(context, (context->linedefCount + 1) * sizeof(linedefkey_t));
+    if (!keys) {
+        fprintf(stderr, "%s %s %s the %s sorting table\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, LINEDEF_STR);
+        CONTEXT_Fail(context);
+    }
+    context->bufferA = 0; // amount of keys
+    for (uint32_t i = 0; i < context->linedefCount; i++) {
+        if (removed[LEVEL_LINEDEF][i] || !context->linedefs[i].v1 || !context->linedefs[i].v2 || BOOL_IsLinedefFunctional(context->linedefs[i].block))
+            continue;
+        keys[context->bufferA].v1 = (uint32_t)(context->linedefs[i].v1 - context->vertices);
+        keys[context->bufferA].v2 = (uint32_t)(context->linedefs[i].v2 - context->vertices);
+        keys[context->bufferA].linedef = i;
+        context->bufferA++;
+    }
+    qsort(keys, context->bufferA, sizeof(linedefkey_t), LINEDEFKEY_Compare);
+
+    const char* sideKeys[] = { SIDEFRONT_STR, SIDEBACK_STR, 0 };
+    for (uint32_t start = 0; start < context->bufferA;) {
+        uint32_t end = start + 1;
+        while (end < context->bufferA && keys[end].v1 == keys[start].v1 && keys[end].v2 == keys[start].v2)
+            end++;
+
+        // Compare every linedef in the run with the ones that come after it, the first one is kept
+        for (uint32_t a = start; a < end; a++) {
+            const linedef_t* la = &context->linedefs[keys[a].linedef];
+            if (removed[LEVEL_LINEDEF][keys[a].linedef])
+                continue;
+            for (uint32_t b = a + 1; b < end; b++) {
+                const linedef_t* lb = &context->linedefs[keys[b].linedef];
+                if (removed[LEVEL_LINEDEF][keys[b].linedef])
+                    continue;
+                if (BOOL_AreBlocksEqualIgnoring(context, la->block, lb->block, sideKeys) && BOOL_AreSidesEqual(context, la->sidefront, lb->sidefront) && BOOL_AreSidesEqual(context, la->sideback, lb->sideback)) {
+                    removed[LEVEL_LINEDEF][keys[b].linedef] = 1;
+                    removedLinedefs++;
+                }
+            }
+        }
+        start = end;
+    }
+    MEMORY_Free(context, keys);
+
+    // Sectors with no area: the signed area is summed over the sector boundary. A sector can only be removed
+    // if none of its linedefs separate it from another sector (otherwise they'd be left without a side).
+    double* area = (double*)MEMORY_Calloc(context, context->sectorCount + 1, sizeof(double));
+    uint8_t* bordered = (uint8_t*)MEMORY_Calloc(context, context->sectorCount + 1, 1);
+    if (!(area && bordered)) {
+        fprintf(stderr, "%s %s %s the %s area tables\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, SECTOR_STR);
+        CONTEXT_Fail(context);
+    }
+    for (uint32_t i = 0; i < context->linedefCount; i++) {
+        const linedef_t* l = &context->linedefs[i];
+        if (removed[LEVEL_LINEDEF][i])
+            continue;
+
+        sector_t* front = (l->sidefront) ? l->sidefront->sector : 0;
+        sector_t* back = (l->sideback) ? l->sideback->sector : 0;
+
+        if (l->v1 && l->v2) {
+            // The front side is on the right of the linedef
+            double cross = l->v1->x * l->v2->y - l->v2->x * l->v1->y;
+            if (front)
+                area[front - context->sectors] -= cross;
+            if (back)
+                area[back - context->sectors] += cross;
+        }
+
+        if (front && back && front != back) {
+            bordered[front - context->sectors] = 1;
+            bordered[back - context->sectors] = 1;
+        }
+        if (BOOL_IsLinedefFunctional(l->block)) {
+            if (front)
+                bordered[front - context->sectors] = 1;
+            if (back)
+                bordered[back - context->sectors] = 1;
+        }
+    }
+    for (uint32_t s = 0; s < context->sectorCount; s++) {
+        const char* special = getFieldValueFromBlock(context->sectors[s].block, SPECIAL_STR);
+        const char* id = getFieldValueFromBlock(context->sectors[s].block, "id");
+
+        if (bordered[s] || fabs(area[s]) > 1e-6)
+            continue;
+        if ((special && strtol(special, 0, 10)) || (id && strtol(id, 0, 10)) || BOOL_BlockHasField(context->sectors[s].block, "moreids"))
+            continue;
+        removed[LEVEL_SECTOR][s] = 1;
+        removedSectors++;
+    }
+    MEMORY_Free(context, area);
+    MEMORY_Free(context, bordered);
+
+    // Remove the linedefs that are only inside removed sectors
+    for (uint32_t i = 0; i < context->linedefCount; i++) {
+        const linedef_t* l = &context->linedefs[i];
+        if (removed[LEVEL_LINEDEF][i])
+            continue;
+        if ((l->sidefront && l->sidefront->sector && removed[LEVEL_SECTOR][l->sidefront->sector - context->sectors]) || (l->sideback && l->sideback->sector && removed[LEVEL_SECTOR][l->sideback->sector - context->sectors])) {
+            removed[LEVEL_LINEDEF][i] = 1;
+            removedLinedefs++;
+        }
+    }
+
+    // Remove sidedefs and vertices which are no longer referenced by any linedef
+    memset(removed[LEVEL_SIDEDEF], 1, context->sidedefCount);
+    memset(removed[LEVEL_VERTEX], 1, context->vertexCount);
+    for (uint32_t i = 0; i < context->linedefCount; i++) {
+        const linedef_t* l = &context->linedefs[i];
+        if (removed[LEVEL_LINEDEF][i])
+            continue;
+        if (l->sidefront)
+            removed[LEVEL_SIDEDEF][l->sidefront - context->sidedefs] = 0;
+        if (l->sideback)
+            removed[LEVEL_SIDEDEF][l->sideback - context->sidedefs] = 0;
+        if (l->v1)
+            removed[LEVEL_VERTEX][l->v1 - context->vertices] = 0;
+        if (l->v2)
+            removed[LEVEL_VERTEX][l->v2 - context->vertices] = 0;
+    }
+
+    context->bufferA = context->vertexCount; // amount of vertices before removal
+    context->bufferB = context->sidedefCount; // amount of sidedefs before removal
+    MAP_RemoveElements(context, removed);
+
+    for (uint8_t e = 0; e < 5; e++)
+        MEMORY_Free(context, removed[e]);
+
+    CONTEXT_Print(context, "%s (%u %ss, %u %ss, %u %ss, %u vertices)\n", DONE_STR, removedLinedefs, LINEDEF_STR, context->bufferB - context->sidedefCount, SIDEDEF_STR, removedSectors, SECTOR_STR, context->bufferA - context->vertexCount);
+
+    // The old nodes refer to the removed linedefs and vertices, the old reject has a row for every removed sector
+    uint32_t rebuild = 0;
+    if (context->bufferA != context->vertexCount || removedLinedefs)
+        rebuild |= LESSUDMF_FLAG_BUILDNODES;
+    if (removedSectors)
+        rebuild |= LESSUDMF_FLAG_BUILDREJECT;
+    if ((rebuild & LESSUDMF_FLAG_BUILDNODES) && !(context->FLAGS & LESSUDMF_FLAG_BUILDNODES))
+        CONTEXT_Print(context, "The map geometry was changed, the nodes of the map are rebuilt\n");
+    if ((rebuild & LESSUDMF_FLAG_BUILDREJECT) && !(context->FLAGS & LESSUDMF_FLAG_BUILDREJECT))
+        CONTEXT_Print(context, "The %ss were removed, the reject of the map is rebuilt\n", SECTOR_STR);
+    context->mapFlags |= rebuild;
+}
+
+static int FIELD_Compare(const void* a, const void* b)
+{
+    const field_t* fa = *(const field_t* const*)a;
+    const field_t* fb = *(const field_t* const*)b;
+    int result = strcmp(fa->key, fb->key);
+    return result ? result : strcmp(fa->value, fb->value);
+}
+
+// Check if the thing type is meant to be placed on top of each other (config "stackable")
+static uint8_t BOOL_IsThingStackable(lessudmf_t* context, const block_t* thing)
+{
+    const char* type = getFieldValueFromBlock(thing, "type");
+    long value = strtol(type ? type : "0", 0, 10);
+
+    for (uint16_t a = 0; context->config.thingTypesStackable && context->config.thingTypesStackable[a]; a++) {
+        if (value == context->config.thingTypesStackable[a])
+            return 1;
+    }
+    return 0;
+}
+
+// Remove the things which are exact copies of an earlier thing (the same fields in any order).
+// Things that can be found by tag and the stackable thing types are kept.
+static void MAP_RemoveDuplicateThings(lessudmf_t* context)
+{
+    CONTEXT_Print(context, "Removing duplicate things... ");
+
+    uint32_t thingCount = 0;
+    for (uint32_t b = 0; b < context->blockCount; b++)
+        thingCount += (BLOCK_GetLevelElement(&context->blocks[b]) == LEVEL_THING);
+
+    uint8_t* removed[5] = { 0 };
+    removed[LEVEL_THING] = (uint8_t*)MEMORY_Calloc(context, thingCount + 1, 1);
+    field_t** sorted = (field_t**)MEMORY_Alloc(context, 256 * sizeof(field_t*));
+    size_t keySize = 256;
+    char* key = (char*)MEMORY_Alloc(context, keySize);
+    if (!(removed[LEVEL_THING] && sorted && key)) {
+        fprintf(stderr, "%s %s %s the duplicate %ss table\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, THING_STR);
+        CONTEXT_Fail(context);
+    }
+
+    // Every thing is keyed by its fields sorted by key, so the field order does not matter
+    hashtable_t seen = { 0 };
+    uint32_t thing = 0;
+    uint32_t removedThings = 0;
+    for (uint32_t b = 0; b < context->blockCount; b++) {
+        const block_t* blk = &context->blocks[b];
+        if (BLOCK_GetLevelElement(blk) != LEVEL_THING)
+            continue;
+        thing++;
+
+        const char* id = getFieldValueFromBlock(blk, "id");
+        if ((id && strtol(id, 0, 10)) || BOOL_IsThingStackable(context, blk))
+            continue;
+
+        size_t length = 0;
+        for (uint8_t f = 0; f < blk->fieldsCount; f++) {
+            sorted[f] = &blk->fields[f];
+            length += strlen(blk->fields[f].key) + strlen(blk->fields[f].value) + 2;
+        }
+        qsort(sorted, blk->fieldsCount, sizeof(field_t*), FIELD_Compare);
+
+        if (length + 1 > keySize) {
+            keySize = length + 1;
+            key = (char*)MEMORY_Realloc(context, key, keySize);
+            if (!key) {
+                fprintf(stderr, "%s %s %s the duplicate %ss table\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, THING_STR);
+                CONTEXT_Fail(context);
+            }
+        }
+        length = 0;
+        for (uint8_t f = 0; f < blk->fieldsCount; f++)
+            length += sprintf(key + length, "%s=%s;", sorted[f]->key, sorted[f]->value);
+
+        if (HASHTABLE_Get(&seen, key, 0)) {
+            removed[LEVEL_THING][thing - 1] = 1;
+            removedThings++;
+        } else
+            HASHTABLE_Set(context, &seen, key, 1);
+    }
+    HASHTABLE_Free(context, &seen);
+    MEMORY_Free(context, sorted);
+    MEMORY_Free(context, key);
+
+    if (removedThings)
+        MAP_RemoveElements(context, removed);
+    MEMORY_Free(context, removed[LEVEL_THING]);
+
+    CONTEXT_Print(context, "%s (%u %ss)\n", DONE_STR, removedThings, THING_STR);
+}
+
+// Character of the TEXTMAP at the pointer, 0 past the end of the lump
+#define TEXTMAP_CHAR(p) ((p) < end ? *(p) : '\0')
+
+// Tokenize TEXTMAP into block structures (block_t). The lump does not have to be zero-terminated,
+// it is parsed straight from the mapped Input WAD.
+static void TEXTMAP_Parse(lessudmf_t* context, const char* textmapdata, uint32_t size)
+{
+    const char* ptr = textmapdata;
+    const char* end = textmapdata + size;
+    while (ptr < end) {
+        // skip whitespace and comments at top-level
+        if (TEXTMAP_CHAR(ptr) == '/' && TEXTMAP_CHAR(ptr + 1) == '/') {
+            ptr += 2;
+            while (ptr < end && *ptr != '\n')
+                ptr++;
+            if (ptr < end)
+                ptr++;
+            continue;
+        }
+        if (TEXTMAP_CHAR(ptr) == '/' && TEXTMAP_CHAR(ptr + 1) == '*') {
+            ptr += 2;
+            while (ptr < end && !(*ptr == '*' && TEXTMAP_CHAR(ptr + 1) == '/'))
+                ptr++;
+            if (ptr < end)
+                ptr += 2;
+            continue;
+        }
+        if (isspace(TEXTMAP_CHAR(ptr))) {
+            ptr++;
+            continue;
+        }
+
+        // namespace
+        if (end - ptr >= 9 && !strncmp(ptr, NAMESPACE_STR, 9)) {
+            ptr += 9;
+            while (isspace(TEXTMAP_CHAR(ptr)))
+                ptr++;
+            if (TEXTMAP_CHAR(ptr) == '=')
+                ptr++;
+            while (isspace(TEXTMAP_CHAR(ptr)))
+                ptr++;
+            if (TEXTMAP_CHAR(ptr) == '"') {
+                ptr++;
+                const char* start = ptr;
+                while (ptr < end && *ptr != '"')
+                    ptr++;
+                size_t len = ptr - start;
+                context->namespaceValue = (char*)MEMORY_Alloc(context, len + 1);
+                if (!context->namespaceValue) {
+                    fprintf(stderr, "%s %s %s the %s value\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, NAMESPACE_STR);
+                    CONTEXT_Fail(context);
+                }
+                memcpy(context->namespaceValue, start, len);
+                context->namespaceValue[len] = '\0';
+                if (TEXTMAP_CHAR(ptr) == '"')
+                    ptr++;
+            }
+
+            // determine engine
+            if (context->FLAGS & LESSUDMF_FLAG_CUSTOMCONFIG) {
+                context->gameEngine = ENGINE_UNKNOWN;
+            } else {
+                if (context->namespaceValue) {
+                    if (!strncmp(context->namespaceValue, "doom", 4))
+                        context->gameEngine = ENGINE_DOOM;
+                    else if (!strncmp(context->namespaceValue, "heretic", 7))
+                        context->gameEngine = ENGINE_HERETIC;
+                    else if (!strncmp(context->namespaceValue, "hexen", 5))
+                        context->gameEngine = ENGINE_HEXEN;
+                    else if (!strncmp(context->namespaceValue, "strife", 6))
+                        context->gameEngine = ENGINE_STRIFE;
+                    else if (!strncmp(context->namespaceValue, "zdoom", 5))
+                        context->gameEngine = ENGINE_ZDOOM;
+                    else if (!strncmp(context->namespaceValue, "srb2", 4))
+                        context->gameEngine = ENGINE_SRB2;
+                    else
+                        context->gameEngine = ENGINE_UNKNOWN;
+                } else {
+                    context->gameEngine = ENGINE_UNKNOWN;
+                }
+            }
+
+            // skip until semicolon
+            while (ptr < end && *ptr != ';')
+                ptr++;
+            if (TEXTMAP_CHAR(ptr) == ';')
+                ptr++;
+            continue;
+        }
+
+        // Read block header (skip leading whitespace and avoid consuming comments)
+        char headerBuf[64];
+        int hi = 0;
+
+        // read header token until whitespace, '{' or comment start
+        while (ptr < end && *ptr != '{') {
+            if ((TEXTMAP_CHAR(ptr) == '/' && (TEXTMAP_CHAR(ptr + 1) == '/' || TEXTMAP_CHAR(ptr + 1) == '*')) || isspace(TEXTMAP_CHAR(ptr)))
+                break; // don't include comment start or whitespace in header
+            if (hi < (int)sizeof(headerBuf) - 1)
+                headerBuf[hi++] = *ptr;
+            ptr++;
+        }
+        headerBuf[hi] = '\0';
+
+        // If we didn't read a header (e.g. encountered comment or stray chars), skip comments and continue
+        if (!hi) {
+            // skip comments or stray characters until next top-level token
+            if (TEXTMAP_CHAR(ptr) == '/' && TEXTMAP_CHAR(ptr + 1) == '/') {
+                ptr += 2;
+                while (ptr < end && *ptr != '\n')
+                    ptr++;
+                if (ptr < end)
+                    ptr++;
+                continue;
+            }
+            if (TEXTMAP_CHAR(ptr) == '/' && TEXTMAP_CHAR(ptr + 1) == '*') {
+                ptr += 2;
+                while (ptr < end && !(*ptr == '*' && TEXTMAP_CHAR(ptr + 1) == '/'))
+                    ptr++;
+                if (ptr < end)
+                    ptr += 2;
+                continue;
+            }
+            // if we hit '{' without a header, just skip it
+            if (TEXTMAP_CHAR(ptr) == '{') {
+                ptr++;
+                continue;
+            }
+            // otherwise continue to next iteration
+            continue;
+        }
+
+        // Allocate space for the new block_t and add new block to the memory
+        block_t* newBlocks = (block_t*)MEMORY_Realloc(context, context->blocks, (context->blockCount + 1) * sizeof(block_t));
+        if (!newBlocks) {
+            fprintf(stderr, "%s %s re%s the blocks array for the new block\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+            CONTEXT_Fail(context);
+        }
+        context->blocks = newBlocks;
+        block_t* blk = &context->blocks[context->blockCount];
+        memset(blk, 0, sizeof(block_t));
+        memcpy(blk->header, headerBuf, strnlen(headerBuf, sizeof(blk->header) - 1));
+
+        // skip whitespace/comments between header and '{'
+        while (ptr < end) {
+            if (isspace(TEXTMAP_CHAR(ptr))) {
+                ptr++;
+                continue;
+            }
+            if (TEXTMAP_CHAR(ptr) == '/' && TEXTMAP_CHAR(ptr + 1) == '/') {
+                ptr += 2;
+                while (ptr < end && *ptr != '\n')
+                    ptr++;
+                if (ptr < end)
+                    ptr++;
+                continue;
+            }
+            if (TEXTMAP_CHAR(ptr) == '/' && TEXTMAP_CHAR(ptr + 1) == '*') {
+                ptr += 2;
+                while (ptr < end && !(*ptr == '*' && TEXTMAP_CHAR(ptr + 1) == '/'))
+                    ptr++;
+                if (ptr < end)
+                    ptr += 2;
+                continue;
+            }
+            break;
+        }
+        if (TEXTMAP_CHAR(ptr) == '{')
+            ptr++;
+
+        // Parse fields inside block
+        while (ptr < end) {
+            // skip whitespace and comments
+            if (TEXTMAP_CHAR(ptr) == '/' && TEXTMAP_CHAR(ptr + 1) == '/') {
+                ptr += 2;
+                while (ptr < end && *ptr != '\n')
+                    ptr++;
+                if (ptr < end)
+                    ptr++;
+                continue;
+            }
+            if (TEXTMAP_CHAR(ptr) == '/' && TEXTMAP_CHAR(ptr + 1) == '*') {
+                ptr += 2;
+                while (ptr < end && !(*ptr == '*' && TEXTMAP_CHAR(ptr + 1) == '/'))
+                    ptr++;
+                if (ptr < end)
+                    ptr += 2;
+                continue;
+            }
+            if (isspace(TEXTMAP_CHAR(ptr))) {
+                ptr++;
+                continue;
+            }
+            if (TEXTMAP_CHAR(ptr) == '}') {
+                ptr++;
+                break;
+            }
+
+            // read key
+            char key[128];
+            int ki = 0;
+            while (ptr < end && *ptr != '=' && *ptr != '}' && !isspace(*ptr)) {
+                if (ki < (int)sizeof(key) - 1)
+                    key[ki++] = *ptr;
+                ptr++;
+            }
+            key[ki] = '\0';
+            while (isspace(TEXTMAP_CHAR(ptr)))
+                ptr++;
+            if (TEXTMAP_CHAR(ptr) == '=')
+                ptr++;
+            while (isspace(TEXTMAP_CHAR(ptr)))
+                ptr++;
+
+            // read value
+            char value[1024];
+            int vi = 0;
+            if (TEXTMAP_CHAR(ptr) == '"') {
+                value[vi++] = '"';
+                ptr++;
+                while (ptr < end && *ptr != '"') {
+                    if (vi < (int)sizeof(value) - 1)
+                        value[vi++] = *ptr;
+                    ptr++;
+                }
+                if (TEXTMAP_CHAR(ptr) == '"') {
+                    if (vi < (int)sizeof(value) - 1)
+                        value[vi++] = '"';
+                    ptr++;
+                }
+            } else {
+                while (ptr < end && *ptr != ';' && *ptr != '}') {
+                    if (vi < (int)sizeof(value) - 1)
+                        value[vi++] = *ptr;
+                    ptr++;
+                }
+            }
+            value[vi] = '\0';
+
+            if (BOOL_IsStrFloat(value))
+                FLOAT_TrimValue(value);
+            addField(context, blk, key, value);
+
+            // advance past semicolon if present
+            if (TEXTMAP_CHAR(ptr) == ';')
+                ptr++;
+        }
+
+        context->blockCount++;
+    }
+
+    // Remove trailing empty blocks
+    while (context->blockCount > 0 && context->blocks[context->blockCount - 1].fieldsCount == 0) {
+        MEMORY_Free(context, context->blocks[context->blockCount - 1].fields);
+        context->blockCount--;
+    }
+}
+
+#undef TEXTMAP_CHAR
+
+static void TEXTMAP_BuildReferences(lessudmf_t* context)
+{
+    // Count the amount of elements in map
+    context->sectorCount = 0;
+    context->sidedefCount = 0;
+    context->linedefCount = 0;
+    context->vertexCount = 0;
+    for (uint32_t i = 0; i < context->blockCount; i++) {
+        if (!strncmp(context->blocks[i].header, SECTOR_STR, 6))
+            context->sectorCount++;
+        if (!strncmp(context->blocks[i].header, SIDEDEF_STR, 7))
+            context->sidedefCount++;
+        if (!strncmp(context->blocks[i ].header, LINEDEF_STR, 7))
+            context->linedefCount++;
+        if (!strncmp(context->blocks[i].header, VERTEX_STR, 6))
+            context->vertexCount++;
+    }
+
+    // Memory allocation
+
+    // Vertices
+    context->vertices = (vertex_t*)MEMORY_Realloc(context, context->vertices, context->vertexCount * sizeof(vertex_t));
+    if (context->vertexCount && !context->vertices) {
+        fprintf(stderr, "%s %s (re)%s the %s array\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, VERTEX_STR);
+        CONTEXT_Fail(context);
+    }
+    memset(context->vertices, 0, context->vertexCount * sizeof(vertex_t));
+
+    // Sectors
+    context->sectors = (sector_t*)MEMORY_Realloc(context, context->sectors, context->sectorCount * sizeof(sector_t));
+    if (context->sectorCount && !context->sectors) {
+        fprintf(stderr, "%s %s (re)%s the %s array\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, SECTOR_STR);
+        CONTEXT_Fail(context);
+    }
+    memset(context->sectors, 0, context->sectorCount * sizeof(sector_t));
+
+    // Sidedefs
+    context->sidedefs = (sidedef_t*)MEMORY_Realloc(context, context->sidedefs, context->sidedefCount * sizeof(sidedef_t));
+    if (context->sidedefCount && !context->sidedefs) {
+        fprintf(stderr, "%s %s (re)%s the %s array\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, SIDEDEF_STR);
+        CONTEXT_Fail(context);
+    }
+    memset(context->sidedefs, 0, context->sidedefCount * sizeof(sidedef_t));
+
+    // Linedefs
+    context->linedefs = (linedef_t*)MEMORY_Realloc(context, context->linedefs, context->linedefCount * sizeof(linedef_t));
+    if (context->linedefCount && !context->linedefs) {
+        fprintf(stderr, "%s %s (re)%s the %s array\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, LINEDEF_STR);
+        CONTEXT_Fail(context);
+    }
+    memset(context->linedefs, 0, context->linedefCount * sizeof(linedef_t));
+
+
+    // Assign block references
+    uint32_t sectorID = 0;
+    uint32_t sidedefID = 0;
+    uint32_t linedefID = 0;
+    uint32_t vertexID = 0;
+
+    for (uint32_t i = 0; i < context->blockCount; i++) {
+        if (!strncmp(context->blocks[i].header, VERTEX_STR, 6)) {
+            const char* x_str = getFieldValueFromBlock(&context->blocks[i], "x");
+            const char* y_str = getFieldValueFromBlock(&context->blocks[i], "y");
+            context->vertices[vertexID].block = &context->blocks[i];
+            context->vertices[vertexID].x = strtod(x_str ? x_str : "0", 0);
+            context->vertices[vertexID].y = strtod(y_str ? y_str : "0", 0);
+            vertexID++;
+        } else if (!strncmp(context->blocks[i].header, SECTOR_STR, 6)) {
+            context->sectors[sectorID].block = &context->blocks[i];
+            context->sectors[sectorID].isMaster = -1;
+            context->sectors[sectorID].isSlope = -1;
+            context->sectors[sectorID].masterID = -1;
+            context->sectors[sectorID].sectorID = (int)sectorID;
+            sectorID++;
+        } else if (!strncmp(context->blocks[i].header, SIDEDEF_STR, 7)) {
+            context->sidedefs[sidedefID].block = &context->blocks[i];
+            sidedefID++;
+        } else if (!strncmp(context->blocks[i].header, LINEDEF_STR, 7)) {
+            context->linedefs[linedefID].block = &context->blocks[i];
+            linedefID++;
+        }
+    }
+
+    // Assign sidedef->sector pointers
+    for (uint32_t i = 0; i < context->sidedefCount; i++) {
+        const char* sectorNum_str = getFieldValueFromBlock(context->sidedefs[i].block, SECTOR_STR);
+        if (!sectorNum_str)
+            continue;
+
+        uint32_t sectorNum = (uint32_t)strtol(sectorNum_str, 0, 10);
+        if (sectorNum < context->sectorCount)
+            context->sidedefs[i].sector = &context->sectors[sectorNum];
+    }
+
+    // Assign linedef->vertex and linedef->sidedef pointers
+    for (uint32_t i = 0; i < context->linedefCount; i++) {
+        const char* v1Num_str = getFieldValueFromBlock(context->linedefs[i].block, "v1");
+        const char* v2Num_str = getFieldValueFromBlock(context->linedefs[i].block, "v2");
+
+        if (v1Num_str) {
+            uint32_t v1Num = (uint32_t)strtol(v1Num_str, 0, 10);
+            if (v1Num < context->vertexCount)
+                context->linedefs[i].v1 = &context->vertices[v1Num];
+        }
+
+        if (v2Num_str) {
+            uint32_t v2Num = (uint32_t)strtol(v2Num_str, 0, 10);
+            if (v2Num < context->vertexCount)
+                context->linedefs[i].v2 = &context->vertices[v2Num];
+        }
+
+        const char* frontsideNum_str = getFieldValueFromBlock(context->linedefs[i].block, SIDEFRONT_STR);
+        const char* backsideNum_str = getFieldValueFromBlock(context->linedefs[i].block, SIDEBACK_STR);
+
+        if (frontsideNum_str) {
+            uint32_t frontsideNum = (uint32_t)strtol(frontsideNum_str, 0, 10);
+            if (frontsideNum < context->sidedefCount)
+                context->linedefs[i].sidefront = &context->sidedefs[frontsideNum];
+        }
+
+        if (backsideNum_str) {
+            uint32_t backsideNum = (uint32_t)strtol(backsideNum_str, 0, 10);
+            if (backsideNum < context->sidedefCount)
+                context->linedefs[i].sideback = &context->sidedefs[backsideNum];
+        }
+    }
+}
+
+// Fields written first (in this order) by the canonical ordering, the rest follow sorted by key
+static const char* const canonicalKeys[5][24] = {
+    { "x", "y", "zfloor", "zceiling", 0 }, // LEVEL_VERTEX
+    { "v1", "v2", "sidefront", "sideback", "twosided", "special", "arg0", "arg1", "arg2", "arg3", "arg4", "arg5", "arg6", "arg7", "arg8", "arg9", "stringarg0", "stringarg1", "id", "moreids", 0 }, // LEVEL_LINEDEF
+    { "sector", "texturetop", "texturemiddle", "texturebottom", "offsetx", "offsety", 0 }, // LEVEL_SIDEDEF
+    { "heightfloor", "heightceiling", "texturefloor", "textureceiling", "lightlevel", "special", "id", "moreids", 0 }, // LEVEL_SECTOR
+    { "type", "x", "y", "height", "angle", "id", "arg0", "arg1", "arg2", "arg3", "arg4", "arg5", "arg6", "arg7", "arg8", "arg9", "stringarg0", "stringarg1", 0 } // LEVEL_THING
+};
+
+// Order of the element types in the canonical block ordering
+static const uint8_t canonicalElements[5] = { LEVEL_THING, LEVEL_VERTEX, LEVEL_LINEDEF, LEVEL_SIDEDEF, LEVEL_SECTOR };
+
+// Position of the key in the canonical ordering of the level element, UINT8_MAX if the key is not listed
+static uint8_t FIELD_GetCanonicalRank(uint8_t levelElement, const char* key)
+{
+    for (uint8_t r = 0; canonicalKeys[levelElement][r]; r++) {
+        if (!strcmp(canonicalKeys[levelElement][r], key))
+            return r;
+    }
+    return UINT8_MAX;
+}
+
+static int FIELD_CompareCanonical(uint8_t levelElement, const field_t* a, const field_t* b)
+{
+    uint8_t rankA = FIELD_GetCanonicalRank(levelElement, a->key);
+    uint8_t rankB = FIELD_GetCanonicalRank(levelElement, b->key);
+    if (rankA != rankB)
+        return (rankA < rankB) ? -1 : 1;
+    return strcmp(a->key, b->key);
+}
+
+// Write the blocks grouped by element type and the fields of every block in a fixed order, so the same data
+// always gives the same text and the compressors find more matches. Elements keep their order inside the type
+// group, so all the indices stay valid.
+static void MAP_SortCanonical(lessudmf_t* context)
+{
+    CONTEXT_Print(context, "Sorting the blocks and fields in the canonical order... ");
+
+    // Fields, insertion sort is enough for the few fields of a block
+    for (uint32_t b = 0; b < context->blockCount; b++) {
+        uint8_t e = BLOCK_GetLevelElement(&context->blocks[b]);
+        if (e == UINT8_MAX)
+            continue;
+        field_t* fields = context->blocks[b].fields;
+        for (uint8_t i = 1; i < context->blocks[b].fieldsCount; i++) {
+            field_t field = fields[i];
+            uint8_t j = i;
+            while (j && FIELD_CompareCanonical(e, &field, &fields[j - 1]) < 0) {
+                fields[j] = fields[j - 1];
+                j--;
+            }
+            fields[j] = field;
+        }
+    }
+
+    // Blocks, stable grouping by element type, unknown blocks go last
+    block_t* old = (block_t*)MEMORY_Alloc(context, context->blockCount * sizeof(block_t));
+    if (!old) {
+        fprintf(stderr, "%s %s %s the block reordering table\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        CONTEXT_Fail(context);
+    }
+    memcpy(old, context->blocks, context->blockCount * sizeof(block_t));
+    uint32_t writeIndex = 0;
+    for (uint8_t g = 0; g <= 5; g++) {
+        for (uint32_t b = 0; b < context->blockCount; b++) {
+            uint8_t e = BLOCK_GetLevelElement(&old[b]);
+            if ((g < 5) ? (e == canonicalElements[g]) : (e == UINT8_MAX))
+                context->blocks[writeIndex++] = old[b];
+        }
+    }
+    MEMORY_Free(context, old);
+
+    TEXTMAP_BuildReferences(context);
+    CONTEXT_Print(context, "%s\n", DONE_STR);
+}
+
+// Numeric type of the field of the level element
+static uint8_t FIELD_GetNumberType(lessudmf_t* context, uint8_t levelElement, const char* key)
+{
+    int64_t type;
+    for (uint8_t x = 0; numberTypes[x].key; x++) {
+        if (numberTypes[x].levelElement == levelElement && !strcmp(numberTypes[x].key, key))
+            return numberTypes[x].type;
+    }
+    if ((context->FLAGS & LESSUDMF_FLAG_CONFIGLOADED) && HASHTABLE_Get(&context->config.fieldTypes[levelElement], key, &type))
+        return (uint8_t)type;
+    return NUMBER_ANY;
+}
+
+// Write every numeric value in its canonical form (see NUMBER_Canonicalize), so equal values are always
+// written the same way and blocks which only differed by the number notation can be merged
+static void MAP_CanonicalizeNumbers(lessudmf_t* context)
+{
+    CONTEXT_Print(context, "Canonicalizing the numeric values... ");
+
+    char canonical[64];
+    context->bufferA = 0;
+    for (uint32_t b = 0; b < context->blockCount; b++) {
+        uint8_t e = BLOCK_GetLevelElement(&context->blocks[b]);
+        if (e == UINT8_MAX)
+            continue;
+        for (uint8_t f = 0; f < context->blocks[b].fieldsCount; f++) {
+            field_t* field = &context->blocks[b].fields[f];
+            if (!NUMBER_Canonicalize(field->value, FIELD_GetNumberType(context, e, field->key), canonical, sizeof(canonical)) || !strcmp(canonical, field->value))
+                continue;
+            MEMORY_Free(context, field->value);
+            field->value = MEMORY_StrDup(context, canonical);
+            if (!field->value) {
+                fprintf(stderr, "%s %s %s the %s field value\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, UDMF_STR);
+                CONTEXT_Fail(context);
+            }
+            context->bufferA++;
+        }
+    }
+
+    CONTEXT_Print(context, "%s (%u fields)\n", DONE_STR, context->bufferA);
+}
+
+// Snap the numeric values to the grids of the game config quantization rules. The value is rounded to
+// the nearest multiple of the step and written with no more decimals than the step has.
+static void MAP_QuantizeValues(lessudmf_t* context)
+{
+    CONTEXT_Print(context, "Quantizing the numeric values... ");
+
+    uint8_t decimals[5][256];
+    for (uint8_t e = 0; e < 5; e++) {
+        for (uint16_t r = 0; context->config.quantizeRules[e] && context->config.quantizeRules[e][r].key && r < 256; r++) {
+            char step[64];
+            FLOAT_ToShortestString(context->config.quantizeRules[e][r].step, step, sizeof(step));
+            const char* dot = strchr(step, '.');
+            decimals[e][r] = dot ? (uint8_t)strlen(dot + 1) : 0;
+        }
+    }
+
+    char quantized[64];
+    uint32_t vertexChanges = 0;
+    context->bufferA = 0;
+    for (uint32_t b = 0; b < context->blockCount; b++) {
+        uint8_t e = BLOCK_GetLevelElement(&context->blocks[b]);
+        if (e == UINT8_MAX || !context->config.quantizeRules[e])
+            continue;
+        for (uint8_t f = 0; f < context->blocks[b].fieldsCount; f++) {
+            field_t* field = &context->blocks[b].fields[f];
+            uint16_t r = 0;
+            while (context->config.quantizeRules[e][r].key && strcmp(context->config.quantizeRules[e][r].key, field->key))
+                r++;
+            if (!context->config.quantizeRules[e][r].key || r >= 256)
+                continue;
+
+            char* end;
+            double value = strtod(field->value, &end);
+            if (end == field->value || *end || !isfinite(value))
+                continue;
+            double step = context->config.quantizeRules[e][r].step;
+            snprintf(quantized, sizeof(quantized), "%.*f", decimals[e][r], round(value / step) * step);
+            if (BOOL_IsStrFloat(quantized))
+                FLOAT_TrimValue(quantized);
+            if (!strcmp(quantized, "-0"))
+                strcpy(quantized, "0");
+            if (!strcmp(quantized, field->value))
+                continue;
+
+            MEMORY_Free(context, field->value);
+            field->value = MEMORY_StrDup(context, quantized);
+            if (!field->value) {
+                fprintf(stderr, "%s %s %s the %s field value\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, UDMF_STR);
+                CONTEXT_Fail(context);
+            }
+            vertexChanges += (e == LEVEL_VERTEX);
+            context->bufferA++;
+        }
+    }
+
+    CONTEXT_Print(context, "%s (%u fields)\n", DONE_STR, context->bufferA);
+
+    // The later passes and the nodes read the coordinates of the vertices, the old nodes no longer match them
+    if (vertexChanges)
+        TEXTMAP_BuildReferences(context);
+    if (vertexChanges && !(context->FLAGS & LESSUDMF_FLAG_BUILDNODES))
+        CONTEXT_Print(context, "The map geometry was changed, the nodes of the map are rebuilt%s\n", (context->FLAGS & LESSUDMF_FLAG_REMOVEGEOMETRY) ? "" : " (use -g to remove the linedefs that became zero-length)");
+    if (vertexChanges)
+        context->mapFlags |= LESSUDMF_FLAG_BUILDNODES;
+}
+
+// Generate a new TEXTMAP lump using the blocks data from memory
+static char* TEXTMAP_Generate(lessudmf_t* context, block_t* mapBlocks)
+{
+    uint32_t allocated = 0x100000; // 1 Megabyte
+    uint32_t used = 0;
+    char* out = (char*)MEMORY_Alloc(context, allocated);
+    if (!out) {
+        fprintf(stderr, "%s %s %s the new %s lump\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, TEXTMAP_STR);
+        return 0;
+    }
+
+    used += snprintf(out, allocated, "%s=\"%s\";", NAMESPACE_STR, context->namespaceValue);
+
+    for (uint32_t b = 0; b < context->blockCount; b++) {
+        // Calculate the character length of the block we are about to write
+        uint32_t block_len = strlen(mapBlocks[b].header) + 2;
+        for (uint8_t p = 0; p < mapBlocks[b].fieldsCount; p++) {
+            block_len += strlen(mapBlocks[b].fields[p].key) + strlen(mapBlocks[b].fields[p].value) + 2;
+        }
+
+        // If the buffer is going to be bigger than the amout of space we allocated, allocate more memory
+        while (used + block_len + 1 > allocated) {
+            allocated *= 2;
+            out = (char*)MEMORY_Realloc(context, out, allocated);
+            if (!out) {
+                MEMORY_Free(context, out);
+                fprintf(stderr, "%s %s re%s the new %s lump (%u %s)\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, TEXTMAP_STR, allocated, BYTES_STR);
+                return 0;
+            }
+        }
+
+        // Write the data itself
+        used += snprintf(out + used, allocated - used, "%s{", mapBlocks[b].header);
+        for (uint8_t p = 0; p < mapBlocks[b].fieldsCount; p++) {
+            used += snprintf(out + used, allocated - used, "%s=%s;", mapBlocks[b].fields[p].key, mapBlocks[b].fields[p].value);
+        }
+        used += snprintf(out + used, allocated - used, "}");
+    }
+
+    // Final newline
+    if (used + 1 > allocated) {
+        allocated += 2;
+        out = (char*)MEMORY_Realloc(context, out, allocated);
+        if (!out) {
+            MEMORY_Free(context, out);
+            fprintf(stderr, "%s %s re%s the new %s lump (%u %s)\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, TEXTMAP_STR, allocated, BYTES_STR);
+            return 0;
+        }
+    }
+    out[used++] = '\n';
+    out[used] = 0;
+    return out;
+}
+
+//
+// THREADS
+//
+
+// Function called for every index of THREAD_ParallelFor, returns 0 on failure
+typedef uint8_t (*parallelfunc_t)(lessudmf_t* context, uint32_t index, void* data);
+
+typedef struct {
+    parallelfunc_t func;
+    void* data;
+    uint32_t count;
+    lessudmf_t* context; // context of the calling thread
+    uint32_t next; // next index to be processed
+    uint8_t failed; // a call stopped with an error, the calling thread fails when all the threads are done
+#ifdef LESSUDMF_THREADS
+    pthread_mutex_t lock;
+#endif
+} parallelfor_t;
+
+// Get the amount of threads the program can run at once
+static uint32_t THREAD_GetCount()
+{
+#ifdef LESSUDMF_THREADS
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cpus > 1) ? (uint32_t)cpus : 1;
+#else
+    return 1;
+#endif
+}
+
+static void* THREAD_ParallelWorker(void* arg)
+{
+    parallelfor_t* job = (parallelfor_t*)arg;
+
+    for (;;) {
+#ifdef LESSUDMF_THREADS
+        pthread_mutex_lock(&job->lock);
+#endif
+        uint32_t index = job->next++;
+#ifdef LESSUDMF_THREADS
+        pthread_mutex_unlock(&job->lock);
+#endif
+        if (index >= job->count)
+            break;
+        if (!job->func(job->context, index, job->data)) {
+            // No more indices are taken after an error
+#ifdef LESSUDMF_THREADS
+            pthread_mutex_lock(&job->lock);
+#endif
+            job->failed = 1;
+            job->next = job->count;
+#ifdef LESSUDMF_THREADS
+            pthread_mutex_unlock(&job->lock);
+#endif
+        }
+    }
+    return 0;
+}
+
+// Call func for every index from 0 to count-1, the calls are spread over the given amount of threads.
+// The threads take the next index when they are done with one, so the lower indices are processed first
+static void THREAD_ParallelForThreads(lessudmf_t* context, uint32_t count, uint32_t threadCount, parallelfunc_t func, void* data)
+{
+#ifdef LESSUDMF_THREADS
+    parallelfor_t job = { func, data, count, context, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+    if (threadCount > count)
+        threadCount = count;
+    pthread_t* threads = (pthread_t*)MEMORY_Alloc(context, (threadCount + 1) * sizeof(pthread_t));
+    uint32_t started = 0;
+
+    if (threads) {
+        MEMORY_Share(context);
+        // The calling thread is a worker too
+        while (started + 1 < threadCount && !pthread_create(&threads[started], 0, THREAD_ParallelWorker, &job))
+            started++;
+    }
+    THREAD_ParallelWorker(&job);
+    for (uint32_t t = 0; t < started; t++)
+        pthread_join(threads[t], 0);
+    pthread_mutex_destroy(&job.lock);
+    MEMORY_Free(context, threads);
+#else
+    parallelfor_t job = { func, data, count, context, 0, 0 };
+    (void)threadCount;
+    THREAD_ParallelWorker(&job);
+#endif
+    if (job.failed)
+        CONTEXT_Fail(context);
+}
+
+// Call func for every index from 0 to count-1, the calls are spread over all processor cores
+static void THREAD_ParallelFor(lessudmf_t* context, uint32_t count, parallelfunc_t func, void* data)
+{
+    THREAD_ParallelForThreads(context, count, THREAD_GetCount(), func, data);
+}
+
+//
+// NODES
+//
+
+#define NODES_EPSILON (1.0 / 256.0) // distance under which a point is considered to be on a line
+#define NODES_CANDIDATES 64 // maximum amount of partition candidates evaluated per node
+#define NODES_THREADSEGS 512 // minimum amount of segs in a subtree to build it on a separate thread
+#define NODES_MINISEGLEN (1.0 / 32.0) // gaps shorter than this in a subsector are not filled with minisegs
+#define NODES_MINISEG UINT32_MAX
+
+// Point of a node builder polygon
+typedef struct {
+    double x;
+    double y;
+    int32_t vertex; // index of the map vertex at this point, -1 if the point is new
+} nodepoint_t;
+
+// Seg of the node builder
+typedef struct {
+    nodepoint_t v1;
+    nodepoint_t v2;
+    uint32_t linedef; // index of the linedef the seg is part of
+    uint8_t side; // 0=front, 1=back
+    double px, py, pdx, pdy; // the line the seg lies on (coordinates of the linedef, reversed for the back side)
+} nodeseg_t;
+
+// Seg of a finished subsector, the end of the seg is the start of the next one
+typedef struct {
+    nodepoint_t v1;
+    uint32_t linedef; // NODES_MINISEG for minisegs
+    uint8_t side;
+} glseg_t;
+
+// Node of the BSP tree
+typedef struct bspnode_s {
+    struct bspnode_s* child[2]; // 0=front (right), 1=back (left), both 0 if this is a subsector
+    double px, py, pdx, pdy; // partition line
+    double bbox[4]; // top, bottom, left, right
+    glseg_t* glsegs; // subsector segs in clockwise order
+    uint32_t glsegCount;
+} bspnode_t;
+
+#ifdef LESSUDMF_THREADS
+static pthread_mutex_t nodesThreadsLock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t nodesThreadsFree = 0; // amount of threads the node builder may still start
+static pthread_once_t nodesThreadsOnce = PTHREAD_ONCE_INIT;
+
+// The threads are shared by the node builders of all the contexts, the started ones are given back when they end
+static void NODES_InitThreads()
+{
+    nodesThreadsFree = THREAD_GetCount() - 1;
+}
+#endif
+
+// Signed distance of the point to the line, positive on the back (left) side
+static double NODES_PointDistance(double px, double py, double pdx, double pdy, double x, double y)
+{
+    return (pdx * (y - py) - pdy * (x - px)) / sqrt(pdx * pdx + pdy * pdy);
+}
+
+// On which side of the partition the seg is: 0=front, 1=back, 2=needs to be split
+static uint8_t NODES_SegSide(const nodeseg_t* seg, double px, double py, double pdx, double pdy, double* d1, double* d2)
+{
+    *d1 = NODES_PointDistance(px, py, pdx, pdy, seg->v1.x, seg->v1.y);
+    *d2 = NODES_PointDistance(px, py, pdx, pdy, seg->v2.x, seg->v2.y);
+
+    if (fabs(*d1) < NODES_EPSILON && fabs(*d2) < NODES_EPSILON) // on the partition, the direction decides
+        return ((seg->v2.x - seg->v1.x) * pdx + (seg->v2.y - seg->v1.y) * pdy > 0) ? 0 : 1;
+    if (*d1 < NODES_EPSILON && *d2 < NODES_EPSILON)
+        return 0;
+    if (*d1 > -NODES_EPSILON && *d2 > -NODES_EPSILON)
+        return 1;
+
+    // Do not split off pieces too short to be a seg, the seg goes to the side most of it is on
+    double length = sqrt((seg->v2.x - seg->v1.x) * (seg->v2.x - seg->v1.x) + (seg->v2.y - seg->v1.y) * (seg->v2.y - seg->v1.y));
+    double t = *d1 / (*d1 - *d2);
+    if (length * t < NODES_MINISEGLEN)
+        return (*d2 < 0) ? 0 : 1;
+    if (length * (1 - t) < NODES_MINISEGLEN)
+        return (*d1 < 0) ? 0 : 1;
+    return 2;
+}
+
+// Clip the convex polygon with the partition line. Keeps the front side (back=0) or the back side (back=1).
+// Returns a new array, the caller has to free it. Returns 0 on failure
+static nodepoint_t* NODES_ClipPolygon(lessudmf_t* context, const nodepoint_t* poly, uint32_t count, double px, double py, double pdx, double pdy, uint8_t back, uint32_t* outCount)
+{
+    nodepoint_t* out = (nodepoint_t*)MEMORY_Alloc(context, (count + 1) * sizeof(nodepoint_t));
+    if (!out) {
+        fprintf(stderr, "%s %s %s the node builder polygon\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        return 0;
+    }
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const nodepoint_t* a = &poly[i];
+        const nodepoint_t* b = &poly[(i + 1) % count];
+        double da = NODES_PointDistance(px, py, pdx, pdy, a->x, a->y);
+        double db = NODES_PointDistance(px, py, pdx, pdy, b->x, b->y);
+        if (back) {
+            da = -da;
+            db = -db;
+        }
+
+        if (da <= NODES_EPSILON)
+            out[n++] = *a;
+        if ((da < -NODES_EPSILON && db > NODES_EPSILON) || (da > NODES_EPSILON && db < -NODES_EPSILON)) {
+            double t = da / (da - db);
+            out[n].x = a->x + (b->x - a->x) * t;
+            out[n].y = a->y + (b->y - a->y) * t;
+            out[n].vertex = -1;
+            n++;
+        }
+    }
+
+    // Drop points that are too close to each other
+    uint32_t w = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (w && fabs(out[i].x - out[w - 1].x) < NODES_EPSILON && fabs(out[i].y - out[w - 1].y) < NODES_EPSILON)
+            continue;
+        out[w++] = out[i];
+    }
+    while (w > 1 && fabs(out[0].x - out[w - 1].x) < NODES_EPSILON && fabs(out[0].y - out[w - 1].y) < NODES_EPSILON)
+        w--;
+
+    *outCount = w;
+    return out;
+}
+
+// Pick the partition line for the segs. Returns the index of the seg to partition with, -1 if the segs are convex.
+static int32_t NODES_PickPartition(const nodeseg_t* segs, uint32_t count)
+{
+    int32_t best = -1;
+    uint32_t bestScore = UINT32_MAX;
+    uint32_t step = (count > NODES_CANDIDATES) ? count / NODES_CANDIDATES : 1;
+
+    for (uint8_t pass = 0; pass < 2 && best < 0; pass++) {
+        // First pass evaluates the sampled candidates, second pass looks for any partition if none of them divided the segs
+        for (uint32_t c = 0; c < count; c += (pass ? 1 : step)) {
+            const nodeseg_t* p = &segs[c];
+            uint32_t front = 0, back = 0, splits = 0;
+            double d1, d2;
+
+            for (uint32_t i = 0; i < count; i++) {
+                switch (NODES_SegSide(&segs[i], p->px, p->py, p->pdx, p->pdy, &d1, &d2)) {
+                case 0:
+                    front++;
+                    break;
+                case 1:
+                    back++;
+                    break;
+                default:
+                    splits++;
+                    break;
+                }
+            }
+            if (!back && !splits)
+                continue; // does not divide anything
+
+            uint32_t score = splits * 8 + (front > back ? front - back : back - front);
+            if (score < bestScore) {
+                bestScore = score;
+                best = (int32_t)c;
+                if (pass)
+                    break;
+            }
+        }
+        if (count <= NODES_CANDIDATES)
+            break; // every seg was already a candidate
+    }
+    return best;
+}
+
+static int NODES_GlSegCompare(const void* a, const void* b)
+{
+    double ta = ((const double*)a)[0], tb = ((const double*)b)[0];
+    return (ta > tb) - (ta < tb);
+}
+
+// Turn the convex segs into a closed subsector, adding minisegs where the polygon has no segs. Returns 0 on failure
+static uint8_t NODES_CloseSubsector(lessudmf_t* context, bspnode_t* leaf, nodeseg_t* segs, uint32_t count, const nodepoint_t* region, uint32_t regionCount)
+{
+    // The subsector polygon is the region clipped by the line of every seg
+    uint32_t polyCount = regionCount;
+    nodepoint_t* poly = (nodepoint_t*)MEMORY_Alloc(context, (regionCount + 1) * sizeof(nodepoint_t));
+    if (!poly) {
+        fprintf(stderr, "%s %s %s the node builder polygon\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        return 0;
+    }
+    memcpy(poly, region, regionCount * sizeof(nodepoint_t));
+    for (uint32_t i = 0; i < count && polyCount >= 3; i++) {
+        uint32_t clippedCount;
+        nodepoint_t* clipped = NODES_ClipPolygon(context, poly, polyCount, segs[i].px, segs[i].py, segs[i].pdx, segs[i].pdy, 0, &clippedCount);
+        if (!clipped)
+            return 0;
+        MEMORY_Free(context, poly);
+        poly = clipped;
+        polyCount = clippedCount;
+    }
+
+    leaf->glsegs = (glseg_t*)MEMORY_Alloc(context, (count * 2 + polyCount + 1) * sizeof(glseg_t));
+    double(*order)[2] = (double(*)[2])MEMORY_Alloc(context, (count + 1) * sizeof(*order)); // position along the edge, seg index
+    uint8_t* placed = (uint8_t*)MEMORY_Calloc(context, count + 1, 1);
+    if (!(leaf->glsegs && order && placed)) {
+        fprintf(stderr, "%s %s %s the subsector segs\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        return 0;
+    }
+    leaf->glsegCount = 0;
+
+    uint32_t placedCount = 0;
+    nodepoint_t cursor = { 0, 0, -1 };
+    if (polyCount)
+        cursor = poly[0];
+    for (uint32_t e = 0; e < polyCount && polyCount >= 3; e++) {
+        const nodepoint_t* a = &poly[e];
+        const nodepoint_t* b = &poly[(e + 1) % polyCount];
+        double edx = b->x - a->x, edy = b->y - a->y;
+        double elen = sqrt(edx * edx + edy * edy);
+        if (elen < NODES_EPSILON)
+            continue;
+
+        // Collect the segs lying on this edge, ordered along it
+        uint32_t onEdge = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (placed[i])
+                continue;
+            if (fabs(NODES_PointDistance(a->x, a->y, edx, edy, segs[i].v1.x, segs[i].v1.y)) > NODES_EPSILON * 4 || fabs(NODES_PointDistance(a->x, a->y, edx, edy, segs[i].v2.x, segs[i].v2.y)) > NODES_EPSILON * 4)
+                continue;
+            if ((segs[i].v2.x - segs[i].v1.x) * edx + (segs[i].v2.y - segs[i].v1.y) * edy <= 0)
+                continue;
+            order[onEdge][0] = ((segs[i].v1.x - a->x) * edx + (segs[i].v1.y - a->y) * edy) / elen;
+            order[onEdge][1] = i;
+            onEdge++;
+            placed[i] = 1;
+            placedCount++;
+        }
+        qsort(order, onEdge, sizeof(*order), NODES_GlSegCompare);
+
+        for (uint32_t o = 0; o < onEdge; o++) {
+            const nodeseg_t* s = &segs[(uint32_t)order[o][1]];
+            if (fabs(cursor.x - s->v1.x) > NODES_MINISEGLEN || fabs(cursor.y - s->v1.y) > NODES_MINISEGLEN) {
+                leaf->glsegs[leaf->glsegCount].v1 = cursor;
+                leaf->glsegs[leaf->glsegCount].linedef = NODES_MINISEG;
+                leaf->glsegs[leaf->glsegCount++].side = 0;
+            }
+            leaf->glsegs[leaf->glsegCount].v1 = s->v1;
+            leaf->glsegs[leaf->glsegCount].linedef = s->linedef;
+            leaf->glsegs[leaf->glsegCount++].side = s->side;
+            cursor = s->v2;
+        }
+        if (fabs(cursor.x - b->x) > NODES_MINISEGLEN || fabs(cursor.y - b->y) > NODES_MINISEGLEN) {
+            leaf->glsegs[leaf->glsegCount].v1 = cursor;
+            leaf->glsegs[leaf->glsegCount].linedef = NODES_MINISEG;
+            leaf->glsegs[leaf->glsegCount++].side = 0;
+            cursor = *b;
+        }
+    }
+
+    if (placedCount != count) {
+        // The polygon does not match the segs (broken geometry), fall back to the segs in clockwise order around their center
+        double cx = 0, cy = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            cx += segs[i].v1.x + segs[i].v2.x;
+            cy += segs[i].v1.y + segs[i].v2.y;
+        }
+        cx /= count * 2;
+        cy /= count * 2;
+        for (uint32_t i = 0; i < count; i++) {
+            order[i][0] = -atan2(segs[i].v1.y - cy, segs[i].v1.x - cx);
+            order[i][1] = i;
+        }
+        qsort(order, count, sizeof(*order), NODES_GlSegCompare);
+
+        leaf->glsegCount = 0;
+        for (uint32_t o = 0; o < count; o++) {
+            const nodeseg_t* s = &segs[(uint32_t)order[o][1]];
+            const nodeseg_t* next = &segs[(uint32_t)order[(o + 1) % count][1]];
+            leaf->glsegs[leaf->glsegCount].v1 = s->v1;
+            leaf->glsegs[leaf->glsegCount].linedef = s->linedef;
+            leaf->glsegs[leaf->glsegCount++].side = s->side;
+            if (fabs(s->v2.x - next->v1.x) > NODES_MINISEGLEN || fabs(s->v2.y - next->v1.y) > NODES_MINISEGLEN) {
+                leaf->glsegs[leaf->glsegCount].v1 = s->v2;
+                leaf->glsegs[leaf->glsegCount].linedef = NODES_MINISEG;
+                leaf->glsegs[leaf->glsegCount++].side = 0;
+            }
+        }
+    } else if (leaf->glsegCount && leaf->glsegs[0].linedef == NODES_MINISEG) {
+        // Close the polygon exactly at the end of the last seg
+        leaf->glsegs[0].v1 = cursor;
+    }
+
+    // Start the subsector with a real seg, the sector of the subsector is taken from its first seg
+    for (uint32_t i = 0; i < leaf->glsegCount; i++) {
+        if (leaf->glsegs[i].linedef == NODES_MINISEG)
+            continue;
+        if (i) {
+            glseg_t* rotated = (glseg_t*)MEMORY_Alloc(context, leaf->glsegCount * sizeof(glseg_t));
+            if (!rotated) {
+                fprintf(stderr, "%s %s %s the subsector segs\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+                return 0;
+            }
+            memcpy(rotated, leaf->glsegs + i, (leaf->glsegCount - i) * sizeof(glseg_t));
+            memcpy(rotated + leaf->glsegCount - i, leaf->glsegs, i * sizeof(glseg_t));
+            MEMORY_Free(context, leaf->glsegs);
+            leaf->glsegs = rotated;
+        }
+        break;
+    }
+
+    // Bounding box of the subsector
+    leaf->bbox[0] = leaf->bbox[3] = -INFINITY;
+    leaf->bbox[1] = leaf->bbox[2] = INFINITY;
+    for (uint32_t i = 0; i < leaf->glsegCount; i++) {
+        const nodepoint_t* p = &leaf->glsegs[i].v1;
+        leaf->bbox[0] = fmax(leaf->bbox[0], p->y);
+        leaf->bbox[1] = fmin(leaf->bbox[1], p->y);
+        leaf->bbox[2] = fmin(leaf->bbox[2], p->x);
+        leaf->bbox[3] = fmax(leaf->bbox[3], p->x);
+    }
+
+    MEMORY_Free(context, poly);
+    MEMORY_Free(context, order);
+    MEMORY_Free(context, placed);
+    return 1;
+}
+
+typedef struct {
+    nodeseg_t* segs;
+    uint32_t count;
+    nodepoint_t* region;
+    uint32_t regionCount;
+    bspnode_t* result;
+    lessudmf_t* context; // context of the map, its memory is shared by the threads building the tree
+} nodestask_t;
+
+static void* NODES_BuildTask(void* arg);
+static void NODES_Free(lessudmf_t* context, bspnode_t* node);
+
+// Recursively build the BSP tree of the segs inside the convex region. Takes ownership of the segs and region arrays.
+// Returns 0 on failure, the subtrees are built on other threads so the caller fails when the whole tree is done
+static bspnode_t* NODES_Build(lessudmf_t* context, nodeseg_t* segs, uint32_t count, nodepoint_t* region, uint32_t regionCount)
+{
+    bspnode_t* node = (bspnode_t*)MEMORY_Calloc(context, 1, sizeof(bspnode_t));
+    if (!node) {
+        fprintf(stderr, "%s %s %s the BSP node\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        return 0;
+    }
+
+    int32_t partition = NODES_PickPartition(segs, count);
+    if (partition < 0) {
+        if (!NODES_CloseSubsector(context, node, segs, count, region, regionCount))
+            return 0;
+        MEMORY_Free(context, segs);
+        MEMORY_Free(context, region);
+        return node;
+    }
+
+    node->px = segs[partition].px;
+    node->py = segs[partition].py;
+    node->pdx = segs[partition].pdx;
+    node->pdy = segs[partition].pdy;
+
+    // Divide the segs, the ones crossing the partition are split in two
+    nodestask_t sides[2] = { { 0 } };
+    for (uint8_t s = 0; s < 2; s++) {
+        sides[s].context = context;
+        sides[s].segs = (nodeseg_t*)MEMORY_Alloc(context, (count * 2) * sizeof(nodeseg_t));
+        if (!sides[s].segs) {
+            fprintf(stderr, "%s %s %s the BSP node segs\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        double d1, d2;
+        uint8_t side = NODES_SegSide(&segs[i], node->px, node->py, node->pdx, node->pdy, &d1, &d2);
+
+        if (side < 2) {
+            sides[side].segs[sides[side].count++] = segs[i];
+            continue;
+        }
+
+        double t = d1 / (d1 - d2);
+        nodepoint_t cut;
+        cut.x = segs[i].v1.x + (segs[i].v2.x - segs[i].v1.x) * t;
+        cut.y = segs[i].v1.y + (segs[i].v2.y - segs[i].v1.y) * t;
+        cut.vertex = -1;
+
+        nodeseg_t* first = &sides[d1 < 0 ? 0 : 1].segs[sides[d1 < 0 ? 0 : 1].count++];
+        nodeseg_t* second = &sides[d1 < 0 ? 1 : 0].segs[sides[d1 < 0 ? 1 : 0].count++];
+        *first = segs[i];
+        first->v2 = cut;
+        *second = segs[i];
+        second->v1 = cut;
+    }
+    MEMORY_Free(context, segs);
+
+    for (uint8_t s = 0; s < 2; s++) {
+        sides[s].region = NODES_ClipPolygon(context, region, regionCount, node->px, node->py, node->pdx, node->pdy, s, &sides[s].regionCount);
+        if (!sides[s].region)
+            return 0;
+    }
+    MEMORY_Free(context, region);
+
+    // Build the back subtree on another thread if it is big enough and there is a free thread for it
+#ifdef LESSUDMF_THREADS
+    pthread_t thread;
+    uint8_t threaded = 0;
+    if (sides[1].count >= NODES_THREADSEGS) {
+        pthread_mutex_lock(&nodesThreadsLock);
+        if (nodesThreadsFree) {
+            nodesThreadsFree--;
+            threaded = 1;
+        }
+        pthread_mutex_unlock(&nodesThreadsLock);
+        if (threaded)
+            MEMORY_Share(context);
+        if (threaded && pthread_create(&thread, 0, NODES_BuildTask, &sides[1])) {
+            threaded = 0;
+            pthread_mutex_lock(&nodesThreadsLock);
+            nodesThreadsFree++;
+            pthread_mutex_unlock(&nodesThreadsLock);
+        }
+    }
+    if (!threaded)
+        NODES_BuildTask(&sides[1]);
+    NODES_BuildTask(&sides[0]);
+    if (threaded) {
+        pthread_join(thread, 0);
+        pthread_mutex_lock(&nodesThreadsLock);
+        nodesThreadsFree++;
+        pthread_mutex_unlock(&nodesThreadsLock);
+    }
+#else
+    NODES_BuildTask(&sides[1]);
+    NODES_BuildTask(&sides[0]);
+#endif
+    if (!sides[0].result || !sides[1].result) {
+        NODES_Free(context, sides[0].result);
+        NODES_Free(context, sides[1].result);
+        MEMORY_Free(context, node);
+        return 0;
+    }
+
+    for (uint8_t s = 0; s < 2; s++)
+        node->child[s] = sides[s].result;
+
+    node->bbox[0] = fmax(node->child[0]->bbox[0], node->child[1]->bbox[0]);
+    node->bbox[1] = fmin(node->child[0]->bbox[1], node->child[1]->bbox[1]);
+    node->bbox[2] = fmin(node->child[0]->bbox[2], node->child[1]->bbox[2]);
+    node->bbox[3] = fmax(node->child[0]->bbox[3], node->child[1]->bbox[3]);
+    return node;
+}
+
+static void* NODES_BuildTask(void* arg)
+{
+    nodestask_t* task = (nodestask_t*)arg;
+
+    // The error of a subtree is passed on by its parent node when both of its subtrees are done
+    task->result = NODES_Build(task->context, task->segs, task->count, task->region, task->regionCount);
+    return 0;
+}
+
+static void NODES_Free(lessudmf_t* context, bspnode_t* node)
+{
+    if (!node)
+        return;
+    NODES_Free(context, node->child[0]);
+    NODES_Free(context, node->child[1]);
+    MEMORY_Free(context, node->glsegs);
+    MEMORY_Free(context, node);
+}
+
+// Growable output buffer of the node builder
+typedef struct {
+    char* data;
+    uint32_t size;
+    uint32_t allocated;
+} nodebuffer_t;
+
+static void NODEBUFFER_Write(lessudmf_t* context, nodebuffer_t* buf, const void* data, uint32_t size)
+{
+    while (buf->size + size > buf->allocated) {
+        buf->allocated = buf->allocated ? buf->allocated * 2 : 0x10000;
+        buf->data = (char*)MEMORY_Realloc(context, buf->data, buf->allocated);
+        if (!buf->data) {
+            fprintf(stderr, "%s %s re%s the nodes lump (%u %s)\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, buf->allocated, BYTES_STR);
+            CONTEXT_Fail(context);
+        }
+    }
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+}
+
+// State of the tree serialization
+typedef struct {
+    uint8_t xgl3; // write XGL3 instead of XGLN
+    int32_t* vertexHash; // open addressing hash of fixed point coordinates -> vertex index, -1 for empty slots
+    uint32_t vertexHashSize; // power of two
+    int32_t (*newVertices)[2]; // fixed point coordinates of the vertices created by the node builder
+    uint32_t newVertexCount;
+    uint32_t newVertexAllocated;
+    nodebuffer_t subsectors; // seg count of every subsector
+    nodebuffer_t segs;
+    nodebuffer_t nodes;
+    uint32_t subsectorCount;
+    uint32_t segCount;
+    uint32_t nodeCount;
+    uint32_t (*segEnds)[3]; // start vertex, end vertex and linedef of every written seg, to find the partner segs
+    uint32_t segEndsAllocated;
+} nodeswriter_t;
+
+static int32_t NODES_ToFixed(double v)
+{
+    return (int32_t)lround(v * 65536.0);
+}
+
+static uint32_t NODES_HashFixed(int32_t x, int32_t y)
+{
+    uint32_t h = (uint32_t)x * 0x9E3779B1u ^ ((uint32_t)y + 0x7F4A7C15u) * 0x85EBCA77u;
+    return h ^ (h >> 15);
+}
+
+// Get the vertex index for a point, points which are not map vertices become new vertices of the nodes
+static uint32_t NODES_GetVertex(lessudmf_t* context, nodeswriter_t* w, const nodepoint_t* p)
+{
+    if (p->vertex >= 0)
+        return (uint32_t)p->vertex;
+
+    int32_t fx = NODES_ToFixed(p->x), fy = NODES_ToFixed(p->y);
+    uint32_t mask = w->vertexHashSize - 1;
+    uint32_t slot = NODES_HashFixed(fx, fy) & mask;
+
+    while (w->vertexHash[slot] >= 0) {
+        int32_t v = w->vertexHash[slot];
+        int32_t vx, vy;
+        if ((uint32_t)v < context->vertexCount) {
+            vx = NODES_ToFixed(context->vertices[v].x);
+            vy = NODES_ToFixed(context->vertices[v].y);
+        } else {
+            vx = w->newVertices[v - context->vertexCount][0];
+            vy = w->newVertices[v - context->vertexCount][1];
+        }
+        if (vx == fx && vy == fy)
+            return (uint32_t)v;
+        slot = (slot + 1) & mask;
+    }
+
+    if (w->newVertexCount == w->newVertexAllocated) {
+        w->newVertexAllocated = w->newVertexAllocated ? w->newVertexAllocated * 2 : 0x400;
+        w->newVertices = (int32_t(*)[2])MEMORY_Realloc(context, w->newVertices, w->newVertexAllocated * sizeof(*w->newVertices));
+        if (!w->newVertices) {
+            fprintf(stderr, "%s %s re%s the new node vertices\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+            CONTEXT_Fail(context);
+        }
+    }
+    w->newVertices[w->newVertexCount][0] = fx;
+    w->newVertices[w->newVertexCount][1] = fy;
+    w->vertexHash[slot] = (int32_t)(context->vertexCount + w->newVertexCount);
+    w->newVertexCount++;
+
+    // Keep the hash at most half full
+    if ((context->vertexCount + w->newVertexCount) * 2 > w->vertexHashSize) {
+        MEMORY_Free(context, w->vertexHash);
+        w->vertexHashSize *= 2;
+        w->vertexHash = (int32_t*)MEMORY_Alloc(context, w->vertexHashSize * sizeof(int32_t));
+        if (!w->vertexHash) {
+            fprintf(stderr, "%s %s %s the node vertex hash\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+            CONTEXT_Fail(context);
+        }
+        memset(w->vertexHash, 0xFF, w->vertexHashSize * sizeof(int32_t));
+        mask = w->vertexHashSize - 1;
+        for (uint32_t v = 0; v < context->vertexCount + w->newVertexCount; v++) {
+            if (v < context->vertexCount)
+                slot = NODES_HashFixed(NODES_ToFixed(context->vertices[v].x), NODES_ToFixed(context->vertices[v].y)) & mask;
+            else
+                slot = NODES_HashFixed(w->newVertices[v - context->vertexCount][0], w->newVertices[v - context->vertexCount][1]) & mask;
+            while (w->vertexHash[slot] >= 0)
+                slot = (slot + 1) & mask;
+            w->vertexHash[slot] = (int32_t)v;
+        }
+    }
+    return context->vertexCount + w->newVertexCount - 1;
+}
+
+static int16_t NODES_ClampShort(double v)
+{
+    return (int16_t)fmax(INT16_MIN, fmin(INT16_MAX, v));
+}
+
+// Write the tree in post-order so the root ends up as the last node. Returns the child reference of the node.
+static uint32_t NODES_Write(lessudmf_t* context, nodeswriter_t* w, const bspnode_t* node)
+{
+    if (!node->child[0]) {
+        NODEBUFFER_Write(context, &w->subsectors, &node->glsegCount, 4);
+        while (w->segCount + node->glsegCount > w->segEndsAllocated) {
+            w->segEndsAllocated = w->segEndsAllocated ? w->segEndsAllocated * 2 : 0x1000;
+            w->segEnds = (uint32_t(*)[3])MEMORY_Realloc(context, w->segEnds, w->segEndsAllocated * sizeof(*w->segEnds));
+            if (!w->segEnds) {
+                fprintf(stderr, "%s %s re%s the node segs\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+                CONTEXT_Fail(context);
+            }
+        }
+        uint32_t (*ends)[3] = &w->segEnds[w->segCount];
+        for (uint32_t i = 0; i < node->glsegCount; i++) {
+            ends[i][0] = NODES_GetVertex(context, w, &node->glsegs[i].v1);
+            ends[i][2] = node->glsegs[i].linedef;
+        }
+        for (uint32_t i = 0; i < node->glsegCount; i++) // the end of the seg is the start of the next one
+            ends[i][1] = ends[(i + 1) % node->glsegCount][0];
+
+        for (uint32_t i = 0; i < node->glsegCount; i++) {
+            const glseg_t* g = &node->glsegs[i];
+            uint32_t v1 = ends[i][0];
+            uint32_t partner = UINT32_MAX; // set by NODES_WritePartners
+            NODEBUFFER_Write(context, &w->segs, &v1, 4);
+            NODEBUFFER_Write(context, &w->segs, &partner, 4);
+            if (w->xgl3) {
+                NODEBUFFER_Write(context, &w->segs, &g->linedef, 4);
+            } else {
+                uint16_t line = (g->linedef == NODES_MINISEG) ? UINT16_MAX : (uint16_t)g->linedef;
+                NODEBUFFER_Write(context, &w->segs, &line, 2);
+            }
+            NODEBUFFER_Write(context, &w->segs, &g->side, 1);
+        }
+        w->segCount += node->glsegCount;
+        return 0x80000000u | w->subsectorCount++;
+    }
+
+    uint32_t children[2];
+    children[0] = NODES_Write(context, w, node->child[0]);
+    children[1] = NODES_Write(context, w, node->child[1]);
+
+    if (w->xgl3) {
+        int32_t partition[4] = { NODES_ToFixed(node->px), NODES_ToFixed(node->py), NODES_ToFixed(node->pdx), NODES_ToFixed(node->pdy) };
+        NODEBUFFER_Write(context, &w->nodes, partition, sizeof(partition));
+    } else {
+        int16_t partition[4] = { (int16_t)node->px, (int16_t)node->py, (int16_t)node->pdx, (int16_t)node->pdy };
+        NODEBUFFER_Write(context, &w->nodes, partition, sizeof(partition));
+    }
+    for (uint8_t c = 0; c < 2; c++) {
+        const double* b = node->child[c]->bbox;
+        int16_t bbox[4] = { NODES_ClampShort(ceil(b[0])), NODES_ClampShort(floor(b[1])), NODES_ClampShort(floor(b[2])), NODES_ClampShort(ceil(b[3])) };
+        NODEBUFFER_Write(context, &w->nodes, bbox, sizeof(bbox));
+    }
+    NODEBUFFER_Write(context, &w->nodes, children, sizeof(children));
+    return w->nodeCount++;
+}
+
+// Write the partner of every seg: the seg on the other side of the same linedef (or miniseg) with the same vertices
+// in the opposite direction. Segs without one keep 0xFFFFFFFF: the segs of one-sided linedefs, and the segs which were
+// split at other points than the other side (the node builder splits the two sides of a linedef separately)
+static void NODES_WritePartners(lessudmf_t* context, nodeswriter_t* w)
+{
+    uint32_t hashSize = 0x400;
+    while (hashSize < w->segCount * 2 + 2)
+        hashSize *= 2;
+    int32_t* hash = (int32_t*)MEMORY_Alloc(context, hashSize * sizeof(int32_t));
+    if (!hash) {
+        fprintf(stderr, "%s %s %s the node seg hash\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        CONTEXT_Fail(context);
+    }
+    memset(hash, 0xFF, hashSize * sizeof(int32_t));
+    for (uint32_t s = 0; s < w->segCount; s++) {
+        uint32_t slot = (NODES_HashFixed((int32_t)w->segEnds[s][0], (int32_t)w->segEnds[s][1]) ^ w->segEnds[s][2] * 0x27D4EB2Fu) & (hashSize - 1);
+        while (hash[slot] >= 0)
+            slot = (slot + 1) & (hashSize - 1);
+        hash[slot] = (int32_t)s;
+    }
+
+    uint32_t segSize = w->xgl3 ? 13 : 11;
+    for (uint32_t s = 0; s < w->segCount; s++) {
+        const uint32_t* seg = w->segEnds[s];
+        uint32_t slot = (NODES_HashFixed((int32_t)seg[1], (int32_t)seg[0]) ^ seg[2] * 0x27D4EB2Fu) & (hashSize - 1);
+        for (; hash[slot] >= 0; slot = (slot + 1) & (hashSize - 1)) {
+            const uint32_t* other = w->segEnds[hash[slot]];
+            if (other[0] == seg[1] && other[1] == seg[0] && other[2] == seg[2]) {
+                uint32_t partner = (uint32_t)hash[slot];
+                memcpy(w->segs.data + (size_t)s * segSize + 4, &partner, 4);
+                break;
+            }
+        }
+    }
+    MEMORY_Free(context, hash);
+}
+
+// Build the extended GL nodes (ZNODES lump) of the map in memory.
+// Returns the lump data and sets its size, 0 if the map has nothing to build the nodes from.
+static char* NODES_BuildZNODES(lessudmf_t* context, uint32_t* size)
+{
+    CONTEXT_Print(context, "Building the ZNODES... ");
+    *size = 0;
+
+    // Partition lines are stored as integers in XGLN, use XGL3 if any coordinate is fractional or too large
+    nodeswriter_t w;
+    memset(&w, 0, sizeof(w));
+    w.xgl3 = (context->linedefCount >= UINT16_MAX);
+    for (uint32_t i = 0; i < context->vertexCount && !w.xgl3; i++) {
+        if (context->vertices[i].x != floor(context->vertices[i].x) || context->vertices[i].y != floor(context->vertices[i].y) || fabs(context->vertices[i].x) > INT16_MAX || fabs(context->vertices[i].y) > INT16_MAX)
+            w.xgl3 = 1;
+    }
+
+    // One seg for every side of every linedef
+    nodeseg_t* segs = (nodeseg_t*)MEMORY_Alloc(context, (context->linedefCount * 2 + 1) * sizeof(nodeseg_t));
+    if (!segs) {
+        fprintf(stderr, "%s %s %s the node builder segs\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        CONTEXT_Fail(context);
+    }
+    uint32_t count = 0;
+    double minx = INFINITY, miny = INFINITY, maxx = -INFINITY, maxy = -INFINITY;
+    for (uint32_t i = 0; i < context->linedefCount; i++) {
+        const linedef_t* l = &context->linedefs[i];
+        if (!l->v1 || !l->v2 || (l->v1->x == l->v2->x && l->v1->y == l->v2->y))
+            continue;
+
+        nodepoint_t a = { l->v1->x, l->v1->y, (int32_t)(l->v1 - context->vertices) };
+        nodepoint_t b = { l->v2->x, l->v2->y, (int32_t)(l->v2 - context->vertices) };
+        minx = fmin(minx, fmin(a.x, b.x));
+        miny = fmin(miny, fmin(a.y, b.y));
+        maxx = fmax(maxx, fmax(a.x, b.x));
+        maxy = fmax(maxy, fmax(a.y, b.y));
+
+        for (uint8_t side = 0; side < 2; side++) {
+            if (!(side ? l->sideback : l->sidefront))
+                continue;
+            nodeseg_t* s = &segs[count++];
+            s->v1 = side ? b : a;
+            s->v2 = side ? a : b;
+            s->linedef = i;
+            s->side = side;
+            s->px = s->v1.x;
+            s->py = s->v1.y;
+            s->pdx = s->v2.x - s->v1.x;
+            s->pdy = s->v2.y - s->v1.y;
+        }
+
+        // The partition lines are the linedefs, their lengths along the axes have to fit in XGLN as well
+        if (fabs(b.x - a.x) > INT16_MAX || fabs(b.y - a.y) > INT16_MAX)
+            w.xgl3 = 1;
+    }
+    if (!count) {
+        MEMORY_Free(context, segs);
+        CONTEXT_Print(context, "Skipped (no linedefs)\n");
+        return 0;
+    }
+
+    // The starting region is the bounding box of the map in clockwise order
+    nodepoint_t* region = (nodepoint_t*)MEMORY_Alloc(context, 4 * sizeof(nodepoint_t));
+    if (!region) {
+        fprintf(stderr, "%s %s %s the node builder polygon\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        CONTEXT_Fail(context);
+    }
+    region[0] = (nodepoint_t) { minx - 64, maxy + 64, -1 };
+    region[1] = (nodepoint_t) { maxx + 64, maxy + 64, -1 };
+    region[2] = (nodepoint_t) { maxx + 64, miny - 64, -1 };
+    region[3] = (nodepoint_t) { minx - 64, miny - 64, -1 };
+
+#ifdef LESSUDMF_THREADS
+    pthread_once(&nodesThreadsOnce, NODES_InitThreads);
+#endif
+    bspnode_t* root = NODES_Build(context, segs, count, region, 4);
+    if (!root)
+        CONTEXT_Fail(context);
+
+    // Serialize
+    w.vertexHashSize = 0x400;
+    while (w.vertexHashSize < context->vertexCount * 2 + 2)
+        w.vertexHashSize *= 2;
+    w.vertexHash = (int32_t*)MEMORY_Alloc(context, w.vertexHashSize * sizeof(int32_t));
+    if (!w.vertexHash) {
+        fprintf(stderr, "%s %s %s the node vertex hash\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        CONTEXT_Fail(context);
+    }
+    memset(w.vertexHash, 0xFF, w.vertexHashSize * sizeof(int32_t));
+    for (uint32_t v = 0; v < context->vertexCount; v++) {
+        uint32_t slot = NODES_HashFixed(NODES_ToFixed(context->vertices[v].x), NODES_ToFixed(context->vertices[v].y)) & (w.vertexHashSize - 1);
+        while (w.vertexHash[slot] >= 0) {
+            int32_t other = w.vertexHash[slot];
+            if (NODES_ToFixed(context->vertices[other].x) == NODES_ToFixed(context->vertices[v].x) && NODES_ToFixed(context->vertices[other].y) == NODES_ToFixed(context->vertices[v].y))
+                break; // keep the first of the overlapping vertices
+            slot = (slot + 1) & (w.vertexHashSize - 1);
+        }
+        if (w.vertexHash[slot] < 0)
+            w.vertexHash[slot] = (int32_t)v;
+    }
+
+    uint32_t rootRef = NODES_Write(context, &w, root);
+    (void)rootRef; // the root is either the last node or the only subsector
+    NODES_Free(context, root);
+    NODES_WritePartners(context, &w);
+
+    nodebuffer_t out = { 0 };
+    NODEBUFFER_Write(context, &out, w.xgl3 ? "XGL3" : "XGLN", 4);
+    NODEBUFFER_Write(context, &out, &context->vertexCount, 4);
+    NODEBUFFER_Write(context, &out, &w.newVertexCount, 4);
+    if (w.newVertexCount)
+        NODEBUFFER_Write(context, &out, w.newVertices, w.newVertexCount * sizeof(*w.newVertices));
+    NODEBUFFER_Write(context, &out, &w.subsectorCount, 4);
+    NODEBUFFER_Write(context, &out, w.subsectors.data, w.subsectors.size);
+    NODEBUFFER_Write(context, &out, &w.segCount, 4);
+    NODEBUFFER_Write(context, &out, w.segs.data, w.segs.size);
+    NODEBUFFER_Write(context, &out, &w.nodeCount, 4);
+    if (w.nodeCount)
+        NODEBUFFER_Write(context, &out, w.nodes.data, w.nodes.size);
+
+    MEMORY_Free(context, w.vertexHash);
+    MEMORY_Free(context, w.newVertices);
+    MEMORY_Free(context, w.subsectors.data);
+    MEMORY_Free(context, w.segs.data);
+    MEMORY_Free(context, w.segEnds);
+    MEMORY_Free(context, w.nodes.data);
+
+    CONTEXT_Print(context, "%s (%s, %u nodes, %u subsectors, %u segs)\n", DONE_STR, w.xgl3 ? "XGL3" : "XGLN", w.nodeCount, w.subsectorCount, w.segCount);
+    *size = out.size;
+    return out.data;
+}
+
+//
+// REJECT
+//
+
+typedef struct {
+    uint8_t* table;
+    const uint32_t* group;
+} rejectjob_t;
+
+// Fill 8 rows of the REJECT table, 8 rows always start on a byte boundary so the jobs never share a byte
+static uint8_t REJECT_FillRows(lessudmf_t* context, uint32_t index, void* data)
+{
+    rejectjob_t* job = (rejectjob_t*)data;
+
+    for (uint32_t source = index * 8; source < index * 8 + 8 && source < context->sectorCount; source++) {
+        uint64_t bit = (uint64_t)source * context->sectorCount;
+        for (uint32_t target = 0; target < context->sectorCount; target++, bit++) {
+            if (job->group[source] != job->group[target])
+                job->table[bit >> 3] |= (uint8_t)(1 << (bit & 7));
+        }
+    }
+    return 1;
+}
+
+// Check if the sector can change its heights (it can be found by tag or has a special)
+static uint8_t BOOL_IsSectorMovable(const sector_t* sector)
+{
+    const char* special = getFieldValueFromBlock(sector->block, SPECIAL_STR);
+
+    if (special && strtol(special, 0, 10))
+        return 1;
+    return BOOL_IsSectorTagged(sector);
+}
+
+// Check if nothing can be seen through the two-sided linedef, now and at any later point of the game
+static uint8_t BOOL_IsLinedefClosedForever(lessudmf_t* context, const linedef_t* linedef)
+{
+    sector_t* front = linedef->sidefront->sector;
+    sector_t* back = linedef->sideback->sector;
+
+    const char* ff = getFieldValueFromBlock(front->block, FLOORHEIGHT_STR);
+    const char* cf = getFieldValueFromBlock(front->block, CEILINGHEIGHT_STR);
+    const char* fb = getFieldValueFromBlock(back->block, FLOORHEIGHT_STR);
+    const char* cb = getFieldValueFromBlock(back->block, CEILINGHEIGHT_STR);
+    double floorTop = fmax(strtod(ff ? ff : "0", 0), strtod(fb ? fb : "0", 0));
+    double ceilingBottom = fmin(strtod(cf ? cf : "0", 0), strtod(cb ? cb : "0", 0));
+
+    if (ceilingBottom > floorTop)
+        return 0;
+
+    // Closed for now, check if the sectors can ever open it
+    return !(BOOL_IsSectorMovable(front) || BOOL_IsSectorMovable(back) || BOOL_IsSectorSloped(context, front) || BOOL_IsSectorSloped(context, back));
+}
+
+// Get the tag of the linedefs the portal linedef is linked to (config "portals"), 0 if it is not a portal
+static long LINEDEF_GetPortalTag(lessudmf_t* context, const linedef_t* linedef)
+{
+    int64_t arg;
+    const char* special = getFieldValueFromBlock(linedef->block, SPECIAL_STR);
+    if (!special || !(context->FLAGS & LESSUDMF_FLAG_CONFIGLOADED) || !context->config.linedefPortals.count)
+        return 0;
+    snprintf(context->buffer_str, sizeof(context->buffer_str), "%ld", strtol(special, 0, 10));
+    if (!HASHTABLE_Get(&context->config.linedefPortals, context->buffer_str, &arg))
+        return 0;
+    if (arg >= 0)
+        return LINEDEF_GetArg(linedef->block, (uint8_t)arg);
+    const char* id = getFieldValueFromBlock(linedef->block, "id");
+    return id ? strtol(id, 0, 10) : 0;
+}
+
+// Check if the block has the tag in its "id" or "moreids"
+static uint8_t BOOL_BlockHasTag(const block_t* blk, long tag)
+{
+    const char* id = getFieldValueFromBlock(blk, "id");
+    if (id && strtol(id, 0, 10) == tag)
+        return 1;
+
+    // moreids is a string of space-separated tags
+    for (const char* ptr = getFieldValueFromBlock(blk, "moreids"); ptr && *ptr;) {
+        char* end;
+        long value = strtol(ptr, &end, 10);
+        if (end == ptr) {
+            ptr++;
+            continue;
+        }
+        if (value == tag)
+            return 1;
+        ptr = end;
+    }
+    return 0;
+}
+
+// Find the pairs of sectors the portal linedefs connect: every sector of a portal linedef is connected to every
+// sector of the linedefs it is linked to. Returns the amount of pairs, pairs[2 * n] and pairs[2 * n + 1]
+// (freed by the caller)
+static uint32_t SECTOR_FindPortalPairs(lessudmf_t* context, uint32_t** pairsOut)
+{
+    uint32_t count = 0, allocated = 0;
+    uint32_t* pairs = 0;
+
+    for (uint32_t i = 0; i < context->linedefCount; i++) {
+        long tag = LINEDEF_GetPortalTag(context, &context->linedefs[i]);
+        if (!tag)
+            continue;
+        const sidedef_t* from[2] = { context->linedefs[i].sidefront, context->linedefs[i].sideback };
+
+        for (uint32_t t = 0; t < context->linedefCount; t++) {
+            if (t == i || !BOOL_BlockHasTag(context->linedefs[t].block, tag))
+                continue;
+            const sidedef_t* to[2] = { context->linedefs[t].sidefront, context->linedefs[t].sideback };
+
+            for (uint8_t a = 0; a < 2; a++) {
+                for (uint8_t b = 0; b < 2; b++) {
+                    if (!from[a] || !from[a]->sector || !to[b] || !to[b]->sector || from[a]->sector == to[b]->sector)
+                        continue;
+                    if (count == allocated) {
+                        allocated = allocated ? allocated * 2 : 0x40;
+                        pairs = (uint32_t*)MEMORY_Realloc(context, pairs, allocated * 2 * sizeof(uint32_t));
+                        if (!pairs) {
+                            fprintf(stderr, "%s %s re%s the %s portals\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, SECTOR_STR);
+                            CONTEXT_Fail(context);
+                        }
+                    }
+                    pairs[count * 2] = (uint32_t)(from[a]->sector - context->sectors);
+                    pairs[count * 2 + 1] = (uint32_t)(to[b]->sector - context->sectors);
+                    count++;
+                }
+            }
+        }
+    }
+
+    *pairsOut = pairs;
+    return count;
+}
+
+// Build the sector adjacency graph through the two-sided linedefs that are not closed forever and the portals,
+// in compressed rows: the neighbours of sector s are adjacency[first[s]..first[s + 1]]. Both arrays are freed
+// by the caller.
+static void SECTOR_BuildAdjacency(lessudmf_t* context, uint32_t** firstOut, uint32_t** adjacencyOut)
+{
+    uint32_t* portalPairs;
+    uint32_t portalCount = SECTOR_FindPortalPairs(context, &portalPairs);
+
+    uint32_t* first = (uint32_t*)MEMORY_Calloc(context, context->sectorCount + 1, sizeof(uint32_t));
+    uint32_t* adjacency = (uint32_t*)MEMORY_Alloc(context, ((context->linedefCount + portalCount) * 2 + 1) * sizeof(uint32_t));
+    uint8_t* portal = (uint8_t*)MEMORY_Calloc(context, context->linedefCount + 1, 1);
+    if (!(first && adjacency && portal)) {
+        fprintf(stderr, "%s %s %s the %s adjacency graph\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, SECTOR_STR);
+        CONTEXT_Fail(context);
+    }
+
+    for (uint32_t i = 0; i < context->linedefCount; i++) {
+        const linedef_t* l = &context->linedefs[i];
+        if (!l->sidefront || !l->sideback || !l->sidefront->sector || !l->sideback->sector || l->sidefront->sector == l->sideback->sector)
+            continue;
+        if (BOOL_IsLinedefClosedForever(context, l) && !LINEDEF_GetPortalTag(context, l))
+            continue;
+        portal[i] = 1;
+        first[l->sidefront->sector - context->sectors]++;
+        first[l->sideback->sector - context->sectors]++;
+    }
+    for (uint32_t p = 0; p < portalCount; p++) {
+        first[portalPairs[p * 2]]++;
+        first[portalPairs[p * 2 + 1]]++;
+    }
+    for (uint32_t s = 0, total = 0; s <= context->sectorCount; s++) {
+        uint32_t count = first[s];
+        first[s] = total;
+        total += count;
+    }
+    uint32_t* fill = (uint32_t*)MEMORY_Alloc(context, (context->sectorCount + 1) * sizeof(uint32_t));
+    if (!fill) {
+        fprintf(stderr, "%s %s %s the %s adjacency graph\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, SECTOR_STR);
+        CONTEXT_Fail(context);
+    }
+    memcpy(fill, first, (context->sectorCount + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < context->linedefCount; i++) {
+        if (!portal[i])
+            continue;
+        uint32_t front = (uint32_t)(context->linedefs[i].sidefront->sector - context->sectors);
+        uint32_t back = (uint32_t)(context->linedefs[i].sideback->sector - context->sectors);
+        adjacency[fill[front]++] = back;
+        adjacency[fill[back]++] = front;
+    }
+    for (uint32_t p = 0; p < portalCount; p++) {
+        adjacency[fill[portalPairs[p * 2]]++] = portalPairs[p * 2 + 1];
+        adjacency[fill[portalPairs[p * 2 + 1]]++] = portalPairs[p * 2];
+    }
+    MEMORY_Free(context, fill);
+    MEMORY_Free(context, portal);
+    MEMORY_Free(context, portalPairs);
+
+    *firstOut = first;
+    *adjacencyOut = adjacency;
+}
+
+// Build the REJECT lump of the map in memory. The sectors are flood-filled through the linedefs that can
+// be seen through, sectors from different groups can never see each other and are marked in the table.
+// Returns the lump data and sets its size, 0 if the map has no sectors.
+static char* REJECT_Build(lessudmf_t* context, uint32_t* size)
+{
+    CONTEXT_Print(context, "Building the REJECT... ");
+    *size = 0;
+    if (!context->sectorCount) {
+        CONTEXT_Print(context, "Skipped (no sectors)\n");
+        return 0;
+    }
+
+    uint32_t* first;
+    uint32_t* adjacency;
+    SECTOR_BuildAdjacency(context, &first, &adjacency);
+    uint32_t* group = (uint32_t*)MEMORY_Alloc(context, context->sectorCount * sizeof(uint32_t));
+    uint32_t* queue = (uint32_t*)MEMORY_Alloc(context, context->sectorCount * sizeof(uint32_t));
+    if (!(group && queue)) {
+        fprintf(stderr, "%s %s %s the %s groups\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, SECTOR_STR);
+        CONTEXT_Fail(context);
+    }
+
+    // Flood-fill the groups of sectors connected by portals
+    uint32_t groupCount = 0;
+    memset(group, 0xFF, context->sectorCount * sizeof(uint32_t));
+    for (uint32_t s = 0; s < context->sectorCount; s++) {
+        if (group[s] != UINT32_MAX)
+            continue;
+
+        uint32_t head = 0, tail = 0;
+        group[s] = groupCount;
+        queue[tail++] = s;
+        while (head < tail) {
+            uint32_t current = queue[head++];
+            for (uint32_t n = first[current]; n < first[current + 1]; n++) {
+                if (group[adjacency[n]] == UINT32_MAX) {
+                    group[adjacency[n]] = groupCount;
+                    queue[tail++] = adjacency[n];
+                }
+            }
+        }
+        groupCount++;
+    }
+    MEMORY_Free(context, first);
+    MEMORY_Free(context, adjacency);
+    MEMORY_Free(context, queue);
+
+    // Build the table rows in parallel
+    *size = (uint32_t)(((uint64_t)context->sectorCount * context->sectorCount + 7) / 8);
+    uint8_t* table = (uint8_t*)MEMORY_Calloc(context, *size, 1);
+    if (!table) {
+        fprintf(stderr, "%s %s %s the REJECT table (%u %s)\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, *size, BYTES_STR);
+        CONTEXT_Fail(context);
+    }
+    if (groupCount > 1) {
+        rejectjob_t job = { table, group };
+        THREAD_ParallelFor(context, (context->sectorCount + 7) / 8, REJECT_FillRows, &job);
+    }
+    MEMORY_Free(context, group);
+
+    CONTEXT_Print(context, "%s (%u %ss, %u groups)\n", DONE_STR, context->sectorCount, SECTOR_STR, groupCount);
+    return (char*)table;
+}
+
+//
+// UNREACHABLE AREAS
+//
+
+// Find the sector the point is in: the closest linedef crossed by a ray going East from the point
+// decides it, by the side of the linedef the point is on. Returns -1 if the point is in the void.
+static int32_t SECTOR_AtPoint(lessudmf_t* context, double x, double y)
+{
+    double closest = INFINITY;
+    int32_t result = -1;
+
+    for (uint32_t i = 0; i < context->linedefCount; i++) {
+        const linedef_t* l = &context->linedefs[i];
+        if (!l->v1 || !l->v2 || l->v1->y == l->v2->y)
+            continue;
+        if ((y < l->v1->y) == (y < l->v2->y))
+            continue;
+
+        double hit = l->v1->x + (y - l->v1->y) * (l->v2->x - l->v1->x) / (l->v2->y - l->v1->y);
+        if (hit < x || hit >= closest)
+            continue;
+        closest = hit;
+
+        // The front side is on the right of the v1->v2 direction
+        double cross = (l->v2->x - l->v1->x) * (y - l->v1->y) - (l->v2->y - l->v1->y) * (x - l->v1->x);
+        const sidedef_t* side = (cross < 0) ? l->sidefront : l->sideback;
+        result = (side && side->sector) ? (int32_t)(side->sector - context->sectors) : -1;
+    }
+    return result;
+}
+
+// Check if the thing type is one the level can be reached or seen from (config "reachableFrom")
+static uint8_t BOOL_IsThingReachableFrom(lessudmf_t* context, const block_t* thing)
+{
+    const char* type = getFieldValueFromBlock(thing, "type");
+    long value = strtol(type ? type : "0", 0, 10);
+
+    for (uint16_t a = 0; context->config.thingTypesReachableFrom && context->config.thingTypesReachableFrom[a]; a++) {
+        if (value == context->config.thingTypesReachableFrom[a])
+            return 1;
+    }
+    return 0;
+}
+
+// Remove the textures and flats of the sectors which can not be reached or seen from any of the "reachableFrom"
+// things. The sectors are flood-filled through the linedefs that can be seen through. Control sectors (on either
+// side of a linedef with a special) and the sectors that can move are never stripped and also start the flood,
+// they can be moved, copied or looked into by the specials.
+static void MAP_RemoveUnreachableAreas(lessudmf_t* context)
+{
+    CONTEXT_Print(context, "Removing textures and flats of unreachable areas... ");
+    if (!context->sectorCount) {
+        CONTEXT_Print(context, "Skipped (no sectors)\n");
+        return;
+    }
+
+    uint32_t* first;
+    uint32_t* adjacency;
+    SECTOR_BuildAdjacency(context, &first, &adjacency);
+    uint8_t* reached = (uint8_t*)MEMORY_Calloc(context, context->sectorCount, 1);
+    uint32_t* queue = (uint32_t*)MEMORY_Alloc(context, context->sectorCount * sizeof(uint32_t));
+    if (!(reached && queue)) {
+        fprintf(stderr, "%s %s %s the reachable %ss\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, SECTOR_STR);
+        CONTEXT_Fail(context);
+    }
+
+    // Seed the flood with the sectors of the start things and the control sectors
+    uint32_t head = 0, tail = 0, seedThings = 0;
+    for (uint32_t b = 0; b < context->blockCount; b++) {
+        if (BLOCK_GetLevelElement(&context->blocks[b]) != LEVEL_THING || !BOOL_IsThingReachableFrom(context, &context->blocks[b]))
+            continue;
+        const char* x = getFieldValueFromBlock(&context->blocks[b], "x");
+        const char* y = getFieldValueFromBlock(&context->blocks[b], "y");
+        int32_t s = SECTOR_AtPoint(context, strtod(x ? x : "0", 0), strtod(y ? y : "0", 0));
+        if (s >= 0 && !reached[s]) {
+            reached[s] = 1;
+            queue[tail++] = (uint32_t)s;
+        }
+        seedThings++;
+    }
+    if (!seedThings) {
+        MEMORY_Free(context, first);
+        MEMORY_Free(context, adjacency);
+        MEMORY_Free(context, reached);
+        MEMORY_Free(context, queue);
+        CONTEXT_Print(context, "Skipped (no start things)\n");
+        return;
+    }
+    for (uint32_t i = 0; i < context->linedefCount; i++) {
+        const char* special = getFieldValueFromBlock(context->linedefs[i].block, SPECIAL_STR);
+        if (!special || !strtol(special, 0, 10))
+            continue;
+        const sidedef_t* sides[2] = { context->linedefs[i].sidefront, context->linedefs[i].sideback };
+        for (uint8_t x = 0; x < 2; x++) {
+            if (sides[x] && sides[x]->sector && !reached[sides[x]->sector - context->sectors]) {
+                reached[sides[x]->sector - context->sectors] = 1;
+                queue[tail++] = (uint32_t)(sides[x]->sector - context->sectors);
+            }
+        }
+    }
+    for (uint32_t s = 0; s < context->sectorCount; s++) {
+        if (!reached[s] && BOOL_IsSectorMovable(&context->sectors[s])) {
+            reached[s] = 1;
+            queue[tail++] = s;
+        }
+    }
+
+    while (head < tail) {
+        uint32_t current = queue[head++];
+        for (uint32_t n = first[current]; n < first[current + 1]; n++) {
+            if (!reached[adjacency[n]]) {
+                reached[adjacency[n]] = 1;
+                queue[tail++] = adjacency[n];
+            }
+        }
+    }
+    MEMORY_Free(context, first);
+    MEMORY_Free(context, adjacency);
+    MEMORY_Free(context, queue);
+
+    // Nothing of the unreachable sectors can be seen, neither the flats nor the walls facing into them
+    uint32_t stripped = 0;
+    for (uint32_t s = 0; s < context->sectorCount; s++) {
+        if (reached[s])
+            continue;
+        removeField(context, context->sectors[s].block, TEXTUREFLOOR_STR);
+        removeField(context, context->sectors[s].block, TEXTURECEILING_STR);
+        stripped++;
+    }
+    for (uint32_t s = 0; s < context->sidedefCount && stripped; s++) {
+        if (!context->sidedefs[s].sector || reached[context->sidedefs[s].sector - context->sectors])
+            continue;
+        removeField(context, context->sidedefs[s].block, TEXTURETOP_STR);
+        removeField(context, context->sidedefs[s].block, TEXTUREMIDDLE_STR);
+        removeField(context, context->sidedefs[s].block, TEXTUREBOTTOM_STR);
+    }
+    MEMORY_Free(context, reached);
+
+    CONTEXT_Print(context, "%s (%u %ss)\n", DONE_STR, stripped, SECTOR_STR);
+}
+
+//
+// BINARY MAP
+//
+
+// Integer UDMF fields of the binary map formats
+typedef struct {
+    uint8_t levelElement;
+    uint8_t formats; // (1 << BINARYFORMAT_*) bits of the formats that have the field
+    const char* key;
+    int32_t min; // range of the values the format can store
+    int32_t max;
+} binaryfield_t;
+
+static const binaryfield_t binaryFields[] = {
+    { LEVEL_THING, 6, "x", INT16_MIN, INT16_MAX },
+    { LEVEL_THING, 6, "y", INT16_MIN, INT16_MAX },
+    { LEVEL_THING, 6, "angle", INT16_MIN, INT16_MAX },
+    { LEVEL_THING, 6, "type", 0, INT16_MAX },
+    { LEVEL_THING, 4, "id", INT16_MIN, INT16_MAX },
+    { LEVEL_THING, 4, "height", INT16_MIN, INT16_MAX },
+    { LEVEL_THING, 4, "special", 0, UINT8_MAX },
+    { LEVEL_THING, 4, "arg0", 0, UINT8_MAX },
+    { LEVEL_THING, 4, "arg1", 0, UINT8_MAX },
+    { LEVEL_THING, 4, "arg2", 0, UINT8_MAX },
+    { LEVEL_THING, 4, "arg3", 0, UINT8_MAX },
+    { LEVEL_THING, 4, "arg4", 0, UINT8_MAX },
+    { LEVEL_VERTEX, 6, "x", INT16_MIN, INT16_MAX },
+    { LEVEL_VERTEX, 6, "y", INT16_MIN, INT16_MAX },
+    { LEVEL_LINEDEF, 2, "special", 0, INT16_MAX },
+    { LEVEL_LINEDEF, 2, "id", -1, INT16_MAX }, // the tag of the Doom format
+    { LEVEL_LINEDEF, 4, "id", -1, 0 }, // Hexen format linedefs have no id
+    { LEVEL_LINEDEF, 4, "special", 0, UINT8_MAX },
+    { LEVEL_LINEDEF, 4, "arg0", 0, UINT8_MAX },
+    { LEVEL_LINEDEF, 4, "arg1", 0, UINT8_MAX },
+    { LEVEL_LINEDEF, 4, "arg2", 0, UINT8_MAX },
+    { LEVEL_LINEDEF, 4, "arg3", 0, UINT8_MAX },
+    { LEVEL_LINEDEF, 4, "arg4", 0, UINT8_MAX },
+    { LEVEL_SIDEDEF, 6, "offsetx", INT16_MIN, INT16_MAX },
+    { LEVEL_SIDEDEF, 6, "offsety", INT16_MIN, INT16_MAX },
+    { LEVEL_SECTOR, 6, "heightfloor", INT16_MIN, INT16_MAX },
+    { LEVEL_SECTOR, 6, "heightceiling", INT16_MIN, INT16_MAX },
+    { LEVEL_SECTOR, 6, "lightlevel", INT16_MIN, INT16_MAX },
+    { LEVEL_SECTOR, 6, "special", 0, INT16_MAX },
+    { LEVEL_SECTOR, 6, "id", INT16_MIN, INT16_MAX },
+    { 0, 0, 0, 0, 0 }
+};
+
+// Boolean UDMF fields of the binary map formats and the flag bits they are stored in. Fields sharing a bit
+// must have the same value. Inverted fields set their bit when they are false.
+typedef struct {
+    uint8_t levelElement;
+    uint8_t formats; // (1 << BINARYFORMAT_*) bits of the formats that have the field
+    const char* key;
+    uint16_t bit;
+    uint8_t inverted;
+} binaryflag_t;
+
+static const binaryflag_t binaryFlags[] = {
+    { LEVEL_THING, 6, "skill1", 0x0001, 0 },
+    { LEVEL_THING, 6, "skill2", 0x0001, 0 },
+    { LEVEL_THING, 6, "skill3", 0x0002, 0 },
+    { LEVEL_THING, 6, "skill4", 0x0004, 0 },
+    { LEVEL_THING, 6, "skill5", 0x0004, 0 },
+    { LEVEL_THING, 6, "ambush", 0x0008, 0 },
+    { LEVEL_THING, 2, "single", 0x0010, 1 },
+    { LEVEL_THING, 2, "dm", 0x0020, 1 },
+    { LEVEL_THING, 2, "coop", 0x0040, 1 },
+    { LEVEL_THING, 2, "friend", 0x0080, 0 },
+    { LEVEL_THING, 4, "dormant", 0x0010, 0 },
+    { LEVEL_THING, 4, "class1", 0x0020, 0 },
+    { LEVEL_THING, 4, "class2", 0x0040, 0 },
+    { LEVEL_THING, 4, "class3", 0x0080, 0 },
+    { LEVEL_THING, 4, "single", 0x0100, 0 },
+    { LEVEL_THING, 4, "coop", 0x0200, 0 },
+    { LEVEL_THING, 4, "dm", 0x0400, 0 },
+    { LEVEL_LINEDEF, 6, "blocking", 0x0001, 0 },
+    { LEVEL_LINEDEF, 6, "blockmonsters", 0x0002, 0 },
+    { LEVEL_LINEDEF, 6, "twosided", 0x0004, 0 },
+    { LEVEL_LINEDEF, 6, "dontpegtop", 0x0008, 0 },
+    { LEVEL_LINEDEF, 6, "dontpegbottom", 0x0010, 0 },
+    { LEVEL_LINEDEF, 6, "secret", 0x0020, 0 },
+    { LEVEL_LINEDEF, 6, "blocksound", 0x0040, 0 },
+    { LEVEL_LINEDEF, 6, "dontdraw", 0x0080, 0 },
+    { LEVEL_LINEDEF, 6, "mapped", 0x0100, 0 },
+    { LEVEL_LINEDEF, 2, "passuse", 0x0200, 0 },
+    { LEVEL_LINEDEF, 4, "repeatspecial", 0x0200, 0 },
+    { 0, 0, 0, 0, 0 }
+};
+
+// Hexen format activation types of the linedef specials, stored in bits 10-12 of the flags
+static const char* binaryActivations[] = { "playercross", "playeruse", "monstercross", "impact", "playerpush", "missilecross", 0 };
+
+// Get the integer value of a field (or its default value, 0 if it has none), returns 0 if the value is not an integer
+static uint8_t BINARY_GetInteger(lessudmf_t* context, const block_t* blk, uint8_t levelElement, const char* key, int32_t* value)
+{
+    const char* str = BLOCK_GetValueOrDefault(context, blk, levelElement, key);
+    char* end;
+    double number = strtod(str ? str : "0", &end);
+
+    if (*end || number != floor(number) || fabs(number) > INT32_MAX)
+        return 0;
+    *value = (int32_t)number;
+    return 1;
+}
+
+// Check if the block fits the binary map format, sets the bits of its flags. Returns the field that does not fit, 0 if all do
+static const char* BINARY_CheckBlock(lessudmf_t* context, const block_t* blk, uint8_t levelElement, uint8_t format, uint16_t* flags)
+{
+    uint16_t set = 0, cleared = 0;
+    uint8_t activations = 0;
+
+    for (uint8_t x = 0; x < blk->fieldsCount; x++) {
+        const char* key = blk->fields[x].key;
+        uint8_t known = 0;
+
+        // The indices are checked with the element counts
+        if ((levelElement == LEVEL_LINEDEF && (!strcmp(key, "v1") || !strcmp(key, "v2") || !strcmp(key, "sidefront") || !strcmp(key, "sideback"))) || (levelElement == LEVEL_SIDEDEF && !strcmp(key, SECTOR_STR)))
+            continue;
+
+        // Texture names are stored in 8 characters
+        if ((levelElement == LEVEL_SIDEDEF && (!strcmp(key, TEXTURETOP_STR) || !strcmp(key, TEXTUREMIDDLE_STR) || !strcmp(key, TEXTUREBOTTOM_STR))) || (levelElement == LEVEL_SECTOR && (!strcmp(key, TEXTUREFLOOR_STR) || !strcmp(key, TEXTURECEILING_STR)))) {
+            char name[16];
+            TEXTURE_GetKey(blk->fields[x].value, name, sizeof(name));
+            if (strlen(name) > 8)
+                return key;
+            continue;
+        }
+
+        for (uint16_t f = 0; binaryFields[f].key && !known; f++) {
+            if (binaryFields[f].levelElement != levelElement || !(binaryFields[f].formats & (1 << format)) || strcmp(binaryFields[f].key, key))
+                continue;
+            int32_t value;
+            if (!BINARY_GetInteger(context, blk, levelElement, key, &value) || value < binaryFields[f].min || value > binaryFields[f].max)
+                return key;
+            known = 1;
+        }
+
+        for (uint16_t f = 0; binaryFlags[f].key; f++) {
+            if (binaryFlags[f].levelElement != levelElement || !(binaryFlags[f].formats & (1 << format)) || strcmp(binaryFlags[f].key, key))
+                continue;
+            known = 1;
+        }
+
+        for (uint8_t a = 0; format == BINARYFORMAT_HEXEN && levelElement == LEVEL_LINEDEF && binaryActivations[a]; a++) {
+            if (strcmp(binaryActivations[a], key))
+                continue;
+            if (!strcmp(blk->fields[x].value, "true")) {
+                *flags = (*flags & ~0x1C00) | (a << 10);
+                activations++;
+            }
+            known = 1;
+        }
+
+        if (!known)
+            return key;
+    }
+
+    // Missing booleans are false
+    for (uint16_t f = 0; binaryFlags[f].key; f++) {
+        if (binaryFlags[f].levelElement != levelElement || !(binaryFlags[f].formats & (1 << format)))
+            continue;
+        const char* value = getFieldValueFromBlock(blk, binaryFlags[f].key);
+        if ((value && !strcmp(value, "true")) != binaryFlags[f].inverted)
+            set |= binaryFlags[f].bit;
+        else
+            cleared |= binaryFlags[f].bit;
+    }
+    for (uint16_t f = 0; binaryFlags[f].key; f++) {
+        if (binaryFlags[f].levelElement == levelElement && (binaryFlags[f].formats & (1 << format)) && (set & cleared & binaryFlags[f].bit))
+            return binaryFlags[f].key;
+    }
+    *flags |= set;
+
+    // A Hexen format special has exactly one activation type
+    if (activations > 1)
+        return "activation";
+    if (format == BINARYFORMAT_HEXEN && levelElement == LEVEL_LINEDEF && !activations) {
+        int32_t special;
+        if (BINARY_GetInteger(context, blk, levelElement, SPECIAL_STR, &special) && special)
+            return "activation";
+    }
+    return 0;
+}
+
+// Find the binary map format the map fits in. The namespace decides the format: Doom and Heretic maps use
+// the Doom format, Hexen and ZDoom maps the Hexen format. Every field of the map has to exist in the format
+// with a value it can store, the indices have to fit in 16 bits and the map can have only the lumps the binary
+// maps have. The map lumps follow the TEXTMAP lump with the given index.
+static uint8_t MAP_GetBinaryFormat(lessudmf_t* context, uint16_t textmapLump)
+{
+    CONTEXT_Print(context, "Checking if the map fits the binary map format... ");
+
+    uint8_t format = BINARYFORMAT_NONE;
+    if (context->namespaceValue && (!strcmp(context->namespaceValue, "doom") || !strcmp(context->namespaceValue, "heretic")))
+        format = BINARYFORMAT_DOOM;
+    else if (context->namespaceValue && (!strcmp(context->namespaceValue, "hexen") || !strcmp(context->namespaceValue, "zdoom")))
+        format = BINARYFORMAT_HEXEN;
+    else {
+        CONTEXT_Print(context, "No (%s \"%s\" has no binary format)\n", NAMESPACE_STR, context->namespaceValue ? context->namespaceValue : "");
+        return BINARYFORMAT_NONE;
+    }
+
+    if (context->vertexCount > UINT16_MAX || context->sidedefCount >= UINT16_MAX || context->sectorCount > UINT16_MAX || context->linedefCount > UINT16_MAX) {
+        CONTEXT_Print(context, "No (too many elements for 16-bit indices)\n");
+        return BINARYFORMAT_NONE;
+    }
+
+    for (uint32_t l = textmapLump + 1; l < context->WAD_LumpsAmount && strncmp(context->lumps[l].name, ENDMAP_STR, 6); l++) {
+        if (!strncmp(context->lumps[l].name, "ZNODES", 8) || !strncmp(context->lumps[l].name, "REJECT", 8) || !strncmp(context->lumps[l].name, "BLOCKMAP", 8) || !strncmp(context->lumps[l].name, "SCRIPTS", 8))
+            continue;
+        if (!strncmp(context->lumps[l].name, "BEHAVIOR", 8) && format == BINARYFORMAT_HEXEN)
+            continue;
+        CONTEXT_Print(context, "No (the map has the %.8s lump)\n", context->lumps[l].name);
+        return BINARYFORMAT_NONE;
+    }
+
+    for (uint32_t b = 0; b < context->blockCount; b++) {
+        uint8_t levelElement = BLOCK_GetLevelElement(&context->blocks[b]);
+        if (levelElement == UINT8_MAX)
+            continue;
+        uint16_t flags = 0;
+        const char* field = BINARY_CheckBlock(context, &context->blocks[b], levelElement, format, &flags);
+        if (field) {
+            CONTEXT_Print(context, "No (\"%s\" of a %s)\n", field, context->blocks[b].header);
+            return BINARYFORMAT_NONE;
+        }
+    }
+
+    CONTEXT_Print(context, "%s (%s format)\n", DONE_STR, (format == BINARYFORMAT_DOOM) ? "Doom" : "Hexen");
+    return format;
+}
+
+// Write a little-endian 16-bit value and move the pointer past it
+static void BINARY_Put16(uint8_t** p, int32_t value)
+{
+    (*p)[0] = (uint8_t)(value & 0xFF);
+    (*p)[1] = (uint8_t)((value >> 8) & 0xFF);
+    *p += 2;
+}
+
+// Write the integer value of the field and move the pointer past it
+static void BINARY_PutField(lessudmf_t* context, uint8_t** p, const block_t* blk, uint8_t levelElement, const char* key, uint8_t bytes)
+{
+    int32_t value = 0;
+    BINARY_GetInteger(context, blk, levelElement, key, &value);
+    if (bytes == 1)
+        *(*p)++ = (uint8_t)value;
+    else
+        BINARY_Put16(p, value);
+}
+
+// Write the texture name in 8 characters ("-" if the field is missing) and move the pointer past it
+static void BINARY_PutTexture(uint8_t** p, const block_t* blk, const char* key)
+{
+    const char* value = getFieldValueFromBlock(blk, key);
+    char name[16];
+    TEXTURE_GetKey(value ? value : "-", name, sizeof(name));
+    memset(*p, 0, 8);
+    memcpy(*p, name, strlen(name));
+    *p += 8;
+}
+
+// Allocate the binary map lump of the given amount of records
+static uint8_t* BINARY_AllocateLump(lessudmf_t* context, uint8_t lump, uint32_t count, uint32_t recordSize)
+{
+    context->binaryLumps[lump].size = count * recordSize;
+    context->binaryLumps[lump].data = (char*)MEMORY_Calloc(context, context->binaryLumps[lump].size + 1, 1);
+    if (!context->binaryLumps[lump].data) {
+        fprintf(stderr, "%s %s %s the %s lump (%u %s)\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, context->binaryLumps[lump].name, context->binaryLumps[lump].size, BYTES_STR);
+        CONTEXT_Fail(context);
+    }
+    return (uint8_t*)context->binaryLumps[lump].data;
+}
+
+// Build the THINGS, LINEDEFS, SIDEDEFS, VERTEXES and SECTORS lumps of the map in the binary map format,
+// they are written when the ENDMAP lump of the map is reached
+static void MAP_BuildBinaryLumps(lessudmf_t* context, uint8_t format)
+{
+    CONTEXT_Print(context, "Building the binary map lumps... ");
+
+    uint8_t hexen = (format == BINARYFORMAT_HEXEN);
+    uint32_t thingCount = 0;
+    for (uint32_t b = 0; b < context->blockCount; b++) {
+        if (BLOCK_GetLevelElement(&context->blocks[b]) == LEVEL_THING)
+            thingCount++;
+    }
+
+    uint8_t* p = BINARY_AllocateLump(context, BINLUMP_THINGS, thingCount, hexen ? 20 : 10);
+    for (uint32_t b = 0; b < context->blockCount; b++) {
+        if (BLOCK_GetLevelElement(&context->blocks[b]) != LEVEL_THING)
+            continue;
+        uint16_t flags = 0;
+        BINARY_CheckBlock(context, &context->blocks[b], LEVEL_THING, format, &flags);
+        if (hexen)
+            BINARY_PutField(context, &p, &context->blocks[b], LEVEL_THING, "id", 2);
+        BINARY_PutField(context, &p, &context->blocks[b], LEVEL_THING, "x", 2);
+        BINARY_PutField(context, &p, &context->blocks[b], LEVEL_THING, "y", 2);
+        if (hexen)
+            BINARY_PutField(context, &p, &context->blocks[b], LEVEL_THING, "height", 2);
+        BINARY_PutField(context, &p, &context->blocks[b], LEVEL_THING, "angle", 2);
+        BINARY_PutField(context, &p, &context->blocks[b], LEVEL_THING, "type", 2);
+        BINARY_Put16(&p, flags);
+        if (hexen) {
+            BINARY_PutField(context, &p, &context->blocks[b], LEVEL_THING, SPECIAL_STR, 1);
+            for (uint8_t a = 0; a < 5; a++) {
+                snprintf(context->buffer_str, sizeof(context->buffer_str), "arg%u", a);
+                BINARY_PutField(context, &p, &context->blocks[b], LEVEL_THING, context->buffer_str, 1);
+            }
+        }
+    }
+
+    p = BINARY_AllocateLump(context, BINLUMP_LINEDEFS, context->linedefCount, hexen ? 16 : 14);
+    for (uint32_t l = 0; l < context->linedefCount; l++) {
+        const linedef_t* linedef = &context->linedefs[l];
+        uint16_t flags = 0;
+        BINARY_CheckBlock(context, linedef->block, LEVEL_LINEDEF, format, &flags);
+        BINARY_Put16(&p, linedef->v1 ? (int32_t)(linedef->v1 - context->vertices) : 0);
+        BINARY_Put16(&p, linedef->v2 ? (int32_t)(linedef->v2 - context->vertices) : 0);
+        BINARY_Put16(&p, flags);
+        if (hexen) {
+            BINARY_PutField(context, &p, linedef->block, LEVEL_LINEDEF, SPECIAL_STR, 1);
+            for (uint8_t a = 0; a < 5; a++) {
+                snprintf(context->buffer_str, sizeof(context->buffer_str), "arg%u", a);
+                BINARY_PutField(context, &p, linedef->block, LEVEL_LINEDEF, context->buffer_str, 1);
+            }
+        } else {
+            int32_t tag = 0;
+            BINARY_PutField(context, &p, linedef->block, LEVEL_LINEDEF, SPECIAL_STR, 2);
+            BINARY_GetInteger(context, linedef->block, LEVEL_LINEDEF, "id", &tag);
+            BINARY_Put16(&p, (tag < 0) ? 0 : tag);
+        }
+        BINARY_Put16(&p, linedef->sidefront ? (int32_t)(linedef->sidefront - context->sidedefs) : UINT16_MAX);
+        BINARY_Put16(&p, linedef->sideback ? (int32_t)(linedef->sideback - context->sidedefs) : UINT16_MAX);
+    }
+
+    p = BINARY_AllocateLump(context, BINLUMP_SIDEDEFS, context->sidedefCount, 30);
+    for (uint32_t s = 0; s < context->sidedefCount; s++) {
+        const block_t* blk = context->sidedefs[s].block;
+        BINARY_PutField(context, &p, blk, LEVEL_SIDEDEF, "offsetx", 2);
+        BINARY_PutField(context, &p, blk, LEVEL_SIDEDEF, "offsety", 2);
+        BINARY_PutTexture(&p, blk, TEXTURETOP_STR);
+        BINARY_PutTexture(&p, blk, TEXTUREBOTTOM_STR);
+        BINARY_PutTexture(&p, blk, TEXTUREMIDDLE_STR);
+        BINARY_Put16(&p, context->sidedefs[s].sector ? (int32_t)(context->sidedefs[s].sector - context->sectors) : 0);
+    }
+
+    p = BINARY_AllocateLump(context, BINLUMP_VERTEXES, context->vertexCount, 4);
+    for (uint32_t v = 0; v < context->vertexCount; v++) {
+        BINARY_PutField(context, &p, context->vertices[v].block, LEVEL_VERTEX, "x", 2);
+        BINARY_PutField(context, &p, context->vertices[v].block, LEVEL_VERTEX, "y", 2);
+    }
+
+    p = BINARY_AllocateLump(context, BINLUMP_SECTORS, context->sectorCount, 26);
+    for (uint32_t s = 0; s < context->sectorCount; s++) {
+        const block_t* blk = context->sectors[s].block;
+        BINARY_PutField(context, &p, blk, LEVEL_SECTOR, FLOORHEIGHT_STR, 2);
+        BINARY_PutField(context, &p, blk, LEVEL_SECTOR, CEILINGHEIGHT_STR, 2);
+        BINARY_PutTexture(&p, blk, TEXTUREFLOOR_STR);
+        BINARY_PutTexture(&p, blk, TEXTURECEILING_STR);
+        BINARY_PutField(context, &p, blk, LEVEL_SECTOR, "lightlevel", 2);
+        BINARY_PutField(context, &p, blk, LEVEL_SECTOR, SPECIAL_STR, 2);
+        BINARY_PutField(context, &p, blk, LEVEL_SECTOR, "id", 2);
+    }
+
+    // Hexen format maps are recognized by their BEHAVIOR lump, an empty ACS object is written if the map has none
+    if (hexen) {
+        static const uint8_t emptyBehavior[16] = { 'A', 'C', 'S', 0, 8, 0, 0, 0 };
+        memcpy(BINARY_AllocateLump(context, BINLUMP_BEHAVIOR, 1, sizeof(emptyBehavior)), emptyBehavior, sizeof(emptyBehavior));
+    }
+
+    uint32_t total = 0;
+    for (uint8_t m = 0; m < BINLUMP_COUNT; m++)
+        total += context->binaryLumps[m].data ? context->binaryLumps[m].size : 0;
+    CONTEXT_Print(context, "%s (%u %s)\n", DONE_STR, total, BYTES_STR);
+}
+
+//
+// OUTPUT
+//
+
+#ifndef LESSUDMF_LIBRARY
+// Remove the unfinished Output WAD, called when the program fails before it finished writing it
+static void OUTPUT_Discard(lessudmf_t* context)
+{
+    if (!context->outputTempPath[0])
+        return;
+#ifdef LESSUDMF_MMAP
+    close(context->OUTPUT_FD);
+    context->OUTPUT_FD = -1;
+#else
+    fclose(context->outputWAD);
+    context->outputWAD = 0;
+#endif
+    remove(context->outputTempPath);
+    context->outputTempPath[0] = 0;
+}
+
+// Create the Output WAD next to the given path, it replaces the file only when it is complete (see OUTPUT_Finish).
+// The Input WAD can be the same file. Returns 0 on failure
+static uint8_t OUTPUT_Open(lessudmf_t* context, const char* path)
+{
+    if (snprintf(context->outputTempPath, sizeof(context->outputTempPath), "%s.tmp", path) >= (int)sizeof(context->outputTempPath)) {
+        context->outputTempPath[0] = 0; // the path is too long
+        return 0;
+    }
+#ifdef LESSUDMF_MMAP
+    context->OUTPUT_FD = open(context->outputTempPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (context->OUTPUT_FD < 0) {
+#else
+    context->outputWAD = fopen(context->outputTempPath, "w+b");
+    if (!context->outputWAD) {
+#endif
+        context->outputTempPath[0] = 0;
+        return 0;
+    }
+    context->OUTPUT_SIZE = 0;
+    return 1;
+}
+#endif
+
+// Build the Output WAD in memory instead of a file, OUTPUT_Finish leaves it in OUTPUT_MEMORY (OUTPUT_SIZE bytes)
+static void OUTPUT_OpenMemory(lessudmf_t* context)
+{
+    context->OUTPUT_ALLOCATED = 0x10000;
+    context->OUTPUT_MEMORY = (char*)MEMORY_Alloc(context, context->OUTPUT_ALLOCATED);
+    if (!context->OUTPUT_MEMORY) {
+        fprintf(stderr, "%s %s %s the %s %s (%u %s)\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, OUTPUT_STR, WAD_STR, context->OUTPUT_ALLOCATED, BYTES_STR);
+        CONTEXT_Fail(context);
+    }
+    context->OUTPUT_SIZE = 0;
+}
+
+// Append the data to the Output WAD file
+static void OUTPUT_Write(lessudmf_t* context, const void* data, uint32_t size)
+{
+    const char* p = (const char*)data;
+    uint32_t left = size;
+
+    if (context->OUTPUT_MEMORY) {
+        if ((uint64_t)context->OUTPUT_SIZE + size > context->OUTPUT_ALLOCATED) {
+            while ((uint64_t)context->OUTPUT_SIZE + size > context->OUTPUT_ALLOCATED)
+                context->OUTPUT_ALLOCATED = (context->OUTPUT_ALLOCATED > UINT32_MAX / 2) ? UINT32_MAX : context->OUTPUT_ALLOCATED * 2;
+            context->OUTPUT_MEMORY = (char*)MEMORY_Realloc(context, context->OUTPUT_MEMORY, context->OUTPUT_ALLOCATED);
+            if (!context->OUTPUT_MEMORY) {
+                fprintf(stderr, "%s %s re%s the %s %s (%u %s)\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, OUTPUT_STR, WAD_STR, context->OUTPUT_ALLOCATED, BYTES_STR);
+                CONTEXT_Fail(context);
+            }
+        }
+        if (size)
+            memcpy(context->OUTPUT_MEMORY + context->OUTPUT_SIZE, data, size);
+        context->OUTPUT_SIZE += size;
+        return;
+    }
+#ifdef LESSUDMF_MMAP
+    while (left) {
+        ssize_t written = write(context->OUTPUT_FD, p, left);
+        if (written <= 0)
+            break;
+        p += written;
+        left -= (uint32_t)written;
+    }
+#else
+    if (left && fwrite(p, left, 1, context->outputWAD) == 1)
+        left = 0;
+#endif
+    if (left) {
+        fprintf(stderr, "%s %s write the %s %s (%s)\n", ERROR_STR, FAILEDTO_STR, OUTPUT_STR, WAD_STR, context->outputTempPath);
+        CONTEXT_Fail(context);
+    }
+    context->OUTPUT_SIZE += size;
+}
+
+// Add the lump at the current end of the Output WAD to its Directory Table
+static void OUTPUT_AddDirectoryEntry(lessudmf_t* context, const char* name, uint32_t size)
+{
+    context->outputLumps = (lump_t*)MEMORY_Realloc(context, context->outputLumps, (context->outputLumpsAmount + 1) * sizeof(lump_t));
+    if (!context->outputLumps) {
+        fprintf(stderr, "%s %s re%s the %s %s Directory Table\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, OUTPUT_STR, WAD_STR);
+        CONTEXT_Fail(context);
+    }
+    lump_t* lump = &context->outputLumps[context->outputLumpsAmount++];
+    memset(lump->name, 0, sizeof(lump->name));
+    memcpy(lump->name, name, strnlen(name, sizeof(lump->name))); // not terminated when 8 characters long
+    lump->address = context->OUTPUT_SIZE;
+    lump->size = size;
+}
+
+// Check if the data was already written to the Output WAD at the address
+static uint8_t OUTPUT_IsWritten(lessudmf_t* context, const void* data, uint32_t size, uint32_t address)
+{
+    char chunk[0x4000];
+    uint8_t equal = 1;
+
+    if (context->OUTPUT_MEMORY)
+        return !memcmp(context->OUTPUT_MEMORY + address, data, size);
+#ifndef LESSUDMF_MMAP
+    fflush(context->outputWAD);
+    fseek(context->outputWAD, address, SEEK_SET);
+#endif
+    for (uint32_t done = 0; done < size && equal; done += sizeof(chunk)) {
+        uint32_t part = (size - done < sizeof(chunk)) ? size - done : sizeof(chunk);
+#ifdef LESSUDMF_MMAP
+        equal = (pread(context->OUTPUT_FD, chunk, part, address + done) == (ssize_t)part);
+#else
+        equal = (fread(chunk, part, 1, context->outputWAD) == 1);
+#endif
+        equal = equal && !memcmp(chunk, (const char*)data + done, part);
+    }
+#ifndef LESSUDMF_MMAP
+    fseek(context->outputWAD, 0, SEEK_END);
+#endif
+    return equal;
+}
+
+// Add the lump to the Directory Table pointing at the data of an earlier lump with identical contents.
+// Returns 0 if no earlier lump has the data, the data is then indexed for the later lumps
+static uint8_t OUTPUT_ShareLump(lessudmf_t* context, const char* name, const void* data, uint32_t size)
+{
+    if (!size || (context->FLAGS & LESSUDMF_FLAG_PRESERVELUMPS))
+        return 0;
+
+    char key[32];
+    int64_t index;
+    snprintf(key, sizeof(key), "%016llx %u", (unsigned long long)HASH_Data(data, size), size);
+    if (HASHTABLE_Get(&context->outputLumpData, key, &index) && OUTPUT_IsWritten(context, data, size, context->outputLumps[index].address)) {
+        uint32_t address = context->outputLumps[index].address;
+        OUTPUT_AddDirectoryEntry(context, name, size);
+        context->outputLumps[context->outputLumpsAmount - 1].address = address;
+        context->outputSharedLumps++;
+        context->outputSharedBytes += size;
+        return 1;
+    }
+    HASHTABLE_Set(context, &context->outputLumpData, key, context->outputLumpsAmount);
+    return 0;
+}
+
+// Write the lump data to the Output WAD and add the lump to its Directory Table
+static void OUTPUT_AddLump(lessudmf_t* context, const char* name, const void* data, uint32_t size)
+{
+    if (OUTPUT_ShareLump(context, name, data, size))
+        return;
+    OUTPUT_AddDirectoryEntry(context, name, size);
+    OUTPUT_Write(context, data, size);
+}
+
+// Copy a lump of the Input WAD to the Output WAD unmodified. The data is copied from file to file by the kernel
+// where possible, without passing through the memory of the program
+static void OUTPUT_CopyLump(lessudmf_t* context, uint32_t index)
+{
+    uint32_t left = context->lumps[index].size;
+    if (OUTPUT_ShareLump(context, context->lumps[index].name, WAD_GetLump(context, index), left))
+        return;
+    OUTPUT_AddDirectoryEntry(context, context->lumps[index].name, left);
+
+#ifdef LESSUDMF_COPYRANGE
+    // The Output WAD file offset moves with the copied data, the Input WAD offset is given
+    loff_t from = context->lumps[index].address;
+    while (left && !context->OUTPUT_MEMORY && context->INPUT_FD >= 0) {
+        ssize_t copied = copy_file_range(context->INPUT_FD, &from, context->OUTPUT_FD, 0, left, 0);
+        if (copied <= 0)
+            break;
+        left -= (uint32_t)copied;
+        context->OUTPUT_SIZE += (uint32_t)copied;
+    }
+    while (left && !context->OUTPUT_MEMORY && context->INPUT_FD >= 0) {
+        off_t offset = (off_t)from;
+        ssize_t copied = sendfile(context->OUTPUT_FD, context->INPUT_FD, &offset, left);
+        if (copied <= 0)
+            break;
+        from = offset;
+        left -= (uint32_t)copied;
+        context->OUTPUT_SIZE += (uint32_t)copied;
+    }
+#endif
+
+    // Copy the rest from the mapped Input WAD
+    OUTPUT_Write(context, WAD_GetLump(context, index) + context->lumps[index].size - left, left);
+}
+
+// Close the Output file and replace the file at the output path with it, the file is removed instead if
+// writing it failed before (ok is 0). Returns 0 on failure
+static uint8_t OUTPUT_Close(lessudmf_t* context, uint8_t ok)
+{
+#ifdef LESSUDMF_MMAP
+    ok &= !close(context->OUTPUT_FD);
+    context->OUTPUT_FD = -1;
+#else
+    ok &= !fclose(context->outputWAD);
+    context->outputWAD = 0;
+    remove(context->outputFilePath); // rename() does not replace files on Windows
+#endif
+    if (!ok || rename(context->outputTempPath, context->outputFilePath)) {
+        remove(context->outputTempPath);
+        context->outputTempPath[0] = 0;
+        return 0;
+    }
+    context->outputTempPath[0] = 0;
+    return 1;
+}
+
+// Write the Directory Table of the Output WAD, patch the amount of lumps and the Directory Table address
+// in its header and replace the Output WAD file with it. Returns 0 on failure
+static uint8_t OUTPUT_Finish(lessudmf_t* context)
+{
+    uint32_t header[2] = { context->outputLumpsAmount, context->OUTPUT_SIZE };
+
+    char* directory = (char*)MEMORY_Alloc(context, context->outputLumpsAmount * 16 + 1);
+    if (!directory) {
+        fprintf(stderr, "%s %s %s the %s %s Directory Table\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, OUTPUT_STR, WAD_STR);
+        return 0;
+    }
+    for (uint32_t i = 0; i < context->outputLumpsAmount; i++) {
+        memcpy(directory + i * 16, &context->outputLumps[i].address, 4);
+        memcpy(directory + i * 16 + 4, &context->outputLumps[i].size, 4);
+        memcpy(directory + i * 16 + 8, context->outputLumps[i].name, 8);
+    }
+    OUTPUT_Write(context, directory, context->outputLumpsAmount * 16);
+    MEMORY_Free(context, directory);
+
+    if (context->OUTPUT_MEMORY) {
+        memcpy(context->OUTPUT_MEMORY + 4, header, sizeof(header));
+        return 1;
+    }
+#ifdef LESSUDMF_MMAP
+    uint8_t ok = (pwrite(context->OUTPUT_FD, header, sizeof(header), 4) == sizeof(header));
+#else
+    uint8_t ok = !fseek(context->outputWAD, 4, SEEK_SET) && fwrite(header, sizeof(header), 1, context->outputWAD) == 1;
+#endif
+    return OUTPUT_Close(context, ok);
+}
+
+// Write the lumps generated for the current map, only the one with the given name or all if the name is 0
+static void OUTPUT_AddMapLumps(lessudmf_t* context, const char* name)
+{
+    for (uint8_t m = 0; m < MAPLUMP_COUNT; m++) {
+        if (!context->mapLumps[m].data || (name && strncmp(context->mapLumps[m].name, name, 8)))
+            continue;
+        OUTPUT_AddLump(context, context->mapLumps[m].name, context->mapLumps[m].data, context->mapLumps[m].size);
+        MEMORY_Free(context, context->mapLumps[m].data);
+        context->mapLumps[m].data = 0;
+    }
+}
+
+// Collect a lump of the map written in the binary format, the data of the lumps the binary map has no place for is
+// dropped (they are checked before). Lumps already generated for the map replace the old ones.
+static void OUTPUT_CollectBinaryMapLump(lessudmf_t* context, const char* name, const void* data, uint32_t size)
+{
+    uint8_t slot = BINLUMP_COUNT;
+    if (!strncmp(name, "ZNODES", 8))
+        slot = BINLUMP_SSECTORS;
+    for (uint8_t m = BINLUMP_REJECT; m < BINLUMP_COUNT && slot == BINLUMP_COUNT; m++) {
+        if (!strncmp(context->binaryLumps[m].name, name, 8))
+            slot = m;
+    }
+    if (slot == BINLUMP_COUNT || (context->binaryLumps[slot].data && slot != BINLUMP_BEHAVIOR))
+        return;
+
+    MEMORY_Free(context, context->binaryLumps[slot].data);
+    context->binaryLumps[slot].data = (char*)MEMORY_Alloc(context, size + 1);
+    if (!context->binaryLumps[slot].data) {
+        fprintf(stderr, "%s %s %s the %s lump (%u %s)\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, context->binaryLumps[slot].name, size, BYTES_STR);
+        CONTEXT_Fail(context);
+    }
+    memcpy(context->binaryLumps[slot].data, data, size);
+    context->binaryLumps[slot].size = size;
+}
+
+// Write the lumps of the binary map in their order, the missing nodes and blockmap lumps are written empty
+// so the engine builds them. The Doom format has no BEHAVIOR lump.
+static void OUTPUT_AddBinaryMapLumps(lessudmf_t* context)
+{
+    for (uint8_t m = 0; m < BINLUMP_COUNT; m++) {
+        if (context->binaryLumps[m].data)
+            OUTPUT_AddLump(context, context->binaryLumps[m].name, context->binaryLumps[m].data, context->binaryLumps[m].size);
+        else if (m < BINLUMP_BEHAVIOR)
+            OUTPUT_AddLump(context, context->binaryLumps[m].name, 0, 0);
+        MEMORY_Free(context, context->binaryLumps[m].data);
+        context->binaryLumps[m].data = 0;
+        context->binaryLumps[m].size = 0;
+    }
+    context->binaryFormat = BINARYFORMAT_NONE;
+}
+
+// Free the lumps of the map which were not written
+static void MAP_FreeLumps(lessudmf_t* context)
+{
+    for (uint8_t m = 0; m < MAPLUMP_COUNT; m++) {
+        MEMORY_Free(context, context->mapLumps[m].data);
+        context->mapLumps[m].data = 0;
+    }
+    for (uint8_t m = 0; m < BINLUMP_COUNT; m++) {
+        MEMORY_Free(context, context->binaryLumps[m].data);
+        context->binaryLumps[m].data = 0;
+        context->binaryLumps[m].size = 0;
+    }
+    context->binaryFormat = BINARYFORMAT_NONE;
+}
+
+// Check if a lump with the given name was generated for the current map
+static uint8_t BOOL_IsMapLumpGenerated(lessudmf_t* context, const char* name)
+{
+    for (uint8_t m = 0; m < MAPLUMP_COUNT; m++) {
+        if (context->mapLumps[m].data && !strncmp(context->mapLumps[m].name, name, 8))
+            return 1;
+    }
+    return 0;
+}
+
+// Load the configuration file for the game engine of the map
+static void CONFIG_LoadFile(lessudmf_t* context)
+{
+    // The config of the previous game engine does not apply to this map, even if the new one is not found
+    if (context->FLAGS & LESSUDMF_FLAG_CONFIGLOADED)
+        CONFIG_Free(context, &context->config);
+
+    if (stat(context->configFiles[context->gameEngine], &context->filestatus)) {
+        fprintf(stderr, "%s %s \"%s\" %s\n", WARNING_STR, CONFIGFILE_STR, context->configFiles[context->gameEngine], NOTFOUND_STR);
+    } else {
+        if (context->configFiles[ENGINE_UNKNOWN])
+            CONTEXT_Print(context, "! Using custom game configuration !\n");
+        context->config.flags = 0;
+
+        // Try to load the file itself
+        context->config.filesize = context->filestatus.st_size;
+
+        context->config.buffer = (char*)MEMORY_Alloc(context, context->config.filesize + 1);
+        if (!context->config.buffer) {
+            fprintf(stderr, "%s %s %s the %s (%u %s)\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, CONFIGFILE_STR, context->config.filesize + 1, BYTES_STR);
+            return;
+        }
+
+        context->configFile = fopen(context->configFiles[context->gameEngine], "rb");
+        if (!context->configFile) {
+            fprintf(stderr, "%s %s open the \"%s\" %s\n", ERROR_STR, FAILEDTO_STR, context->configFiles[context->gameEngine], CONFIGFILE_STR);
+            MEMORY_Free(context, context->config.buffer);
+            context->config.buffer = 0;
+            return;
+        }
+
+        fread(context->config.buffer, context->config.filesize, 1, context->configFile);
+        context->config.buffer[context->config.filesize] = 0;
+        fclose(context->configFile);
+
+        json_settings settings = CONFIG_JSONSettings(context);
+        context->config.json = json_parse_ex(&settings, context->config.buffer, context->config.filesize, 0);
+        if (!context->config.json) {
+            fprintf(stderr, "%s %s parse JSON data from the %s\n", ERROR_STR, FAILEDTO_STR, CONFIGFILE_STR);
+            MEMORY_Free(context, context->config.buffer);
+            context->config.buffer = 0;
+            return;
+        }
+
+        if (!CONFIG_Parse(context, &context->config)) {
+            fprintf(stderr, "%s %s parse the %s, program will not do deep level optimization\n", ERROR_STR, FAILEDTO_STR, CONFIGFILE_STR);
+            CONFIG_Free(context, &context->config);
+            memset(&context->config, 0, sizeof(context->config));
+            return;
+        }
+
+        context->FLAGS |= LESSUDMF_FLAG_CONFIGLOADED;
+    }
+}
+
+#ifdef LESSUDMF_THREADS
+static pthread_mutex_t sharedConfigsLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+// Get the configuration of the game engine of the map from the WAD context, it is loaded by the first map
+// that needs it and then shared read-only by all the maps optimized on the thread pool
+static void CONFIG_LoadShared(lessudmf_t* context)
+{
+    lessudmf_t* wad = context->parent;
+    jmp_buf* previousJump = context->failJump;
+    jmp_buf jump;
+#ifdef LESSUDMF_THREADS
+    pthread_mutex_lock(&sharedConfigsLock);
+#endif
+    context->failJump = &jump;
+    if (setjmp(jump)) {
+        // The other maps must still get the lock
+#ifdef LESSUDMF_THREADS
+        pthread_mutex_unlock(&sharedConfigsLock);
+#endif
+        context->failJump = previousJump;
+        CONTEXT_Fail(context);
+    }
+    if (!wad->sharedConfigsState[context->gameEngine]) {
+        CONFIG_LoadFile(context);
+        wad->sharedConfigs[context->gameEngine] = context->config;
+        wad->sharedConfigsState[context->gameEngine] = (context->FLAGS & LESSUDMF_FLAG_CONFIGLOADED) ? 1 : 2;
+    } else if (wad->sharedConfigsState[context->gameEngine] == 1) {
+        context->config = wad->sharedConfigs[context->gameEngine];
+        context->FLAGS |= LESSUDMF_FLAG_CONFIGLOADED;
+    }
+    context->failJump = previousJump;
+#ifdef LESSUDMF_THREADS
+    pthread_mutex_unlock(&sharedConfigsLock);
+#endif
+}
+
+// Load the configuration file for the game engine of the map so the program knows better what to optimize,
+// the config stays loaded for the next maps of the same game engine
+static void CONFIG_Load(lessudmf_t* context)
+{
+    if (context->parent) {
+        CONFIG_LoadShared(context);
+        return;
+    }
+    if (context->gameEngine == context->gameEngine_last)
+        return;
+    context->gameEngine_last = context->gameEngine;
+    CONFIG_LoadFile(context);
+}
+
+// Free the data blocks of the loaded map
+static void MAP_Free(lessudmf_t* context)
+{
+    for (uint32_t b = 0; b < context->blockCount; b++) {
+        for (size_t p = 0; p < context->blocks[b].fieldsCount; p++) {
+            MEMORY_Free(context, context->blocks[b].fields[p].key);
+            MEMORY_Free(context, context->blocks[b].fields[p].value);
+        }
+        MEMORY_Free(context, context->blocks[b].fields);
+    }
+    MEMORY_Free(context, context->blocks);
+    context->blocks = 0;
+    context->blockCount = 0;
+    MEMORY_Free(context, context->namespaceValue);
+    context->namespaceValue = 0;
+}
+
+// Parse the TEXTMAP into data blocks for the program and load the game configuration of its namespace
+static void MAP_Load(lessudmf_t* context, const char* textmap, uint32_t size)
+{
+    // Free old blocks if any
+    MAP_Free(context);
+    context->mapFlags = 0;
+
+    // Parse the TEXTMAP into data blocks for the program
+    TEXTMAP_Parse(context, textmap, size);
+    TEXTMAP_BuildReferences(context);
+    CONTEXT_Print(context, "Loaded the map data, %s is \"%s\"\n", NAMESPACE_STR, context->namespaceValue);
+
+    CONFIG_Load(context);
+}
+
+// Optimize the loaded map with the passes enabled by the flags
+static void MAP_Optimize(lessudmf_t* context)
+{
+    // Same numbers are written the same way before any block is compared
+    MAP_CanonicalizeNumbers(context);
+
+    // Snap the values to the config grids, so more blocks become identical (enabled with "--quantize" CLI option)
+    if ((context->FLAGS & LESSUDMF_FLAG_QUANTIZE) && (context->FLAGS & LESSUDMF_FLAG_CONFIGLOADED))
+        MAP_QuantizeValues(context);
+
+    // Remove zero-length/duplicate linedefs and sectors with no area (enabled with "-g" CLI option)
+    if (context->FLAGS & LESSUDMF_FLAG_REMOVEGEOMETRY)
+        MAP_RemoveDegenerateGeometry(context);
+
+    // Remove flat textures from non-visible sector surfaces
+    if (!(context->FLAGS & LESSUDMF_FLAG_PRESERVEFLATS))
+        MAP_RemoveUnseenFlatTextures(context);
+
+    if (context->FLAGS & LESSUDMF_FLAG_CONFIGLOADED) {
+        // Vertex heights only matter in triangular sectors
+        if (context->config.flags & CFGFLAG_POLYGONSLOPE)
+            MAP_RemoveUnusedVertexHeights(context);
+
+        // Remove the specials that target nothing, the tags do not change afterwards
+        MAP_BuildTagIndex(context);
+        if (context->config.tagArgs.count)
+            MAP_RemoveDeadSpecials(context);
+
+        // Remove the sector tags nothing refers to before merging, they keep the sectors apart
+        // (can be disabled with "-i" CLI option, the scripts in the WAD can refer to any tag)
+        if (!(context->FLAGS & LESSUDMF_FLAG_PRESERVETAGS) && !context->WAD_HasScripts && !context->OUTSIDE_HasScripts)
+            MAP_RemoveUnreferencedSectorTags(context);
+
+        // Merge identical sectors first so the final block layout and references are consistent.
+        if (!(context->FLAGS & LESSUDMF_FLAG_PRESERVESECTORS))
+            MAP_MergeSectors(context);
+
+        // Remove the textures and flats nobody can reach or see (enabled with "-u" CLI option)
+        if (context->FLAGS & LESSUDMF_FLAG_STRIPUNREACHABLE)
+            MAP_RemoveUnreachableAreas(context);
+
+        // Remove unrequired textures from control linedefs (can be disabled with "-t" CLI option)
+        if (!(context->FLAGS & LESSUDMF_FLAG_PRESERVETEXTURES)) {
+            MAP_RemoveControlLineTextures(context);
+            MAP_RemoveUnseenWallTextures(context);
+        }
+
+        // Force some things to face East (angle 0) (can be disabled with "-a" CLI option)
+        if (!(context->FLAGS & LESSUDMF_FLAG_PRESERVEANGLES))
+            MAP_NoAngleThings(context);
+
+        // Remove the parameters of textures that got removed or were never applied
+        MAP_RemoveTextureParameters(context);
+
+        // Remove the arguments the linedef specials and thing types do not use, the scripts can read any argument
+        if (!context->WAD_HasScripts && !context->OUTSIDE_HasScripts)
+            MAP_RemoveUnusedArgs(context);
+    }
+
+    // Reduce the texture offsets modulo the texture sizes (can be disabled with "-x" CLI option)
+    if (!(context->FLAGS & LESSUDMF_FLAG_PRESERVEOFFSETS) && context->textureSizes.count)
+        MAP_NormalizeTextureOffsets(context);
+
+    // Remove UDMF fields which are set to default value (can be disabled with "-d" CLI option)
+    if ((context->FLAGS & LESSUDMF_FLAG_CONFIGLOADED) && !(context->FLAGS & LESSUDMF_FLAG_PRESERVEDEFAULT))
+        MAP_RemoveDefaultValues(context);
+
+    // Remove the exact duplicates of things (can be disabled with "-k" CLI option)
+    if ((context->FLAGS & LESSUDMF_FLAG_CONFIGLOADED) && !(context->FLAGS & LESSUDMF_FLAG_PRESERVETHINGS))
+        MAP_RemoveDuplicateThings(context);
+
+    // Give the most referenced elements the shortest indices (enabled with "-m" CLI option)
+    if (context->FLAGS & LESSUDMF_FLAG_RENUMBER)
+        MAP_RenumberElements(context);
+
+    // Write the blocks and fields in a fixed order (enabled with "-z" CLI option)
+    if (context->FLAGS & LESSUDMF_FLAG_CANONICAL)
+        MAP_SortCanonical(context);
+}
+
+// Build the lumps of the optimized map: the TEXTMAP (in LUMP_BUFFER) or the lumps of the binary map, and the
+// nodes and REJECT. They are written when the old lumps or ENDMAP are reached
+static void MAP_Build(lessudmf_t* context, uint32_t textmapLump)
+{
+    // Write the map in the binary format when it fits (enabled with "-b" CLI option)
+    if (context->FLAGS & LESSUDMF_FLAG_BINARYMAP)
+        context->binaryFormat = MAP_GetBinaryFormat(context, textmapLump);
+    context->LUMP_BUFFER = 0;
+    if (context->binaryFormat != BINARYFORMAT_NONE)
+        MAP_BuildBinaryLumps(context, context->binaryFormat);
+    else
+        context->LUMP_BUFFER = TEXTMAP_Generate(context, context->blocks); // Write new lump to the buffer
+
+    // Generate the lumps from the optimized map, also when the changes to the map need them
+    if ((context->FLAGS | context->mapFlags) & LESSUDMF_FLAG_BUILDNODES)
+        context->mapLumps[MAPLUMP_ZNODES].data = NODES_BuildZNODES(context, &context->mapLumps[MAPLUMP_ZNODES].size);
+    if ((context->FLAGS | context->mapFlags) & LESSUDMF_FLAG_BUILDREJECT)
+        context->mapLumps[MAPLUMP_REJECT].data = REJECT_Build(context, &context->mapLumps[MAPLUMP_REJECT].size);
+
+    // The binary map keeps the extended GL nodes in its SSECTORS lump
+    if (context->binaryFormat != BINARYFORMAT_NONE) {
+        context->binaryLumps[BINLUMP_SSECTORS].data = context->mapLumps[MAPLUMP_ZNODES].data;
+        context->binaryLumps[BINLUMP_SSECTORS].size = context->mapLumps[MAPLUMP_ZNODES].size;
+        context->binaryLumps[BINLUMP_REJECT].data = context->mapLumps[MAPLUMP_REJECT].data;
+        context->binaryLumps[BINLUMP_REJECT].size = context->mapLumps[MAPLUMP_REJECT].size;
+        context->mapLumps[MAPLUMP_ZNODES].data = 0;
+        context->mapLumps[MAPLUMP_REJECT].data = 0;
+    }
+}
+
+//
+// IDENTICAL MAPS
+//
+
+// Check if the map lumps following the two TEXTMAP lumps have the same names
+static uint8_t BOOL_AreMapLumpsEqual(lessudmf_t* context, uint32_t a, uint32_t b)
+{
+    for (a++, b++; a < context->WAD_LumpsAmount && b < context->WAD_LumpsAmount; a++, b++) {
+        if (strncmp(context->lumps[a].name, context->lumps[b].name, 8))
+            return 0;
+        if (!strncmp(context->lumps[a].name, ENDMAP_STR, 6))
+            return 1;
+    }
+    return a >= context->WAD_LumpsAmount && b >= context->WAD_LumpsAmount;
+}
+
+// Find the maps of the Input WAD with a TEXTMAP identical to an earlier one (and the same map lumps), they are
+// optimized the same way so the optimized lumps of the first map are kept for them
+static void WAD_FindIdenticalMaps(lessudmf_t* context)
+{
+    context->identicalMaps = (uint32_t*)MEMORY_Alloc(context, context->WAD_LumpsAmount * sizeof(uint32_t) + 1);
+    context->mapCache = (mapcache_t**)MEMORY_Calloc(context, context->WAD_LumpsAmount + 1, sizeof(mapcache_t*));
+    if (!(context->identicalMaps && context->mapCache)) {
+        fprintf(stderr, "%s %s %s the identical maps index\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        CONTEXT_Fail(context);
+    }
+
+    hashtable_t textmaps = { 0 };
+    uint32_t copies = 0;
+    for (uint32_t i = 0; i < context->WAD_LumpsAmount; i++) {
+        context->identicalMaps[i] = i;
+        if (strncmp(context->lumps[i].name, TEXTMAP_STR, 8))
+            continue;
+
+        char key[32];
+        int64_t first;
+        snprintf(key, sizeof(key), "%016llx %u", (unsigned long long)HASH_Data(WAD_GetLump(context, i), context->lumps[i].size), context->lumps[i].size);
+        if (!HASHTABLE_Get(&textmaps, key, &first)) {
+            HASHTABLE_Set(context, &textmaps, key, i);
+            continue;
+        }
+        if (memcmp(WAD_GetLump(context, i), WAD_GetLump(context, (uint32_t)first), context->lumps[i].size) || !BOOL_AreMapLumpsEqual(context, (uint32_t)first, i))
+            continue;
+        context->identicalMaps[i] = (uint32_t)first;
+        if (!context->mapCache[first]) {
+            context->mapCache[first] = (mapcache_t*)MEMORY_Calloc(context, 1, sizeof(mapcache_t));
+            if (!context->mapCache[first]) {
+                fprintf(stderr, "%s %s %s the identical maps index\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+                CONTEXT_Fail(context);
+            }
+        }
+        copies++;
+    }
+    HASHTABLE_Free(context, &textmaps);
+
+    if (copies)
+        CONTEXT_Print(context, "%u maps of the %s %s are identical to earlier maps, their optimized data is reused\n", copies, INPUT_STR, WAD_STR);
+}
+
+// Copy the data of a map lump
+static void MAPLUMP_Copy(lessudmf_t* context, maplump_t* to, const maplump_t* from)
+{
+    to->name = from->name;
+    to->size = from->size;
+    to->data = 0;
+    if (!from->data)
+        return;
+    to->data = (char*)MEMORY_Alloc(context, from->size + 1);
+    if (!to->data) {
+        fprintf(stderr, "%s %s %s the copy of the %s lump (%u %s)\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, from->name, from->size, BYTES_STR);
+        CONTEXT_Fail(context);
+    }
+    memcpy(to->data, from->data, from->size);
+}
+
+// Keep the optimized lumps of the map with the TEXTMAP lump of the given index for its identical copies
+static void MAP_SaveToCache(lessudmf_t* context, uint32_t textmapLump, const char* textmap)
+{
+    mapcache_t* cache = context->mapCache[textmapLump];
+    maplump_t generated = { TEXTMAP_STR, (char*)textmap, textmap ? (uint32_t)strlen(textmap) : 0 };
+
+    cache->format = context->binaryFormat;
+    MAPLUMP_Copy(context, &cache->textmap, &generated);
+    for (uint8_t m = 0; m < MAPLUMP_COUNT; m++)
+        MAPLUMP_Copy(context, &cache->generated[m], &context->mapLumps[m]);
+    for (uint8_t m = 0; m < BINLUMP_COUNT; m++)
+        MAPLUMP_Copy(context, &cache->binary[m], &context->binaryLumps[m]);
+    cache->saved = 1;
+}
+
+// Tell which optimized lumps of the map were written to the Output WAD
+static void MAP_PrintWritten(lessudmf_t* context, uint32_t textmapLump)
+{
+    if (context->binaryFormat != BINARYFORMAT_NONE)
+        CONTEXT_Print(context, "* Wrote the modified data of %s to the %s in the binary format *\n", context->lumps[textmapLump - 1].name, OUTPUT_STR);
+    else
+        CONTEXT_Print(context, "* Wrote the modified %s data of %s to the %s *\n", TEXTMAP_STR, context->lumps[textmapLump - 1].name, OUTPUT_STR);
+}
+
+// Write the optimized lumps of the map (optimized on the thread pool) or of the identical map in place of the
+// TEXTMAP lump of the given index, the generated lumps are written when the old lump or ENDMAP is reached.
+// Returns 0 if they are not known yet
+static uint8_t MAP_LoadFromCache(lessudmf_t* context, uint32_t textmapLump)
+{
+    uint32_t first = context->identicalMaps[textmapLump];
+    if (!context->mapCache[first] || !context->mapCache[first]->saved)
+        return 0;
+
+    const mapcache_t* cache = context->mapCache[first];
+    if (first == textmapLump && cache->log)
+        CONTEXT_Print(context, "%s", cache->log);
+    context->binaryFormat = cache->format;
+    if (cache->textmap.data)
+        OUTPUT_AddLump(context, TEXTMAP_STR, cache->textmap.data, cache->textmap.size);
+    for (uint8_t m = 0; m < MAPLUMP_COUNT; m++)
+        MAPLUMP_Copy(context, &context->mapLumps[m], &cache->generated[m]);
+    for (uint8_t m = 0; m < BINLUMP_COUNT; m++)
+        MAPLUMP_Copy(context, &context->binaryLumps[m], &cache->binary[m]);
+
+    if (first == textmapLump) {
+        MAP_PrintWritten(context, textmapLump);
+        return 1;
+    }
+    CONTEXT_Print(context, "\n* %s of %s is identical to the one of %.8s, wrote its optimized data to the %s *\n", TEXTMAP_STR, context->lumps[textmapLump - 1].name, context->lumps[first - 1].name, OUTPUT_STR);
+    return 1;
+}
+
+// Free the optimized lumps of the identical maps
+static void MAP_FreeCache(lessudmf_t* context)
+{
+    for (uint32_t i = 0; context->mapCache && i < context->WAD_LumpsAmount; i++) {
+        if (!context->mapCache[i])
+            continue;
+        MEMORY_Free(context, context->mapCache[i]->textmap.data);
+        for (uint8_t m = 0; m < MAPLUMP_COUNT; m++)
+            MEMORY_Free(context, context->mapCache[i]->generated[m].data);
+        for (uint8_t m = 0; m < BINLUMP_COUNT; m++)
+            MEMORY_Free(context, context->mapCache[i]->binary[m].data);
+        MEMORY_Free(context, context->mapCache[i]->log);
+        MEMORY_Free(context, context->mapCache[i]);
+    }
+    MEMORY_Free(context, context->mapCache);
+    MEMORY_Free(context, context->identicalMaps);
+    context->mapCache = 0;
+    context->identicalMaps = 0;
+}
+
+//
+// MAP THREAD POOL
+//
+
+// Order of the TEXTMAP lumps, packed as ((UINT32_MAX - size) << 32 | lump index) so the largest come first
+static int MAP_CompareOrder(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Free what the context of a map holds, its memory goes back to the WAD context
+static void MAP_FreeContext(lessudmf_t* context)
+{
+    MAP_Free(context);
+    MEMORY_Free(context, context->sectors);
+    MEMORY_Free(context, context->sidedefs);
+    MEMORY_Free(context, context->linedefs);
+    MEMORY_Free(context, context->vertices);
+    MAP_FreeLumps(context);
+    for (uint8_t x = 0; x < 5; x++)
+        TEXTURERULES_Free(context, &context->builtinRules[x]);
+    for (uint8_t x = 0; x < 5; x++)
+        HASHTABLE_Free(context, &context->tagIndex[x]);
+    HASHTABLE_Free(context, &context->tagReferences);
+#ifdef LESSUDMF_THREADS
+    pthread_mutex_destroy(&context->allocations.lock);
+#endif
+}
+
+// Optimize a map of the WAD with its own context, the optimized lumps and the progress go to the map cache.
+// Returns 0 on failure, the memory of the map is freed with the WAD context
+static uint8_t MAP_OptimizeTask(lessudmf_t* wad, uint32_t index, void* data)
+{
+    const uint64_t* order = (const uint64_t*)data;
+    uint32_t lump = (uint32_t)order[index];
+    lessudmf_t* context = (lessudmf_t*)MEMORY_Alloc(wad, sizeof(lessudmf_t));
+    if (!context || !CONTEXT_Share(context, wad)) {
+        fprintf(stderr, "%s %s %s the context of the map\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        return 0;
+    }
+    jmp_buf jump;
+    context->failJump = &jump;
+    if (setjmp(jump))
+        return 0;
+
+    CONTEXT_Print(context, "\n* Working on %s of %s *\n", TEXTMAP_STR, context->lumps[lump - 1].name);
+    MAP_Load(context, (const char*)WAD_GetLump(context, lump), context->lumps[lump].size);
+    MAP_Optimize(context);
+    MAP_Build(context, lump);
+    MAP_SaveToCache(context, lump, context->LUMP_BUFFER);
+    MEMORY_Free(context, context->LUMP_BUFFER);
+    context->LUMP_BUFFER = 0;
+    context->mapCache[lump]->log = context->log;
+    context->log = 0;
+
+    CONTEXT_Unshare(context);
+    MAP_FreeContext(context);
+    MEMORY_Free(wad, context);
+    return 1;
+}
+
+// Optimize the maps of the Input WAD at once on the thread pool (enabled with "-j" CLI option), the largest maps
+// go first so no large map is left for the end. The lumps are written later in the order of the WAD
+static void WAD_OptimizeMaps(lessudmf_t* context)
+{
+    uint64_t* order = (uint64_t*)MEMORY_Alloc(context, (context->WAD_LumpsAmount + 1) * sizeof(uint64_t));
+    if (!order) {
+        fprintf(stderr, "%s %s %s the maps order\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+        CONTEXT_Fail(context);
+    }
+
+    uint32_t count = 0;
+    for (uint32_t i = 1; i < context->WAD_LumpsAmount; i++)
+        if (!strncmp(context->lumps[i].name, TEXTMAP_STR, 8) && context->identicalMaps[i] == i)
+            order[count++] = (uint64_t)(UINT32_MAX - context->lumps[i].size) << 32 | i;
+
+    uint32_t threadCount = context->mapThreads ? context->mapThreads : THREAD_GetCount();
+    if (threadCount > count)
+        threadCount = count;
+    if (threadCount < 2) {
+        // Nothing to do at once, the maps are optimized one by one
+        MEMORY_Free(context, order);
+        return;
+    }
 
-            // advance past semicolon if present
-            if (*ptr == ';')
-                ptr++;
+    for (uint32_t x = 0; x < count; x++) {
+        uint32_t lump = (uint32_t)order[x];
+        if (context->mapCache[lump])
+            continue;
+        context->mapCache[lump] = (mapcache_t*)MEMORY_Calloc(context, 1, sizeof(mapcache_t));
+        if (!context->mapCache[lump]) {
+            fprintf(stderr, "%s %s %s the optimized map\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR);
+            CONTEXT_Fail(context);
         }
-
-        blockCount++;
     }
+    qsort(order, count, sizeof(uint64_t), MAP_CompareOrder);
 
-    // Remove trailing empty blocks
-    while (blockCount > 0 && blocks[blockCount - 1].fieldsCount == 0) {
-        free(blocks[blockCount - 1].fields);
-        blockCount--;
+    CONTEXT_Print(context, "\nOptimizing %u maps on %u threads... ", count, threadCount);
+    fflush(stdout);
+    THREAD_ParallelForThreads(context, count, threadCount, MAP_OptimizeTask, order);
+    CONTEXT_Print(context, "%s\n", DONE_STR);
+    MEMORY_Free(context, order);
+}
+
+//
+// WAD
+//
+
+// Free the Directory Tables and the indexes of the optimized WAD, so another WAD can be optimized
+static void WAD_Free(lessudmf_t* context)
+{
+    MEMORY_Free(context, context->lumps);
+    context->lumps = 0;
+    context->WAD_LumpsAmount = 0;
+    context->WAD_HasScripts = 0;
+    MEMORY_Free(context, context->outputLumps);
+    context->outputLumps = 0;
+    context->outputLumpsAmount = 0;
+    context->outputSharedLumps = 0;
+    context->outputSharedBytes = 0;
+    HASHTABLE_Free(context, &context->textureSizes);
+    for (uint8_t x = 0; x < 5; x++)
+        HASHTABLE_Free(context, &context->tagIndex[x]);
+    HASHTABLE_Free(context, &context->outputLumpData);
+    MAP_FreeCache(context);
+    for (uint8_t e = 0; e <= ENGINE_SRB2; e++) {
+        if (context->sharedConfigsState[e] == 1)
+            CONFIG_Free(context, &context->sharedConfigs[e]);
+        context->sharedConfigsState[e] = 0;
     }
 }
 
-static void TEXTMAP_BuildReferences(void)
+// Optimize the maps of the Input WAD (INPUT_DATA) and write the Output WAD to the opened output. Returns 0 on failure
+static uint8_t WAD_Optimize(lessudmf_t* context)
 {
-    // Count the amount of elements in map
-    sectorCount = 0;
-    sidedefCount = 0;
-    linedefCount = 0;
-    for (uint32_t i = 0; i < blockCount; i++) {
-        if (!strncmp(blocks[i].header, SECTOR_STR, 6))
-            sectorCount++;
-        if (!strncmp(blocks[i].header, SIDEDEF_STR, 7))
-            sidedefCount++;
-        if (!strncmp(blocks[i ].header, LINEDEF_STR, 7))
-            linedefCount++;
+    // Read the WAD type
+    if (context->INPUT_SIZE < 12 || strncmp(context->INPUT_DATA + 1, WAD_STR, 3)) {
+        fprintf(stderr, "%s %s Bad %s %s header\n", ERROR_STR, ERROR_STR, INPUT_STR, WAD_STR);
+        return 0;
     }
 
-    // Memory allocation
+    // The lumps are written to the Output WAD as soon as they are ready
+    OUTPUT_Write(context, context->INPUT_DATA, 4);
 
-    // Sectors
-    sectors = (sector_t*)realloc(sectors, sectorCount * sizeof(sector_t));
-    if (sectorCount && !sectors) {
-        fprintf(stderr, "%s %s (re)%s the %s array\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, SECTOR_STR);
-        exit(1);
+    // Get the amount of lumps in WAD and allocate the space for them
+    memcpy(&context->WAD_LumpsAmount, context->INPUT_DATA + 4, 4);
+    // Ignore the amount of lumps in the Output WAD for now, lumps can be added so we'll correct it at the end
+    OUTPUT_Write(context, &context->WAD_LumpsAmount, 4);
+    context->lumps = (lump_t*)MEMORY_Alloc(context, sizeof(lump_t) * context->WAD_LumpsAmount);
+    if (!context->lumps) {
+        fprintf(stderr, "%s %s %s the %s lumps buffer\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, WAD_STR);
+        WAD_Free(context);
+        return 0;
     }
-    memset(sectors, 0, sectorCount * sizeof(sector_t));
 
-    // Sidedefs
-    sidedefs = (sidedef_t*)realloc(sidedefs, sidedefCount * sizeof(sidedef_t));
-    if (sidedefCount && !sidedefs) {
-        fprintf(stderr, "%s %s (re)%s the %s array\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, SIDEDEF_STR);
-        exit(1);
+    // Get Directory Table address
+    memcpy(&context->WAD_DirectoryAddress, context->INPUT_DATA + 8, 4);
+    if ((uint64_t)context->WAD_DirectoryAddress + (uint64_t)context->WAD_LumpsAmount * 16 > context->INPUT_SIZE) {
+        fprintf(stderr, "%s Bad %s %s Directory Table\n", ERROR_STR, INPUT_STR, WAD_STR);
+        WAD_Free(context);
+        return 0;
     }
-    memset(sidedefs, 0, sidedefCount * sizeof(sidedef_t));
 
-    // Linedefs
-    linedefs = (linedef_t*)realloc(linedefs, linedefCount * sizeof(linedef_t));
-    if (linedefCount && !linedefs) {
-        fprintf(stderr, "%s %s (re)%s the %s array\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, LINEDEF_STR);
-        exit(1);
+    // Ignore the Directory Table address in the Output WAD for now, we'll correct it at the end
+    OUTPUT_Write(context, &context->WAD_DirectoryAddress, 4);
+
+    // Read the dir table, the lumps are read at their addresses so they can be stored in any order
+    CONTEXT_Print(context, "Directory Table of the %s %s:", INPUT_STR, WAD_STR);
+    CONTEXT_Print(context, "%s\n", DIRTABLE_STR);
+    for (uint32_t i = 0; i < context->WAD_LumpsAmount; i++) {
+        const char* entry = context->INPUT_DATA + context->WAD_DirectoryAddress + i * 16;
+        memcpy(&context->lumps[i].address, entry, 4);
+        memcpy(&context->lumps[i].size, entry + 4, 4);
+        memcpy(context->lumps[i].name, entry + 8, 8);
+        CONTEXT_Print(context, "%2d %8d %8d %8.8s\n", i, context->lumps[i].address, context->lumps[i].size, context->lumps[i].name);
+        if (context->lumps[i].size && (uint64_t)context->lumps[i].address + context->lumps[i].size > context->INPUT_SIZE) {
+            fprintf(stderr, "%s The %.8s lump is outside of the %s %s\n", ERROR_STR, context->lumps[i].name, INPUT_STR, WAD_STR);
+            WAD_Free(context);
+            return 0;
+        }
+
+        // Lua, SOC and ACS scripts can refer to the tags by their numbers (MAINCFG and OBJCTCFG are SOC lumps too)
+        if (!strncmp(context->lumps[i].name, "LUA_", 4) || !strncmp(context->lumps[i].name, "SOC_", 4) || !strncmp(context->lumps[i].name, "MAINCFG", 8) || !strncmp(context->lumps[i].name, "OBJCTCFG", 8) || !strncmp(context->lumps[i].name, "BEHAVIOR", 8) || !strncmp(context->lumps[i].name, "SCRIPTS", 8))
+            context->WAD_HasScripts = 1;
     }
-    memset(linedefs, 0, linedefCount * sizeof(linedef_t));
+    if (context->WAD_HasScripts && !context->OUTSIDE_HasScripts)
+        CONTEXT_Print(context, "%s The %s %s has scripts, the sector tags and the arguments are preserved\n", WARNING_STR, INPUT_STR, WAD_STR);
+    CONTEXT_Print(context, "Filesize: %u %s\n", context->INPUT_SIZE, BYTES_STR);
 
+    // Read the texture sizes once, they are used for all the maps of the WAD
+    if (!(context->FLAGS & LESSUDMF_FLAG_PRESERVEOFFSETS))
+        TEXTURE_IndexWAD(context);
 
-    // Assign block references
-    uint32_t sectorID = 0;
-    uint32_t sidedefID = 0;
-    uint32_t linedefID = 0;
+    // Identical maps are only optimized once
+    WAD_FindIdenticalMaps(context);
 
-    for (uint32_t i = 0; i < blockCount; i++) {
-        if (!strncmp(blocks[i].header, SECTOR_STR, 6)) {
-            sectors[sectorID].block = &blocks[i];
-            sectors[sectorID].isMaster = -1;
-            sectors[sectorID].isSlope = -1;
-            sectors[sectorID].masterID = -1;
-            sectors[sectorID].sectorID = (int)sectorID;
-            sectorID++;
-        } else if (!strncmp(blocks[i].header, SIDEDEF_STR, 7)) {
-            sidedefs[sidedefID].block = &blocks[i];
-            sidedefID++;
-        } else if (!strncmp(blocks[i].header, LINEDEF_STR, 7)) {
-            linedefs[linedefID].block = &blocks[i];
-            linedefID++;
-        }
-    }
+    // The maps are optimized on the thread pool first, the loop below writes their lumps
+    if (context->mapThreads != 1)
+        WAD_OptimizeMaps(context);
 
-    // Assign sidedef->sector pointers
-    for (uint32_t i = 0; i < sidedefCount; i++) {
-        const char* sectorNum_str = getFieldValueFromBlock(sidedefs[i].block, SECTOR_STR);
-        if (!sectorNum_str)
+    // Copy/modify lumps
+    for (uint32_t i = 0; i < context->WAD_LumpsAmount; i++) {
+        if (context->binaryFormat != BINARYFORMAT_NONE) {
+            // The map is written in the binary format, its lumps are written in their order at the end of the map
+            if (!strncmp(context->lumps[i].name, ENDMAP_STR, 6))
+                OUTPUT_AddBinaryMapLumps(context);
+            else
+                OUTPUT_CollectBinaryMapLump(context, context->lumps[i].name, WAD_GetLump(context, i), context->lumps[i].size);
+            continue;
+        }
+        if (BOOL_IsMapLumpGenerated(context, context->lumps[i].name)) {
+            // Write the generated lump in place of the old one
+            OUTPUT_AddMapLumps(context, context->lumps[i].name);
             continue;
+        }
+        if (!strncmp(context->lumps[i].name, ENDMAP_STR, 6)) {
+            // The map did not have some of the generated lumps, write them before the end of the map
+            OUTPUT_AddMapLumps(context, 0);
+        }
 
-        uint32_t sectorNum = (uint32_t)strtol(sectorNum_str, 0, 10);
-        if (sectorNum < sectorCount)
-            sidedefs[i].sector = &sectors[sectorNum];
-    }
+        if (strncmp(context->lumps[i].name, TEXTMAP_STR, 7)) {
+            // Lump is not TEXTMAP, copy the lump contents to the Output WAD unmodified
+            OUTPUT_CopyLump(context, i);
+        } else if (!MAP_LoadFromCache(context, i)) {
+            //---------- Modify TEXTMAP ----------
+            CONTEXT_Print(context, "\n* Working on %s of %s *\n", TEXTMAP_STR, context->lumps[i - 1].name);
 
-    // Assign linedef->sidedef pointers
-    for (uint32_t i = 0; i < linedefCount; i++) {
-        const char* frontsideNum_str = getFieldValueFromBlock(linedefs[i].block, SIDEFRONT_STR);
-        const char* backsideNum_str = getFieldValueFromBlock(linedefs[i].block, SIDEBACK_STR);
+            // Parse the TEXTMAP into data blocks, optimize them and build the new lumps
+            MAP_Load(context, (const char*)WAD_GetLump(context, i), context->lumps[i].size);
+            MAP_Optimize(context);
+            MAP_Build(context, i);
 
-        if (frontsideNum_str) {
-            uint32_t frontsideNum = (uint32_t)strtol(frontsideNum_str, 0, 10);
-            if (frontsideNum < sidedefCount)
-                linedefs[i].sidefront = &sidedefs[frontsideNum];
+            // Write the new TEXTMAP to the Output WAD
+            if (context->LUMP_BUFFER)
+                OUTPUT_AddLump(context, TEXTMAP_STR, context->LUMP_BUFFER, strlen(context->LUMP_BUFFER));
+            MAP_PrintWritten(context, i);
+
+            // Keep the optimized lumps for the identical maps later in the WAD
+            if (context->mapCache[i])
+                MAP_SaveToCache(context, i, context->LUMP_BUFFER);
+            MEMORY_Free(context, context->LUMP_BUFFER);
         }
+    }
 
-        if (backsideNum_str) {
-            uint32_t backsideNum = (uint32_t)strtol(backsideNum_str, 0, 10);
-            if (backsideNum < sidedefCount)
-                linedefs[i].sideback = &sidedefs[backsideNum];
-        }
+    // The map was the last thing in the WAD, write its generated lumps at the end
+    OUTPUT_AddMapLumps(context, 0);
+    if (context->binaryFormat != BINARYFORMAT_NONE)
+        OUTPUT_AddBinaryMapLumps(context);
+
+    // Write the new Directory Table, the correct amount of lumps and Directory Table address
+    CONTEXT_Print(context, "\nDirectory Table of the %s %s:", OUTPUT_STR, WAD_STR);
+    CONTEXT_Print(context, "%s\n", DIRTABLE_STR);
+    for (uint32_t i = 0; i < context->outputLumpsAmount; i++)
+        CONTEXT_Print(context, "%2d %8d %8d %8.8s\n", i, context->outputLumps[i].address, context->outputLumps[i].size, context->outputLumps[i].name);
+    CONTEXT_Print(context, "Filesize: %u %s\n", context->OUTPUT_SIZE + context->outputLumpsAmount * 16, BYTES_STR);
+    if (context->outputSharedLumps)
+        CONTEXT_Print(context, "%u lumps share the data of identical lumps (%u %s)\n", context->outputSharedLumps, context->outputSharedBytes, BYTES_STR);
+
+    if (!OUTPUT_Finish(context)) {
+        fprintf(stderr, "%s %s write the %s %s (%s)\n", ERROR_STR, FAILEDTO_STR, OUTPUT_STR, WAD_STR, context->outputFilePath);
+        WAD_Free(context);
+        return 0;
     }
+
+    WAD_Free(context);
+    return 1;
 }
 
-// Generate a new TEXTMAP lump using the blocks data from memory
-static char* TEXTMAP_Generate(block_t* blocks)
+#ifndef LESSUDMF_LIBRARY
+
+//
+// PK3
+//
+
+typedef struct {
+    const uint8_t* header; // the entry in the Central Directory of the Input PK3
+    uint32_t headerSize;
+    const uint8_t* local; // Local File Header of the entry
+    const uint8_t* data; // compressed data of the entry
+    uint32_t dataSize;
+    uint32_t size; // uncompressed size
+    uint16_t method;
+    uint8_t isMap; // the entry is a WAD in the "maps/" folder
+    uint8_t* inflated;
+    uint8_t* optimized; // the Output WAD, 0 if the entry is copied unchanged
+    uint32_t optimizedSize;
+    uint8_t* deflated;
+    uint32_t deflatedSize;
+    uint16_t deflatedMethod;
+} zipentry_t;
+
+static uint16_t PK3_Get16(const uint8_t* p)
 {
-    uint32_t allocated = 0x100000; // 1 Megabyte
-    uint32_t used = 0;
-    char* out = (char*)malloc(allocated);
-    if (!out) {
-        fprintf(stderr, "%s %s %s the new %s lump\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, TEXTMAP_STR);
-        return 0;
-    }
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
 
-    used += snprintf(out, allocated, "%s=\"%s\";", NAMESPACE_STR, namespaceValue);
+static uint32_t PK3_Get32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
 
-    for (uint32_t b = 0; b < blockCount; b++) {
-        // Calculate the character length of the block we are about to write
-        uint32_t block_len = strlen(blocks[b].header) + 2;
-        for (uint8_t p = 0; p < blocks[b].fieldsCount; p++) {
-            block_len += strlen(blocks[b].fields[p].key) + strlen(blocks[b].fields[p].value) + 2;
-        }
+static void PK3_Put16(uint8_t* p, uint16_t value)
+{
+    p[0] = (uint8_t)(value & 0xFF);
+    p[1] = (uint8_t)(value >> 8);
+}
 
-        // If the buffer is going to be bigger than the amout of space we allocated, allocate more memory
-        while (used + block_len + 1 > allocated) {
-            allocated *= 2;
-            out = (char*)realloc(out, allocated);
-            if (!out) {
-                free(out);
-                fprintf(stderr, "%s %s re%s the new %s lump (%u %s)\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, TEXTMAP_STR, allocated, BYTES_STR);
-                return 0;
-            }
-        }
+static void PK3_Put32(uint8_t* p, uint32_t value)
+{
+    PK3_Put16(p, (uint16_t)(value & 0xFFFF));
+    PK3_Put16(p + 2, (uint16_t)(value >> 16));
+}
 
-        // Write the data itself
-        used += snprintf(out + used, allocated - used, "%s{", blocks[b].header);
-        for (uint8_t p = 0; p < blocks[b].fieldsCount; p++) {
-            used += snprintf(out + used, allocated - used, "%s=%s;", blocks[b].fields[p].key, blocks[b].fields[p].value);
-        }
-        used += snprintf(out + used, allocated - used, "}");
+// Check if the entry name is a WAD in the "maps/" folder, the names are not case-sensitive in the game
+static uint8_t BOOL_IsPK3MapEntry(const char* name, uint16_t length)
+{
+    if (length < 10 || name[length - 1] == '/')
+        return 0;
+    for (uint8_t x = 0; x < 5; x++) {
+        if (tolower((unsigned char)name[x]) != "maps/"[x])
+            return 0;
     }
-
-    // Final newline
-    if (used + 1 > allocated) {
-        allocated += 2;
-        out = (char*)realloc(out, allocated);
-        if (!out) {
-            free(out);
-            fprintf(stderr, "%s %s re%s the new %s lump (%u %s)\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, TEXTMAP_STR, allocated, BYTES_STR);
+    for (uint8_t x = 0; x < 4; x++) {
+        if (tolower((unsigned char)name[length - 4 + x]) != ".wad"[x])
             return 0;
-        }
     }
-    out[used++] = '\n';
-    out[used] = 0;
-    return out;
+    return 1;
 }
 
-//
-// MAIN
-//
-int main(int argc, char* argv[])
+// Check if the entry is a script which can refer to the sector tags of the maps: the files of the "Lua/", "SOC/"
+// and "ACS/" folders and the Lua and SOC files anywhere else
+static uint8_t BOOL_IsPK3ScriptEntry(const char* name, uint16_t length)
+{
+    static const char* const folders[] = { "lua/", "soc/", "acs/" };
+    static const char* const extensions[] = { ".lua", ".soc" };
+    if (!length || name[length - 1] == '/')
+        return 0;
+    for (uint8_t f = 0; f < 3; f++) {
+        uint8_t x = 0;
+        while (x < 4 && x < length && tolower((unsigned char)name[x]) == folders[f][x])
+            x++;
+        if (x == 4)
+            return 1;
+    }
+    for (uint8_t f = 0; f < 2 && length >= 4; f++) {
+        uint8_t x = 0;
+        while (x < 4 && tolower((unsigned char)name[length - 4 + x]) == extensions[f][x])
+            x++;
+        if (x == 4)
+            return 1;
+    }
+    return 0;
+}
+
+// Read the Central Directory of the Input PK3 (INPUT_DATA). Returns 0 if the file is not a ZIP archive it can read
+static uint8_t PK3_ReadDirectory(lessudmf_t* context, zipentry_t** entriesOut, uint32_t* countOut, const uint8_t** endOut)
 {
-    puts("LESSUDMF v4.0 by LeonardoTheMutant\n");
+    const uint8_t* data = (const uint8_t*)context->INPUT_DATA;
+    const uint8_t* end = 0;
 
-    if (argc < 2) {
-        printf("%s <%s.%s> [-o <%s.%s>] ...\n", argv[0], INPUT_STR, WAD_STR, OUTPUT_STR, WAD_STR);
-        printf("Optimize the %s maps data in %s\n", UDMF_STR, WAD_STR);
-        printf("    -o <%s.%s>\t%s to the file. If not given, the %s will be written to %s\n", OUTPUT_STR, WAD_STR, OUTPUT_STR, OUTPUT_STR, outputFilePath);
-        puts("    -c <config.json>\tLoad custom game engine configuration");
-        puts("    -t\t\tPreserve textures on walls that do not require them");
-        puts("    -f\t\tPreserve flats on sectors that do not require them");
-        puts("    -s\t\tPreserve information about identical sectors, do not merge them with each other");
-        puts("    -a\t\tPreserve angle facing information for things that are no-angle");
-        printf("    -d\t\tPreserve the %s fields which are set to default values\n", UDMF_STR);
-        puts("\nAlways make sure to have a copy of the old file - new file can have corruptions!");
+    // The End of Central Directory record is at the end of the file, followed by the comment of the archive
+    for (uint32_t x = 22; x <= context->INPUT_SIZE && x <= 22 + UINT16_MAX && !end; x++) {
+        if (PK3_Get32(data + context->INPUT_SIZE - x) == 0x06054B50 && PK3_Get16(data + context->INPUT_SIZE - x + 20) == x - 22)
+            end = data + context->INPUT_SIZE - x;
+    }
+    if (!end) {
+        fprintf(stderr, "%s The End of Central Directory of the %s %s is not found\n", ERROR_STR, INPUT_STR, PK3_STR);
         return 0;
     }
 
-    // parse args
-    for (int i = 1; i < argc; i++) {
-        if (!strncmp(argv[i], "-o", 2) && i + 1 < argc)
-            strncpy(outputFilePath, argv[++i], sizeof(outputFilePath) - 1); // output file
-        else if (!strncmp(argv[i], "-c", 2) && i + 1 < argc) { // custom game configuration
-            i++;
-            configFiles[ENGINE_UNKNOWN] = strdup(argv[i]);
-            if (!configFiles[ENGINE_UNKNOWN])
-                fprintf(stderr, "%s %s %s the %s (%d %s)\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, CONFIGFILE_STR, config.filesize, BYTES_STR);
-            FLAGS |= FLAGS_CUSTOMCONFIG; //"Using custom config file"
-        } else if (!strncmp(argv[i], "-t", 2))
-            FLAGS |= FLAG_PRESERVETEXTURES; //"No texture removal"
-        else if (!strncmp(argv[i], "-f", 2))
-            FLAGS |= FLAG_PRESERVEFLATS; //"No flat removal"
-        else if (!strncmp(argv[i], "-s", 2))
-            FLAGS |= FLAG_PRESERVESECTORS; //"No sector merging"
-        else if (!strncmp(argv[i], "-a", 2))
-            FLAGS |= FLAG_PRESERVEANGLES; //"No angle 0 things"
-        else if (!strncmp(argv[i], "-d", 2))
-            FLAGS |= FLAG_PRESERVEDEFAULT; //"Keep default values"
-        else
-            strncpy(buffer_str, argv[i], sizeof(buffer_str));
+    uint32_t count = PK3_Get16(end + 10);
+    uint32_t directorySize = PK3_Get32(end + 12);
+    uint32_t directoryAddress = PK3_Get32(end + 16);
+    if (PK3_Get16(end + 4) || PK3_Get16(end + 6) || count != PK3_Get16(end + 8) || count == UINT16_MAX || directoryAddress == UINT32_MAX) {
+        fprintf(stderr, "%s Multi-disk and ZIP64 %s files are not supported\n", ERROR_STR, PK3_STR);
+        return 0;
+    }
+    if ((uint64_t)directoryAddress + directorySize > (uint64_t)(end - data)) {
+        fprintf(stderr, "%s Bad %s %s Central Directory\n", ERROR_STR, INPUT_STR, PK3_STR);
+        return 0;
     }
 
-    if (stat(buffer_str, &filestatus)) {
-        fprintf(stderr, "%s %s file \"%s\" %s\n", ERROR_STR, INPUT_STR, buffer_str, NOTFOUND_STR);
-        return 1;
+    zipentry_t* entries = (zipentry_t*)MEMORY_Calloc(context, count + 1, sizeof(zipentry_t));
+    if (!entries) {
+        fprintf(stderr, "%s %s %s the %s %s Central Directory\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, INPUT_STR, PK3_STR);
+        return 0;
     }
 
-    OUTPUT_BUFFER = (char*)malloc(filestatus.st_size * sizeof(char));
+    const uint8_t* p = data + directoryAddress;
+    const uint8_t* directoryEnd = p + directorySize;
+    for (uint32_t i = 0; i < count; i++) {
+        zipentry_t* e = &entries[i];
+        if (p + 46 > directoryEnd || PK3_Get32(p) != 0x02014B50)
+            break;
+        e->header = p;
+        e->headerSize = 46 + PK3_Get16(p + 28) + PK3_Get16(p + 30) + PK3_Get16(p + 32);
+        e->method = PK3_Get16(p + 10);
+        e->dataSize = PK3_Get32(p + 20);
+        e->size = PK3_Get32(p + 24);
+        uint32_t address = PK3_Get32(p + 42);
+        if (p + e->headerSize > directoryEnd || (uint64_t)address + 30 > directoryAddress)
+            break;
+        e->local = data + address;
+        if (PK3_Get32(e->local) != 0x04034B50)
+            break;
+        e->data = e->local + 30 + PK3_Get16(e->local + 26) + PK3_Get16(e->local + 28);
+        if ((uint64_t)(e->data - data) + e->dataSize > directoryAddress)
+            break;
 
-    inputWAD = fopen(buffer_str, "rb");
-    if (!inputWAD) {
-        fprintf(stderr, "%s %s to open %s %s (%s)\n", ERROR_STR, FAILEDTO_STR, INPUT_STR, WAD_STR, buffer_str);
-        return 1;
+        // Encrypted entries and the compression methods other than Deflate are copied as they are
+        e->isMap = BOOL_IsPK3MapEntry((const char*)p + 46, PK3_Get16(p + 28)) && !(PK3_Get16(p + 8) & 1) && (e->method == 0 || e->method == 8);
+        p += e->headerSize;
+        *countOut = i + 1;
+    }
+    if (*countOut != count) {
+        fprintf(stderr, "%s Bad %s %s Central Directory\n", ERROR_STR, INPUT_STR, PK3_STR);
+        MEMORY_Free(context, entries);
+        return 0;
     }
 
-    memset(buffer_str, 0, sizeof(buffer_str));
+    *entriesOut = entries;
+    *endOut = end;
+    return 1;
+}
 
-    // Read the WAD type
-    fread(buffer_str, 1, 4, inputWAD);
-    if (strncmp(buffer_str + 1, WAD_STR, 3)) {
-        fprintf(stderr, "%s %s Bad %s %s header\n", ERROR_STR, ERROR_STR, INPUT_STR, WAD_STR);
-        fclose(inputWAD);
-        inputWAD = 0;
+// Decompress a map entry of the PK3, the entry stays unchanged if its data is broken
+static uint8_t PK3_InflateEntry(lessudmf_t* context, uint32_t index, void* data)
+{
+    zipentry_t* e = &((zipentry_t*)data)[index];
+    if (!e->isMap)
+        return 1;
+
+    e->inflated = (uint8_t*)MEMORY_Alloc(context, e->size + 1);
+    if (!e->inflated)
+        return 1;
+    uint8_t ok;
+    if (e->method == 0)
+        ok = (e->dataSize == e->size);
+    else {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        ok = (inflateInit2(&stream, -MAX_WBITS) == Z_OK);
+        if (ok) {
+            stream.next_in = (Bytef*)e->data;
+            stream.avail_in = e->dataSize;
+            stream.next_out = e->inflated;
+            stream.avail_out = e->size;
+            ok = (inflate(&stream, Z_FINISH) == Z_STREAM_END && stream.total_out == e->size);
+            inflateEnd(&stream);
+        }
+    }
+    const uint8_t* contents = (e->method == 0) ? e->data : e->inflated;
+    if (!ok || crc32(crc32(0, 0, 0), contents, e->size) != PK3_Get32(e->header + 16)) {
+        MEMORY_Free(context, e->inflated);
+        e->inflated = 0;
         return 1;
     }
-    memcpy(OUTPUT_BUFFER, buffer_str, 4);
-    OUTPUT_SIZE += 4;
+    if (e->method == 0)
+        memcpy(e->inflated, e->data, e->size);
+    return 1;
+}
 
-    // Get the amount of lumps in WAD and allocate the space for them
-    fread(&WAD_LumpsAmount, 4, 1, inputWAD);
-    memcpy(OUTPUT_BUFFER + OUTPUT_SIZE, &WAD_LumpsAmount, 4);
-    OUTPUT_SIZE += 4;
-    lumps = (lump_t*)malloc(sizeof(lump_t) * WAD_LumpsAmount);
-    if (!lumps) {
-        fprintf(stderr, "%s %s %s the %s lumps buffer", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, WAD_STR);
-        fclose(inputWAD);
-        inputWAD = 0;
+// Compress the optimized map entry of the PK3, it is stored uncompressed if Deflate does not make it smaller
+static uint8_t PK3_DeflateEntry(lessudmf_t* context, uint32_t index, void* data)
+{
+    zipentry_t* e = &((zipentry_t*)data)[index];
+    if (!e->optimized)
+        return 1;
+
+    e->deflatedMethod = 0;
+    if (e->method != 8)
         return 1;
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        return 1;
+    uint32_t bound = (uint32_t)deflateBound(&stream, e->optimizedSize);
+    e->deflated = (uint8_t*)MEMORY_Alloc(context, bound + 1);
+    if (e->deflated) {
+        stream.next_in = e->optimized;
+        stream.avail_in = e->optimizedSize;
+        stream.next_out = e->deflated;
+        stream.avail_out = bound;
+        if (deflate(&stream, Z_FINISH) == Z_STREAM_END && stream.total_out < e->optimizedSize) {
+            e->deflatedSize = (uint32_t)stream.total_out;
+            e->deflatedMethod = 8;
+        } else {
+            MEMORY_Free(context, e->deflated);
+            e->deflated = 0;
+        }
     }
+    deflateEnd(&stream);
+    return 1;
+}
 
-    // Get Directory Table address
-    fread(&WAD_DirectoryAddress, 4, 1, inputWAD);
+// Optimize the WADs in the "maps/" folder of the Input PK3 (INPUT_DATA) and write the Output PK3. The entries are
+// decompressed and compressed on all processor cores, the unchanged entries are copied without recompressing them.
+// Returns 0 on failure
+static uint8_t PK3_Optimize(lessudmf_t* context)
+{
+    zipentry_t* entries;
+    uint32_t count = 0;
+    const uint8_t* end;
+    if (!PK3_ReadDirectory(context, &entries, &count, &end))
+        return 0;
 
-    // Ignore the Directory Table address in the Output WAD for now, we'll correct it at the end
-    OUTPUT_SIZE += 4;
+    CONTEXT_Print(context, "Central Directory of the %s %s: %u entries\n", INPUT_STR, PK3_STR, count);
+    CONTEXT_Print(context, "Filesize: %u %s\n", context->INPUT_SIZE, BYTES_STR);
+
+    // The Lua, SOC and ACS scripts of the PK3 can refer to the tags of all its maps
+    for (uint32_t i = 0; i < count && !context->OUTSIDE_HasScripts; i++)
+        context->OUTSIDE_HasScripts = BOOL_IsPK3ScriptEntry((const char*)entries[i].header + 46, PK3_Get16(entries[i].header + 28));
+    if (context->OUTSIDE_HasScripts)
+        CONTEXT_Print(context, "%s The %s %s has scripts, the sector tags and the arguments are preserved\n", WARNING_STR, INPUT_STR, PK3_STR);
+
+    CONTEXT_Print(context, "Decompressing the maps... ");
+    THREAD_ParallelFor(context, count, PK3_InflateEntry, entries);
+    CONTEXT_Print(context, "%s\n", DONE_STR);
+
+    // The WADs are optimized like the files, the Input and Output WADs are in memory
+    const char* pk3Data = context->INPUT_DATA;
+    uint32_t pk3Size = context->INPUT_SIZE;
+#ifdef LESSUDMF_MMAP
+    int pk3FD = context->INPUT_FD;
+    context->INPUT_FD = -1;
+#endif
+    uint32_t changed = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        zipentry_t* e = &entries[i];
+        if (!e->isMap)
+            continue;
+        CONTEXT_Print(context, "\n** Working on %.*s of the %s %s **\n", PK3_Get16(e->header + 28), (const char*)e->header + 46, INPUT_STR, PK3_STR);
+        if (!e->inflated) {
+            fprintf(stderr, "%s %s decompress the %s entry, it is copied unchanged\n", WARNING_STR, FAILEDTO_STR, PK3_STR);
+            continue;
+        }
 
-    // Seek to dir table, read it
-    fseek(inputWAD, WAD_DirectoryAddress, SEEK_SET);
-    printf("Directory Table of the %s %s:", INPUT_STR, WAD_STR);
-    puts(DIRTABLE_STR);
-    for (uint16_t i = 0; i < WAD_LumpsAmount; i++) {
-        fread(&lumps[i].address, 4, 1, inputWAD);
-        fread(&lumps[i].size, 4, 1, inputWAD);
-        fread(lumps[i].name, 8, 1, inputWAD);
-        printf("%2d %8d %8d %8s\n", i, lumps[i].address, lumps[i].size, lumps[i].name);
+        context->INPUT_DATA = (const char*)e->inflated;
+        context->INPUT_SIZE = e->size;
+        OUTPUT_OpenMemory(context);
+        if (WAD_Optimize(context) && (context->OUTPUT_SIZE != e->size || memcmp(context->OUTPUT_MEMORY, e->inflated, e->size))) {
+            e->optimized = (uint8_t*)context->OUTPUT_MEMORY;
+            e->optimizedSize = context->OUTPUT_SIZE;
+            changed++;
+        } else
+            MEMORY_Free(context, context->OUTPUT_MEMORY);
+        context->OUTPUT_MEMORY = 0;
+        MEMORY_Free(context, e->inflated);
+        e->inflated = 0;
+    }
+    context->INPUT_DATA = pk3Data;
+    context->INPUT_SIZE = pk3Size;
+    context->OUTSIDE_HasScripts = 0;
+#ifdef LESSUDMF_MMAP
+    context->INPUT_FD = pk3FD;
+#endif
+
+    CONTEXT_Print(context, "\nCompressing the %u optimized maps... ", changed);
+    THREAD_ParallelFor(context, count, PK3_DeflateEntry, entries);
+    CONTEXT_Print(context, "%s\n", DONE_STR);
+
+    if (!OUTPUT_Open(context, context->outputFilePath)) {
+        fprintf(stderr, "%s %s open %s %s (%s)\n", ERROR_STR, FAILEDTO_STR, OUTPUT_STR, PK3_STR, context->outputFilePath);
+        return 0;
     }
-    printf("Filesize: %ld %s\n", filestatus.st_size, BYTES_STR);
-    memset(&filestatus, 0, sizeof(filestatus));
 
-    // Copy/modify lumps
-    fseek(inputWAD, 0x0C, SEEK_SET); // Jump back to the actuall lump data
-    for (uint16_t i = 0; i < WAD_LumpsAmount; i++) {
-        // Set new lump address
-        lumps[i].address = OUTPUT_SIZE;
-        if (strncmp(lumps[i].name, TEXTMAP_STR, 7)) {
-            // Lump is not TEXTMAP, copy the lump contents to the Output WAD unmodified
-            if (lumps[i].size > 0) {
-                LUMP_BUFFER = (char*)malloc(lumps[i].size);
-                fread(LUMP_BUFFER, lumps[i].size, 1, inputWAD);
-                memcpy(OUTPUT_BUFFER + OUTPUT_SIZE, LUMP_BUFFER, lumps[i].size);
-                OUTPUT_SIZE += lumps[i].size;
-                free(LUMP_BUFFER);
-            }
-        } else {
-            //---------- Modify TEXTMAP ----------
-            printf("\n* Working on %s of %s *\n", TEXTMAP_STR, lumps[i - 1].name);
-
-            // Copy TEXTMAP to memory
-            LUMP_BUFFER = (char*)malloc(lumps[i].size + 1);
-            fread(LUMP_BUFFER, lumps[i].size, 1, inputWAD);
-            LUMP_BUFFER[lumps[i].size] = '\0';
-
-            // Free old blocks if any
-            for (uint32_t b = 0; b < blockCount; b++) {
-                for (size_t p = 0; p < blocks[b].fieldsCount; p++) {
-                    free(blocks[b].fields[p].key);
-                    free(blocks[b].fields[p].value);
-                }
-                free(blocks[b].fields);
-            }
-            free(blocks);
-            blocks = 0;
-            blockCount = 0;
-
-            // Parse the TEXTMAP into data blocks for the program
-            TEXTMAP_Parse(LUMP_BUFFER);
-            TEXTMAP_BuildReferences();
-            printf("Loaded the map data, %s is \"%s\"\n", NAMESPACE_STR, namespaceValue);
-            free(LUMP_BUFFER); // Unload the lump because we no longer need the original data
-
-            // Load the configuration file for the specified game engine so the program knows better what to optimize
-            if (gameEngine == gameEngine_last)
-                goto skip_config_load;
-            if (stat(configFiles[gameEngine], &filestatus)) {
-                fprintf(stderr, "%s %s \"%s\" %s\n", WARNING_STR, CONFIGFILE_STR, configFiles[gameEngine], NOTFOUND_STR);
-            } else {
-                if (FLAGS & FLAG_CONFIGLOADED)
-                    CONFIG_Free(&config);
-                if (configFiles[ENGINE_UNKNOWN])
-                    puts("! Using custom game configuration !");
-                config.flags = 0;
-
-                // Try to load the file itself
-                config.filesize = filestatus.st_size;
-
-                config.buffer = (char*)malloc(config.filesize + 1);
-                if (!config.buffer) {
-                    fprintf(stderr, "%s %s %s the %s (%u %s)\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, CONFIGFILE_STR, config.filesize + 1, BYTES_STR);
-                    goto skip_config_load;
-                }
+    // Local File Headers and the data, the entries are written in the order of the Central Directory
+    uint32_t* addresses = (uint32_t*)MEMORY_Alloc(context, (count + 1) * sizeof(uint32_t));
+    if (!addresses) {
+        fprintf(stderr, "%s %s %s the %s %s Central Directory\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, OUTPUT_STR, PK3_STR);
+        return 0;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        zipentry_t* e = &entries[i];
+        uint8_t local[30];
+        memcpy(local, e->local, 30);
+        PK3_Put16(local + 6, PK3_Get16(e->header + 8) & ~8); // sizes are in the header, no Data Descriptor
+        memcpy(local + 14, e->header + 16, 12); // CRC-32 and sizes
+        if (e->optimized) {
+            PK3_Put16(local + 8, e->deflatedMethod);
+            PK3_Put32(local + 14, crc32(crc32(0, 0, 0), e->optimized, e->optimizedSize));
+            PK3_Put32(local + 18, e->deflated ? e->deflatedSize : e->optimizedSize);
+            PK3_Put32(local + 22, e->optimizedSize);
+        }
+        addresses[i] = context->OUTPUT_SIZE;
+        OUTPUT_Write(context, local, 30);
+        OUTPUT_Write(context, e->local + 30, (uint32_t)(e->data - e->local) - 30); // name and extra field
+        if (e->deflated)
+            OUTPUT_Write(context, e->deflated, e->deflatedSize);
+        else if (e->optimized)
+            OUTPUT_Write(context, e->optimized, e->optimizedSize);
+        else
+            OUTPUT_Write(context, e->data, e->dataSize);
+    }
 
-                configFile = fopen(configFiles[gameEngine], "rb");
-                if (!configFile) {
-                    fprintf(stderr, "%s %s open the \"%s\" %s\n", ERROR_STR, FAILEDTO_STR, configFiles[gameEngine], CONFIGFILE_STR);
-                    free(config.buffer);
-                    config.buffer = 0;
-                    goto skip_config_load;
-                }
+    // Central Directory, the entries get the values of their Local File Headers
+    uint32_t directoryAddress = context->OUTPUT_SIZE;
+    for (uint32_t i = 0; i < count; i++) {
+        zipentry_t* e = &entries[i];
+        uint8_t header[46];
+        memcpy(header, e->header, 46);
+        PK3_Put16(header + 8, PK3_Get16(e->header + 8) & ~8);
+        if (e->optimized) {
+            PK3_Put16(header + 10, e->deflatedMethod);
+            PK3_Put32(header + 16, crc32(crc32(0, 0, 0), e->optimized, e->optimizedSize));
+            PK3_Put32(header + 20, e->deflated ? e->deflatedSize : e->optimizedSize);
+            PK3_Put32(header + 24, e->optimizedSize);
+        }
+        PK3_Put32(header + 42, addresses[i]);
+        OUTPUT_Write(context, header, 46);
+        OUTPUT_Write(context, e->header + 46, e->headerSize - 46);
+    }
+
+    uint8_t record[22];
+    memcpy(record, end, 22);
+    PK3_Put32(record + 12, context->OUTPUT_SIZE - directoryAddress);
+    PK3_Put32(record + 16, directoryAddress);
+    OUTPUT_Write(context, record, 22);
+    OUTPUT_Write(context, end + 22, PK3_Get16(end + 20)); // comment of the archive
+    CONTEXT_Print(context, "\nFilesize: %u %s\n", context->OUTPUT_SIZE, BYTES_STR);
+
+    for (uint32_t i = 0; i < count; i++) {
+        MEMORY_Free(context, entries[i].optimized);
+        MEMORY_Free(context, entries[i].deflated);
+    }
+    MEMORY_Free(context, entries);
+    MEMORY_Free(context, addresses);
 
-                fread(config.buffer, config.filesize, 1, configFile);
-                config.buffer[config.filesize] = 0;
-                fclose(configFile);
+    if (!OUTPUT_Close(context, 1)) {
+        fprintf(stderr, "%s %s write the %s %s (%s)\n", ERROR_STR, FAILEDTO_STR, OUTPUT_STR, PK3_STR, context->outputFilePath);
+        return 0;
+    }
+    return 1;
+}
 
-                config.json = json_parse(config.buffer, config.filesize);
-                if (!config.json) {
-                    fprintf(stderr, "%s %s parse JSON data from the %s\n", ERROR_STR, FAILEDTO_STR, CONFIGFILE_STR);
-                    free(config.buffer);
-                    config.buffer = 0;
-                    goto skip_config_load;
-                }
+#endif // LESSUDMF_LIBRARY
 
-                if (!CONFIG_Parse(&config)) {
-                    fprintf(stderr, "%s %s parse the %s, program will not do deep level optimization\n", ERROR_STR, FAILEDTO_STR, CONFIGFILE_STR);
-                    CONFIG_Free(&config);
-                    memset(&config, 0, sizeof(config));
-                    goto skip_config_load;
-                }
+//
+// LIBRARY
+//
 
-                FLAGS |= FLAG_CONFIGLOADED;
-            }
+// Free all the memory of the context after a failed call and set it up again with its options and custom config
+// file, so it can be used again
+static void CONTEXT_Reset(lessudmf_t* context)
+{
+    uint32_t flags = context->FLAGS & ~LESSUDMF_FLAG_CONFIGLOADED; // the config is freed too
+    const char* configPath = context->configFiles[ENGINE_UNKNOWN];
+    uint32_t mapThreads = context->mapThreads;
+
+    MEMORY_FreeAll(context);
+#ifdef LESSUDMF_THREADS
+    pthread_mutex_destroy(&context->allocations.lock);
+#endif
+    CONTEXT_Init(context, flags, 0);
+    context->configFiles[ENGINE_UNKNOWN] = configPath;
+    context->mapThreads = mapThreads;
+}
+
+lessudmf_t* LESSUDMF_Create(uint32_t flags, const char* configPath)
+{
+    lessudmf_t* context = (lessudmf_t*)malloc(sizeof(lessudmf_t));
+    if (context && !CONTEXT_Init(context, flags & ~(LESSUDMF_FLAG_CONFIGLOADED | LESSUDMF_FLAG_CUSTOMCONFIG), configPath)) {
+        free(context);
+        context = 0;
+    }
+    return context;
+}
 
-        skip_config_load:
+void LESSUDMF_Destroy(lessudmf_t* context)
+{
+    if (!context)
+        return;
+    MEMORY_FreeAll(context);
+#ifdef LESSUDMF_THREADS
+    pthread_mutex_destroy(&context->allocations.lock);
+#endif
+    free((char*)context->configFiles[ENGINE_UNKNOWN]);
+    free(context);
+}
 
-            // Remove flat textures from non-visible sector surfaces
-            if (!(FLAGS & FLAG_PRESERVEFLATS))
-                MAP_RemoveUnseenFlatTextures();
+uint8_t LESSUDMF_OptimizeTEXTMAP(lessudmf_t* context, const char* textmap, uint32_t size, char** output, uint32_t* outputSize)
+{
+    if (!context || !textmap || !output)
+        return 0;
+    jmp_buf jump;
+    context->failJump = &jump;
+    if (setjmp(jump)) {
+        // The error is printed, everything the context holds is freed so it can be used again
+        CONTEXT_Reset(context);
+        return 0;
+    }
 
-            if (FLAGS & FLAG_CONFIGLOADED) {
-                // Merge identical sectors first so the final block layout and references are consistent.
-                if (!(FLAGS & FLAG_PRESERVESECTORS))
-                    MAP_MergeSectors();
+    // The scripts of the map are not known, they can refer to any tag
+    context->OUTSIDE_HasScripts = 1;
+    MAP_Load(context, textmap, size);
+    MAP_Optimize(context);
+    context->OUTSIDE_HasScripts = 0;
+    *output = TEXTMAP_Generate(context, context->blocks);
+    MEMORY_Release(context, *output);
+    if (outputSize)
+        *outputSize = *output ? (uint32_t)strlen(*output) : 0;
+
+    context->failJump = 0;
+    return *output != 0;
+}
 
-                // Remove unrequired textures from control linedefs (can be disabled with "-t" CLI option)
-                if (!(FLAGS & FLAG_PRESERVETEXTURES)) {
-                    MAP_RemoveControlLineTextures();
-                    MAP_RemoveUnseenWallTextures();
-                }
+uint8_t LESSUDMF_OptimizeWAD(lessudmf_t* context, const void* wad, uint32_t size, void** output, uint32_t* outputSize)
+{
+    if (!context || !wad || !output)
+        return 0;
+    jmp_buf jump;
+    context->failJump = &jump;
+    if (setjmp(jump)) {
+        // The error is printed, everything the context holds is freed so it can be used again
+        CONTEXT_Reset(context);
+        return 0;
+    }
 
-                // Force some things to face East (angle 0) (can be disabled with "-a" CLI option)
-                if (!(FLAGS & FLAG_PRESERVEANGLES))
-                    MAP_NoAngleThings();
+    context->INPUT_DATA = (const char*)wad;
+    context->INPUT_SIZE = size;
+    OUTPUT_OpenMemory(context);
+    uint8_t ok = WAD_Optimize(context);
+    if (ok) {
+        *output = context->OUTPUT_MEMORY;
+        MEMORY_Release(context, *output);
+        if (outputSize)
+            *outputSize = context->OUTPUT_SIZE;
+    } else
+        MEMORY_Free(context, context->OUTPUT_MEMORY);
+    context->OUTPUT_MEMORY = 0;
+    context->INPUT_DATA = 0;
+    context->INPUT_SIZE = 0;
+
+    context->failJump = 0;
+    return ok;
+}
 
-                // Remove UDMF fields which are set to default value (can be disabled with "-f" CLI option)
-                if (!(FLAGS & FLAG_PRESERVEDEFAULT))
-                    MAP_RemoveDefaultValues();
-            }
+void LESSUDMF_Free(void* output)
+{
+    // The output was allocated by a context, with the header of its memory
+    if (output)
+        free((allocation_t*)output - 1);
+}
 
-            LUMP_BUFFER = TEXTMAP_Generate(blocks); // Write new lump to the buffer
-            lumps[i].size = strlen(LUMP_BUFFER);
+#ifndef LESSUDMF_LIBRARY
 
-            // Write the new TEXTMAP to the Output WAD
-            memcpy(OUTPUT_BUFFER + OUTPUT_SIZE, LUMP_BUFFER, lumps[i].size);
-            OUTPUT_SIZE += lumps[i].size;
-            printf("* Wrote the modified %s data of %s to the %s *\n", TEXTMAP_STR, lumps[i - 1].name, OUTPUT_STR);
+//
+// MAIN
+//
+int main(int argc, char* argv[])
+{
+    static lessudmf_t mainContext;
+    lessudmf_t* context = &mainContext;
+    CONTEXT_Init(context, 0, 0);
 
-            free(LUMP_BUFFER);
-            gameEngine_last = gameEngine;
-        }
+    CONTEXT_Print(context, "LESSUDMF v4.0 by LeonardoTheMutant\n\n");
+
+    if (argc < 2) {
+        CONTEXT_Print(context, "%s <%s.%s> [-o <%s.%s>] ...\n", argv[0], INPUT_STR, WAD_STR, OUTPUT_STR, WAD_STR);
+        CONTEXT_Print(context, "Optimize the %s maps data in %s, or in the %s files of the maps/ folder of %s\n", UDMF_STR, WAD_STR, WAD_STR, PK3_STR);
+        CONTEXT_Print(context, "    -o <%s.%s>\t%s to the file. If not given, the %s will be written to %s\n", OUTPUT_STR, WAD_STR, OUTPUT_STR, OUTPUT_STR, context->outputFilePath);
+        CONTEXT_Print(context, "    -c <config.json>\tLoad custom game engine configuration\n");
+        CONTEXT_Print(context, "    -t\t\tPreserve textures on walls that do not require them\n");
+        CONTEXT_Print(context, "    -f\t\tPreserve flats on sectors that do not require them\n");
+        CONTEXT_Print(context, "    -s\t\tPreserve information about identical sectors, do not merge them with each other\n");
+        CONTEXT_Print(context, "    -a\t\tPreserve angle facing information for things that are no-angle\n");
+        CONTEXT_Print(context, "    -d\t\tPreserve the %s fields which are set to default values\n", UDMF_STR);
+        CONTEXT_Print(context, "    -n\t\tRebuild the ZNODES lump of the optimized maps\n");
+        CONTEXT_Print(context, "    -r\t\tBuild the REJECT lump of the optimized maps\n");
+        CONTEXT_Print(context, "    -g\t\tRemove zero-length and duplicate linedefs and sectors with no area (use with -n)\n");
+        CONTEXT_Print(context, "    -x\t\tPreserve texture offsets, do not reduce them modulo the texture sizes\n");
+        CONTEXT_Print(context, "    -i\t\tPreserve sector tags which no linedef special or thing refers to\n");
+        CONTEXT_Print(context, "    -k\t\tPreserve things which are exact duplicates of other things\n");
+        CONTEXT_Print(context, "    -z\t\tWrite the blocks grouped by type and the fields in a fixed order, for better compression\n");
+        CONTEXT_Print(context, "    --quantize\tSnap coordinates, offsets and other values to the grids from the game configuration (lossy)\n");
+        CONTEXT_Print(context, "    -l\t\tAlso merge the sectors which only differ within the tolerances from the game configuration (lossy)\n");
+        CONTEXT_Print(context, "    -p\t\tWrite every lump separately, do not share the data of identical lumps\n");
+        CONTEXT_Print(context, "    -b\t\tWrite the maps which fit the binary Doom/Hexen map format in it instead of TEXTMAP\n");
+        CONTEXT_Print(context, "    -u\t\tRemove textures and flats of the areas which can not be reached from the player starts (lossy)\n");
+        CONTEXT_Print(context, "    -m\t\tRenumber vertices, sidedefs and sectors so the most referenced ones get the smallest indices (rebuilds the nodes and reject)\n");
+        CONTEXT_Print(context, "    -j <threads>\tOptimize the maps on the given amount of threads (0 for all processor cores)\n");
+        CONTEXT_Print(context, "\nAlways make sure to have a copy of the old file - new file can have corruptions!\n");
+        return 0;
     }
 
-    if (FLAGS & FLAG_CONFIGLOADED)
-        CONFIG_Free(&config);
+    // parse args
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--quantize"))
+            context->FLAGS |= LESSUDMF_FLAG_QUANTIZE; //"Quantize values"
+        else if (!strncmp(argv[i], "-j", 2) && i + 1 < argc)
+            context->mapThreads = (uint32_t)strtoul(argv[++i], 0, 10); // threads for the maps
+        else if (!strncmp(argv[i], "-o", 2) && i + 1 < argc)
+            strncpy(context->outputFilePath, argv[++i], sizeof(context->outputFilePath) - 1); // output file
+        else if (!strncmp(argv[i], "-c", 2) && i + 1 < argc) { // custom game configuration
+            i++;
+            context->configFiles[ENGINE_UNKNOWN] = strdup(argv[i]);
+            if (!context->configFiles[ENGINE_UNKNOWN])
+                fprintf(stderr, "%s %s %s the %s (%d %s)\n", ERROR_STR, FAILEDTO_STR, ALLOCATEFOR_STR, CONFIGFILE_STR, context->config.filesize, BYTES_STR);
+            context->FLAGS |= LESSUDMF_FLAG_CUSTOMCONFIG; //"Using custom config file"
+        } else if (!strncmp(argv[i], "-t", 2))
+            context->FLAGS |= LESSUDMF_FLAG_PRESERVETEXTURES; //"No texture removal"
+        else if (!strncmp(argv[i], "-f", 2))
+            context->FLAGS |= LESSUDMF_FLAG_PRESERVEFLATS; //"No flat removal"
+        else if (!strncmp(argv[i], "-s", 2))
+            context->FLAGS |= LESSUDMF_FLAG_PRESERVESECTORS; //"No sector merging"
+        else if (!strncmp(argv[i], "-a", 2))
+            context->FLAGS |= LESSUDMF_FLAG_PRESERVEANGLES; //"No angle 0 things"
+        else if (!strncmp(argv[i], "-d", 2))
+            context->FLAGS |= LESSUDMF_FLAG_PRESERVEDEFAULT; //"Keep default values"
+        else if (!strncmp(argv[i], "-g", 2))
+            context->FLAGS |= LESSUDMF_FLAG_REMOVEGEOMETRY; //"Remove degenerate geometry"
+        else if (!strncmp(argv[i], "-n", 2))
+            context->FLAGS |= LESSUDMF_FLAG_BUILDNODES; //"Rebuild nodes"
+        else if (!strncmp(argv[i], "-r", 2))
+            context->FLAGS |= LESSUDMF_FLAG_BUILDREJECT; //"Build reject"
+        else if (!strncmp(argv[i], "-x", 2))
+            context->FLAGS |= LESSUDMF_FLAG_PRESERVEOFFSETS; //"Keep texture offsets"
+        else if (!strncmp(argv[i], "-i", 2))
+            context->FLAGS |= LESSUDMF_FLAG_PRESERVETAGS; //"Keep sector IDs"
+        else if (!strncmp(argv[i], "-k", 2))
+            context->FLAGS |= LESSUDMF_FLAG_PRESERVETHINGS; //"Keep duplicate things"
+        else if (!strncmp(argv[i], "-l", 2))
+            context->FLAGS |= LESSUDMF_FLAG_MERGESIMILAR; //"Lossy sector merging"
+        else if (!strncmp(argv[i], "-m", 2))
+            context->FLAGS |= LESSUDMF_FLAG_RENUMBER; //"Minimize indices"
+        else if (!strncmp(argv[i], "-z", 2))
+            context->FLAGS |= LESSUDMF_FLAG_CANONICAL; //"Zip-friendly order"
+        else if (!strncmp(argv[i], "-p", 2))
+            context->FLAGS |= LESSUDMF_FLAG_PRESERVELUMPS; //"No lump sharing"
+        else if (!strncmp(argv[i], "-b", 2))
+            context->FLAGS |= LESSUDMF_FLAG_BINARYMAP; //"Binary map format"
+        else if (!strncmp(argv[i], "-u", 2))
+            context->FLAGS |= LESSUDMF_FLAG_STRIPUNREACHABLE; //"Strip unreachable areas"
+        else
+            snprintf(context->buffer_str, sizeof(context->buffer_str), "%s", argv[i]);
+    }
 
-    // Write the correct Directory Table address
-    memcpy(OUTPUT_BUFFER + 8, &OUTPUT_SIZE, 4);
+    if (stat(context->buffer_str, &context->filestatus)) {
+        fprintf(stderr, "%s %s file \"%s\" %s\n", ERROR_STR, INPUT_STR, context->buffer_str, NOTFOUND_STR);
+        return 1;
+    }
 
-    // Write the new Directory Table
-    printf("\nDirectory Table of the %s %s:", OUTPUT_STR, WAD_STR);
-    puts(DIRTABLE_STR);
-    for (uint16_t i = 0; i < WAD_LumpsAmount; i++) {
-        printf("%2d %8d %8d %8s\n", i, lumps[i].address, lumps[i].size, lumps[i].name);
-        memcpy(OUTPUT_BUFFER + OUTPUT_SIZE, &lumps[i].address, 4);
-        OUTPUT_SIZE += 4;
-        memcpy(OUTPUT_BUFFER + OUTPUT_SIZE, &lumps[i].size, 4);
-        OUTPUT_SIZE += 4;
-        memcpy(OUTPUT_BUFFER + OUTPUT_SIZE, lumps[i].name, 8);
-        OUTPUT_SIZE += 8;
+    if (!INPUT_Open(context, context->buffer_str)) {
+        fprintf(stderr, "%s %s to open %s %s (%s)\n", ERROR_STR, FAILEDTO_STR, INPUT_STR, WAD_STR, context->buffer_str);
+        return 1;
     }
-    printf("Filesize: %d %s\n", OUTPUT_SIZE, BYTES_STR);
 
-    outputWAD = fopen(outputFilePath, "wb");
-    if (!outputWAD) {
-        fprintf(stderr, "%s %s open %s %s (%s)\n", ERROR_STR, FAILEDTO_STR, OUTPUT_STR, WAD_STR, outputFilePath);
-        fclose(inputWAD);
-        inputWAD = 0;
-        fclose(outputWAD);
+    memset(context->buffer_str, 0, sizeof(context->buffer_str));
+
+    jmp_buf jump;
+    context->failJump = &jump;
+    if (setjmp(jump)) {
+        // The error is printed, the memory is freed with the program
+        OUTPUT_Discard(context);
         return 1;
     }
 
-    fwrite(OUTPUT_BUFFER, OUTPUT_SIZE, 1, outputWAD);
+    uint8_t ok;
+    if (context->INPUT_SIZE >= 4 && !memcmp(context->INPUT_DATA, "PK\3\4", 4)) {
+        // PK3 files are ZIP archives, the WADs of the maps inside of them are optimized
+        ok = PK3_Optimize(context);
+    } else {
+        // The lumps are written to the Output WAD as soon as they are ready
+        ok = OUTPUT_Open(context, context->outputFilePath);
+        if (!ok)
+            fprintf(stderr, "%s %s open %s %s (%s)\n", ERROR_STR, FAILEDTO_STR, OUTPUT_STR, WAD_STR, context->outputFilePath);
+        else
+            ok = WAD_Optimize(context);
+    }
 
-    fclose(inputWAD);
-    inputWAD = 0;
-    fclose(outputWAD);
-    outputWAD = 0;
-    free(lumps);
+    INPUT_Close(context);
+    if (context->FLAGS & LESSUDMF_FLAG_CONFIGLOADED)
+        CONFIG_Free(context, &context->config);
+    for (uint8_t x = 0; x < 5; x++)
+        TEXTURERULES_Free(context, &context->builtinRules[x]);
+    if (!ok) {
+        OUTPUT_Discard(context);
+        return 1;
+    }
 
-    printf("\n\"%s\" is ready. Make sure to check the contents of the %s for corruptions!\n", outputFilePath, WAD_STR);
+    CONTEXT_Print(context, "\n\"%s\" is ready. Make sure to check the contents of the %s for corruptions!\n", context->outputFilePath, WAD_STR);
     return 0;
 }
+
+#endif // LESSUDMF_LIBRARY
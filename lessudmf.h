@@ -0,0 +1,60 @@
+//"Less UDMF" library interface
+// Optimize the UDMF maps in memory, without the files of the command line program
+// Code by LeonardoTheMutant
+
+#ifndef _LESSUDMF_H
+#define _LESSUDMF_H
+
+#include <stdint.h>
+
+// Program flags, the options of the optimization
+enum lessudmf_flags {
+    LESSUDMF_FLAG_CONFIGLOADED = 1, // Game configuration file is loaded (set by the program)
+    LESSUDMF_FLAG_CUSTOMCONFIG = 2, // Custom game configuration file is used (set by the program)
+    LESSUDMF_FLAG_PRESERVESECTORS = 4, // Preserve indentical sectors in map
+    LESSUDMF_FLAG_PRESERVETEXTURES = 8, // Preserve textures on control linedefs which do not use them
+    LESSUDMF_FLAG_PRESERVEANGLES = 16, // Preserge facing angles on things that do not require angle information
+    LESSUDMF_FLAG_PRESERVEDEFAULT = 32, // Preserve the UDMF fields which are set to default value
+    LESSUDMF_FLAG_PRESERVEFLATS = 64, // Preserve floor/ceiling flat textures on sectors that are invisible or not reachable
+    LESSUDMF_FLAG_REMOVEGEOMETRY = 128, // Remove zero-length/duplicate linedefs and sectors with no area
+    LESSUDMF_FLAG_BUILDNODES = 256, // Rebuild the ZNODES lump of the optimized maps
+    LESSUDMF_FLAG_BUILDREJECT = 512, // Build the REJECT lump of the optimized maps
+    LESSUDMF_FLAG_PRESERVEOFFSETS = 1024, // Preserve the texture offsets, do not reduce them modulo the texture sizes
+    LESSUDMF_FLAG_PRESERVETAGS = 2048, // Preserve the sector tags which no linedef special or thing refers to
+    LESSUDMF_FLAG_PRESERVETHINGS = 4096, // Preserve the exact duplicates of things
+    LESSUDMF_FLAG_RENUMBER = 8192, // Renumber vertices, sidedefs and sectors so the most referenced ones get the smallest indices
+    LESSUDMF_FLAG_CANONICAL = 16384, // Write the blocks grouped by element type and the fields in a fixed order
+    LESSUDMF_FLAG_QUANTIZE = 32768, // Snap the numeric values to the grids given in the game config file (lossy)
+    LESSUDMF_FLAG_MERGESIMILAR = 65536, // Merge the sectors which only differ within the tolerances given in the game config file (lossy)
+    LESSUDMF_FLAG_STRIPUNREACHABLE = 131072, // Remove the textures and flats of the areas which can not be reached from the player starts (lossy)
+    LESSUDMF_FLAG_BINARYMAP = 262144, // Write the maps which fit the binary Doom/Hexen map format in it instead of TEXTMAP
+    LESSUDMF_FLAG_PRESERVELUMPS = 524288 // Write every lump separately, do not share the data of identical lumps
+};
+
+// State of the optimization: the options, the game configuration and the map being optimized.
+// A context is used by one thread at a time, different contexts can be used by different threads at once.
+// The errors are printed to stderr and the function returns 0, the memory the context holds is freed and it can be
+// used again after that (its game configuration is loaded again)
+typedef struct lessudmf_s lessudmf_t;
+
+// Create a context with the given flags. The game configuration is loaded from the given file, or from the
+// default config file of the game engine of the map (in the working directory) if it is 0. Returns 0 on failure
+lessudmf_t* LESSUDMF_Create(uint32_t flags, const char* configPath);
+
+// Free the context and everything it holds
+void LESSUDMF_Destroy(lessudmf_t* context);
+
+// Optimize the TEXTMAP data, the optimized TEXTMAP is returned in output (free it with LESSUDMF_Free).
+// The lumps of the map other than TEXTMAP are not known here, so no nodes, REJECT or binary map are made, and the
+// sector tags and the arguments are kept as the scripts of the map may refer to them.
+// Returns 0 on failure
+uint8_t LESSUDMF_OptimizeTEXTMAP(lessudmf_t* context, const char* textmap, uint32_t size, char** output, uint32_t* outputSize);
+
+// Optimize the maps of the WAD data, the Output WAD is returned in output (free it with LESSUDMF_Free).
+// Returns 0 on failure
+uint8_t LESSUDMF_OptimizeWAD(lessudmf_t* context, const void* wad, uint32_t size, void** output, uint32_t* outputSize);
+
+// Free the output of the functions above
+void LESSUDMF_Free(void* output);
+
+#endif